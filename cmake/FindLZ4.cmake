@@ -0,0 +1,30 @@
+find_path(LZ4_INCLUDE_DIR
+    NAMES lz4frame.h
+    HINTS ${LZ4_ROOT} ${BLIMP_BUILDBOX_DIRECTORY}
+    PATH_SUFFIXES include
+)
+
+find_library(LZ4_LIBRARY
+    NAMES lz4 liblz4 liblz4_static
+    HINTS ${LZ4_ROOT} ${BLIMP_BUILDBOX_DIRECTORY}
+    PATH_SUFFIXES lib
+)
+
+if(WIN32)
+    find_file(LZ4_DLL
+        NAMES lz4.dll liblz4.dll
+        HINTS ${LZ4_ROOT} ${BLIMP_BUILDBOX_DIRECTORY}
+        PATH_SUFFIXES bin
+    )
+    mark_as_advanced(LZ4_DLL)
+endif()
+
+include(FindPackageHandleStandardArgs)
+find_package_handle_standard_args(LZ4 DEFAULT_MSG LZ4_INCLUDE_DIR LZ4_LIBRARY)
+mark_as_advanced(LZ4_INCLUDE_DIR LZ4_LIBRARY)
+
+if(LZ4_FOUND AND NOT TARGET liblz4)
+    add_library(liblz4 INTERFACE)
+    target_link_libraries(liblz4 INTERFACE ${LZ4_LIBRARY})
+    target_include_directories(liblz4 INTERFACE ${LZ4_INCLUDE_DIR})
+endif()
@@ -0,0 +1,21 @@
+find_path(LIBURING_INCLUDE_DIR
+    NAMES liburing.h
+    HINTS ${LIBURING_ROOT}
+    PATH_SUFFIXES include
+)
+
+find_library(LIBURING_LIBRARY
+    NAMES uring
+    HINTS ${LIBURING_ROOT}
+    PATH_SUFFIXES lib
+)
+
+include(FindPackageHandleStandardArgs)
+find_package_handle_standard_args(LibUring DEFAULT_MSG LIBURING_INCLUDE_DIR LIBURING_LIBRARY)
+mark_as_advanced(LIBURING_INCLUDE_DIR LIBURING_LIBRARY)
+
+if(LibUring_FOUND AND NOT TARGET liburing)
+    add_library(liburing INTERFACE)
+    target_link_libraries(liburing INTERFACE ${LIBURING_LIBRARY})
+    target_include_directories(liburing INTERFACE ${LIBURING_INCLUDE_DIR})
+endif()
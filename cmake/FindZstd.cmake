@@ -0,0 +1,30 @@
+find_path(ZSTD_INCLUDE_DIR
+    NAMES zstd.h
+    HINTS ${ZSTD_ROOT} ${BLIMP_BUILDBOX_DIRECTORY}
+    PATH_SUFFIXES include
+)
+
+find_library(ZSTD_LIBRARY
+    NAMES zstd zstd_static libzstd
+    HINTS ${ZSTD_ROOT} ${BLIMP_BUILDBOX_DIRECTORY}
+    PATH_SUFFIXES lib
+)
+
+if(WIN32)
+    find_file(ZSTD_DLL
+        NAMES zstd.dll libzstd.dll
+        HINTS ${ZSTD_ROOT} ${BLIMP_BUILDBOX_DIRECTORY}
+        PATH_SUFFIXES bin
+    )
+    mark_as_advanced(ZSTD_DLL)
+endif()
+
+include(FindPackageHandleStandardArgs)
+find_package_handle_standard_args(Zstd DEFAULT_MSG ZSTD_INCLUDE_DIR ZSTD_LIBRARY)
+mark_as_advanced(ZSTD_INCLUDE_DIR ZSTD_LIBRARY)
+
+if(Zstd_FOUND AND NOT TARGET libzstd)
+    add_library(libzstd INTERFACE)
+    target_link_libraries(libzstd INTERFACE ${ZSTD_LIBRARY})
+    target_include_directories(libzstd INTERFACE ${ZSTD_INCLUDE_DIR})
+endif()
@@ -7,10 +7,12 @@ ddl_files = [
     'file_contents',
     'file_elements',
     'indexed_locations',
+    'inline_contents',
     'plugin_kv_store',
     'snapshots',
     'snapshot_contents',
     'sqlite_master',
+    'storage_blocks',
     'storage_containers',
     'storage_inventory',
     'user_selection',
@@ -0,0 +1,324 @@
+#include <compression_lz4.hpp>
+
+#include <blimp_plugin_helper_cpp.hpp>
+
+#include <lz4frame.h>
+
+#include <algorithm>
+#include <charconv>
+#include <deque>
+#include <stdexcept>
+#include <vector>
+
+namespace {
+struct ErrorStrings {
+    static constexpr char const okay[] = "Ok";
+    static constexpr char const compression_error[] = "Unexpected error during compression";
+    static constexpr char const decompression_error[] = "Unexpected error during decompression";
+};
+
+/// Compression level as accepted by LZ4F_preferences_t; 0 is the fast mode, negative values accelerate further
+constexpr char const g_kvKeyLevel[] = "compression_level";
+
+/// Input is passed to the compressor in slices of this size, so that the worst case output of a slice is
+/// small compared to an output buffer. This matches the frame's block size.
+constexpr std::size_t g_inputSliceSize = (64 << 10);
+
+struct Buffer {
+    std::vector<char> b;
+    static constexpr size_t buffer_size = (1 << 20);
+
+    Buffer()
+    {
+        b.resize(buffer_size);
+    }
+
+    Buffer(Buffer const&) = delete;
+    Buffer& operator=(Buffer const&) = delete;
+
+    Buffer(Buffer&&) = default;
+    Buffer& operator=(Buffer&&) = default;
+
+    char* data() {
+        return b.data();
+    }
+
+    char const* data() const {
+        return b.data();
+    }
+
+    size_t size() const {
+        return b.size();
+    }
+};
+
+int retrieveInt(KeyValueStore& kv_store, char const* key, int default_value)
+{
+    BlimpKeyValueStoreValue const v = kv_store.retrieve(key);
+    if (v.data == nullptr) { return default_value; }
+    int ret = 0;
+    auto const [ptr, ec] = std::from_chars(v.data, v.data + v.size, ret);
+    if ((ec != std::errc{}) || (ptr != v.data + v.size)) {
+        throw std::exception();
+    }
+    return ret;
+}
+}   // anonymous namespace
+
+struct BlimpPluginCompressionState {
+    LZ4F_cctx* cctx;
+    LZ4F_dctx* dctx;
+    LZ4F_preferences_t preferences;
+    Buffer compression_buffer;
+    std::size_t compression_buffer_used;
+    bool compression_frame_started;
+    Buffer decompression_buffer;
+    std::size_t decompression_buffer_used;
+    std::deque<Buffer> available_buffers;
+    Buffer public_buffer;
+    std::vector<Buffer> free_buffers;
+    char const* error_string;
+    KeyValueStore kv_store;
+    bool decompression_is_finished;
+
+    BlimpPluginCompressionState(BlimpKeyValueStore const& n_kv_store);
+    ~BlimpPluginCompressionState();
+
+    BlimpPluginCompressionState(BlimpPluginCompressionState const&) = delete;
+    BlimpPluginCompressionState& operator=(BlimpPluginCompressionState const&) = delete;
+
+    char const* get_last_error();
+
+    BlimpPluginResult compress_file_chunk(BlimpFileChunk chunk);
+    BlimpPluginResult decompress_file_chunk(BlimpFileChunk chunk);
+    BlimpFileChunk get_processed_chunk();
+
+    Buffer getFreeBuffer();
+    void reserveCompressionOutput(std::size_t n_bytes);
+    BlimpPluginResult compressionFailed();
+};
+
+BlimpPluginInfo blimp_plugin_api_info()
+{
+    return BlimpPluginInfo{
+        .type = BLIMP_PLUGIN_TYPE_COMPRESSION,
+        .version = BlimpPluginVersion{
+            .major = 1,
+            .minor = 0,
+            .patch = 0
+        },
+        .uuid = {
+            // {A74417E8-5A64-419A-818A-AFE8551EB3CB}
+            0xa74417e8, 0x5a64, 0x419a, { 0x81, 0x8a, 0xaf, 0xe8, 0x55, 0x1e, 0xb3, 0xcb }
+        },
+        .name = "LZ4 Compression",
+        .description = "Fast compression with the LZ4 frame format"
+    };
+}
+
+char const* blimp_plugin_get_last_error(BlimpPluginCompressionStateHandle state)
+{
+    return state->get_last_error();
+}
+
+BlimpPluginResult blimp_plugin_compress_file_chunk(BlimpPluginCompressionStateHandle state, BlimpFileChunk chunk)
+{
+    return state->compress_file_chunk(chunk);
+}
+
+BlimpPluginResult blimp_plugin_decompress_file_chunk(BlimpPluginCompressionStateHandle state, BlimpFileChunk chunk)
+{
+    return state->decompress_file_chunk(chunk);
+}
+
+BlimpFileChunk blimp_plugin_get_processed_chunk(BlimpPluginCompressionStateHandle state)
+{
+    return state->get_processed_chunk();
+}
+
+BlimpPluginResult blimp_plugin_compression_initialize(BlimpKeyValueStore kv_store, BlimpPluginCompression* plugin)
+{
+    if (plugin->abi != BLIMP_PLUGIN_ABI_1_0_0) {
+        return BLIMP_PLUGIN_RESULT_INVALID_ARGUMENT;
+    }
+    try {
+        plugin->state = new BlimpPluginCompressionState(kv_store);
+    } catch (std::exception&) {
+        plugin->state = nullptr;
+        return BLIMP_PLUGIN_RESULT_FAILED;
+    }
+    plugin->get_last_error = blimp_plugin_get_last_error;
+    plugin->compress_file_chunk = blimp_plugin_compress_file_chunk;
+    plugin->decompress_file_chunk = blimp_plugin_decompress_file_chunk;
+    plugin->get_processed_chunk = blimp_plugin_get_processed_chunk;
+    return BLIMP_PLUGIN_RESULT_OK;
+}
+
+void blimp_plugin_compression_shutdown(BlimpPluginCompression* plugin)
+{
+    delete plugin->state;
+}
+
+BlimpPluginCompressionState::BlimpPluginCompressionState(BlimpKeyValueStore const& n_kv_store)
+    :cctx(nullptr), dctx(nullptr), preferences{}, compression_buffer_used(0), compression_frame_started(false),
+     decompression_buffer_used(0), kv_store(n_kv_store), decompression_is_finished(false)
+{
+    error_string = ErrorStrings::okay;
+    preferences.frameInfo.blockSizeID = LZ4F_max64KB;
+    preferences.frameInfo.blockMode = LZ4F_blockLinked;
+    preferences.frameInfo.contentChecksumFlag = LZ4F_contentChecksumEnabled;
+    preferences.compressionLevel = retrieveInt(kv_store, g_kvKeyLevel, 0);
+
+    if (LZ4F_isError(LZ4F_createCompressionContext(&cctx, LZ4F_VERSION))) {
+        throw std::exception();
+    }
+    if (LZ4F_isError(LZ4F_createDecompressionContext(&dctx, LZ4F_VERSION))) {
+        LZ4F_freeCompressionContext(cctx);
+        throw std::exception();
+    }
+}
+
+BlimpPluginCompressionState::~BlimpPluginCompressionState()
+{
+    LZ4F_freeCompressionContext(cctx);
+    LZ4F_freeDecompressionContext(dctx);
+}
+
+char const* BlimpPluginCompressionState::get_last_error()
+{
+    return error_string;
+}
+
+BlimpPluginResult BlimpPluginCompressionState::compress_file_chunk(BlimpFileChunk chunk)
+{
+    if (chunk.size < 0) {
+        return BLIMP_PLUGIN_RESULT_INVALID_ARGUMENT;
+    }
+    if (!compression_frame_started) {
+        reserveCompressionOutput(LZ4F_HEADER_SIZE_MAX);
+        std::size_t const res = LZ4F_compressBegin(cctx, compression_buffer.data() + compression_buffer_used,
+                                                   compression_buffer.size() - compression_buffer_used, &preferences);
+        if (LZ4F_isError(res)) { return compressionFailed(); }
+        compression_buffer_used += res;
+        compression_frame_started = true;
+    }
+    if (chunk.data != nullptr) {
+        char const* src = chunk.data;
+        std::size_t remaining = static_cast<std::size_t>(chunk.size);
+        while (remaining > 0) {
+            std::size_t const n_bytes = std::min(remaining, g_inputSliceSize);
+            reserveCompressionOutput(LZ4F_compressBound(n_bytes, &preferences));
+            std::size_t const res = LZ4F_compressUpdate(cctx, compression_buffer.data() + compression_buffer_used,
+                                                        compression_buffer.size() - compression_buffer_used,
+                                                        src, n_bytes, nullptr);
+            if (LZ4F_isError(res)) { return compressionFailed(); }
+            compression_buffer_used += res;
+            src += n_bytes;
+            remaining -= n_bytes;
+        }
+    } else {
+        // finalize and flush
+        reserveCompressionOutput(LZ4F_compressBound(0, &preferences));
+        std::size_t const res = LZ4F_compressEnd(cctx, compression_buffer.data() + compression_buffer_used,
+                                                 compression_buffer.size() - compression_buffer_used, nullptr);
+        if (LZ4F_isError(res)) { return compressionFailed(); }
+        compression_buffer.b.resize(compression_buffer_used + res);
+        available_buffers.emplace_back(std::move(compression_buffer));
+        compression_buffer = getFreeBuffer();
+        compression_buffer_used = 0;
+        compression_frame_started = false;
+    }
+    return BLIMP_PLUGIN_RESULT_OK;
+}
+
+BlimpPluginResult BlimpPluginCompressionState::decompress_file_chunk(BlimpFileChunk chunk)
+{
+    if (chunk.size < 0) {
+        return BLIMP_PLUGIN_RESULT_INVALID_ARGUMENT;
+    }
+    if (chunk.data != nullptr) {
+        char const* src = chunk.data;
+        std::size_t remaining = static_cast<std::size_t>(chunk.size);
+        // a full output buffer may leave decoded data behind in the context even if all input was consumed;
+        // frames that were compressed one after another are decompressed one after another
+        bool output_pending = true;
+        while ((remaining > 0) || (output_pending && (!decompression_is_finished))) {
+            std::size_t dst_size = decompression_buffer.size() - decompression_buffer_used;
+            std::size_t src_size = remaining;
+            std::size_t const res = LZ4F_decompress(dctx, decompression_buffer.data() + decompression_buffer_used,
+                                                    &dst_size, src, &src_size, nullptr);
+            if (LZ4F_isError(res)) {
+                LZ4F_resetDecompressionContext(dctx);
+                decompression_buffer_used = 0;
+                error_string = ErrorStrings::decompression_error;
+                return BLIMP_PLUGIN_RESULT_CORRUPTED_DATA;
+            }
+            src += src_size;
+            remaining -= src_size;
+            decompression_buffer_used += dst_size;
+            output_pending = (decompression_buffer_used == decompression_buffer.size());
+            // once a frame is complete, the context is ready for the next frame
+            decompression_is_finished = (res == 0);
+            if (decompression_is_finished || output_pending) {
+                decompression_buffer.b.resize(decompression_buffer_used);
+                available_buffers.emplace_back(std::move(decompression_buffer));
+                decompression_buffer = getFreeBuffer();
+                decompression_buffer_used = 0;
+            }
+        }
+    } else {
+        if (!decompression_is_finished) { return BLIMP_PLUGIN_RESULT_FAILED; }
+        LZ4F_resetDecompressionContext(dctx);
+        decompression_is_finished = false;
+    }
+    return BLIMP_PLUGIN_RESULT_OK;
+}
+
+BlimpFileChunk BlimpPluginCompressionState::get_processed_chunk()
+{
+    if (!available_buffers.empty()) {
+        free_buffers.emplace_back(std::move(public_buffer));
+        public_buffer = std::move(available_buffers.front());
+        available_buffers.pop_front();
+        BlimpFileChunk ret;
+        ret.data = public_buffer.data();
+        ret.size = public_buffer.size();
+        return ret;
+    } else {
+        BlimpFileChunk ret;
+        ret.data = nullptr;
+        ret.size = 0;
+        return ret;
+    }
+}
+
+Buffer BlimpPluginCompressionState::getFreeBuffer()
+{
+    if (free_buffers.empty()) { return Buffer{}; }
+    Buffer ret = std::move(free_buffers.back());
+    free_buffers.pop_back();
+    ret.b.resize(Buffer::buffer_size);
+    return ret;
+}
+
+/** Makes sure the compression buffer has room for at least n_bytes more bytes.
+ * If it does not, the buffer is handed out as it is and compression continues in a fresh buffer.
+ */
+void BlimpPluginCompressionState::reserveCompressionOutput(std::size_t n_bytes)
+{
+    if (compression_buffer.size() - compression_buffer_used < n_bytes) {
+        compression_buffer.b.resize(compression_buffer_used);
+        available_buffers.emplace_back(std::move(compression_buffer));
+        compression_buffer = getFreeBuffer();
+        compression_buffer_used = 0;
+    }
+}
+
+BlimpPluginResult BlimpPluginCompressionState::compressionFailed()
+{
+    // the next call starts a new frame, which resets the compression context
+    compression_buffer_used = 0;
+    compression_frame_started = false;
+    error_string = ErrorStrings::compression_error;
+    return BLIMP_PLUGIN_RESULT_FAILED;
+}
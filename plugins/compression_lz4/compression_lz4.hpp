@@ -0,0 +1,15 @@
+#ifndef BLIMP_INCLUDE_GUARD_PLUGIN_COMPRESSION_LZ4_HPP
+#define BLIMP_INCLUDE_GUARD_PLUGIN_COMPRESSION_LZ4_HPP
+
+#include <blimp_plugin_sdk.h>
+
+#include <compression_lz4_export.h>
+
+extern "C" COMPRESSION_LZ4_EXPORT BlimpPluginInfo blimp_plugin_api_info();
+
+extern "C" COMPRESSION_LZ4_EXPORT BlimpPluginResult blimp_plugin_compression_initialize(BlimpKeyValueStore kv_store,
+                                                                                         BlimpPluginCompression* plugin);
+
+extern "C" COMPRESSION_LZ4_EXPORT void blimp_plugin_compression_shutdown(BlimpPluginCompression* plugin);
+
+#endif
@@ -0,0 +1,143 @@
+#include <compression_lz4.hpp>
+
+#include <blimp_plugin_test_helper_cpp.hpp>
+
+#include <catch.hpp>
+
+#include <algorithm>
+#include <cstdint>
+#include <iterator>
+#include <string>
+#include <vector>
+
+TEST_CASE("Plugin Compression LZ4")
+{
+    SECTION("Plugin Info")
+    {
+        auto const api_info = blimp_plugin_api_info();
+        CHECK(api_info.type == BLIMP_PLUGIN_TYPE_COMPRESSION);
+    }
+
+    BlimpKeyValueStoreState kv_store;
+    BlimpPluginCompression compression;
+    compression.abi = BLIMP_PLUGIN_ABI_1_0_0;
+    REQUIRE(blimp_plugin_compression_initialize(kv_store, &compression) == BLIMP_PLUGIN_RESULT_OK);
+    CHECK(kv_store.call_count_retrieve > 0);
+
+    SECTION("Compression Decompression")
+    {
+        std::vector<char> const text = generateText(3 << 20);
+        std::vector<char> const compressed_text = compressAll(compression, text, text.size());
+        CHECK(compressed_text.size() < text.size() / 2);
+
+        CHECK(decompressAll(compression, compressed_text, compressed_text.size()) == text);
+        // decompress in smaller chunks
+        CHECK(decompressAll(compression, compressed_text, 200) == text);
+        CHECK(decompressAll(compression, compressed_text, 1) == text);
+
+        // the compression context is reused for the next frame
+        CHECK(decompressAll(compression, compressAll(compression, text, text.size()), 1 << 20) == text);
+        // compression in smaller chunks
+        CHECK(decompressAll(compression, compressAll(compression, text, 77777), 1 << 20) == text);
+        CHECK(decompressAll(compression, compressAll(compression, text, 1000), 1 << 20) == text);
+    }
+
+    SECTION("Concatenated Frames")
+    {
+        std::vector<char> const text = generateText(1 << 20);
+        std::vector<char> const noise = generateNoise(1 << 18);
+        std::vector<char> compressed = compressAll(compression, text, 1 << 16);
+        std::vector<char> const compressed_noise = compressAll(compression, noise, 1 << 16);
+        compressed.insert(compressed.end(), compressed_noise.begin(), compressed_noise.end());
+        std::vector<char> expected = text;
+        expected.insert(expected.end(), noise.begin(), noise.end());
+
+        CHECK(decompressAll(compression, compressed, compressed.size()) == expected);
+        CHECK(decompressAll(compression, compressed, 333) == expected);
+    }
+
+    SECTION("Empty Data")
+    {
+        std::vector<char> const compressed = compressAll(compression, {}, 1);
+        REQUIRE(!compressed.empty());
+
+        REQUIRE(compression.decompress_file_chunk(compression.state,
+                                                  BlimpFileChunk{ .data = compressed.data(),
+                                                                  .size = static_cast<int64_t>(compressed.size()) }) ==
+                BLIMP_PLUGIN_RESULT_OK);
+        BlimpFileChunk c = compression.get_processed_chunk(compression.state);
+        REQUIRE(c.data);
+        CHECK(c.size == 0);
+        CHECK(!compression.get_processed_chunk(compression.state).data);
+    }
+
+    SECTION("Corrupted Data")
+    {
+        std::vector<char> compressed = compressAll(compression, generateText(1 << 16), 1 << 16);
+        compressed[compressed.size() / 2] ^= 0x55;
+        CHECK(compression.decompress_file_chunk(compression.state,
+                                                BlimpFileChunk{ .data = compressed.data(),
+                                                                .size = static_cast<int64_t>(compressed.size()) }) ==
+              BLIMP_PLUGIN_RESULT_CORRUPTED_DATA);
+    }
+
+    SECTION("Incomplete Data")
+    {
+        std::vector<char> const compressed = compressAll(compression, generateText(1 << 16), 1 << 16);
+        REQUIRE(compression.decompress_file_chunk(compression.state,
+                                                  BlimpFileChunk{ .data = compressed.data(),
+                                                                  .size = static_cast<int64_t>(compressed.size() - 1) }) ==
+                BLIMP_PLUGIN_RESULT_OK);
+        CHECK(compression.decompress_file_chunk(compression.state, BlimpFileChunk{ .data = nullptr, .size = 0 }) ==
+              BLIMP_PLUGIN_RESULT_FAILED);
+    }
+
+    blimp_plugin_compression_shutdown(&compression);
+}
+
+TEST_CASE("Plugin Compression LZ4 Configuration")
+{
+    std::vector<char> const text = generateText(5 << 20);
+
+    auto const compress = [](BlimpKeyValueStoreState& kv_store, std::vector<char> const& data) -> std::vector<char> {
+        BlimpPluginCompression compression;
+        compression.abi = BLIMP_PLUGIN_ABI_1_0_0;
+        REQUIRE(blimp_plugin_compression_initialize(kv_store, &compression) == BLIMP_PLUGIN_RESULT_OK);
+        std::vector<char> ret = compressAll(compression, data, 1 << 20);
+        CHECK(decompressAll(compression, ret, 1 << 20) == data);
+        blimp_plugin_compression_shutdown(&compression);
+        return ret;
+    };
+
+    SECTION("Compression Level")
+    {
+        BlimpKeyValueStoreState kv_fast;
+        kv_fast.storage["compression_level"] = "0";
+        BlimpKeyValueStoreState kv_accelerated;
+        kv_accelerated.storage["compression_level"] = "-20";
+        BlimpKeyValueStoreState kv_high;
+        kv_high.storage["compression_level"] = "9";
+        std::size_t const size_fast = compress(kv_fast, text).size();
+        CHECK(compress(kv_high, text).size() < size_fast);
+        CHECK(compress(kv_accelerated, text).size() > size_fast);
+    }
+
+    SECTION("Incompressible Data")
+    {
+        // expansion is limited to the frame and block headers
+        BlimpKeyValueStoreState kv_store;
+        std::vector<char> const noise = generateNoise(4 << 20);
+        CHECK(compress(kv_store, noise).size() < noise.size() + noise.size() / 1000);
+    }
+
+    SECTION("Invalid Configuration")
+    {
+        BlimpPluginCompression compression;
+        compression.abi = BLIMP_PLUGIN_ABI_1_0_0;
+        BlimpKeyValueStoreState kv_store;
+        kv_store.storage["compression_level"] = "fast";
+        CHECK(blimp_plugin_compression_initialize(kv_store, &compression) == BLIMP_PLUGIN_RESULT_FAILED);
+        kv_store.storage["compression_level"] = "";
+        CHECK(blimp_plugin_compression_initialize(kv_store, &compression) == BLIMP_PLUGIN_RESULT_FAILED);
+    }
+}
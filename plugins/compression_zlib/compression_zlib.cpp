@@ -5,9 +5,15 @@
 #define ZLIB_CONST
 #include <zlib.h>
 
+#include <algorithm>
+#include <charconv>
+#include <condition_variable>
 #include <deque>
 #include <limits>
+#include <memory>
+#include <mutex>
 #include <stdexcept>
+#include <thread>
 #include <vector>
 
 namespace {
@@ -16,16 +22,44 @@ struct ErrorStrings {
     static constexpr char const compression_error[] = "Unexpected error during compression";
 };
 
+/// Number of threads for block-parallel compression; 0 selects the serial compressor
+constexpr char const g_kvKeyThreads[] = "compression_threads";
+constexpr std::size_t g_maxThreads = 64;
+/// The start of each stream is trial compressed at the fastest level to detect incompressible data
+constexpr std::size_t g_sampleSize = (64 << 10);
+/// Streams that are stored uncompressed are sampled again after this many bytes, as a stream may hold the data of
+/// several files; sampling all of a stored stream would cost about as much as compressing it
+constexpr std::size_t g_resampleInterval = (1 << 20);
+/// Streams that end before the sample is complete are too short to pay off skipping compression
+constexpr std::size_t g_minSampleSize = (4 << 10);
+/// Streams of which the sample does not shrink below this fraction of its size are stored uncompressed
+constexpr double g_incompressibleRatio = 0.98;
+constexpr std::size_t g_parallelBlockSize = (512 << 10);
+constexpr std::size_t g_dictionarySize = (32 << 10);
+
+/** Output buffer, either owned by the plugin or lent from the host's buffer pool.
+ */
 struct Buffer {
     std::vector<Bytef> b;
+    LentBuffer lent;
+    std::size_t lent_size;
     static constexpr size_t buffer_size = (1 << 20);
     static_assert(buffer_size < std::numeric_limits<uInt>::max());
 
     Buffer()
+        :lent_size(0)
     {
         b.resize(buffer_size);
     }
 
+    explicit Buffer(std::vector<Bytef>&& data)
+        :b(std::move(data)), lent_size(0)
+    {}
+
+    explicit Buffer(LentBuffer&& l)
+        :lent(std::move(l)), lent_size(std::min(static_cast<std::size_t>(lent.capacity()), buffer_size))
+    {}
+
     Buffer(Buffer const&) = delete;
     Buffer& operator=(Buffer const&) = delete;
 
@@ -34,17 +68,228 @@ struct Buffer {
 
 
     Bytef* data_byte() {
-        return b.data();
+        return lent.isValid() ? reinterpret_cast<Bytef*>(lent.data()) : b.data();
     }
 
     char const* data_char() const {
-        return reinterpret_cast<char const*>(b.data());
+        return lent.isValid() ? lent.data() : reinterpret_cast<char const*>(b.data());
     }
 
     size_t size() {
-        return b.size();
+        return lent.isValid() ? lent_size : b.size();
+    }
+
+    void resize(std::size_t new_size) {
+        if (lent.isValid()) { lent_size = new_size; } else { b.resize(new_size); }
     }
 };
+
+/** Block-parallel deflate in the style of pigz.
+ * The input is cut into blocks of g_parallelBlockSize bytes, which are deflated independently on a pool of worker
+ * threads. Each block is primed with the last 32 KiB of the preceding input as dictionary and ends on a byte
+ * boundary (Z_SYNC_FLUSH), so that the raw deflate output of all blocks concatenates to one stream. Wrapped with a
+ * zlib header and the combined Adler-32 checksum, the result is a standard zlib stream.
+ * Block boundaries only depend on the offset in the input, so the output is the same for any number of threads
+ * and any chunking of the input. It does differ from the output of the serial compressor.
+ */
+class ParallelDeflate {
+private:
+    struct Job {
+        std::vector<Bytef> input;
+        std::vector<Bytef> dictionary;
+        int level;
+        bool is_first;
+        bool is_last;
+        std::vector<Bytef> output;
+        uLong adler;
+        bool failed;
+        bool done;
+    };
+
+    std::mutex m_mtx;
+    std::condition_variable m_cvWork;
+    std::condition_variable m_cvDone;
+    std::deque<Job*> m_queue;
+    bool m_shutdown;
+    int m_streamLevel;
+    std::vector<std::thread> m_threads;
+
+    std::deque<std::unique_ptr<Job>> m_inFlight;    ///< jobs in stream order
+    std::size_t m_maxInFlight;
+    std::vector<Bytef> m_block;
+    std::vector<Bytef> m_dictionary;
+    bool m_streamStarted;
+    uLong m_adler;
+public:
+    ParallelDeflate(std::size_t n_threads, int level);
+    ~ParallelDeflate();
+
+    ParallelDeflate(ParallelDeflate const&) = delete;
+    ParallelDeflate& operator=(ParallelDeflate const&) = delete;
+
+    bool addData(Bytef const* data, std::size_t size, std::deque<Buffer>& out);
+    bool finish(std::deque<Buffer>& out);
+    /** Sets the level for the blocks of the current stream that are not submitted yet.
+     */
+    void setStreamLevel(int level);
+private:
+    void submitBlock(bool is_last);
+    bool collectOldest(std::deque<Buffer>& out);
+    void work();
+    static void compressBlock(z_stream& zs, Job& job);
+};
+
+ParallelDeflate::ParallelDeflate(std::size_t n_threads, int level)
+    :m_shutdown(false), m_streamLevel(level), m_maxInFlight(2 * n_threads), m_streamStarted(false), m_adler(adler32(0, nullptr, 0))
+{
+    m_block.reserve(g_parallelBlockSize);
+    for (std::size_t i = 0; i < n_threads; ++i) {
+        m_threads.emplace_back([this]() { work(); });
+    }
+}
+
+ParallelDeflate::~ParallelDeflate()
+{
+    {
+        std::lock_guard lk(m_mtx);
+        m_shutdown = true;
+    }
+    m_cvWork.notify_all();
+    for (auto& t : m_threads) { t.join(); }
+}
+
+bool ParallelDeflate::addData(Bytef const* data, std::size_t size, std::deque<Buffer>& out)
+{
+    while (size > 0) {
+        std::size_t const n_bytes = std::min(size, g_parallelBlockSize - m_block.size());
+        m_block.insert(m_block.end(), data, data + n_bytes);
+        data += n_bytes;
+        size -= n_bytes;
+        if (m_block.size() == g_parallelBlockSize) {
+            if ((m_inFlight.size() == m_maxInFlight) && (!collectOldest(out))) { return false; }
+            submitBlock(false);
+        }
+    }
+    return true;
+}
+
+bool ParallelDeflate::finish(std::deque<Buffer>& out)
+{
+    submitBlock(true);
+    bool success = true;
+    while (!m_inFlight.empty()) {
+        success = collectOldest(out) && success;
+    }
+    m_streamStarted = false;
+    m_adler = adler32(0, nullptr, 0);
+    m_dictionary.clear();
+    return success;
+}
+
+void ParallelDeflate::setStreamLevel(int level)
+{
+    m_streamLevel = level;
+}
+
+void ParallelDeflate::submitBlock(bool is_last)
+{
+    auto job = std::make_unique<Job>(Job{ .input = std::move(m_block),
+                                          .dictionary = m_dictionary,
+                                          .level = m_streamLevel,
+                                          .is_first = !m_streamStarted,
+                                          .is_last = is_last,
+                                          .output = {},
+                                          .adler = 0,
+                                          .failed = false,
+                                          .done = false });
+    m_streamStarted = true;
+    std::size_t const dict_size = std::min(job->input.size(), g_dictionarySize);
+    m_dictionary.assign(job->input.end() - dict_size, job->input.end());
+    m_block = std::vector<Bytef>{};
+    m_block.reserve(g_parallelBlockSize);
+    {
+        std::lock_guard lk(m_mtx);
+        m_queue.push_back(job.get());
+    }
+    m_inFlight.emplace_back(std::move(job));
+    m_cvWork.notify_one();
+}
+
+bool ParallelDeflate::collectOldest(std::deque<Buffer>& out)
+{
+    Job& job = *m_inFlight.front();
+    {
+        std::unique_lock lk(m_mtx);
+        m_cvDone.wait(lk, [&job]() { return job.done; });
+    }
+    bool const success = !job.failed;
+    if (success) {
+        m_adler = adler32_combine(m_adler, job.adler, static_cast<z_off_t>(job.input.size()));
+        if (job.is_last) {
+            for (int shift = 24; shift >= 0; shift -= 8) {
+                job.output.push_back(static_cast<Bytef>((m_adler >> shift) & 0xff));
+            }
+        }
+        out.emplace_back(std::move(job.output));
+    }
+    m_inFlight.pop_front();
+    return success;
+}
+
+void ParallelDeflate::work()
+{
+    z_stream zs{};
+    bool const initialized =
+        (deflateInit2(&zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY) == Z_OK);
+    std::unique_lock lk(m_mtx);
+    for (;;) {
+        m_cvWork.wait(lk, [this]() { return (!m_queue.empty()) || m_shutdown; });
+        if (m_queue.empty()) { break; }
+        Job* job = m_queue.front();
+        m_queue.pop_front();
+        lk.unlock();
+        if (initialized) {
+            compressBlock(zs, *job);
+        } else {
+            job->failed = true;
+        }
+        lk.lock();
+        job->done = true;
+        m_cvDone.notify_all();
+    }
+    if (initialized) { deflateEnd(&zs); }
+}
+
+void ParallelDeflate::compressBlock(z_stream& zs, Job& job)
+{
+    if ((deflateReset(&zs) != Z_OK) || (deflateParams(&zs, job.level, Z_DEFAULT_STRATEGY) != Z_OK) ||
+        ((!job.dictionary.empty()) &&
+         (deflateSetDictionary(&zs, job.dictionary.data(), static_cast<uInt>(job.dictionary.size())) != Z_OK)))
+    {
+        job.failed = true;
+        return;
+    }
+    job.adler = adler32(adler32(0, nullptr, 0), job.input.data(), static_cast<uInt>(job.input.size()));
+    if (job.is_first) {
+        // zlib header for deflate with a 32 KiB window; the second byte announces the compression level
+        Bytef const level_flags = (job.level < 2) ? 0x01 : ((job.level < 6) ? 0x5e : ((job.level == 6) ? 0x9c : 0xda));
+        job.output.push_back(0x78);
+        job.output.push_back(level_flags);
+    }
+    std::size_t const header_size = job.output.size();
+    // leave room for the sync flush marker in addition to the worst case deflate expansion
+    job.output.resize(header_size + deflateBound(&zs, static_cast<uLong>(job.input.size())) + 16);
+    zs.next_in = job.input.data();
+    zs.avail_in = static_cast<uInt>(job.input.size());
+    zs.next_out = job.output.data() + header_size;
+    zs.avail_out = static_cast<uInt>(job.output.size() - header_size);
+    int const res = deflate(&zs, job.is_last ? Z_FINISH : Z_SYNC_FLUSH);
+    if ((zs.avail_in != 0) || (job.is_last ? (res != Z_STREAM_END) : (res != Z_OK))) {
+        job.failed = true;
+        return;
+    }
+    job.output.resize(job.output.size() - zs.avail_out);
+}
 }   // anonymous namespace
 
 struct BlimpPluginCompressionState {
@@ -55,9 +300,21 @@ struct BlimpPluginCompressionState {
     std::deque<Buffer> available_buffers;
     Buffer public_buffer;
     std::vector<Buffer> free_buffers;
+    BufferPool buffer_pool;
     char const* error_string;
     KeyValueStore kv_store;
     bool decompression_is_finished;
+    std::unique_ptr<ParallelDeflate> parallel_deflate;
+    int level;
+    std::size_t n_threads;
+    bool compression_stream_started;
+    bool parameters_changed;
+    int stream_level;
+    z_stream zs_sample;
+    std::vector<Bytef> sample;
+    std::vector<Bytef> sample_output;
+    bool sampling_stream;
+    std::size_t stored_until_resample;
 
     BlimpPluginCompressionState(BlimpKeyValueStore const& n_kv_store);
     ~BlimpPluginCompressionState();
@@ -70,8 +327,20 @@ struct BlimpPluginCompressionState {
     BlimpPluginResult compress_file_chunk(BlimpFileChunk chunk);
     BlimpPluginResult decompress_file_chunk(BlimpFileChunk chunk);
     BlimpFileChunk get_processed_chunk();
+    void set_buffer_pool(BlimpBufferPool pool);
+    BlimpLentChunk take_processed_chunk();
+    BlimpPluginResult get_compression_parameter(BlimpCompressionParameter parameter, int64_t* value,
+                                                int64_t* min_value, int64_t* max_value);
+    BlimpPluginResult set_compression_parameter(BlimpCompressionParameter parameter, int64_t value);
 
     Buffer getFreeBuffer();
+    bool applyCompressionParameters();
+    bool compressSample();
+    bool isIncompressible(std::vector<Bytef> const& data);
+    bool setSerialLevel(int new_level);
+    bool compressData(Bytef const* data, std::size_t size);
+    bool finishStream();
+    bool restartDecompression();
 };
 
 BlimpPluginInfo blimp_plugin_api_info()
@@ -112,9 +381,34 @@ BlimpFileChunk blimp_plugin_get_processed_chunk(BlimpPluginCompressionStateHandl
     return state->get_processed_chunk();
 }
 
+void blimp_plugin_set_buffer_pool(BlimpPluginCompressionStateHandle state, BlimpBufferPool pool)
+{
+    state->set_buffer_pool(pool);
+}
+
+BlimpLentChunk blimp_plugin_take_processed_chunk(BlimpPluginCompressionStateHandle state)
+{
+    return state->take_processed_chunk();
+}
+
+BlimpPluginResult blimp_plugin_get_compression_parameter(BlimpPluginCompressionStateHandle state,
+                                                        BlimpCompressionParameter parameter, int64_t* value,
+                                                        int64_t* min_value, int64_t* max_value)
+{
+    return state->get_compression_parameter(parameter, value, min_value, max_value);
+}
+
+BlimpPluginResult blimp_plugin_set_compression_parameter(BlimpPluginCompressionStateHandle state,
+                                                        BlimpCompressionParameter parameter, int64_t value)
+{
+    return state->set_compression_parameter(parameter, value);
+}
+
 BlimpPluginResult blimp_plugin_compression_initialize(BlimpKeyValueStore kv_store, BlimpPluginCompression* plugin)
 {
-    if (plugin->abi != BLIMP_PLUGIN_ABI_1_0_0) {
+    if ((plugin->abi != BLIMP_PLUGIN_ABI_1_0_0) && (plugin->abi != BLIMP_PLUGIN_ABI_1_1_0) &&
+        (plugin->abi != BLIMP_PLUGIN_ABI_1_2_0))
+    {
         return BLIMP_PLUGIN_RESULT_INVALID_ARGUMENT;
     }
     try {
@@ -127,6 +421,14 @@ BlimpPluginResult blimp_plugin_compression_initialize(BlimpKeyValueStore kv_stor
     plugin->compress_file_chunk = blimp_plugin_compress_file_chunk;
     plugin->decompress_file_chunk = blimp_plugin_decompress_file_chunk;
     plugin->get_processed_chunk = blimp_plugin_get_processed_chunk;
+    if (plugin->abi != BLIMP_PLUGIN_ABI_1_0_0) {
+        plugin->set_buffer_pool = blimp_plugin_set_buffer_pool;
+        plugin->take_processed_chunk = blimp_plugin_take_processed_chunk;
+    }
+    if (plugin->abi == BLIMP_PLUGIN_ABI_1_2_0) {
+        plugin->get_compression_parameter = blimp_plugin_get_compression_parameter;
+        plugin->set_compression_parameter = blimp_plugin_set_compression_parameter;
+    }
     return BLIMP_PLUGIN_RESULT_OK;
 }
 
@@ -136,13 +438,15 @@ void blimp_plugin_compression_shutdown(BlimpPluginCompression* plugin)
 }
 
 BlimpPluginCompressionState::BlimpPluginCompressionState(BlimpKeyValueStore const& n_kv_store)
-    :kv_store(n_kv_store), decompression_is_finished(false)
+    :kv_store(n_kv_store), decompression_is_finished(false), level(Z_BEST_COMPRESSION), n_threads(0),
+     compression_stream_started(false), parameters_changed(false), stream_level(level), sampling_stream(true),
+     stored_until_resample(0)
 {
     error_string = ErrorStrings::okay;
     zs_compress.opaque = nullptr;
     zs_compress.zalloc = nullptr;
     zs_compress.zfree = nullptr;
-    int res = deflateInit(&zs_compress, Z_BEST_COMPRESSION);
+    int res = deflateInit(&zs_compress, level);
     if (res != Z_OK) {
         throw std::exception();
     }
@@ -151,6 +455,17 @@ BlimpPluginCompressionState::BlimpPluginCompressionState(BlimpKeyValueStore cons
     zs_compress.next_in = nullptr;
     zs_compress.avail_in = 0;
 
+    BlimpKeyValueStoreValue const threads_v = kv_store.retrieve(g_kvKeyThreads);
+    if (threads_v.data != nullptr) {
+        auto const [ptr, ec] = std::from_chars(threads_v.data, threads_v.data + threads_v.size, n_threads);
+        if ((ec != std::errc{}) || (ptr != threads_v.data + threads_v.size)) {
+            throw std::exception();
+        }
+        if (n_threads > 0) {
+            parallel_deflate = std::make_unique<ParallelDeflate>(n_threads, level);
+        }
+    }
+
     zs_decompress.opaque = nullptr;
     zs_decompress.zalloc = nullptr;
     zs_decompress.zfree = nullptr;
@@ -162,12 +477,22 @@ BlimpPluginCompressionState::BlimpPluginCompressionState(BlimpKeyValueStore cons
     }
     zs_decompress.next_out = decompression_buffer.data_byte();
     zs_decompress.avail_out = static_cast<uInt>(decompression_buffer.size());
+
+    zs_sample.opaque = nullptr;
+    zs_sample.zalloc = nullptr;
+    zs_sample.zfree = nullptr;
+    res = deflateInit(&zs_sample, Z_BEST_SPEED);
+    if (res != Z_OK) {
+        throw std::exception();
+    }
+    sample.reserve(g_sampleSize);
 }
 
 BlimpPluginCompressionState::~BlimpPluginCompressionState()
 {
     deflateEnd(&zs_compress);
     inflateEnd(&zs_decompress);
+    deflateEnd(&zs_sample);
 }
 
 char const* BlimpPluginCompressionState::get_last_error()
@@ -180,37 +505,133 @@ BlimpPluginResult BlimpPluginCompressionState::compress_file_chunk(BlimpFileChun
     if (chunk.size > std::numeric_limits<uInt>::max()) {
         return BLIMP_PLUGIN_RESULT_INVALID_ARGUMENT;
     }
+    if (!compression_stream_started) {
+        if (parameters_changed && (!applyCompressionParameters())) {
+            error_string = ErrorStrings::compression_error;
+            return BLIMP_PLUGIN_RESULT_FAILED;
+        }
+        stream_level = level;
+    }
+    compression_stream_started = (chunk.data != nullptr);
+    bool success = true;
     if (chunk.data != nullptr) {
-        zs_compress.next_in = reinterpret_cast<Bytef const*>(chunk.data);
-        zs_compress.avail_in = static_cast<uInt>(chunk.size);
-        while (zs_compress.avail_in > 0) {
-            int const res = deflate(&zs_compress, Z_NO_FLUSH);
-            if (res != Z_OK) { error_string = ErrorStrings::compression_error; return BLIMP_PLUGIN_RESULT_FAILED; }
-            if (zs_compress.avail_out == 0) {
-                available_buffers.emplace_back(std::move(compression_buffer));
-                compression_buffer = getFreeBuffer();
-                zs_compress.next_out = compression_buffer.data_byte();
-                zs_compress.avail_out = static_cast<uInt>(compression_buffer.size());
+        Bytef const* data = reinterpret_cast<Bytef const*>(chunk.data);
+        std::size_t size = static_cast<std::size_t>(chunk.size);
+        while (success && (sampling_stream || (stored_until_resample > 0)) && (size > 0)) {
+            if (!sampling_stream) {
+                // a stored stream passes data through until it is due for the next sample
+                std::size_t const n_bytes = std::min(size, stored_until_resample);
+                success = compressData(data, n_bytes);
+                data += n_bytes;
+                size -= n_bytes;
+                stored_until_resample -= n_bytes;
+                sampling_stream = (stored_until_resample == 0);
+                continue;
             }
+            // data is held back until it was sampled
+            std::size_t const n_bytes = std::min(size, g_sampleSize - sample.size());
+            sample.insert(sample.end(), data, data + n_bytes);
+            data += n_bytes;
+            size -= n_bytes;
+            if (sample.size() < g_sampleSize) { return BLIMP_PLUGIN_RESULT_OK; }
+            success = compressSample();
         }
+        success = success && compressData(data, size);
     } else {
-        // finalize and flush
-        while (true) {
-            int const res = deflate(&zs_compress, Z_FINISH);
-            if ((res != Z_OK) && (res != Z_STREAM_END)) { error_string = ErrorStrings::compression_error; return BLIMP_PLUGIN_RESULT_FAILED; }
+        success = ((!sampling_stream) || compressSample()) && finishStream();
+        sampling_stream = true;
+        stored_until_resample = 0;
+    }
+    if (!success) { error_string = ErrorStrings::compression_error; return BLIMP_PLUGIN_RESULT_FAILED; }
+    return BLIMP_PLUGIN_RESULT_OK;
+}
+
+/** Picks the level for the stream from the held back sample and compresses the sample.
+ * Data of which the sample does not shrink noticeably at the fastest level, like media files or archives, is stored
+ * uncompressed. The output remains a regular zlib stream, so decompression does not need to know.
+ * A stored stream is sampled again every g_resampleInterval bytes and is compressed from the first sample on that
+ * shrinks, so that a stream starting with incompressible data, like a bundle of small files, is not stored
+ * uncompressed as a whole.
+ */
+bool BlimpPluginCompressionState::compressSample()
+{
+    int const effective_level = isIncompressible(sample) ? Z_NO_COMPRESSION : stream_level;
+    sampling_stream = false;
+    stored_until_resample = (effective_level == Z_NO_COMPRESSION) ? g_resampleInterval : 0;
+    if (parallel_deflate) {
+        parallel_deflate->setStreamLevel(effective_level);
+    } else if (!setSerialLevel(effective_level)) {
+        return false;
+    }
+    bool const success = compressData(sample.data(), sample.size());
+    sample.clear();
+    return success;
+}
+
+/** Changing the level in the middle of a stream ends the current deflate block, which may need more output space.
+ */
+bool BlimpPluginCompressionState::setSerialLevel(int new_level)
+{
+    for (;;) {
+        int const res = deflateParams(&zs_compress, new_level, Z_DEFAULT_STRATEGY);
+        if (res == Z_OK) { return true; }
+        if ((res != Z_BUF_ERROR) || (zs_compress.avail_out != 0)) { return false; }
+        available_buffers.emplace_back(std::move(compression_buffer));
+        compression_buffer = getFreeBuffer();
+        zs_compress.next_out = compression_buffer.data_byte();
+        zs_compress.avail_out = static_cast<uInt>(compression_buffer.size());
+    }
+}
+
+bool BlimpPluginCompressionState::isIncompressible(std::vector<Bytef> const& data)
+{
+    if (data.size() < g_minSampleSize) { return false; }
+    if (deflateReset(&zs_sample) != Z_OK) { return false; }
+    sample_output.resize(deflateBound(&zs_sample, static_cast<uLong>(data.size())));
+    zs_sample.next_in = data.data();
+    zs_sample.avail_in = static_cast<uInt>(data.size());
+    zs_sample.next_out = sample_output.data();
+    zs_sample.avail_out = static_cast<uInt>(sample_output.size());
+    if (deflate(&zs_sample, Z_FINISH) != Z_STREAM_END) { return false; }
+    return static_cast<double>(zs_sample.total_out) >= static_cast<double>(data.size()) * g_incompressibleRatio;
+}
+
+bool BlimpPluginCompressionState::compressData(Bytef const* data, std::size_t size)
+{
+    if (parallel_deflate) { return parallel_deflate->addData(data, size, available_buffers); }
+    zs_compress.next_in = data;
+    zs_compress.avail_in = static_cast<uInt>(size);
+    while (zs_compress.avail_in > 0) {
+        int const res = deflate(&zs_compress, Z_NO_FLUSH);
+        if (res != Z_OK) { return false; }
+        if (zs_compress.avail_out == 0) {
             available_buffers.emplace_back(std::move(compression_buffer));
             compression_buffer = getFreeBuffer();
-            if (res == Z_STREAM_END) { break; }
             zs_compress.next_out = compression_buffer.data_byte();
             zs_compress.avail_out = static_cast<uInt>(compression_buffer.size());
         }
-        available_buffers.back().b.resize(Buffer::buffer_size - zs_compress.avail_out);
-        int const res = deflateReset(&zs_compress);
-        if (res != Z_OK) { error_string = ErrorStrings::compression_error; return BLIMP_PLUGIN_RESULT_FAILED; }
+    }
+    return true;
+}
+
+bool BlimpPluginCompressionState::finishStream()
+{
+    if (parallel_deflate) { return parallel_deflate->finish(available_buffers); }
+    // finalize and flush
+    while (true) {
+        int const res = deflate(&zs_compress, Z_FINISH);
+        if ((res != Z_OK) && (res != Z_STREAM_END)) { return false; }
+        available_buffers.emplace_back(std::move(compression_buffer));
+        compression_buffer = getFreeBuffer();
+        if (res == Z_STREAM_END) { break; }
         zs_compress.next_out = compression_buffer.data_byte();
         zs_compress.avail_out = static_cast<uInt>(compression_buffer.size());
     }
-    return BLIMP_PLUGIN_RESULT_OK;
+    available_buffers.back().resize(available_buffers.back().size() - zs_compress.avail_out);
+    if (deflateReset(&zs_compress) != Z_OK) { return false; }
+    zs_compress.next_out = compression_buffer.data_byte();
+    zs_compress.avail_out = static_cast<uInt>(compression_buffer.size());
+    return true;
 }
 
 BlimpPluginResult BlimpPluginCompressionState::decompress_file_chunk(BlimpFileChunk chunk)
@@ -219,20 +640,22 @@ BlimpPluginResult BlimpPluginCompressionState::decompress_file_chunk(BlimpFileCh
         return BLIMP_PLUGIN_RESULT_INVALID_ARGUMENT;
     }
     if (chunk.data != nullptr) {
-        if (decompression_is_finished) { return BLIMP_PLUGIN_RESULT_FAILED; }
         zs_decompress.next_in = reinterpret_cast<Bytef const*>(chunk.data);
         zs_decompress.avail_in = static_cast<uInt>(chunk.size);
         while (zs_decompress.avail_in > 0) {
+            // data following the end of a stream starts the next one; this allows decompressing a sequence of
+            // concatenated streams, as found in storage containers
+            if (decompression_is_finished && !restartDecompression()) { return BLIMP_PLUGIN_RESULT_FAILED; }
             int const res = inflate(&zs_decompress, Z_NO_FLUSH);
             if (res != Z_OK) {
                 if (res == Z_STREAM_END) {
-                    decompression_buffer.b.resize(decompression_buffer.b.size() - zs_decompress.avail_out);
+                    decompression_buffer.resize(decompression_buffer.size() - zs_decompress.avail_out);
                     available_buffers.emplace_back(std::move(decompression_buffer));
                     decompression_buffer = getFreeBuffer();
                     zs_decompress.next_out = nullptr;
                     zs_decompress.avail_out = 0;
                     decompression_is_finished = true;
-                    break;
+                    continue;
                 } else {
                     return BLIMP_PLUGIN_RESULT_FAILED;
                 }
@@ -246,19 +669,25 @@ BlimpPluginResult BlimpPluginCompressionState::decompress_file_chunk(BlimpFileCh
         }
     } else {
         if (!decompression_is_finished) { return BLIMP_PLUGIN_RESULT_FAILED; }
-        int const res = inflateReset(&zs_decompress);
-        if (res != Z_OK) { return BLIMP_PLUGIN_RESULT_FAILED; }
-        zs_decompress.next_out = decompression_buffer.data_byte();
-        zs_decompress.avail_out = static_cast<uInt>(decompression_buffer.size());
-        decompression_is_finished = false;
+        if (!restartDecompression()) { return BLIMP_PLUGIN_RESULT_FAILED; }
     }
     return BLIMP_PLUGIN_RESULT_OK;
 }
 
+bool BlimpPluginCompressionState::restartDecompression()
+{
+    if (inflateReset(&zs_decompress) != Z_OK) { return false; }
+    zs_decompress.next_out = decompression_buffer.data_byte();
+    zs_decompress.avail_out = static_cast<uInt>(decompression_buffer.size());
+    decompression_is_finished = false;
+    return true;
+}
+
 BlimpFileChunk BlimpPluginCompressionState::get_processed_chunk()
 {
     if (!available_buffers.empty()) {
-        free_buffers.emplace_back(std::move(public_buffer));
+        // lent buffers go back to the host's pool when overwritten
+        if (!public_buffer.lent.isValid()) { free_buffers.emplace_back(std::move(public_buffer)); }
         public_buffer = std::move(available_buffers.front());
         available_buffers.pop_front();
         BlimpFileChunk ret;
@@ -273,12 +702,98 @@ BlimpFileChunk BlimpPluginCompressionState::get_processed_chunk()
     }
 }
 
+void BlimpPluginCompressionState::set_buffer_pool(BlimpBufferPool pool)
+{
+    buffer_pool.set(pool);
+    // no data has been processed yet, so the current output buffers can be swapped for lent ones
+    compression_buffer = getFreeBuffer();
+    zs_compress.next_out = compression_buffer.data_byte();
+    zs_compress.avail_out = static_cast<uInt>(compression_buffer.size());
+    decompression_buffer = getFreeBuffer();
+    zs_decompress.next_out = decompression_buffer.data_byte();
+    zs_decompress.avail_out = static_cast<uInt>(decompression_buffer.size());
+}
+
+BlimpLentChunk BlimpPluginCompressionState::take_processed_chunk()
+{
+    if (available_buffers.empty() || !available_buffers.front().lent.isValid()) {
+        // buffers owned by the plugin are handed out as with get_processed_chunk
+        BlimpFileChunk const chunk = get_processed_chunk();
+        return BlimpLentChunk{ .data = chunk.data, .size = chunk.size, .token = 0 };
+    }
+    Buffer& buffer = available_buffers.front();
+    BlimpLentChunk ret;
+    ret.data = buffer.data_char();
+    ret.size = static_cast<int64_t>(buffer.size());
+    ret.token = buffer.lent.passOwnership();
+    available_buffers.pop_front();
+    return ret;
+}
+
+BlimpPluginResult BlimpPluginCompressionState::get_compression_parameter(BlimpCompressionParameter parameter,
+                                                                         int64_t* value, int64_t* min_value,
+                                                                         int64_t* max_value)
+{
+    if (parameter == BLIMP_COMPRESSION_PARAMETER_LEVEL) {
+        *value = level;
+        *min_value = Z_BEST_SPEED;
+        *max_value = Z_BEST_COMPRESSION;
+    } else if (parameter == BLIMP_COMPRESSION_PARAMETER_THREADS) {
+        *value = static_cast<int64_t>(n_threads);
+        *min_value = 0;
+        *max_value = static_cast<int64_t>(g_maxThreads);
+    } else {
+        return BLIMP_PLUGIN_RESULT_INVALID_ARGUMENT;
+    }
+    return BLIMP_PLUGIN_RESULT_OK;
+}
+
+BlimpPluginResult BlimpPluginCompressionState::set_compression_parameter(BlimpCompressionParameter parameter,
+                                                                         int64_t value)
+{
+    if ((parameter == BLIMP_COMPRESSION_PARAMETER_LEVEL) && (value >= Z_BEST_SPEED) &&
+        (value <= Z_BEST_COMPRESSION))
+    {
+        level = static_cast<int>(value);
+    } else if ((parameter == BLIMP_COMPRESSION_PARAMETER_THREADS) && (value >= 0) &&
+               (value <= static_cast<int64_t>(g_maxThreads)))
+    {
+        n_threads = static_cast<std::size_t>(value);
+    } else {
+        return BLIMP_PLUGIN_RESULT_INVALID_ARGUMENT;
+    }
+    parameters_changed = true;
+    return BLIMP_PLUGIN_RESULT_OK;
+}
+
+/** Switches the compressor to the current parameters. Must only be called between compressed streams.
+ */
+bool BlimpPluginCompressionState::applyCompressionParameters()
+{
+    parameters_changed = false;
+    // no data was passed to the serial compressor since it was reset, so the new level applies to all of the stream
+    if (deflateParams(&zs_compress, level, Z_DEFAULT_STRATEGY) != Z_OK) { return false; }
+    parallel_deflate.reset();
+    if (n_threads > 0) {
+        try {
+            parallel_deflate = std::make_unique<ParallelDeflate>(n_threads, level);
+        } catch (std::exception&) {
+            return false;
+        }
+    }
+    return true;
+}
+
 Buffer BlimpPluginCompressionState::getFreeBuffer()
 {
+    if (buffer_pool.isSet()) {
+        LentBuffer lent = buffer_pool.acquire();
+        if (lent.isValid()) { return Buffer(std::move(lent)); }
+    }
     if (free_buffers.empty()) { return Buffer{}; }
     Buffer ret = std::move(free_buffers.back());
     free_buffers.pop_back();
-    ret.b.resize(Buffer::buffer_size);
+    ret.resize(Buffer::buffer_size);
     return std::move(ret);
 }
 
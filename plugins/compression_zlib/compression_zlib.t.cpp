@@ -1,54 +1,16 @@
 #include <compression_zlib.hpp>
 
+#include <blimp_plugin_test_helper_cpp.hpp>
+
 #include <catch.hpp>
 
 #include <algorithm>
+#include <cstdint>
 #include <iterator>
-#include <unordered_map>
 #include <string>
+#include <string_view>
 #include <vector>
 
-struct BlimpKeyValueStoreState {
-    std::unordered_map<std::string, std::string> storage;
-    int call_count_store;
-    int call_count_retrieve;
-    std::string last_key_retrieve;
-
-    BlimpKeyValueStoreState()
-        :call_count_store(0), call_count_retrieve(0)
-    {}
-
-    void store(std::string const& key, BlimpKeyValueStoreValue const& v)
-    {
-        ++call_count_store;
-        storage.insert(std::make_pair(key, std::string(v.data, v.data + v.size)));
-    }
-
-    BlimpKeyValueStoreValue retrieve(std::string const& key)
-    {
-        ++call_count_retrieve;
-        last_key_retrieve = key;
-        auto it = storage.find(key);
-        return (it != storage.end()) ?
-            BlimpKeyValueStoreValue{ .data = it->second.data(), .size = static_cast<int64_t>(it->second.size()) } :
-            BlimpKeyValueStoreValue{ .data = nullptr, .size = -1 };
-    }
-
-    operator BlimpKeyValueStore() {
-        return BlimpKeyValueStore {
-            .state = this,
-            .store = [](BlimpKeyValueStoreStateHandle state, char const* key, BlimpKeyValueStoreValue value)
-            {
-                return state->store(key, value);
-        },
-            .retrieve = [](BlimpKeyValueStoreStateHandle state, char const* key) -> BlimpKeyValueStoreValue
-        {
-            return state->retrieve(key);
-        }
-        };
-    }
-};
-
 TEST_CASE("Plugin Compression zlib")
 {
     BlimpKeyValueStoreState stub_kv_store;
@@ -174,6 +136,61 @@ TEST_CASE("Plugin Compression zlib")
         CHECK(!c.data);
     }
 
+    SECTION("Concatenated Streams")
+    {
+        char const text1[] = "It was the best of times, it was the worst of times.";
+        char const text2[] = "It was the age of wisdom, it was the age of foolishness.";
+
+        BlimpPluginResult res;
+        std::vector<char> compressed;
+        for (auto const& t : { std::string_view(text1), std::string_view(text2) }) {
+            res = compression.compress_file_chunk(compression.state,
+                                                  BlimpFileChunk{ .data = t.data(), .size = static_cast<int64_t>(t.size()) });
+            REQUIRE(res == BLIMP_PLUGIN_RESULT_OK);
+            res = compression.compress_file_chunk(compression.state, BlimpFileChunk{ .data = nullptr, .size = 0 });
+            REQUIRE(res == BLIMP_PLUGIN_RESULT_OK);
+            for (BlimpFileChunk c = compression.get_processed_chunk(compression.state); c.data;
+                 c = compression.get_processed_chunk(compression.state))
+            {
+                compressed.insert(compressed.end(), c.data, c.data + c.size);
+            }
+        }
+        std::string const expected = std::string(text1) + std::string(text2);
+
+        auto const decompress = [&compression](std::vector<char> const& data, std::size_t chunk_size) {
+            std::string ret;
+            for (std::size_t offset = 0; offset < data.size(); offset += chunk_size) {
+                std::size_t const n = std::min(chunk_size, data.size() - offset);
+                BlimpPluginResult const r =
+                    compression.decompress_file_chunk(compression.state,
+                                                      BlimpFileChunk{ .data = data.data() + offset,
+                                                                      .size = static_cast<int64_t>(n) });
+                REQUIRE(r == BLIMP_PLUGIN_RESULT_OK);
+            }
+            REQUIRE(compression.decompress_file_chunk(compression.state,
+                                                      BlimpFileChunk{ .data = nullptr, .size = 0 }) ==
+                    BLIMP_PLUGIN_RESULT_OK);
+            for (BlimpFileChunk c = compression.get_processed_chunk(compression.state); c.data;
+                 c = compression.get_processed_chunk(compression.state))
+            {
+                ret.append(c.data, c.data + c.size);
+            }
+            return ret;
+        };
+        // streams ending in the middle of a chunk and at the end of a chunk
+        CHECK(decompress(compressed, compressed.size()) == expected);
+        CHECK(decompress(compressed, 7) == expected);
+        CHECK(decompress(compressed, 1) == expected);
+
+        // a truncated stream cannot be finished
+        res = compression.decompress_file_chunk(compression.state,
+                                                BlimpFileChunk{ .data = compressed.data(),
+                                                                .size = static_cast<int64_t>(compressed.size() - 1) });
+        CHECK(res == BLIMP_PLUGIN_RESULT_OK);
+        res = compression.decompress_file_chunk(compression.state, BlimpFileChunk{ .data = nullptr, .size = 0 });
+        CHECK(res == BLIMP_PLUGIN_RESULT_FAILED);
+    }
+
     SECTION("Empty Data")
     {
         BlimpPluginResult res;
@@ -191,3 +208,390 @@ TEST_CASE("Plugin Compression zlib")
         CHECK(c.data[0] == '\0');
     }
 }
+
+TEST_CASE("Plugin Compression zlib Parallel")
+{
+    // compressible input spanning several blocks of the parallel compressor
+    std::vector<char> data = generateText((3 << 20) + 12345);
+
+    auto const compress = [&data](char const* n_threads, std::size_t chunk_size) -> std::vector<char> {
+        BlimpKeyValueStoreState kv_store;
+        kv_store.storage["compression_threads"] = n_threads;
+        BlimpPluginCompression compression;
+        compression.abi = BLIMP_PLUGIN_ABI_1_0_0;
+        REQUIRE(blimp_plugin_compression_initialize(kv_store, &compression) == BLIMP_PLUGIN_RESULT_OK);
+        std::vector<char> ret;
+        auto const drain = [&]() {
+            for (BlimpFileChunk c = compression.get_processed_chunk(compression.state); c.data;
+                 c = compression.get_processed_chunk(compression.state))
+            {
+                ret.insert(ret.end(), c.data, c.data + c.size);
+            }
+        };
+        for (std::size_t offset = 0; offset < data.size(); offset += chunk_size) {
+            std::size_t const n = std::min(chunk_size, data.size() - offset);
+            REQUIRE(compression.compress_file_chunk(compression.state,
+                                                    BlimpFileChunk{ .data = data.data() + offset,
+                                                                    .size = static_cast<int64_t>(n) }) ==
+                    BLIMP_PLUGIN_RESULT_OK);
+            drain();
+        }
+        REQUIRE(compression.compress_file_chunk(compression.state, BlimpFileChunk{ .data = nullptr, .size = 0 }) ==
+                BLIMP_PLUGIN_RESULT_OK);
+        drain();
+        blimp_plugin_compression_shutdown(&compression);
+        return ret;
+    };
+
+    SECTION("Output is independent of thread count and chunking")
+    {
+        std::vector<char> const compressed = compress("4", 1 << 20);
+        CHECK(compressed.size() < data.size() / 2);
+        CHECK(compress("1", 1 << 20) == compressed);
+        CHECK(compress("3", 77777) == compressed);
+    }
+
+    SECTION("Output is a standard zlib stream")
+    {
+        std::vector<char> const compressed = compress("4", 1 << 20);
+        BlimpKeyValueStoreState kv_store;
+        BlimpPluginCompression compression;
+        compression.abi = BLIMP_PLUGIN_ABI_1_0_0;
+        REQUIRE(blimp_plugin_compression_initialize(kv_store, &compression) == BLIMP_PLUGIN_RESULT_OK);
+        REQUIRE(compression.decompress_file_chunk(compression.state,
+                                                  BlimpFileChunk{ .data = compressed.data(),
+                                                                  .size = static_cast<int64_t>(compressed.size()) }) ==
+                BLIMP_PLUGIN_RESULT_OK);
+        REQUIRE(compression.decompress_file_chunk(compression.state, BlimpFileChunk{ .data = nullptr, .size = 0 }) ==
+                BLIMP_PLUGIN_RESULT_OK);
+        std::vector<char> decompressed;
+        for (BlimpFileChunk c = compression.get_processed_chunk(compression.state); c.data;
+             c = compression.get_processed_chunk(compression.state))
+        {
+            decompressed.insert(decompressed.end(), c.data, c.data + c.size);
+        }
+        CHECK(decompressed == data);
+        blimp_plugin_compression_shutdown(&compression);
+    }
+
+    SECTION("Empty Data")
+    {
+        data.clear();
+        // zlib header, final empty block and checksum
+        CHECK(compress("2", 1 << 20).size() == 2 + 2 + 4);
+    }
+}
+
+struct BlimpBufferPoolState {
+    std::vector<std::vector<char>> buffers;
+    std::vector<bool> in_use;
+
+    BlimpBufferPoolState(std::size_t n_buffers, std::size_t buffer_size)
+        :buffers(n_buffers, std::vector<char>(buffer_size)), in_use(n_buffers, false)
+    {}
+
+    std::size_t buffersInUse() const {
+        return static_cast<std::size_t>(std::count(in_use.begin(), in_use.end(), true));
+    }
+
+    operator BlimpBufferPool() {
+        return BlimpBufferPool{
+            .state = this,
+            .acquire = [](BlimpBufferPoolStateHandle state) -> BlimpBuffer {
+                auto const it = std::find(state->in_use.begin(), state->in_use.end(), false);
+                if (it == state->in_use.end()) { return BlimpBuffer{ .data = nullptr, .capacity = 0, .token = 0 }; }
+                *it = true;
+                std::size_t const index = static_cast<std::size_t>(std::distance(state->in_use.begin(), it));
+                return BlimpBuffer{ .data = state->buffers[index].data(),
+                                    .capacity = static_cast<int64_t>(state->buffers[index].size()),
+                                    .token = index + 1 };
+            },
+            .release = [](BlimpBufferPoolStateHandle state, uint64_t token) {
+                REQUIRE(state->in_use[token - 1]);
+                state->in_use[token - 1] = false;
+            }
+        };
+    }
+};
+
+TEST_CASE("Plugin Compression zlib Buffer Lending")
+{
+    std::vector<char> const data = generateText(512 << 10, 1234, 5000);
+
+    auto const compress = [&data](BlimpBufferPoolState* pool, std::size_t& lent_chunks) -> std::vector<char> {
+        BlimpKeyValueStoreState kv_store;
+        BlimpPluginCompression compression;
+        compression.abi = BLIMP_PLUGIN_ABI_1_1_0;
+        REQUIRE(blimp_plugin_compression_initialize(kv_store, &compression) == BLIMP_PLUGIN_RESULT_OK);
+        if (pool) { compression.set_buffer_pool(compression.state, *pool); }
+        std::vector<char> ret;
+        auto const drain = [&]() {
+            for (BlimpLentChunk c = compression.take_processed_chunk(compression.state); c.data;
+                 c = compression.take_processed_chunk(compression.state))
+            {
+                ret.insert(ret.end(), c.data, c.data + c.size);
+                if (c.token != 0) {
+                    ++lent_chunks;
+                    BlimpBufferPool const host_pool = *pool;
+                    host_pool.release(host_pool.state, c.token);
+                }
+            }
+        };
+        for (std::size_t offset = 0; offset < data.size(); offset += 10000) {
+            std::size_t const n = std::min<std::size_t>(10000, data.size() - offset);
+            REQUIRE(compression.compress_file_chunk(compression.state,
+                                                    BlimpFileChunk{ .data = data.data() + offset,
+                                                                    .size = static_cast<int64_t>(n) }) ==
+                    BLIMP_PLUGIN_RESULT_OK);
+            drain();
+        }
+        REQUIRE(compression.compress_file_chunk(compression.state, BlimpFileChunk{ .data = nullptr, .size = 0 }) ==
+                BLIMP_PLUGIN_RESULT_OK);
+        drain();
+        blimp_plugin_compression_shutdown(&compression);
+        return ret;
+    };
+
+    std::size_t lent_chunks = 0;
+    std::vector<char> const expected = compress(nullptr, lent_chunks);
+    CHECK(lent_chunks == 0);
+
+    SECTION("Output is written to lent buffers")
+    {
+        BlimpBufferPoolState pool(64, 4096);
+        CHECK(compress(&pool, lent_chunks) == expected);
+        CHECK(lent_chunks >= expected.size() / 4096);
+        CHECK(pool.buffersInUse() == 0);
+    }
+
+    SECTION("Exhausted pool falls back to owned buffers")
+    {
+        BlimpBufferPoolState pool(1, 4096);
+        CHECK(compress(&pool, lent_chunks) == expected);
+        CHECK(pool.buffersInUse() == 0);
+    }
+
+    SECTION("Plugin accepts the previous ABI")
+    {
+        BlimpKeyValueStoreState kv_store;
+        BlimpPluginCompression compression;
+        compression.abi = BLIMP_PLUGIN_ABI_1_0_0;
+        compression.set_buffer_pool = nullptr;
+        REQUIRE(blimp_plugin_compression_initialize(kv_store, &compression) == BLIMP_PLUGIN_RESULT_OK);
+        CHECK(compression.set_buffer_pool == nullptr);
+        blimp_plugin_compression_shutdown(&compression);
+    }
+}
+
+TEST_CASE("Plugin Compression zlib Parameters")
+{
+    std::vector<char> const data = generateText(2 << 20, 4711, 5000);
+
+    BlimpKeyValueStoreState kv_store;
+    BlimpPluginCompression compression;
+    compression.abi = BLIMP_PLUGIN_ABI_1_2_0;
+    REQUIRE(blimp_plugin_compression_initialize(kv_store, &compression) == BLIMP_PLUGIN_RESULT_OK);
+
+    // compresses data as one stream, calling on_first_chunk after passing the first chunk
+    auto const compress = [&](auto const& on_first_chunk) -> std::vector<char> {
+        std::vector<char> ret;
+        auto const drain = [&]() {
+            for (BlimpLentChunk c = compression.take_processed_chunk(compression.state); c.data;
+                 c = compression.take_processed_chunk(compression.state))
+            {
+                ret.insert(ret.end(), c.data, c.data + c.size);
+            }
+        };
+        for (std::size_t offset = 0; offset < data.size(); offset += 100000) {
+            std::size_t const n = std::min<std::size_t>(100000, data.size() - offset);
+            REQUIRE(compression.compress_file_chunk(compression.state,
+                                                    BlimpFileChunk{ .data = data.data() + offset,
+                                                                    .size = static_cast<int64_t>(n) }) ==
+                    BLIMP_PLUGIN_RESULT_OK);
+            if (offset == 0) { on_first_chunk(); }
+            drain();
+        }
+        REQUIRE(compression.compress_file_chunk(compression.state, BlimpFileChunk{ .data = nullptr, .size = 0 }) ==
+                BLIMP_PLUGIN_RESULT_OK);
+        drain();
+        return ret;
+    };
+    auto const decompress = [](std::vector<char> const& compressed) -> std::vector<char> {
+        BlimpKeyValueStoreState kv_store;
+        BlimpPluginCompression decompression;
+        decompression.abi = BLIMP_PLUGIN_ABI_1_0_0;
+        REQUIRE(blimp_plugin_compression_initialize(kv_store, &decompression) == BLIMP_PLUGIN_RESULT_OK);
+        REQUIRE(decompression.decompress_file_chunk(decompression.state,
+                                                    BlimpFileChunk{ .data = compressed.data(),
+                                                                    .size = static_cast<int64_t>(compressed.size()) })
+                == BLIMP_PLUGIN_RESULT_OK);
+        REQUIRE(decompression.decompress_file_chunk(decompression.state, BlimpFileChunk{ .data = nullptr, .size = 0 })
+                == BLIMP_PLUGIN_RESULT_OK);
+        std::vector<char> ret;
+        for (BlimpFileChunk c = decompression.get_processed_chunk(decompression.state); c.data;
+             c = decompression.get_processed_chunk(decompression.state))
+        {
+            ret.insert(ret.end(), c.data, c.data + c.size);
+        }
+        blimp_plugin_compression_shutdown(&decompression);
+        return ret;
+    };
+    auto const get_parameter = [&compression](BlimpCompressionParameter parameter) -> std::vector<int64_t> {
+        int64_t value = -1;
+        int64_t min_value = -1;
+        int64_t max_value = -1;
+        REQUIRE(compression.get_compression_parameter(compression.state, parameter, &value, &min_value,
+                                                      &max_value) == BLIMP_PLUGIN_RESULT_OK);
+        return { value, min_value, max_value };
+    };
+    auto const set_parameter = [&compression](BlimpCompressionParameter parameter, int64_t value) {
+        return compression.set_compression_parameter(compression.state, parameter, value);
+    };
+
+    SECTION("Default parameters")
+    {
+        CHECK(get_parameter(BLIMP_COMPRESSION_PARAMETER_LEVEL) == std::vector<int64_t>{ 9, 1, 9 });
+        CHECK(get_parameter(BLIMP_COMPRESSION_PARAMETER_THREADS)[0] == 0);
+        int64_t value = 0;
+        CHECK(compression.get_compression_parameter(compression.state, static_cast<BlimpCompressionParameter>(0),
+                                                    &value, &value, &value) == BLIMP_PLUGIN_RESULT_INVALID_ARGUMENT);
+    }
+
+    SECTION("Values out of range are rejected")
+    {
+        CHECK(set_parameter(BLIMP_COMPRESSION_PARAMETER_LEVEL, 0) == BLIMP_PLUGIN_RESULT_INVALID_ARGUMENT);
+        CHECK(set_parameter(BLIMP_COMPRESSION_PARAMETER_LEVEL, 10) == BLIMP_PLUGIN_RESULT_INVALID_ARGUMENT);
+        CHECK(set_parameter(BLIMP_COMPRESSION_PARAMETER_THREADS, -1) == BLIMP_PLUGIN_RESULT_INVALID_ARGUMENT);
+        CHECK(get_parameter(BLIMP_COMPRESSION_PARAMETER_LEVEL)[0] == 9);
+        CHECK(get_parameter(BLIMP_COMPRESSION_PARAMETER_THREADS)[0] == 0);
+    }
+
+    SECTION("Changed parameters apply to the next stream")
+    {
+        std::vector<char> const best = compress([]() {});
+        std::vector<char> const still_best = compress([&]() {
+            CHECK(set_parameter(BLIMP_COMPRESSION_PARAMETER_LEVEL, 1) == BLIMP_PLUGIN_RESULT_OK);
+        });
+        CHECK(still_best == best);
+        CHECK(get_parameter(BLIMP_COMPRESSION_PARAMETER_LEVEL)[0] == 1);
+        std::vector<char> const fast = compress([]() {});
+        CHECK(fast.size() > best.size());
+        CHECK(decompress(fast) == data);
+
+        CHECK(set_parameter(BLIMP_COMPRESSION_PARAMETER_THREADS, 3) == BLIMP_PLUGIN_RESULT_OK);
+        std::vector<char> const fast_parallel = compress([]() {});
+        CHECK(fast_parallel != fast);
+        CHECK(decompress(fast_parallel) == data);
+        CHECK(set_parameter(BLIMP_COMPRESSION_PARAMETER_LEVEL, 9) == BLIMP_PLUGIN_RESULT_OK);
+        std::vector<char> const best_parallel = compress([]() {});
+        CHECK(best_parallel.size() < fast_parallel.size());
+        CHECK(decompress(best_parallel) == data);
+
+        CHECK(set_parameter(BLIMP_COMPRESSION_PARAMETER_THREADS, 0) == BLIMP_PLUGIN_RESULT_OK);
+        CHECK(compress([]() {}) == best);
+    }
+
+    blimp_plugin_compression_shutdown(&compression);
+}
+
+TEST_CASE("Plugin Compression zlib Incompressible Data")
+{
+    std::vector<char> const random_data = generateNoise((1 << 20) + 333, 815);
+    std::vector<char> const text_data = generateText(1 << 20, 816, 5000);
+
+    auto const compress_streams = [](char const* n_threads,
+                                     std::vector<std::vector<char> const*> const& streams) -> std::vector<std::size_t>
+    {
+        BlimpKeyValueStoreState kv_store;
+        kv_store.storage["compression_threads"] = n_threads;
+        BlimpPluginCompression compression;
+        compression.abi = BLIMP_PLUGIN_ABI_1_0_0;
+        REQUIRE(blimp_plugin_compression_initialize(kv_store, &compression) == BLIMP_PLUGIN_RESULT_OK);
+        BlimpKeyValueStoreState kv_store_decompression;
+        BlimpPluginCompression decompression;
+        decompression.abi = BLIMP_PLUGIN_ABI_1_0_0;
+        REQUIRE(blimp_plugin_compression_initialize(kv_store_decompression, &decompression) ==
+                BLIMP_PLUGIN_RESULT_OK);
+        std::vector<std::size_t> ret;
+        for (auto const* data : streams) {
+            std::vector<char> compressed;
+            auto const drain = [&]() {
+                for (BlimpFileChunk c = compression.get_processed_chunk(compression.state); c.data;
+                     c = compression.get_processed_chunk(compression.state))
+                {
+                    compressed.insert(compressed.end(), c.data, c.data + c.size);
+                }
+            };
+            for (std::size_t offset = 0; offset < data->size(); offset += 10000) {
+                std::size_t const n = std::min<std::size_t>(10000, data->size() - offset);
+                REQUIRE(compression.compress_file_chunk(compression.state,
+                                                        BlimpFileChunk{ .data = data->data() + offset,
+                                                                        .size = static_cast<int64_t>(n) }) ==
+                        BLIMP_PLUGIN_RESULT_OK);
+                drain();
+            }
+            REQUIRE(compression.compress_file_chunk(compression.state, BlimpFileChunk{ .data = nullptr, .size = 0 })
+                    == BLIMP_PLUGIN_RESULT_OK);
+            drain();
+            ret.push_back(compressed.size());
+
+            REQUIRE(decompression.decompress_file_chunk(decompression.state,
+                                                        BlimpFileChunk{ .data = compressed.data(),
+                                                                        .size = static_cast<int64_t>(compressed.size())
+                                                        }) == BLIMP_PLUGIN_RESULT_OK);
+            REQUIRE(decompression.decompress_file_chunk(decompression.state,
+                                                        BlimpFileChunk{ .data = nullptr, .size = 0 }) ==
+                    BLIMP_PLUGIN_RESULT_OK);
+            std::vector<char> decompressed;
+            for (BlimpFileChunk c = decompression.get_processed_chunk(decompression.state); c.data;
+                 c = decompression.get_processed_chunk(decompression.state))
+            {
+                decompressed.insert(decompressed.end(), c.data, c.data + c.size);
+            }
+            CHECK(decompressed == *data);
+        }
+        blimp_plugin_compression_shutdown(&compression);
+        blimp_plugin_compression_shutdown(&decompression);
+        return ret;
+    };
+
+    SECTION("Incompressible streams are stored")
+    {
+        for (char const* n_threads : { "0", "2" }) {
+            std::vector<std::size_t> const sizes =
+                compress_streams(n_threads, { &random_data, &text_data, &random_data });
+            // stored blocks only add a few bytes of framing per 64 KiB
+            CHECK(sizes[0] < random_data.size() + random_data.size() / 1000);
+            CHECK(sizes[1] < text_data.size() / 2);
+            CHECK(sizes[2] == sizes[0]);
+        }
+    }
+
+    SECTION("Stored streams are compressed once the data compresses")
+    {
+        std::vector<char> mixed_data = random_data;
+        mixed_data.insert(mixed_data.end(), text_data.begin(), text_data.end());
+        for (char const* n_threads : { "0", "2" }) {
+            std::vector<std::size_t> const sizes = compress_streams(n_threads, { &mixed_data });
+            CHECK(sizes[0] < random_data.size() + text_data.size() / 2);
+        }
+    }
+
+    SECTION("Stored streams are not sampled again before the resample interval")
+    {
+        std::vector<char> mixed_data(random_data.begin(), random_data.begin() + (256 << 10));
+        mixed_data.insert(mixed_data.end(), text_data.begin(), text_data.begin() + (256 << 10));
+        for (char const* n_threads : { "0", "2" }) {
+            std::vector<std::size_t> const sizes = compress_streams(n_threads, { &mixed_data });
+            CHECK(sizes[0] > mixed_data.size());
+        }
+    }
+
+    SECTION("Short streams are compressed regardless")
+    {
+        std::vector<char> const short_data(random_data.begin(), random_data.begin() + 100);
+        std::vector<char> const short_text(text_data.begin(), text_data.begin() + 1000);
+        std::vector<std::size_t> const sizes = compress_streams("0", { &short_data, &short_text });
+        CHECK(sizes[1] < short_text.size());
+    }
+}
@@ -0,0 +1,303 @@
+#include <compression_zstd.hpp>
+
+#include <blimp_plugin_helper_cpp.hpp>
+
+#include <zstd.h>
+
+#include <charconv>
+#include <deque>
+#include <stdexcept>
+#include <vector>
+
+namespace {
+struct ErrorStrings {
+    static constexpr char const okay[] = "Ok";
+    static constexpr char const compression_error[] = "Unexpected error during compression";
+    static constexpr char const decompression_error[] = "Unexpected error during decompression";
+};
+
+/// Compression level as accepted by ZSTD_c_compressionLevel
+constexpr char const g_kvKeyLevel[] = "compression_level";
+/// Number of worker threads; 0 compresses on the calling thread
+constexpr char const g_kvKeyThreads[] = "compression_threads";
+/// Enables long distance matching if non-zero
+constexpr char const g_kvKeyLongDistance[] = "compression_long_distance";
+
+constexpr int g_defaultLevel = 3;
+
+struct Buffer {
+    std::vector<char> b;
+    static constexpr size_t buffer_size = (1 << 20);
+
+    Buffer()
+    {
+        b.resize(buffer_size);
+    }
+
+    Buffer(Buffer const&) = delete;
+    Buffer& operator=(Buffer const&) = delete;
+
+    Buffer(Buffer&&) = default;
+    Buffer& operator=(Buffer&&) = default;
+
+    char* data() {
+        return b.data();
+    }
+
+    char const* data() const {
+        return b.data();
+    }
+
+    size_t size() const {
+        return b.size();
+    }
+};
+
+int retrieveInt(KeyValueStore& kv_store, char const* key, int default_value)
+{
+    BlimpKeyValueStoreValue const v = kv_store.retrieve(key);
+    if (v.data == nullptr) { return default_value; }
+    int ret = 0;
+    auto const [ptr, ec] = std::from_chars(v.data, v.data + v.size, ret);
+    if ((ec != std::errc{}) || (ptr != v.data + v.size)) {
+        throw std::exception();
+    }
+    return ret;
+}
+}   // anonymous namespace
+
+struct BlimpPluginCompressionState {
+    ZSTD_CCtx* cctx;
+    ZSTD_DCtx* dctx;
+    Buffer compression_buffer;
+    std::size_t compression_buffer_used;
+    Buffer decompression_buffer;
+    std::size_t decompression_buffer_used;
+    std::deque<Buffer> available_buffers;
+    Buffer public_buffer;
+    std::vector<Buffer> free_buffers;
+    char const* error_string;
+    KeyValueStore kv_store;
+    bool decompression_is_finished;
+
+    BlimpPluginCompressionState(BlimpKeyValueStore const& n_kv_store);
+    ~BlimpPluginCompressionState();
+
+    BlimpPluginCompressionState(BlimpPluginCompressionState const&) = delete;
+    BlimpPluginCompressionState& operator=(BlimpPluginCompressionState const&) = delete;
+
+    char const* get_last_error();
+
+    BlimpPluginResult compress_file_chunk(BlimpFileChunk chunk);
+    BlimpPluginResult decompress_file_chunk(BlimpFileChunk chunk);
+    BlimpFileChunk get_processed_chunk();
+
+    Buffer getFreeBuffer();
+};
+
+BlimpPluginInfo blimp_plugin_api_info()
+{
+    return BlimpPluginInfo{
+        .type = BLIMP_PLUGIN_TYPE_COMPRESSION,
+        .version = BlimpPluginVersion{
+            .major = 1,
+            .minor = 0,
+            .patch = 0
+        },
+        .uuid = {
+            // {C93C3C97-8910-44C0-A74B-B4718D4BC5B1}
+            0xc93c3c97, 0x8910, 0x44c0, { 0xa7, 0x4b, 0xb4, 0x71, 0x8d, 0x4b, 0xc5, 0xb1 }
+        },
+        .name = "zstd Compression",
+        .description = "Compression with Zstandard"
+    };
+}
+
+char const* blimp_plugin_get_last_error(BlimpPluginCompressionStateHandle state)
+{
+    return state->get_last_error();
+}
+
+BlimpPluginResult blimp_plugin_compress_file_chunk(BlimpPluginCompressionStateHandle state, BlimpFileChunk chunk)
+{
+    return state->compress_file_chunk(chunk);
+}
+
+BlimpPluginResult blimp_plugin_decompress_file_chunk(BlimpPluginCompressionStateHandle state, BlimpFileChunk chunk)
+{
+    return state->decompress_file_chunk(chunk);
+}
+
+BlimpFileChunk blimp_plugin_get_processed_chunk(BlimpPluginCompressionStateHandle state)
+{
+    return state->get_processed_chunk();
+}
+
+BlimpPluginResult blimp_plugin_compression_initialize(BlimpKeyValueStore kv_store, BlimpPluginCompression* plugin)
+{
+    if (plugin->abi != BLIMP_PLUGIN_ABI_1_0_0) {
+        return BLIMP_PLUGIN_RESULT_INVALID_ARGUMENT;
+    }
+    try {
+        plugin->state = new BlimpPluginCompressionState(kv_store);
+    } catch (std::exception&) {
+        plugin->state = nullptr;
+        return BLIMP_PLUGIN_RESULT_FAILED;
+    }
+    plugin->get_last_error = blimp_plugin_get_last_error;
+    plugin->compress_file_chunk = blimp_plugin_compress_file_chunk;
+    plugin->decompress_file_chunk = blimp_plugin_decompress_file_chunk;
+    plugin->get_processed_chunk = blimp_plugin_get_processed_chunk;
+    return BLIMP_PLUGIN_RESULT_OK;
+}
+
+void blimp_plugin_compression_shutdown(BlimpPluginCompression* plugin)
+{
+    delete plugin->state;
+}
+
+BlimpPluginCompressionState::BlimpPluginCompressionState(BlimpKeyValueStore const& n_kv_store)
+    :cctx(nullptr), dctx(nullptr), compression_buffer_used(0), decompression_buffer_used(0), kv_store(n_kv_store),
+     decompression_is_finished(false)
+{
+    error_string = ErrorStrings::okay;
+    int const level = retrieveInt(kv_store, g_kvKeyLevel, g_defaultLevel);
+    int const n_threads = retrieveInt(kv_store, g_kvKeyThreads, 0);
+    bool const long_distance = (retrieveInt(kv_store, g_kvKeyLongDistance, 0) != 0);
+    if ((level < ZSTD_minCLevel()) || (level > ZSTD_maxCLevel()) || (n_threads < 0)) {
+        throw std::exception();
+    }
+
+    cctx = ZSTD_createCCtx();
+    dctx = ZSTD_createDCtx();
+    if ((!cctx) || (!dctx)) {
+        ZSTD_freeCCtx(cctx);
+        ZSTD_freeDCtx(dctx);
+        throw std::exception();
+    }
+    // setting the number of workers fails if libzstd was built without multithreading support;
+    // decompression accepts the largest possible window, so that frames written in long distance mode can be read
+    ZSTD_bounds const window_log_bounds = ZSTD_dParam_getBounds(ZSTD_d_windowLogMax);
+    if (ZSTD_isError(ZSTD_CCtx_setParameter(cctx, ZSTD_c_compressionLevel, level)) ||
+        ZSTD_isError(ZSTD_CCtx_setParameter(cctx, ZSTD_c_nbWorkers, n_threads)) ||
+        ZSTD_isError(ZSTD_CCtx_setParameter(cctx, ZSTD_c_enableLongDistanceMatching, long_distance ? 1 : 0)) ||
+        ZSTD_isError(ZSTD_CCtx_setParameter(cctx, ZSTD_c_checksumFlag, 1)) ||
+        ZSTD_isError(ZSTD_DCtx_setParameter(dctx, ZSTD_d_windowLogMax, window_log_bounds.upperBound)))
+    {
+        ZSTD_freeCCtx(cctx);
+        ZSTD_freeDCtx(dctx);
+        throw std::exception();
+    }
+}
+
+BlimpPluginCompressionState::~BlimpPluginCompressionState()
+{
+    ZSTD_freeCCtx(cctx);
+    ZSTD_freeDCtx(dctx);
+}
+
+char const* BlimpPluginCompressionState::get_last_error()
+{
+    return error_string;
+}
+
+BlimpPluginResult BlimpPluginCompressionState::compress_file_chunk(BlimpFileChunk chunk)
+{
+    if (chunk.size < 0) {
+        return BLIMP_PLUGIN_RESULT_INVALID_ARGUMENT;
+    }
+    ZSTD_inBuffer in{ .src = chunk.data, .size = static_cast<std::size_t>(chunk.size), .pos = 0 };
+    ZSTD_EndDirective const mode = (chunk.data != nullptr) ? ZSTD_e_continue : ZSTD_e_end;
+    for (;;) {
+        ZSTD_outBuffer out{ .dst = compression_buffer.data(), .size = compression_buffer.size(),
+                            .pos = compression_buffer_used };
+        std::size_t const res = ZSTD_compressStream2(cctx, &out, &in, mode);
+        if (ZSTD_isError(res)) {
+            ZSTD_CCtx_reset(cctx, ZSTD_reset_session_only);
+            compression_buffer_used = 0;
+            error_string = ErrorStrings::compression_error;
+            return BLIMP_PLUGIN_RESULT_FAILED;
+        }
+        compression_buffer_used = out.pos;
+        if ((mode == ZSTD_e_end) && (res == 0)) {
+            // frame is complete
+            compression_buffer.b.resize(compression_buffer_used);
+            available_buffers.emplace_back(std::move(compression_buffer));
+            compression_buffer = getFreeBuffer();
+            compression_buffer_used = 0;
+            break;
+        }
+        if (out.pos == out.size) {
+            available_buffers.emplace_back(std::move(compression_buffer));
+            compression_buffer = getFreeBuffer();
+            compression_buffer_used = 0;
+        } else if ((mode == ZSTD_e_continue) && (in.pos == in.size)) {
+            break;
+        }
+    }
+    return BLIMP_PLUGIN_RESULT_OK;
+}
+
+BlimpPluginResult BlimpPluginCompressionState::decompress_file_chunk(BlimpFileChunk chunk)
+{
+    if (chunk.size < 0) {
+        return BLIMP_PLUGIN_RESULT_INVALID_ARGUMENT;
+    }
+    if (chunk.data != nullptr) {
+        ZSTD_inBuffer in{ .src = chunk.data, .size = static_cast<std::size_t>(chunk.size), .pos = 0 };
+        // a full output buffer may leave decoded data behind in the context even if all input was consumed;
+        // frames that were compressed one after another are decompressed one after another
+        bool output_pending = true;
+        while ((in.pos < in.size) || (output_pending && (!decompression_is_finished))) {
+            ZSTD_outBuffer out{ .dst = decompression_buffer.data(), .size = decompression_buffer.size(),
+                                .pos = decompression_buffer_used };
+            std::size_t const res = ZSTD_decompressStream(dctx, &out, &in);
+            if (ZSTD_isError(res)) {
+                error_string = ErrorStrings::decompression_error;
+                return BLIMP_PLUGIN_RESULT_CORRUPTED_DATA;
+            }
+            decompression_buffer_used = out.pos;
+            output_pending = (out.pos == out.size);
+            // once a frame is complete, the context is ready for the next frame
+            decompression_is_finished = (res == 0);
+            if (decompression_is_finished || output_pending) {
+                decompression_buffer.b.resize(decompression_buffer_used);
+                available_buffers.emplace_back(std::move(decompression_buffer));
+                decompression_buffer = getFreeBuffer();
+                decompression_buffer_used = 0;
+            }
+        }
+    } else {
+        if (!decompression_is_finished) { return BLIMP_PLUGIN_RESULT_FAILED; }
+        if (ZSTD_isError(ZSTD_DCtx_reset(dctx, ZSTD_reset_session_only))) { return BLIMP_PLUGIN_RESULT_FAILED; }
+        decompression_is_finished = false;
+    }
+    return BLIMP_PLUGIN_RESULT_OK;
+}
+
+BlimpFileChunk BlimpPluginCompressionState::get_processed_chunk()
+{
+    if (!available_buffers.empty()) {
+        free_buffers.emplace_back(std::move(public_buffer));
+        public_buffer = std::move(available_buffers.front());
+        available_buffers.pop_front();
+        BlimpFileChunk ret;
+        ret.data = public_buffer.data();
+        ret.size = public_buffer.size();
+        return ret;
+    } else {
+        BlimpFileChunk ret;
+        ret.data = nullptr;
+        ret.size = 0;
+        return ret;
+    }
+}
+
+Buffer BlimpPluginCompressionState::getFreeBuffer()
+{
+    if (free_buffers.empty()) { return Buffer{}; }
+    Buffer ret = std::move(free_buffers.back());
+    free_buffers.pop_back();
+    ret.b.resize(Buffer::buffer_size);
+    return ret;
+}
@@ -0,0 +1,15 @@
+#ifndef BLIMP_INCLUDE_GUARD_PLUGIN_COMPRESSION_ZSTD_HPP
+#define BLIMP_INCLUDE_GUARD_PLUGIN_COMPRESSION_ZSTD_HPP
+
+#include <blimp_plugin_sdk.h>
+
+#include <compression_zstd_export.h>
+
+extern "C" COMPRESSION_ZSTD_EXPORT BlimpPluginInfo blimp_plugin_api_info();
+
+extern "C" COMPRESSION_ZSTD_EXPORT BlimpPluginResult blimp_plugin_compression_initialize(BlimpKeyValueStore kv_store,
+                                                                                         BlimpPluginCompression* plugin);
+
+extern "C" COMPRESSION_ZSTD_EXPORT void blimp_plugin_compression_shutdown(BlimpPluginCompression* plugin);
+
+#endif
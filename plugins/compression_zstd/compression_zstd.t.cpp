@@ -0,0 +1,156 @@
+#include <compression_zstd.hpp>
+
+#include <blimp_plugin_test_helper_cpp.hpp>
+
+#include <catch.hpp>
+
+#include <algorithm>
+#include <cstdint>
+#include <iterator>
+#include <string>
+#include <vector>
+
+TEST_CASE("Plugin Compression zstd")
+{
+    SECTION("Plugin Info")
+    {
+        auto const api_info = blimp_plugin_api_info();
+        CHECK(api_info.type == BLIMP_PLUGIN_TYPE_COMPRESSION);
+    }
+
+    BlimpKeyValueStoreState kv_store;
+    BlimpPluginCompression compression;
+    compression.abi = BLIMP_PLUGIN_ABI_1_0_0;
+    REQUIRE(blimp_plugin_compression_initialize(kv_store, &compression) == BLIMP_PLUGIN_RESULT_OK);
+    CHECK(kv_store.call_count_retrieve > 0);
+
+    SECTION("Compression Decompression")
+    {
+        std::vector<char> const text = generateText(3 << 20);
+        std::vector<char> const compressed_text = compressAll(compression, text, text.size());
+        CHECK(compressed_text.size() < text.size() / 2);
+
+        CHECK(decompressAll(compression, compressed_text, compressed_text.size()) == text);
+        // decompress in smaller chunks
+        CHECK(decompressAll(compression, compressed_text, 200) == text);
+        CHECK(decompressAll(compression, compressed_text, 1) == text);
+
+        // compression is deterministic
+        CHECK(compressAll(compression, text, text.size()) == compressed_text);
+        // compression in smaller chunks
+        CHECK(compressAll(compression, text, 77777) == compressed_text);
+    }
+
+    SECTION("Concatenated Frames")
+    {
+        std::vector<char> const text = generateText(1 << 20);
+        std::vector<char> const noise = generateNoise(1 << 18);
+        std::vector<char> compressed = compressAll(compression, text, 1 << 16);
+        std::vector<char> const compressed_noise = compressAll(compression, noise, 1 << 16);
+        compressed.insert(compressed.end(), compressed_noise.begin(), compressed_noise.end());
+        std::vector<char> expected = text;
+        expected.insert(expected.end(), noise.begin(), noise.end());
+
+        CHECK(decompressAll(compression, compressed, compressed.size()) == expected);
+        CHECK(decompressAll(compression, compressed, 333) == expected);
+        // a frame ending exactly at the end of a chunk
+        CHECK(decompressAll(compression, compressed, compressed.size() - compressed_noise.size()) == expected);
+    }
+
+    SECTION("Empty Data")
+    {
+        std::vector<char> const compressed = compressAll(compression, {}, 1);
+        REQUIRE(!compressed.empty());
+
+        REQUIRE(compression.decompress_file_chunk(compression.state,
+                                                  BlimpFileChunk{ .data = compressed.data(),
+                                                                  .size = static_cast<int64_t>(compressed.size()) }) ==
+                BLIMP_PLUGIN_RESULT_OK);
+        BlimpFileChunk c = compression.get_processed_chunk(compression.state);
+        REQUIRE(c.data);
+        CHECK(c.size == 0);
+        CHECK(!compression.get_processed_chunk(compression.state).data);
+    }
+
+    SECTION("Corrupted Data")
+    {
+        std::vector<char> compressed = compressAll(compression, generateText(1 << 16), 1 << 16);
+        compressed[compressed.size() / 2] ^= 0x55;
+        CHECK(compression.decompress_file_chunk(compression.state,
+                                                BlimpFileChunk{ .data = compressed.data(),
+                                                                .size = static_cast<int64_t>(compressed.size()) }) ==
+              BLIMP_PLUGIN_RESULT_CORRUPTED_DATA);
+    }
+
+    SECTION("Incomplete Data")
+    {
+        std::vector<char> const compressed = compressAll(compression, generateText(1 << 16), 1 << 16);
+        REQUIRE(compression.decompress_file_chunk(compression.state,
+                                                  BlimpFileChunk{ .data = compressed.data(),
+                                                                  .size = static_cast<int64_t>(compressed.size() - 1) }) ==
+                BLIMP_PLUGIN_RESULT_OK);
+        CHECK(compression.decompress_file_chunk(compression.state, BlimpFileChunk{ .data = nullptr, .size = 0 }) ==
+              BLIMP_PLUGIN_RESULT_FAILED);
+    }
+
+    blimp_plugin_compression_shutdown(&compression);
+}
+
+TEST_CASE("Plugin Compression zstd Configuration")
+{
+    std::vector<char> const text = generateText(5 << 20);
+
+    auto const compress = [](BlimpKeyValueStoreState& kv_store, std::vector<char> const& data) -> std::vector<char> {
+        BlimpPluginCompression compression;
+        compression.abi = BLIMP_PLUGIN_ABI_1_0_0;
+        REQUIRE(blimp_plugin_compression_initialize(kv_store, &compression) == BLIMP_PLUGIN_RESULT_OK);
+        std::vector<char> ret = compressAll(compression, data, 1 << 20);
+        CHECK(decompressAll(compression, ret, 1 << 20) == data);
+        blimp_plugin_compression_shutdown(&compression);
+        return ret;
+    };
+
+    SECTION("Compression Level")
+    {
+        BlimpKeyValueStoreState kv_fast;
+        kv_fast.storage["compression_level"] = "1";
+        BlimpKeyValueStoreState kv_strong;
+        kv_strong.storage["compression_level"] = "19";
+        CHECK(compress(kv_strong, text).size() < compress(kv_fast, text).size());
+    }
+
+    SECTION("Multithreading")
+    {
+        // output of the multithreaded compressor does not depend on the number of workers
+        BlimpKeyValueStoreState kv_two;
+        kv_two.storage["compression_threads"] = "2";
+        BlimpKeyValueStoreState kv_four;
+        kv_four.storage["compression_threads"] = "4";
+        CHECK(compress(kv_two, text) == compress(kv_four, text));
+    }
+
+    SECTION("Long Distance Matching")
+    {
+        // a repetition too far apart for the default window
+        std::vector<char> const noise = generateNoise(8 << 20);
+        std::vector<char> data = noise;
+        data.insert(data.end(), noise.begin(), noise.end());
+        BlimpKeyValueStoreState kv_default;
+        BlimpKeyValueStoreState kv_long;
+        kv_long.storage["compression_long_distance"] = "1";
+        CHECK(compress(kv_default, data).size() > (data.size() * 9) / 10);
+        CHECK(compress(kv_long, data).size() < (data.size() * 6) / 10);
+    }
+
+    SECTION("Invalid Configuration")
+    {
+        BlimpPluginCompression compression;
+        compression.abi = BLIMP_PLUGIN_ABI_1_0_0;
+        BlimpKeyValueStoreState kv_store;
+        kv_store.storage["compression_level"] = "fast";
+        CHECK(blimp_plugin_compression_initialize(kv_store, &compression) == BLIMP_PLUGIN_RESULT_FAILED);
+        kv_store.storage["compression_level"] = "3";
+        kv_store.storage["compression_threads"] = "-1";
+        CHECK(blimp_plugin_compression_initialize(kv_store, &compression) == BLIMP_PLUGIN_RESULT_FAILED);
+    }
+}
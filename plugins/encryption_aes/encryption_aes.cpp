@@ -4,6 +4,7 @@
 
 #include <aes.h>
 #include <filters.h>
+#include <gcm.h>
 #include <hex.h>
 #include <modes.h>
 #include <osrng.h>
@@ -12,8 +13,17 @@
 
 #include <algorithm>
 #include <array>
+#include <charconv>
+#include <condition_variable>
+#include <cstdint>
 #include <deque>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <optional>
 #include <stdexcept>
+#include <string_view>
+#include <thread>
 #include <vector>
 
 namespace {
@@ -24,6 +34,41 @@ struct ErrorStrings {
     static constexpr char const corrupted_database_container_key[] = "Container key entry in database is corrupted";
     static constexpr char const corrupted_database_container_iv[] = "Container initialization vector entry in database is corrupted";
     static constexpr char const master_key_error[] = "Error reconstructing master key";
+    static constexpr char const corrupted_database_container_mode[] = "Container mode entry in database is corrupted";
+    static constexpr char const corrupted_segment[] = "Encrypted segment is corrupted";
+    static constexpr char const no_mark[] = "Encryption was not marked in the current container";
+    static constexpr char const mark_within_stream[] = "Encryption can only be marked between two streams";
+};
+
+/// Upper limit for the number of unused output buffers kept for reuse
+constexpr std::size_t g_maxFreeBuffers = 8;
+
+/// Mode used for newly created containers, either "cbc" or "gcm"; "gcm" if not set
+constexpr char const g_kvKeyMode[] = "encryption_mode";
+/// Number of threads processing segments in GCM mode; 0 processes them on the calling thread. If not set, one per
+/// hardware thread up to g_maxDefaultThreads, or 0 on machines with a single hardware thread.
+constexpr char const g_kvKeyThreads[] = "encryption_threads";
+constexpr std::size_t g_maxDefaultThreads = 4;
+
+/** In GCM mode, the data of a container is split into independently encrypted segments.
+ * Each segment consists of a header, the encrypted data and the authentication tag. All segments hold
+ * g_segmentSize bytes of data, except for the final segment of a stream, which may be shorter.
+ * The header is authenticated as additional data and its first 12 bytes are the segment's GCM nonce:
+ *  - 8 bytes random stream nonce, chosen anew for every stream
+ *  - 4 bytes big-endian segment index within the stream
+ *  - 1 byte flags
+ *  - 3 bytes reserved, always zero
+ */
+constexpr std::size_t g_segmentSize = (1 << 20);
+constexpr std::size_t g_segmentHeaderSize = 16;
+constexpr std::size_t g_segmentNonceSize = 12;
+constexpr std::size_t g_segmentTagSize = 16;
+constexpr std::size_t g_segmentOverhead = g_segmentHeaderSize + g_segmentTagSize;
+constexpr CryptoPP::byte g_segmentFlagFinal = 0x01;
+
+enum class ContainerMode {
+    Cbc,
+    Gcm
 };
 
 std::string to_string(CryptoPP::byte const* data, std::size_t size)
@@ -52,6 +97,229 @@ void null_memory(std::array<T, N>& arr)
     T volatile* p = &arr.front();
     std::fill(p, p + N, 0);
 }
+
+struct SegmentKey {
+    std::array<CryptoPP::byte, CryptoPP::AES::MAX_KEYLENGTH> key;
+
+    SegmentKey()
+        :key{ 0 }
+    {}
+
+    ~SegmentKey()
+    {
+        null_memory(key);
+    }
+
+    SegmentKey(SegmentKey const&) = delete;
+    SegmentKey& operator=(SegmentKey const&) = delete;
+};
+
+/** Processed output, either owned by the plugin or lent from the host's buffer pool.
+ */
+struct OutputBuffer {
+    std::vector<CryptoPP::byte> b;
+    LentBuffer lent;
+    std::size_t lent_size;
+
+    OutputBuffer()
+        :lent_size(0)
+    {}
+
+    OutputBuffer(std::vector<CryptoPP::byte>&& owned)
+        :b(std::move(owned)), lent_size(0)
+    {}
+
+    OutputBuffer(LentBuffer&& l, std::size_t size)
+        :lent(std::move(l)), lent_size(size)
+    {}
+
+    CryptoPP::byte* data() {
+        return lent.isValid() ? reinterpret_cast<CryptoPP::byte*>(lent.data()) : b.data();
+    }
+
+    std::size_t size() const {
+        return lent.isValid() ? lent_size : b.size();
+    }
+};
+
+/** Encrypts and decrypts segments in GCM mode.
+ * With worker threads, up to twice as many segments as there are threads are processed concurrently.
+ * Results are handed out in submission order. Without worker threads, segments are processed on submission.
+ */
+class SegmentProcessor {
+public:
+    struct Job {
+        std::shared_ptr<SegmentKey const> key;
+        bool encrypt;
+        /// header, data and tag; when encrypting, the data is encrypted in place
+        std::vector<CryptoPP::byte> segment;
+        /// receives the decrypted data
+        std::vector<CryptoPP::byte> output;
+        bool failed;
+        bool done;
+    };
+private:
+    struct Context {
+        CryptoPP::GCM<CryptoPP::AES>::Encryption encryption;
+        CryptoPP::GCM<CryptoPP::AES>::Decryption decryption;
+    };
+
+    std::mutex m_mtx;
+    std::condition_variable m_cvWork;
+    std::condition_variable m_cvDone;
+    std::deque<Job*> m_queue;
+    bool m_shutdown;
+    std::vector<std::thread> m_threads;
+
+    std::deque<std::unique_ptr<Job>> m_inFlight;    ///< jobs in submission order
+    std::size_t m_maxInFlight;
+    bool m_failed;
+    Context m_inlineContext;
+public:
+    explicit SegmentProcessor(std::size_t n_threads);
+    ~SegmentProcessor();
+
+    SegmentProcessor(SegmentProcessor const&) = delete;
+    SegmentProcessor& operator=(SegmentProcessor const&) = delete;
+
+    /** Submits a segment for processing.
+     * Blocks until the oldest segment has been processed if the maximum number of segments is in flight.
+     * @return false if any segment collected since the last call to clearFailure() failed.
+     */
+    bool submit(std::unique_ptr<Job> job, std::deque<OutputBuffer>& out,
+                std::vector<std::vector<CryptoPP::byte>>& free_buffers);
+
+    /** Moves the results of processed segments to out in submission order.
+     * If wait_for_all is set, blocks until all segments in flight have been processed.
+     * Otherwise stops at the first segment that is still being processed.
+     * @return false if any segment collected since the last call to clearFailure() failed.
+     */
+    bool collect(bool wait_for_all, std::deque<OutputBuffer>& out,
+                 std::vector<std::vector<CryptoPP::byte>>& free_buffers);
+
+    void clearFailure();
+private:
+    void collectOldest(std::deque<OutputBuffer>& out,
+                       std::vector<std::vector<CryptoPP::byte>>& free_buffers);
+    void work();
+    static void process(Context& context, Job& job);
+};
+
+SegmentProcessor::SegmentProcessor(std::size_t n_threads)
+    :m_shutdown(false), m_maxInFlight(2 * n_threads), m_failed(false)
+{
+    for (std::size_t i = 0; i < n_threads; ++i) {
+        m_threads.emplace_back([this]() { work(); });
+    }
+}
+
+SegmentProcessor::~SegmentProcessor()
+{
+    {
+        std::lock_guard lk(m_mtx);
+        m_shutdown = true;
+    }
+    m_cvWork.notify_all();
+    for (auto& t : m_threads) { t.join(); }
+}
+
+bool SegmentProcessor::submit(std::unique_ptr<Job> job, std::deque<OutputBuffer>& out,
+                              std::vector<std::vector<CryptoPP::byte>>& free_buffers)
+{
+    if (m_threads.empty()) {
+        process(m_inlineContext, *job);
+        job->done = true;
+    } else {
+        if (m_inFlight.size() == m_maxInFlight) { collectOldest(out, free_buffers); }
+        {
+            std::lock_guard lk(m_mtx);
+            m_queue.push_back(job.get());
+        }
+        m_cvWork.notify_one();
+    }
+    m_inFlight.emplace_back(std::move(job));
+    return collect(false, out, free_buffers);
+}
+
+bool SegmentProcessor::collect(bool wait_for_all, std::deque<OutputBuffer>& out,
+                               std::vector<std::vector<CryptoPP::byte>>& free_buffers)
+{
+    while (!m_inFlight.empty()) {
+        if (!wait_for_all) {
+            std::lock_guard lk(m_mtx);
+            if (!m_inFlight.front()->done) { break; }
+        }
+        collectOldest(out, free_buffers);
+    }
+    return !m_failed;
+}
+
+void SegmentProcessor::clearFailure()
+{
+    m_failed = false;
+}
+
+void SegmentProcessor::collectOldest(std::deque<OutputBuffer>& out,
+                                     std::vector<std::vector<CryptoPP::byte>>& free_buffers)
+{
+    Job& job = *m_inFlight.front();
+    {
+        std::unique_lock lk(m_mtx);
+        m_cvDone.wait(lk, [&job]() { return job.done; });
+    }
+    if (job.failed) {
+        m_failed = true;
+    } else {
+        if (job.encrypt) {
+            out.emplace_back(std::move(job.segment));
+        } else {
+            if (free_buffers.size() < g_maxFreeBuffers) { free_buffers.emplace_back(std::move(job.segment)); }
+            if (!job.output.empty()) { out.emplace_back(std::move(job.output)); }
+        }
+    }
+    m_inFlight.pop_front();
+}
+
+void SegmentProcessor::work()
+{
+    Context context;
+    std::unique_lock lk(m_mtx);
+    for (;;) {
+        m_cvWork.wait(lk, [this]() { return (!m_queue.empty()) || m_shutdown; });
+        if (m_queue.empty()) { break; }
+        Job* job = m_queue.front();
+        m_queue.pop_front();
+        lk.unlock();
+        process(context, *job);
+        lk.lock();
+        job->done = true;
+        m_cvDone.notify_all();
+    }
+}
+
+void SegmentProcessor::process(Context& context, Job& job)
+{
+    CryptoPP::byte* const header = job.segment.data();
+    CryptoPP::byte* const data = header + g_segmentHeaderSize;
+    std::size_t const data_size = job.segment.size() - g_segmentOverhead;
+    CryptoPP::byte* const tag = data + data_size;
+    try {
+        if (job.encrypt) {
+            context.encryption.SetKeyWithIV(job.key->key.data(), job.key->key.size(), header, g_segmentNonceSize);
+            context.encryption.EncryptAndAuthenticate(data, tag, g_segmentTagSize, header, g_segmentNonceSize,
+                                                      header, g_segmentHeaderSize, data, data_size);
+            job.failed = false;
+        } else {
+            job.output.resize(data_size);
+            context.decryption.SetKeyWithIV(job.key->key.data(), job.key->key.size(), header, g_segmentNonceSize);
+            job.failed = !context.decryption.DecryptAndVerify(job.output.data(), tag, g_segmentTagSize,
+                                                              header, g_segmentNonceSize,
+                                                              header, g_segmentHeaderSize, data, data_size);
+        }
+    } catch (CryptoPP::Exception&) {
+        job.failed = true;
+    }
+}
 }   // anonymous namespace
 
 struct BlimpPluginEncryptionState {
@@ -65,10 +333,27 @@ struct BlimpPluginEncryptionState {
     std::array<CryptoPP::byte, CryptoPP::AES::MAX_KEYLENGTH> container_key;
     CryptoPP::CBC_Mode<CryptoPP::AES>::Encryption container_encryption;
     CryptoPP::CBC_Mode<CryptoPP::AES>::Decryption container_decryption;
+    std::vector<CryptoPP::byte> container_iv;
+    /// decryption continues at a stream whose initialization vector is the next block passed in
+    bool resynchronize_pending;
+    /// in CBC mode, the block the next encrypted stream is chained to: the last block of the previous stream
+    std::array<CryptoPP::byte, CryptoPP::AES::BLOCKSIZE> chain_block;
+    /// chain_block at the most recent mark_encryption in the current container
+    std::optional<std::array<CryptoPP::byte, CryptoPP::AES::BLOCKSIZE>> marked_chain_block;
     std::vector<CryptoPP::byte> in_buffer;
-    std::deque<std::vector<CryptoPP::byte>> out_available;
+    std::deque<OutputBuffer> out_available;
     std::vector<std::vector<CryptoPP::byte>> out_free;
-    std::vector<CryptoPP::byte> busy_buffer;
+    OutputBuffer busy_buffer;
+    BufferPool buffer_pool;
+    ContainerMode configured_mode;
+    ContainerMode container_mode;
+    std::shared_ptr<SegmentKey> segment_key;
+    SegmentProcessor segment_processor;
+    /// the segment currently being filled; when encrypting, space for the header is reserved at the front
+    std::vector<CryptoPP::byte> segment_buffer;
+    bool stream_started;
+    std::array<CryptoPP::byte, 8> stream_nonce;
+    std::uint32_t segment_index;
 
     BlimpPluginEncryptionState(BlimpKeyValueStore const& n_kv_store);
     ~BlimpPluginEncryptionState();
@@ -83,8 +368,24 @@ struct BlimpPluginEncryptionState {
     BlimpPluginResult encrypt_file_chunk(BlimpFileChunk const& file_chunk);
     BlimpPluginResult decrypt_file_chunk(BlimpFileChunk const& file_chunk);
     BlimpFileChunk get_processed_chunk();
+    void set_buffer_pool(BlimpBufferPool pool);
+    BlimpLentChunk take_processed_chunk();
+    BlimpPluginResult seek_decryption(int64_t offset, int64_t* out_read_offset);
+    BlimpPluginResult mark_encryption();
+    BlimpPluginResult rewind_encryption();
 
     std::vector<CryptoPP::byte> getFreeBuffer(std::size_t s);
+    OutputBuffer getOutputBuffer(std::size_t s);
+    void recycleBuffer(std::vector<CryptoPP::byte>&& b);
+    template<typename Cipher>
+    void processBlocks(Cipher& cipher, BlimpFileChunk const& file_chunk);
+
+    BlimpPluginResult encrypt_segments(BlimpFileChunk const& file_chunk);
+    BlimpPluginResult decrypt_segments(BlimpFileChunk const& file_chunk);
+    bool submitEncryptionSegment(bool is_final);
+    bool submitDecryptionSegment();
+    bool submitSegment(bool encrypt);
+    void resetSegmentStream();
 };
 
 BlimpPluginInfo blimp_plugin_api_info()
@@ -135,9 +436,37 @@ BlimpFileChunk blimp_plugin_get_processed_chunk(BlimpPluginEncryptionStateHandle
     return state->get_processed_chunk();
 }
 
+void blimp_plugin_set_buffer_pool(BlimpPluginEncryptionStateHandle state, BlimpBufferPool pool)
+{
+    state->set_buffer_pool(pool);
+}
+
+BlimpLentChunk blimp_plugin_take_processed_chunk(BlimpPluginEncryptionStateHandle state)
+{
+    return state->take_processed_chunk();
+}
+
+BlimpPluginResult blimp_plugin_seek_decryption(BlimpPluginEncryptionStateHandle state, int64_t offset,
+                                               int64_t* out_read_offset)
+{
+    return state->seek_decryption(offset, out_read_offset);
+}
+
+BlimpPluginResult blimp_plugin_mark_encryption(BlimpPluginEncryptionStateHandle state)
+{
+    return state->mark_encryption();
+}
+
+BlimpPluginResult blimp_plugin_rewind_encryption(BlimpPluginEncryptionStateHandle state)
+{
+    return state->rewind_encryption();
+}
+
 BlimpPluginResult blimp_plugin_encryption_initialize(BlimpKeyValueStore kv_store, BlimpPluginEncryption* plugin)
 {
-    if (plugin->abi != BLIMP_PLUGIN_ABI_1_0_0) {
+    if ((plugin->abi != BLIMP_PLUGIN_ABI_1_0_0) && (plugin->abi != BLIMP_PLUGIN_ABI_1_1_0) &&
+        (plugin->abi != BLIMP_PLUGIN_ABI_1_2_0) && (plugin->abi != BLIMP_PLUGIN_ABI_1_3_0))
+    {
         return BLIMP_PLUGIN_RESULT_INVALID_ARGUMENT;
     }
     try {
@@ -152,6 +481,17 @@ BlimpPluginResult blimp_plugin_encryption_initialize(BlimpKeyValueStore kv_store
     plugin->encrypt_file_chunk = blimp_plugin_encrypt_file_chunk;
     plugin->decrypt_file_chunk = blimp_plugin_decrypt_file_chunk;
     plugin->get_processed_chunk = blimp_plugin_get_processed_chunk;
+    if (plugin->abi != BLIMP_PLUGIN_ABI_1_0_0) {
+        plugin->set_buffer_pool = blimp_plugin_set_buffer_pool;
+        plugin->take_processed_chunk = blimp_plugin_take_processed_chunk;
+    }
+    if ((plugin->abi == BLIMP_PLUGIN_ABI_1_2_0) || (plugin->abi == BLIMP_PLUGIN_ABI_1_3_0)) {
+        plugin->seek_decryption = blimp_plugin_seek_decryption;
+    }
+    if (plugin->abi == BLIMP_PLUGIN_ABI_1_3_0) {
+        plugin->mark_encryption = blimp_plugin_mark_encryption;
+        plugin->rewind_encryption = blimp_plugin_rewind_encryption;
+    }
     return BLIMP_PLUGIN_RESULT_OK;
 }
 
@@ -160,8 +500,37 @@ void blimp_plugin_encryption_shutdown(BlimpPluginEncryption* plugin)
     delete plugin->state;
 }
 
+namespace {
+ContainerMode retrieveConfiguredMode(KeyValueStore& kv_store)
+{
+    BlimpKeyValueStoreValue const v = kv_store.retrieve(g_kvKeyMode);
+    if (v.data == nullptr) { return ContainerMode::Gcm; }
+    std::string_view const mode(v.data, static_cast<std::size_t>(v.size));
+    if (mode == "cbc") { return ContainerMode::Cbc; }
+    if (mode == "gcm") { return ContainerMode::Gcm; }
+    throw std::exception();
+}
+
+std::size_t retrieveThreadCount(KeyValueStore& kv_store)
+{
+    BlimpKeyValueStoreValue const v = kv_store.retrieve(g_kvKeyThreads);
+    if (v.data == nullptr) {
+        std::size_t const n_threads = std::min<std::size_t>(std::thread::hardware_concurrency(), g_maxDefaultThreads);
+        return (n_threads > 1) ? n_threads : 0;
+    }
+    std::size_t ret = 0;
+    auto const [ptr, ec] = std::from_chars(v.data, v.data + v.size, ret);
+    if ((ec != std::errc{}) || (ptr != v.data + v.size)) {
+        throw std::exception();
+    }
+    return ret;
+}
+}
+
 BlimpPluginEncryptionState::BlimpPluginEncryptionState(BlimpKeyValueStore const& n_kv_store)
-    :kv_store(n_kv_store), master_key{ 0 }, container_key{ 0 }
+    :kv_store(n_kv_store), master_key{ 0 }, container_key{ 0 }, resynchronize_pending(false), chain_block{ 0 },
+     configured_mode(retrieveConfiguredMode(kv_store)), container_mode(ContainerMode::Cbc),
+     segment_processor(retrieveThreadCount(kv_store)), stream_started(false), stream_nonce{ 0 }, segment_index(0)
 {
     error_string = ErrorStrings::okay;
     in_buffer.reserve(CryptoPP::AES::BLOCKSIZE);
@@ -210,9 +579,20 @@ BlimpPluginResult BlimpPluginEncryptionState::set_password(BlimpPluginEncryption
 
 BlimpPluginResult BlimpPluginEncryptionState::new_storage_container(int64_t container_id)
 {
+    bool const segments_ok = segment_processor.collect(true, out_available, out_free);
+    resetSegmentStream();
+    if (!segments_ok) {
+        error_string = ErrorStrings::corrupted_segment;
+        return BLIMP_PLUGIN_RESULT_CORRUPTED_DATA;
+    }
+
     std::string const kv_string_key = "container_key_" + std::to_string(container_id);
+    std::string const kv_string_mode = "container_mode_" + std::to_string(container_id);
     BlimpKeyValueStoreValue container_key_v = kv_store.retrieve(kv_string_key.c_str());
     if (container_key_v.data == nullptr) {
+        std::string_view const mode = (configured_mode == ContainerMode::Gcm) ? "gcm" : "cbc";
+        kv_store.store(kv_string_mode.c_str(),
+                       BlimpKeyValueStoreValue{ .data = mode.data(), .size = static_cast<int64_t>(mode.size()) });
         std::array<CryptoPP::byte, CryptoPP::AES::MAX_KEYLENGTH> new_key;
         pool.GenerateBlock(new_key.data(), new_key.size());
         std::array<CryptoPP::byte, CryptoPP::AES::MAX_KEYLENGTH> encrypted_key;
@@ -245,10 +625,29 @@ BlimpPluginResult BlimpPluginEncryptionState::new_storage_container(int64_t cont
         return BLIMP_PLUGIN_RESULT_CORRUPTED_DATA;
     }
 
+    // containers created before the mode was recorded are always in CBC mode
+    BlimpKeyValueStoreValue const container_mode_v = kv_store.retrieve(kv_string_mode.c_str());
+    if ((container_mode_v.data == nullptr) ||
+        (std::string_view(container_mode_v.data, static_cast<std::size_t>(container_mode_v.size)) == "cbc"))
+    {
+        container_mode = ContainerMode::Cbc;
+    } else if (std::string_view(container_mode_v.data, static_cast<std::size_t>(container_mode_v.size)) == "gcm") {
+        container_mode = ContainerMode::Gcm;
+    } else {
+        error_string = ErrorStrings::corrupted_database_container_mode;
+        return BLIMP_PLUGIN_RESULT_CORRUPTED_DATA;
+    }
+
     auto const encrypted_key = from_string(container_key_v.data, container_key_v.size);
     master_decryption.ProcessData(container_key.data(), encrypted_key.data(), encrypted_key.size());
+    // worker threads only ever see the key through the segments they process
+    segment_key = std::make_shared<SegmentKey>();
+    std::copy(container_key.begin(), container_key.end(), segment_key->key.begin());
 
-    auto const container_iv = from_string(container_iv_v.data, container_iv_v.size);
+    container_iv = from_string(container_iv_v.data, container_iv_v.size);
+    resynchronize_pending = false;
+    std::copy(container_iv.begin(), container_iv.end(), chain_block.begin());
+    marked_chain_block.reset();
     container_encryption.SetKeyWithIV(container_key.data(), container_key.size(), container_iv.data());
     container_decryption.SetKeyWithIV(container_key.data(), container_key.size(), container_iv.data());
 
@@ -257,25 +656,20 @@ BlimpPluginResult BlimpPluginEncryptionState::new_storage_container(int64_t cont
 
 BlimpPluginResult BlimpPluginEncryptionState::encrypt_file_chunk(BlimpFileChunk const& file_chunk)
 {
-    std::vector<CryptoPP::byte> enc_buffer = getFreeBuffer(in_buffer.size() + file_chunk.size);
-    auto const it_buffer = std::copy(in_buffer.begin(), in_buffer.end(), enc_buffer.begin());
+    if (container_mode == ContainerMode::Gcm) { return encrypt_segments(file_chunk); }
+    if ((file_chunk.data == nullptr) && (file_chunk.size != 0)) { return BLIMP_PLUGIN_RESULT_INVALID_ARGUMENT; }
     if (file_chunk.data != nullptr) {
-        std::copy(file_chunk.data, file_chunk.data + file_chunk.size, it_buffer);
-        std::size_t const overflow = std::min((enc_buffer.size() % CryptoPP::AES::BLOCKSIZE) + CryptoPP::AES::BLOCKSIZE, enc_buffer.size());
-        in_buffer.assign(enc_buffer.begin() + (enc_buffer.size() - overflow), enc_buffer.end());
-        enc_buffer.resize(enc_buffer.size() - overflow);
+        processBlocks(container_encryption, file_chunk);
     } else {
-        if (enc_buffer.size() != in_buffer.size()) { return BLIMP_PLUGIN_RESULT_INVALID_ARGUMENT; }
+        std::size_t const padding = CryptoPP::AES::BLOCKSIZE - (in_buffer.size() % CryptoPP::AES::BLOCKSIZE);
+        in_buffer.resize(in_buffer.size() + padding);
+        pool.GenerateBlock(in_buffer.data() + (in_buffer.size() - padding), padding);
+        in_buffer.back() &= 0xF0;
+        in_buffer.back() |= static_cast<char>(padding - 1);
+        std::vector<CryptoPP::byte> enc_buffer = getFreeBuffer(in_buffer.size());
+        container_encryption.ProcessData(enc_buffer.data(), in_buffer.data(), in_buffer.size());
         in_buffer.clear();
-        std::size_t const padding = CryptoPP::AES::BLOCKSIZE - (enc_buffer.size() % CryptoPP::AES::BLOCKSIZE);
-        enc_buffer.resize(enc_buffer.size() + padding);
-        pool.GenerateBlock(enc_buffer.data() + (enc_buffer.size() - padding), padding);
-        enc_buffer.back() &= 0xF0;
-        enc_buffer.back() |= static_cast<char>(padding - 1);
-    }
-
-    if (!enc_buffer.empty()) {
-        container_encryption.ProcessData(enc_buffer.data(), enc_buffer.data(), enc_buffer.size());
+        std::copy(enc_buffer.end() - CryptoPP::AES::BLOCKSIZE, enc_buffer.end(), chain_block.begin());
         out_available.emplace_back(std::move(enc_buffer));
     }
     return BLIMP_PLUGIN_RESULT_OK;
@@ -283,28 +677,39 @@ BlimpPluginResult BlimpPluginEncryptionState::encrypt_file_chunk(BlimpFileChunk
 
 BlimpPluginResult BlimpPluginEncryptionState::decrypt_file_chunk(BlimpFileChunk const& file_chunk)
 {
-    std::vector<CryptoPP::byte> dec_buffer = getFreeBuffer(in_buffer.size() + file_chunk.size);
-    auto const it_buffer = std::copy(in_buffer.begin(), in_buffer.end(), dec_buffer.begin());
+    if (container_mode == ContainerMode::Gcm) { return decrypt_segments(file_chunk); }
+    if ((file_chunk.data == nullptr) && (file_chunk.size != 0)) { return BLIMP_PLUGIN_RESULT_INVALID_ARGUMENT; }
     if (file_chunk.data != nullptr) {
-        std::copy(file_chunk.data, file_chunk.data + file_chunk.size, it_buffer);
-        std::size_t const overflow = std::min((dec_buffer.size() % CryptoPP::AES::BLOCKSIZE) + CryptoPP::AES::BLOCKSIZE, dec_buffer.size());
-        in_buffer.assign(dec_buffer.begin() + (dec_buffer.size() - overflow), dec_buffer.end());
-        dec_buffer.resize(dec_buffer.size() - overflow);
-        if (!dec_buffer.empty()) {
-            container_decryption.ProcessData(dec_buffer.data(), dec_buffer.data(), dec_buffer.size());
-            out_available.emplace_back(std::move(dec_buffer));
+        BlimpFileChunk chunk = file_chunk;
+        if (resynchronize_pending) {
+            std::size_t const n_bytes = std::min(CryptoPP::AES::BLOCKSIZE - in_buffer.size(),
+                                                 static_cast<std::size_t>(chunk.size));
+            in_buffer.insert(in_buffer.end(), reinterpret_cast<CryptoPP::byte const*>(chunk.data),
+                             reinterpret_cast<CryptoPP::byte const*>(chunk.data) + n_bytes);
+            chunk.data += n_bytes;
+            chunk.size -= static_cast<int64_t>(n_bytes);
+            if (in_buffer.size() < CryptoPP::AES::BLOCKSIZE) { return BLIMP_PLUGIN_RESULT_OK; }
+            container_decryption.Resynchronize(in_buffer.data(), static_cast<int>(in_buffer.size()));
+            in_buffer.clear();
+            resynchronize_pending = false;
+            if (chunk.size == 0) { return BLIMP_PLUGIN_RESULT_OK; }
         }
+        processBlocks(container_decryption, chunk);
     } else {
-        if (dec_buffer.size() != in_buffer.size()) { return BLIMP_PLUGIN_RESULT_INVALID_ARGUMENT; }
-        in_buffer.clear();
-        if ((dec_buffer.size() < CryptoPP::AES::BLOCKSIZE) || (dec_buffer.size() % CryptoPP::AES::BLOCKSIZE != 0)) {
+        resynchronize_pending = false;
+        if ((in_buffer.size() < CryptoPP::AES::BLOCKSIZE) || (in_buffer.size() % CryptoPP::AES::BLOCKSIZE != 0)) {
+            in_buffer.clear();
             return BLIMP_PLUGIN_RESULT_FAILED;
         }
-        container_decryption.ProcessData(dec_buffer.data(), dec_buffer.data(), dec_buffer.size());
+        std::vector<CryptoPP::byte> dec_buffer = getFreeBuffer(in_buffer.size());
+        container_decryption.ProcessData(dec_buffer.data(), in_buffer.data(), in_buffer.size());
+        in_buffer.clear();
         std::size_t const padding = static_cast<std::size_t>(dec_buffer.back() & 0x0F) + 1;
         dec_buffer.resize(dec_buffer.size() - padding);
         if (!dec_buffer.empty()) {
             out_available.emplace_back(std::move(dec_buffer));
+        } else {
+            recycleBuffer(std::move(dec_buffer));
         }
     }
 
@@ -312,10 +717,134 @@ BlimpPluginResult BlimpPluginEncryptionState::decrypt_file_chunk(BlimpFileChunk
 
 }
 
+/** Prepares decrypting the current container from the start of the stream at offset.
+ * In CBC mode, the ciphertext block preceding the stream is the initialization vector of its first block, so the host
+ * has to pass in data starting one block early. GCM streams can be decrypted from their first segment on their own.
+ */
+BlimpPluginResult BlimpPluginEncryptionState::seek_decryption(int64_t offset, int64_t* out_read_offset)
+{
+    if ((offset < 0) || (!out_read_offset)) { return BLIMP_PLUGIN_RESULT_INVALID_ARGUMENT; }
+    in_buffer.clear();
+    resynchronize_pending = false;
+    if (container_mode == ContainerMode::Gcm) {
+        bool const segments_ok = segment_processor.collect(true, out_available, out_free);
+        resetSegmentStream();
+        if (!segments_ok) {
+            error_string = ErrorStrings::corrupted_segment;
+            return BLIMP_PLUGIN_RESULT_CORRUPTED_DATA;
+        }
+        *out_read_offset = offset;
+        return BLIMP_PLUGIN_RESULT_OK;
+    }
+    // streams are padded to full blocks
+    if (offset % CryptoPP::AES::BLOCKSIZE != 0) { return BLIMP_PLUGIN_RESULT_INVALID_ARGUMENT; }
+    if (offset == 0) {
+        container_decryption.Resynchronize(container_iv.data(), static_cast<int>(container_iv.size()));
+        *out_read_offset = 0;
+    } else {
+        resynchronize_pending = true;
+        *out_read_offset = offset - CryptoPP::AES::BLOCKSIZE;
+    }
+    return BLIMP_PLUGIN_RESULT_OK;
+}
+
+/** Records the state of the encryption between two streams, for rewind_encryption().
+ * In CBC mode, this is the block the next stream is chained to. GCM streams do not depend on each other.
+ */
+BlimpPluginResult BlimpPluginEncryptionState::mark_encryption()
+{
+    if ((!in_buffer.empty()) || (!segment_buffer.empty())) {
+        error_string = ErrorStrings::mark_within_stream;
+        return BLIMP_PLUGIN_RESULT_INVALID_ARGUMENT;
+    }
+    marked_chain_block = chain_block;
+    return BLIMP_PLUGIN_RESULT_OK;
+}
+
+/** Continues encrypting the current container from the most recent mark, as if the streams encrypted since had never
+ * been. Output of those streams that the host has not taken yet is dropped.
+ */
+BlimpPluginResult BlimpPluginEncryptionState::rewind_encryption()
+{
+    if (!marked_chain_block) {
+        error_string = ErrorStrings::no_mark;
+        return BLIMP_PLUGIN_RESULT_INVALID_ARGUMENT;
+    }
+    segment_processor.collect(true, out_available, out_free);
+    resetSegmentStream();
+    for (OutputBuffer& b : out_available) { recycleBuffer(std::move(b.b)); }
+    out_available.clear();
+    in_buffer.clear();
+    chain_block = *marked_chain_block;
+    container_encryption.Resynchronize(chain_block.data(), static_cast<int>(chain_block.size()));
+    return BLIMP_PLUGIN_RESULT_OK;
+}
+
+/** Runs all complete blocks of the carried-over bytes followed by file_chunk through cipher.
+ * The blocks are read directly from in_buffer and file_chunk and written to a single output buffer.
+ * The trailing partial block and the last complete block are carried over in in_buffer,
+ * as the last block of a stream needs to be treated differently when finalizing.
+ */
+template<typename Cipher>
+void BlimpPluginEncryptionState::processBlocks(Cipher& cipher, BlimpFileChunk const& file_chunk)
+{
+    std::size_t const block_size = CryptoPP::AES::BLOCKSIZE;
+    CryptoPP::byte const* const chunk_data = reinterpret_cast<CryptoPP::byte const*>(file_chunk.data);
+    std::size_t const chunk_size = static_cast<std::size_t>(file_chunk.size);
+    std::size_t const total_size = in_buffer.size() + chunk_size;
+    std::size_t const carry_size = std::min((total_size % block_size) + block_size, total_size);
+    std::size_t const process_size = total_size - carry_size;
+    if (process_size == 0) {
+        in_buffer.insert(in_buffer.end(), chunk_data, chunk_data + chunk_size);
+        return;
+    }
+
+    OutputBuffer out_buffer = getOutputBuffer(process_size);
+    CryptoPP::byte* out = out_buffer.data();
+    std::size_t chunk_used = 0;
+    // complete blocks from the carried-over bytes
+    std::size_t const carried_blocks_size = std::min((in_buffer.size() / block_size) * block_size, process_size);
+    if (carried_blocks_size > 0) {
+        cipher.ProcessData(out, in_buffer.data(), carried_blocks_size);
+        out += carried_blocks_size;
+    }
+    std::size_t carry_remaining = in_buffer.size() - carried_blocks_size;
+    if ((carried_blocks_size < process_size) && (carry_remaining > 0)) {
+        // the block straddling the carried-over bytes and the new chunk
+        std::array<CryptoPP::byte, block_size> block;
+        auto const it = std::copy(in_buffer.begin() + carried_blocks_size, in_buffer.end(), block.begin());
+        chunk_used = block_size - carry_remaining;
+        std::copy(chunk_data, chunk_data + chunk_used, it);
+        cipher.ProcessData(out, block.data(), block_size);
+        out += block_size;
+        carry_remaining = 0;
+    }
+    // complete blocks from the new chunk
+    std::size_t const direct_size = static_cast<std::size_t>(out_buffer.data() + process_size - out);
+    if (direct_size > 0) {
+        cipher.ProcessData(out, chunk_data + chunk_used, direct_size);
+        chunk_used += direct_size;
+    }
+
+    if (carry_remaining > 0) {
+        in_buffer.erase(in_buffer.begin(), in_buffer.begin() + carried_blocks_size);
+        in_buffer.insert(in_buffer.end(), chunk_data, chunk_data + chunk_size);
+    } else {
+        in_buffer.assign(chunk_data + chunk_used, chunk_data + chunk_size);
+    }
+    out_available.emplace_back(std::move(out_buffer));
+}
+
 BlimpFileChunk BlimpPluginEncryptionState::get_processed_chunk()
 {
     BlimpFileChunk ret{};
+    if (out_available.empty()) {
+        // failed segments are reported by the next call to encrypt or decrypt
+        segment_processor.collect(false, out_available, out_free);
+    }
     if (!out_available.empty()) {
+        // lent buffers go back to the host's pool when overwritten
+        recycleBuffer(std::move(busy_buffer.b));
         busy_buffer = std::move(out_available.front());
         out_available.pop_front();
         ret.data = reinterpret_cast<char const*>(busy_buffer.data());
@@ -324,6 +853,46 @@ BlimpFileChunk BlimpPluginEncryptionState::get_processed_chunk()
     return ret;
 }
 
+void BlimpPluginEncryptionState::set_buffer_pool(BlimpBufferPool pool)
+{
+    buffer_pool.set(pool);
+}
+
+BlimpLentChunk BlimpPluginEncryptionState::take_processed_chunk()
+{
+    if (out_available.empty()) {
+        segment_processor.collect(false, out_available, out_free);
+    }
+    if (out_available.empty() || !out_available.front().lent.isValid()) {
+        // buffers owned by the plugin are handed out as with get_processed_chunk
+        BlimpFileChunk const chunk = get_processed_chunk();
+        return BlimpLentChunk{ .data = chunk.data, .size = chunk.size, .token = 0 };
+    }
+    OutputBuffer& buffer = out_available.front();
+    BlimpLentChunk ret;
+    ret.data = reinterpret_cast<char const*>(buffer.data());
+    ret.size = static_cast<int64_t>(buffer.size());
+    ret.token = buffer.lent.passOwnership();
+    out_available.pop_front();
+    return ret;
+}
+
+void BlimpPluginEncryptionState::recycleBuffer(std::vector<CryptoPP::byte>&& b)
+{
+    if ((b.capacity() > 0) && (out_free.size() < g_maxFreeBuffers)) {
+        out_free.emplace_back(std::move(b));
+    }
+}
+
+OutputBuffer BlimpPluginEncryptionState::getOutputBuffer(std::size_t s)
+{
+    LentBuffer lent = buffer_pool.acquire();
+    if (lent.isValid() && (static_cast<std::size_t>(lent.capacity()) >= s)) {
+        return OutputBuffer(std::move(lent), s);
+    }
+    return OutputBuffer(getFreeBuffer(s));
+}
+
 std::vector<CryptoPP::byte> BlimpPluginEncryptionState::getFreeBuffer(std::size_t s)
 {
     if (out_free.empty()) {
@@ -335,3 +904,151 @@ std::vector<CryptoPP::byte> BlimpPluginEncryptionState::getFreeBuffer(std::size_
         return ret;
     }
 }
+
+BlimpPluginResult BlimpPluginEncryptionState::encrypt_segments(BlimpFileChunk const& file_chunk)
+{
+    if (file_chunk.data != nullptr) {
+        char const* src = file_chunk.data;
+        std::size_t remaining = static_cast<std::size_t>(file_chunk.size);
+        while (remaining > 0) {
+            if (segment_buffer.empty()) {
+                segment_buffer = getFreeBuffer(g_segmentHeaderSize);
+                segment_buffer.reserve(g_segmentSize + g_segmentOverhead);
+            } else if (segment_buffer.size() == g_segmentHeaderSize + g_segmentSize) {
+                // only now it is known that the full segment is not the final one
+                if (!submitEncryptionSegment(false)) {
+                    error_string = ErrorStrings::encryption_error;
+                    return BLIMP_PLUGIN_RESULT_FAILED;
+                }
+                continue;
+            }
+            std::size_t const n_bytes = std::min(remaining, g_segmentHeaderSize + g_segmentSize - segment_buffer.size());
+            segment_buffer.insert(segment_buffer.end(), reinterpret_cast<CryptoPP::byte const*>(src),
+                                  reinterpret_cast<CryptoPP::byte const*>(src) + n_bytes);
+            src += n_bytes;
+            remaining -= n_bytes;
+        }
+    } else {
+        if (segment_buffer.empty()) { segment_buffer = getFreeBuffer(g_segmentHeaderSize); }
+        bool const success = submitEncryptionSegment(true) &&
+                             segment_processor.collect(true, out_available, out_free);
+        resetSegmentStream();
+        if (!success) {
+            error_string = ErrorStrings::encryption_error;
+            return BLIMP_PLUGIN_RESULT_FAILED;
+        }
+    }
+    return BLIMP_PLUGIN_RESULT_OK;
+}
+
+BlimpPluginResult BlimpPluginEncryptionState::decrypt_segments(BlimpFileChunk const& file_chunk)
+{
+    auto const is_final = [this]() { return (segment_buffer[12] & g_segmentFlagFinal) != 0; };
+    if (file_chunk.data != nullptr) {
+        CryptoPP::byte const* src = reinterpret_cast<CryptoPP::byte const*>(file_chunk.data);
+        std::size_t remaining = static_cast<std::size_t>(file_chunk.size);
+        while (remaining > 0) {
+            std::size_t n_bytes = remaining;
+            if (segment_buffer.size() < g_segmentHeaderSize) {
+                n_bytes = std::min(remaining, g_segmentHeaderSize - segment_buffer.size());
+            } else if (!is_final()) {
+                n_bytes = std::min(remaining, g_segmentSize + g_segmentOverhead - segment_buffer.size());
+            }
+            segment_buffer.insert(segment_buffer.end(), src, src + n_bytes);
+            src += n_bytes;
+            remaining -= n_bytes;
+            if (segment_buffer.size() > g_segmentSize + g_segmentOverhead) {
+                // the final segment is no larger than any other segment
+                resetSegmentStream();
+                error_string = ErrorStrings::corrupted_segment;
+                return BLIMP_PLUGIN_RESULT_CORRUPTED_DATA;
+            }
+            if ((segment_buffer.size() == g_segmentSize + g_segmentOverhead) && (!is_final())) {
+                if (!submitDecryptionSegment()) {
+                    resetSegmentStream();
+                    error_string = ErrorStrings::corrupted_segment;
+                    return BLIMP_PLUGIN_RESULT_CORRUPTED_DATA;
+                }
+            }
+        }
+    } else {
+        // a stream may also end on a non-final segment when only a range of the container is decrypted
+        bool success = true;
+        if (!segment_buffer.empty()) {
+            success = (segment_buffer.size() >= g_segmentOverhead) && is_final() && submitDecryptionSegment();
+        }
+        success = segment_processor.collect(true, out_available, out_free) && success;
+        resetSegmentStream();
+        if (!success) {
+            error_string = ErrorStrings::corrupted_segment;
+            return BLIMP_PLUGIN_RESULT_CORRUPTED_DATA;
+        }
+    }
+    return BLIMP_PLUGIN_RESULT_OK;
+}
+
+/** Fills in the header of the segment buffer and hands it to the segment processor.
+ */
+bool BlimpPluginEncryptionState::submitEncryptionSegment(bool is_final)
+{
+    if (!stream_started) {
+        iv_pool.GenerateBlock(stream_nonce.data(), stream_nonce.size());
+        stream_started = true;
+    }
+    CryptoPP::byte* const header = segment_buffer.data();
+    std::copy(stream_nonce.begin(), stream_nonce.end(), header);
+    header[8] = static_cast<CryptoPP::byte>(segment_index >> 24);
+    header[9] = static_cast<CryptoPP::byte>(segment_index >> 16);
+    header[10] = static_cast<CryptoPP::byte>(segment_index >> 8);
+    header[11] = static_cast<CryptoPP::byte>(segment_index);
+    header[12] = is_final ? g_segmentFlagFinal : 0;
+    std::fill(header + 13, header + g_segmentHeaderSize, CryptoPP::byte{ 0 });
+    segment_buffer.resize(segment_buffer.size() + g_segmentTagSize);
+    return submitSegment(true);
+}
+
+/** Checks that the header of the segment buffer continues the stream and hands it to the segment processor.
+ * Decryption may start at any segment of a stream.
+ */
+bool BlimpPluginEncryptionState::submitDecryptionSegment()
+{
+    CryptoPP::byte const* const header = segment_buffer.data();
+    std::uint32_t const index = (static_cast<std::uint32_t>(header[8]) << 24) |
+                                (static_cast<std::uint32_t>(header[9]) << 16) |
+                                (static_cast<std::uint32_t>(header[10]) << 8) |
+                                static_cast<std::uint32_t>(header[11]);
+    if (!stream_started) {
+        std::copy(header, header + stream_nonce.size(), stream_nonce.begin());
+        segment_index = index;
+        stream_started = true;
+    } else if ((!std::equal(stream_nonce.begin(), stream_nonce.end(), header)) || (index != segment_index)) {
+        return false;
+    }
+    return submitSegment(false);
+}
+
+bool BlimpPluginEncryptionState::submitSegment(bool encrypt)
+{
+    // segment indices must never repeat within a stream
+    if (segment_index == std::numeric_limits<std::uint32_t>::max()) { return false; }
+    ++segment_index;
+    auto job = std::make_unique<SegmentProcessor::Job>(SegmentProcessor::Job{
+        .key = segment_key,
+        .encrypt = encrypt,
+        .segment = std::move(segment_buffer),
+        .output = encrypt ? std::vector<CryptoPP::byte>{} : getFreeBuffer(0),
+        .failed = false,
+        .done = false });
+    segment_buffer = std::vector<CryptoPP::byte>{};
+    return segment_processor.submit(std::move(job), out_available, out_free);
+}
+
+void BlimpPluginEncryptionState::resetSegmentStream()
+{
+    recycleBuffer(std::move(segment_buffer));
+    segment_buffer = std::vector<CryptoPP::byte>{};
+    stream_started = false;
+    null_memory(stream_nonce);
+    segment_index = 0;
+    segment_processor.clearFailure();
+}
@@ -1,57 +1,18 @@
 #include <encryption_aes.hpp>
 
+#include <blimp_plugin_test_helper_cpp.hpp>
+
 #include <catch.hpp>
 
 #include <algorithm>
 #include <iterator>
-#include <unordered_map>
 #include <string>
 #include <vector>
 
-struct BlimpKeyValueStoreState {
-    std::unordered_map<std::string, std::string> storage;
-    int call_count_store;
-    int call_count_retrieve;
-    std::string last_key_retrieve;
-
-    BlimpKeyValueStoreState()
-        :call_count_store(0), call_count_retrieve(0)
-    {}
-
-    void store(std::string const& key, BlimpKeyValueStoreValue const& v)
-    {
-        ++call_count_store;
-        storage.insert(std::make_pair(key, std::string(v.data, v.data + v.size)));
-    }
-
-    BlimpKeyValueStoreValue retrieve(std::string const& key)
-    {
-        ++call_count_retrieve;
-        last_key_retrieve = key;
-        auto it = storage.find(key);
-        return (it != storage.end()) ?
-            BlimpKeyValueStoreValue{ .data = it->second.data(), .size = static_cast<int64_t>(it->second.size()) } :
-            BlimpKeyValueStoreValue{ .data = nullptr, .size = -1 };
-    }
-
-    operator BlimpKeyValueStore() {
-        return BlimpKeyValueStore {
-            .state = this,
-            .store = [](BlimpKeyValueStoreStateHandle state, char const* key, BlimpKeyValueStoreValue value)
-            {
-                return state->store(key, value);
-            },
-            .retrieve = [](BlimpKeyValueStoreStateHandle state, char const* key) -> BlimpKeyValueStoreValue
-            {
-                return state->retrieve(key);
-            }
-        };
-    }
-};
-
 TEST_CASE("Plugin Encryption AES")
 {
     BlimpKeyValueStoreState stub_kv_store;
+    stub_kv_store.storage["encryption_mode"] = "cbc";
     SECTION("Plugin Info")
     {
         auto const api_info = blimp_plugin_api_info();
@@ -276,3 +237,463 @@ TEST_CASE("Plugin Encryption AES")
         blimp_plugin_encryption_shutdown(&plugin);
     }
 }
+
+namespace {
+std::vector<char> processAll(BlimpPluginEncryption& plugin, std::vector<char> const& data, std::size_t chunk_size,
+                             bool encrypt, BlimpPluginResult expected_result = BLIMP_PLUGIN_RESULT_OK)
+{
+    auto const process = encrypt ? plugin.encrypt_file_chunk : plugin.decrypt_file_chunk;
+    std::vector<char> ret;
+    auto const drain = [&]() {
+        for (BlimpFileChunk c = plugin.get_processed_chunk(plugin.state); c.data;
+             c = plugin.get_processed_chunk(plugin.state))
+        {
+            ret.insert(ret.end(), c.data, c.data + c.size);
+        }
+    };
+    BlimpPluginResult res = BLIMP_PLUGIN_RESULT_OK;
+    for (std::size_t offset = 0; (offset < data.size()) && (res == BLIMP_PLUGIN_RESULT_OK); offset += chunk_size) {
+        std::size_t const n = std::min(chunk_size, data.size() - offset);
+        res = process(plugin.state, BlimpFileChunk{ .data = data.data() + offset, .size = static_cast<int64_t>(n) });
+        drain();
+    }
+    if (res == BLIMP_PLUGIN_RESULT_OK) {
+        res = process(plugin.state, BlimpFileChunk{ .data = nullptr, .size = 0 });
+        drain();
+    }
+    CHECK(res == expected_result);
+    return ret;
+}
+}
+
+TEST_CASE("Plugin Encryption AES GCM")
+{
+    std::size_t const segment_size = 1 << 20;
+    std::size_t const segment_overhead = 32;
+    std::vector<char> plaintext((3 << 20) + 12345);
+    for (std::size_t i = 0; i < plaintext.size(); ++i) { plaintext[i] = static_cast<char>((i * 7919) >> 5); }
+    char const sample_password[] = "correcthorsebatterystaple";
+    BlimpPluginEncryptionPassword const blimp_password{ .data = sample_password, .size = sizeof(sample_password) };
+
+    BlimpKeyValueStoreState stub_kv_store;
+    stub_kv_store.storage["encryption_mode"] = "gcm";
+    std::string const n_threads = GENERATE(as<std::string>{}, "0", "3");
+    stub_kv_store.storage["encryption_threads"] = n_threads;
+    BlimpPluginEncryption plugin{};
+    plugin.abi = BLIMP_PLUGIN_ABI_1_0_0;
+    REQUIRE(blimp_plugin_encryption_initialize(stub_kv_store, &plugin) == BLIMP_PLUGIN_RESULT_OK);
+    REQUIRE(plugin.set_password(plugin.state, blimp_password) == BLIMP_PLUGIN_RESULT_OK);
+    REQUIRE(plugin.new_storage_container(plugin.state, 42) == BLIMP_PLUGIN_RESULT_OK);
+    CHECK(stub_kv_store.storage["container_mode_42"] == "gcm");
+
+    std::vector<char> const ciphertext = processAll(plugin, plaintext, 100000, true);
+
+    SECTION("Segment layout")
+    {
+        // four segments, each with header and tag
+        CHECK(ciphertext.size() == plaintext.size() + 4 * segment_overhead);
+        // segments are encrypted under different nonces, so same plaintext does not result in same ciphertext
+        CHECK(processAll(plugin, plaintext, plaintext.size(), true) != ciphertext);
+    }
+
+    SECTION("Round-trip")
+    {
+        CHECK(processAll(plugin, ciphertext, ciphertext.size(), false) == plaintext);
+        CHECK(processAll(plugin, ciphertext, 777, false) == plaintext);
+    }
+
+    SECTION("Empty stream")
+    {
+        std::vector<char> const empty_ciphertext = processAll(plugin, {}, 1, true);
+        CHECK(empty_ciphertext.size() == segment_overhead);
+        CHECK(processAll(plugin, empty_ciphertext, 1, false).empty());
+    }
+
+    SECTION("Decryption can start at any segment")
+    {
+        std::vector<char> const tail(ciphertext.begin() + 2 * (segment_size + segment_overhead), ciphertext.end());
+        CHECK(processAll(plugin, tail, 4096, false) ==
+              std::vector<char>(plaintext.begin() + 2 * segment_size, plaintext.end()));
+        std::vector<char> const middle(ciphertext.begin() + (segment_size + segment_overhead),
+                                       ciphertext.begin() + 2 * (segment_size + segment_overhead));
+        CHECK(processAll(plugin, middle, middle.size(), false) ==
+              std::vector<char>(plaintext.begin() + segment_size, plaintext.begin() + 2 * segment_size));
+    }
+
+    SECTION("Decryption of a reopened container")
+    {
+        BlimpPluginEncryption plugin2{};
+        plugin2.abi = BLIMP_PLUGIN_ABI_1_0_0;
+        stub_kv_store.storage["encryption_mode"] = "cbc";
+        REQUIRE(blimp_plugin_encryption_initialize(stub_kv_store, &plugin2) == BLIMP_PLUGIN_RESULT_OK);
+        REQUIRE(plugin2.set_password(plugin2.state, blimp_password) == BLIMP_PLUGIN_RESULT_OK);
+        REQUIRE(plugin2.new_storage_container(plugin2.state, 42) == BLIMP_PLUGIN_RESULT_OK);
+        CHECK(processAll(plugin2, ciphertext, 65536, false) == plaintext);
+        blimp_plugin_encryption_shutdown(&plugin2);
+    }
+
+    SECTION("Tampered data is detected")
+    {
+        std::vector<char> tampered = ciphertext;
+        tampered[segment_size + 1000] ^= 0x01;
+        processAll(plugin, tampered, tampered.size(), false, BLIMP_PLUGIN_RESULT_CORRUPTED_DATA);
+        // the plugin recovers for the next stream
+        CHECK(processAll(plugin, ciphertext, ciphertext.size(), false) == plaintext);
+    }
+
+    SECTION("Reordered segments are detected")
+    {
+        std::vector<char> reordered(ciphertext.begin() + (segment_size + segment_overhead),
+                                    ciphertext.begin() + 2 * (segment_size + segment_overhead));
+        reordered.insert(reordered.end(), ciphertext.begin(), ciphertext.begin() + (segment_size + segment_overhead));
+        processAll(plugin, reordered, reordered.size(), false, BLIMP_PLUGIN_RESULT_CORRUPTED_DATA);
+    }
+
+    SECTION("Truncated segments are detected")
+    {
+        std::vector<char> const truncated(ciphertext.begin(), ciphertext.end() - 1);
+        processAll(plugin, truncated, truncated.size(), false, BLIMP_PLUGIN_RESULT_CORRUPTED_DATA);
+        std::vector<char> const partial(ciphertext.begin(), ciphertext.begin() + segment_size);
+        processAll(plugin, partial, partial.size(), false, BLIMP_PLUGIN_RESULT_CORRUPTED_DATA);
+    }
+
+    blimp_plugin_encryption_shutdown(&plugin);
+}
+
+TEST_CASE("Plugin Encryption AES Container Mode")
+{
+    char const sample_password[] = "correcthorsebatterystaple";
+    BlimpPluginEncryptionPassword const blimp_password{ .data = sample_password, .size = sizeof(sample_password) };
+    BlimpKeyValueStoreState stub_kv_store;
+    stub_kv_store.storage["encryption_mode"] = "cbc";
+    BlimpPluginEncryption plugin{};
+    plugin.abi = BLIMP_PLUGIN_ABI_1_0_0;
+    REQUIRE(blimp_plugin_encryption_initialize(stub_kv_store, &plugin) == BLIMP_PLUGIN_RESULT_OK);
+    REQUIRE(plugin.set_password(plugin.state, blimp_password) == BLIMP_PLUGIN_RESULT_OK);
+    REQUIRE(plugin.new_storage_container(plugin.state, 1) == BLIMP_PLUGIN_RESULT_OK);
+    CHECK(stub_kv_store.storage["container_mode_1"] == "cbc");
+    std::vector<char> const plaintext(100000, 'x');
+    std::vector<char> const ciphertext = processAll(plugin, plaintext, plaintext.size(), true);
+    blimp_plugin_encryption_shutdown(&plugin);
+
+    SECTION("Containers keep their mode")
+    {
+        stub_kv_store.storage["encryption_mode"] = "gcm";
+        REQUIRE(blimp_plugin_encryption_initialize(stub_kv_store, &plugin) == BLIMP_PLUGIN_RESULT_OK);
+        REQUIRE(plugin.set_password(plugin.state, blimp_password) == BLIMP_PLUGIN_RESULT_OK);
+        REQUIRE(plugin.new_storage_container(plugin.state, 1) == BLIMP_PLUGIN_RESULT_OK);
+        CHECK(processAll(plugin, ciphertext, ciphertext.size(), false) == plaintext);
+        blimp_plugin_encryption_shutdown(&plugin);
+    }
+
+    SECTION("Containers without mode entry are in CBC mode")
+    {
+        stub_kv_store.storage.erase("container_mode_1");
+        stub_kv_store.storage["encryption_mode"] = "gcm";
+        REQUIRE(blimp_plugin_encryption_initialize(stub_kv_store, &plugin) == BLIMP_PLUGIN_RESULT_OK);
+        REQUIRE(plugin.set_password(plugin.state, blimp_password) == BLIMP_PLUGIN_RESULT_OK);
+        REQUIRE(plugin.new_storage_container(plugin.state, 1) == BLIMP_PLUGIN_RESULT_OK);
+        CHECK(processAll(plugin, ciphertext, ciphertext.size(), false) == plaintext);
+        blimp_plugin_encryption_shutdown(&plugin);
+    }
+
+    SECTION("New containers are in GCM mode by default")
+    {
+        stub_kv_store.storage.erase("encryption_mode");
+        REQUIRE(blimp_plugin_encryption_initialize(stub_kv_store, &plugin) == BLIMP_PLUGIN_RESULT_OK);
+        REQUIRE(plugin.set_password(plugin.state, blimp_password) == BLIMP_PLUGIN_RESULT_OK);
+        REQUIRE(plugin.new_storage_container(plugin.state, 2) == BLIMP_PLUGIN_RESULT_OK);
+        CHECK(stub_kv_store.storage["container_mode_2"] == "gcm");
+        CHECK(processAll(plugin, processAll(plugin, plaintext, plaintext.size(), true), 4096, false) == plaintext);
+        // existing containers keep their mode
+        REQUIRE(plugin.new_storage_container(plugin.state, 1) == BLIMP_PLUGIN_RESULT_OK);
+        CHECK(processAll(plugin, ciphertext, ciphertext.size(), false) == plaintext);
+        blimp_plugin_encryption_shutdown(&plugin);
+    }
+
+    SECTION("Invalid mode")
+    {
+        stub_kv_store.storage["encryption_mode"] = "ecb";
+        CHECK(blimp_plugin_encryption_initialize(stub_kv_store, &plugin) == BLIMP_PLUGIN_RESULT_FAILED);
+    }
+}
+
+TEST_CASE("Plugin Encryption AES CBC Chunking")
+{
+    char const sample_password[] = "correcthorsebatterystaple";
+    BlimpPluginEncryptionPassword const blimp_password{ .data = sample_password, .size = sizeof(sample_password) };
+    BlimpKeyValueStoreState stub_kv_store;
+    stub_kv_store.storage["encryption_mode"] = "cbc";
+    BlimpPluginEncryption plugin{};
+    plugin.abi = BLIMP_PLUGIN_ABI_1_0_0;
+    REQUIRE(blimp_plugin_encryption_initialize(stub_kv_store, &plugin) == BLIMP_PLUGIN_RESULT_OK);
+    REQUIRE(plugin.set_password(plugin.state, blimp_password) == BLIMP_PLUGIN_RESULT_OK);
+    std::vector<char> plaintext(100003);
+    for (std::size_t i = 0; i < plaintext.size(); ++i) { plaintext[i] = static_cast<char>(i % 251); }
+
+    REQUIRE(plugin.new_storage_container(plugin.state, 1) == BLIMP_PLUGIN_RESULT_OK);
+    std::vector<char> const reference = processAll(plugin, plaintext, plaintext.size(), true);
+    REQUIRE(reference.size() == plaintext.size() + 13);
+
+    std::size_t const chunk_size = GENERATE(as<std::size_t>{}, 1, 7, 16, 17, 33, 4096);
+    SECTION("Encryption does not depend on chunking")
+    {
+        REQUIRE(plugin.new_storage_container(plugin.state, 1) == BLIMP_PLUGIN_RESULT_OK);
+        std::vector<char> const ciphertext = processAll(plugin, plaintext, chunk_size, true);
+        REQUIRE(ciphertext.size() == reference.size());
+        // all but the last block, which contains random padding
+        CHECK(std::equal(ciphertext.begin(), ciphertext.end() - 16, reference.begin()));
+    }
+
+    SECTION("Decryption does not depend on chunking")
+    {
+        REQUIRE(plugin.new_storage_container(plugin.state, 1) == BLIMP_PLUGIN_RESULT_OK);
+        CHECK(processAll(plugin, reference, chunk_size, false) == plaintext);
+    }
+
+    blimp_plugin_encryption_shutdown(&plugin);
+}
+
+struct BlimpBufferPoolState {
+    std::vector<std::vector<char>> buffers;
+    std::vector<bool> in_use;
+
+    BlimpBufferPoolState(std::size_t n_buffers, std::size_t buffer_size)
+        :buffers(n_buffers, std::vector<char>(buffer_size)), in_use(n_buffers, false)
+    {}
+
+    std::size_t buffersInUse() const {
+        return static_cast<std::size_t>(std::count(in_use.begin(), in_use.end(), true));
+    }
+
+    operator BlimpBufferPool() {
+        return BlimpBufferPool{
+            .state = this,
+            .acquire = [](BlimpBufferPoolStateHandle state) -> BlimpBuffer {
+                auto const it = std::find(state->in_use.begin(), state->in_use.end(), false);
+                if (it == state->in_use.end()) { return BlimpBuffer{ .data = nullptr, .capacity = 0, .token = 0 }; }
+                *it = true;
+                std::size_t const index = static_cast<std::size_t>(std::distance(state->in_use.begin(), it));
+                return BlimpBuffer{ .data = state->buffers[index].data(),
+                                    .capacity = static_cast<int64_t>(state->buffers[index].size()),
+                                    .token = index + 1 };
+            },
+            .release = [](BlimpBufferPoolStateHandle state, uint64_t token) {
+                REQUIRE(state->in_use[token - 1]);
+                state->in_use[token - 1] = false;
+            }
+        };
+    }
+};
+
+TEST_CASE("Plugin Encryption AES Buffer Lending")
+{
+    char const sample_password[] = "correcthorsebatterystaple";
+    BlimpPluginEncryptionPassword const blimp_password{ .data = sample_password, .size = sizeof(sample_password) };
+    BlimpKeyValueStoreState stub_kv_store;
+    stub_kv_store.storage["encryption_mode"] = "cbc";
+    BlimpBufferPoolState pool(4, 8192);
+    BlimpPluginEncryption plugin{};
+    plugin.abi = BLIMP_PLUGIN_ABI_1_1_0;
+    REQUIRE(blimp_plugin_encryption_initialize(stub_kv_store, &plugin) == BLIMP_PLUGIN_RESULT_OK);
+    // seeking is only provided since ABI 1.2.0
+    CHECK(plugin.seek_decryption == nullptr);
+    REQUIRE(plugin.set_password(plugin.state, blimp_password) == BLIMP_PLUGIN_RESULT_OK);
+    plugin.set_buffer_pool(plugin.state, pool);
+    std::vector<char> plaintext(100003);
+    for (std::size_t i = 0; i < plaintext.size(); ++i) { plaintext[i] = static_cast<char>(i % 251); }
+
+    REQUIRE(plugin.new_storage_container(plugin.state, 1) == BLIMP_PLUGIN_RESULT_OK);
+    std::vector<char> const reference = processAll(plugin, plaintext, plaintext.size(), true);
+    CHECK(pool.buffersInUse() == 0);
+
+    REQUIRE(plugin.new_storage_container(plugin.state, 1) == BLIMP_PLUGIN_RESULT_OK);
+    std::vector<char> ciphertext;
+    std::size_t lent_chunks = 0;
+    auto const drain = [&]() {
+        for (BlimpLentChunk c = plugin.take_processed_chunk(plugin.state); c.data;
+             c = plugin.take_processed_chunk(plugin.state))
+        {
+            ciphertext.insert(ciphertext.end(), c.data, c.data + c.size);
+            if (c.token != 0) {
+                ++lent_chunks;
+                BlimpBufferPool const host_pool = pool;
+                host_pool.release(host_pool.state, c.token);
+            }
+        }
+    };
+    for (std::size_t offset = 0; offset < plaintext.size(); offset += 4096) {
+        std::size_t const n = std::min<std::size_t>(4096, plaintext.size() - offset);
+        REQUIRE(plugin.encrypt_file_chunk(plugin.state, BlimpFileChunk{ .data = plaintext.data() + offset,
+                                                                        .size = static_cast<int64_t>(n) }) ==
+                BLIMP_PLUGIN_RESULT_OK);
+        drain();
+    }
+    REQUIRE(plugin.encrypt_file_chunk(plugin.state, BlimpFileChunk{ .data = nullptr, .size = 0 }) ==
+            BLIMP_PLUGIN_RESULT_OK);
+    drain();
+    CHECK(lent_chunks == (plaintext.size() + 4095) / 4096);
+    CHECK(pool.buffersInUse() == 0);
+    REQUIRE(ciphertext.size() == reference.size());
+    // all but the last block, which contains random padding
+    CHECK(std::equal(ciphertext.begin(), ciphertext.end() - 16, reference.begin()));
+
+    REQUIRE(plugin.new_storage_container(plugin.state, 1) == BLIMP_PLUGIN_RESULT_OK);
+    CHECK(processAll(plugin, ciphertext, 4096, false) == plaintext);
+    blimp_plugin_encryption_shutdown(&plugin);
+    CHECK(pool.buffersInUse() == 0);
+}
+
+TEST_CASE("Plugin Encryption AES Seeking")
+{
+    char const sample_password[] = "correcthorsebatterystaple";
+    BlimpPluginEncryptionPassword const blimp_password{ .data = sample_password, .size = sizeof(sample_password) };
+    BlimpKeyValueStoreState stub_kv_store;
+    std::string const mode = GENERATE(as<std::string>{}, "cbc", "gcm");
+    stub_kv_store.storage["encryption_mode"] = mode;
+    BlimpPluginEncryption plugin{};
+    plugin.abi = BLIMP_PLUGIN_ABI_1_2_0;
+    REQUIRE(blimp_plugin_encryption_initialize(stub_kv_store, &plugin) == BLIMP_PLUGIN_RESULT_OK);
+    REQUIRE(plugin.seek_decryption != nullptr);
+    // rewinding is only provided since ABI 1.3.0
+    CHECK(plugin.mark_encryption == nullptr);
+    CHECK(plugin.rewind_encryption == nullptr);
+    REQUIRE(plugin.set_password(plugin.state, blimp_password) == BLIMP_PLUGIN_RESULT_OK);
+
+    // a container holding three consecutive streams
+    std::vector<std::vector<char>> plaintexts;
+    for (std::size_t const size : { std::size_t{ 5000 }, std::size_t{ (1 << 20) + 333 }, std::size_t{ 70001 } }) {
+        std::vector<char>& p = plaintexts.emplace_back(size);
+        for (std::size_t i = 0; i < size; ++i) { p[i] = static_cast<char>((i * 31 + plaintexts.size()) % 253); }
+    }
+    REQUIRE(plugin.new_storage_container(plugin.state, 7) == BLIMP_PLUGIN_RESULT_OK);
+    std::vector<char> ciphertext;
+    std::vector<std::size_t> stream_offsets;
+    for (auto const& p : plaintexts) {
+        stream_offsets.push_back(ciphertext.size());
+        std::vector<char> const c = processAll(plugin, p, 4096, true);
+        ciphertext.insert(ciphertext.end(), c.begin(), c.end());
+    }
+    stream_offsets.push_back(ciphertext.size());
+    auto const stream_data = [&](int64_t begin, std::size_t stream_end) {
+        return std::vector<char>(ciphertext.begin() + begin, ciphertext.begin() + stream_offsets[stream_end]);
+    };
+
+    SECTION("Streams decrypt in sequence")
+    {
+        REQUIRE(plugin.new_storage_container(plugin.state, 7) == BLIMP_PLUGIN_RESULT_OK);
+        for (std::size_t i = 0; i < plaintexts.size(); ++i) {
+            CHECK(processAll(plugin, stream_data(stream_offsets[i], i + 1), 1000, false) == plaintexts[i]);
+        }
+    }
+
+    SECTION("Decryption can start at any stream")
+    {
+        REQUIRE(plugin.new_storage_container(plugin.state, 7) == BLIMP_PLUGIN_RESULT_OK);
+        int64_t read_offset = -1;
+        REQUIRE(plugin.seek_decryption(plugin.state, stream_offsets[1], &read_offset) == BLIMP_PLUGIN_RESULT_OK);
+        CHECK(read_offset <= static_cast<int64_t>(stream_offsets[1]));
+        CHECK(processAll(plugin, stream_data(read_offset, 2), 1000, false) == plaintexts[1]);
+        // decryption continues with the following stream
+        CHECK(processAll(plugin, stream_data(stream_offsets[2], 3), 7, false) == plaintexts[2]);
+
+        REQUIRE(plugin.seek_decryption(plugin.state, stream_offsets[2], &read_offset) == BLIMP_PLUGIN_RESULT_OK);
+        CHECK(processAll(plugin, stream_data(read_offset, 3), 3, false) == plaintexts[2]);
+
+        REQUIRE(plugin.seek_decryption(plugin.state, 0, &read_offset) == BLIMP_PLUGIN_RESULT_OK);
+        CHECK(read_offset == 0);
+        CHECK(processAll(plugin, stream_data(0, 1), 5000, false) == plaintexts[0]);
+    }
+
+    SECTION("Invalid seek")
+    {
+        int64_t read_offset = -1;
+        CHECK(plugin.seek_decryption(plugin.state, -16, &read_offset) == BLIMP_PLUGIN_RESULT_INVALID_ARGUMENT);
+        CHECK(plugin.seek_decryption(plugin.state, 16, nullptr) == BLIMP_PLUGIN_RESULT_INVALID_ARGUMENT);
+        if (mode == "cbc") {
+            CHECK(plugin.seek_decryption(plugin.state, 17, &read_offset) == BLIMP_PLUGIN_RESULT_INVALID_ARGUMENT);
+        }
+    }
+
+    blimp_plugin_encryption_shutdown(&plugin);
+}
+
+TEST_CASE("Plugin Encryption AES Rewinding")
+{
+    char const sample_password[] = "correcthorsebatterystaple";
+    BlimpPluginEncryptionPassword const blimp_password{ .data = sample_password, .size = sizeof(sample_password) };
+    BlimpKeyValueStoreState stub_kv_store;
+    std::string const mode = GENERATE(as<std::string>{}, "cbc", "gcm");
+    stub_kv_store.storage["encryption_mode"] = mode;
+    BlimpPluginEncryption plugin{};
+    plugin.abi = BLIMP_PLUGIN_ABI_1_3_0;
+    REQUIRE(blimp_plugin_encryption_initialize(stub_kv_store, &plugin) == BLIMP_PLUGIN_RESULT_OK);
+    REQUIRE(plugin.seek_decryption != nullptr);
+    REQUIRE(plugin.mark_encryption != nullptr);
+    REQUIRE(plugin.rewind_encryption != nullptr);
+    REQUIRE(plugin.set_password(plugin.state, blimp_password) == BLIMP_PLUGIN_RESULT_OK);
+
+    std::vector<std::vector<char>> plaintexts;
+    for (std::size_t const size : { std::size_t{ 5000 }, std::size_t{ (1 << 20) + 333 }, std::size_t{ 70001 } }) {
+        std::vector<char>& p = plaintexts.emplace_back(size);
+        for (std::size_t i = 0; i < size; ++i) { p[i] = static_cast<char>((i * 31 + plaintexts.size()) % 253); }
+    }
+    REQUIRE(plugin.new_storage_container(plugin.state, 7) == BLIMP_PLUGIN_RESULT_OK);
+
+    SECTION("Rewound streams leave no trace")
+    {
+        std::vector<char> ciphertext = processAll(plugin, plaintexts[0], 4096, true);
+        std::size_t const mark_offset = ciphertext.size();
+        REQUIRE(plugin.mark_encryption(plugin.state) == BLIMP_PLUGIN_RESULT_OK);
+        // streams taken back, the last one without being finished
+        processAll(plugin, plaintexts[1], 4096, true);
+        REQUIRE(plugin.encrypt_file_chunk(plugin.state, BlimpFileChunk{ .data = plaintexts[1].data(),
+                                                                        .size = 1000 }) == BLIMP_PLUGIN_RESULT_OK);
+        REQUIRE(plugin.rewind_encryption(plugin.state) == BLIMP_PLUGIN_RESULT_OK);
+        CHECK(plugin.get_processed_chunk(plugin.state).data == nullptr);
+        std::vector<char> const c = processAll(plugin, plaintexts[2], 4096, true);
+        ciphertext.insert(ciphertext.end(), c.begin(), c.end());
+
+        REQUIRE(plugin.new_storage_container(plugin.state, 7) == BLIMP_PLUGIN_RESULT_OK);
+        CHECK(processAll(plugin, std::vector<char>(ciphertext.begin(), ciphertext.begin() + mark_offset), 1000,
+                         false) == plaintexts[0]);
+        CHECK(processAll(plugin, std::vector<char>(ciphertext.begin() + mark_offset, ciphertext.end()), 1000,
+                         false) == plaintexts[2]);
+
+        // the stream following the mark can also be decrypted on its own
+        int64_t read_offset = -1;
+        REQUIRE(plugin.seek_decryption(plugin.state, mark_offset, &read_offset) == BLIMP_PLUGIN_RESULT_OK);
+        CHECK(processAll(plugin, std::vector<char>(ciphertext.begin() + read_offset, ciphertext.end()), 777,
+                         false) == plaintexts[2]);
+    }
+
+    SECTION("Encryption can be rewound to the same mark repeatedly")
+    {
+        REQUIRE(plugin.mark_encryption(plugin.state) == BLIMP_PLUGIN_RESULT_OK);
+        processAll(plugin, plaintexts[0], 4096, true);
+        REQUIRE(plugin.rewind_encryption(plugin.state) == BLIMP_PLUGIN_RESULT_OK);
+        processAll(plugin, plaintexts[1], 4096, true);
+        REQUIRE(plugin.rewind_encryption(plugin.state) == BLIMP_PLUGIN_RESULT_OK);
+        std::vector<char> const ciphertext = processAll(plugin, plaintexts[2], 4096, true);
+
+        REQUIRE(plugin.new_storage_container(plugin.state, 7) == BLIMP_PLUGIN_RESULT_OK);
+        CHECK(processAll(plugin, ciphertext, 1000, false) == plaintexts[2]);
+    }
+
+    SECTION("Marks are only set between streams")
+    {
+        CHECK(plugin.rewind_encryption(plugin.state) == BLIMP_PLUGIN_RESULT_INVALID_ARGUMENT);
+        REQUIRE(plugin.encrypt_file_chunk(plugin.state, BlimpFileChunk{ .data = plaintexts[0].data(),
+                                                                        .size = 1000 }) == BLIMP_PLUGIN_RESULT_OK);
+        CHECK(plugin.mark_encryption(plugin.state) == BLIMP_PLUGIN_RESULT_INVALID_ARGUMENT);
+        REQUIRE(plugin.encrypt_file_chunk(plugin.state, BlimpFileChunk{ .data = nullptr, .size = 0 }) ==
+                BLIMP_PLUGIN_RESULT_OK);
+        while (plugin.get_processed_chunk(plugin.state).data) {}
+        CHECK(plugin.mark_encryption(plugin.state) == BLIMP_PLUGIN_RESULT_OK);
+        // marks do not carry over to the next container
+        REQUIRE(plugin.new_storage_container(plugin.state, 8) == BLIMP_PLUGIN_RESULT_OK);
+        CHECK(plugin.rewind_encryption(plugin.state) == BLIMP_PLUGIN_RESULT_INVALID_ARGUMENT);
+    }
+
+    blimp_plugin_encryption_shutdown(&plugin);
+}
@@ -3,20 +3,302 @@
 #include <blimp_plugin_helper_cpp.hpp>
 
 #include <boost/filesystem.hpp>
+#include <boost/predef.h>
 #include <boost/system/error_code.hpp>
 
+#if BOOST_OS_WINDOWS
+#   ifndef NOMINMAX
+#       define NOMINMAX
+#   endif
+#   ifndef WIN32_LEAN_AND_MEAN
+#       define WIN32_LEAN_AND_MEAN
+#   endif
+#   include <Windows.h>
+#else
+#   include <fcntl.h>
+#   include <unistd.h>
+#   include <cerrno>
+#endif
+
 #include <algorithm>
 #include <array>
+#include <charconv>
+#include <condition_variable>
+#include <cstdint>
 #include <deque>
 #include <fstream>
+#include <mutex>
 #include <stdexcept>
 #include <string>
+#include <thread>
+#include <unordered_set>
 #include <vector>
 
 namespace {
 struct ErrorStrings {
     static constexpr char const okay[] = "Ok";
+    static constexpr char const open_error[] = "Unable to open storage container";
+    static constexpr char const read_error[] = "Error while reading from storage container";
+    static constexpr char const invalid_request[] = "Read request was not submitted";
+    static constexpr char const truncate_error[] = "Unable to truncate storage container";
+};
+
+/// Number of threads serving read requests; 0 serves them on the submitting thread
+constexpr char const g_kvKeyReadThreads[] = "read_threads";
+
+constexpr std::size_t g_readChunkSize = (1 << 20);
+constexpr std::size_t g_defaultReadThreads = 4;
+
+std::size_t retrieveReadThreadCount(KeyValueStore& kv_store)
+{
+    BlimpKeyValueStoreValue const v = kv_store.retrieve(g_kvKeyReadThreads);
+    if (v.data == nullptr) { return g_defaultReadThreads; }
+    std::size_t ret = 0;
+    auto const [ptr, ec] = std::from_chars(v.data, v.data + v.size, ret);
+    if ((ec != std::errc{}) || (ptr != v.data + v.size)) {
+        throw std::exception();
+    }
+    return ret;
+}
+
+/** Read-only file that can be read at arbitrary offsets from several threads at once.
+ */
+class ContainerFile {
+private:
+#if BOOST_OS_WINDOWS
+    HANDLE m_handle;
+#else
+    int m_fd;
+#endif
+public:
+    ContainerFile();
+    ~ContainerFile();
+
+    ContainerFile(ContainerFile const&) = delete;
+    ContainerFile& operator=(ContainerFile const&) = delete;
+
+    bool open(char const* path);
+    void close();
+    bool isOpen() const;
+
+    /** Reads up to size bytes at offset; fewer bytes are only returned at the end of the file.
+     * @return Number of bytes read, or -1 on error.
+     */
+    int64_t readAt(int64_t offset, char* buffer, int64_t size) const;
 };
+
+#if BOOST_OS_WINDOWS
+ContainerFile::ContainerFile()
+    :m_handle(INVALID_HANDLE_VALUE)
+{}
+
+bool ContainerFile::open(char const* path)
+{
+    close();
+    m_handle = CreateFileW(boost::filesystem::path(path).c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+                           OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    return m_handle != INVALID_HANDLE_VALUE;
+}
+
+void ContainerFile::close()
+{
+    if (m_handle != INVALID_HANDLE_VALUE) {
+        CloseHandle(m_handle);
+        m_handle = INVALID_HANDLE_VALUE;
+    }
+}
+
+bool ContainerFile::isOpen() const
+{
+    return m_handle != INVALID_HANDLE_VALUE;
+}
+
+int64_t ContainerFile::readAt(int64_t offset, char* buffer, int64_t size) const
+{
+    int64_t n_total = 0;
+    while (n_total < size) {
+        // reads with an explicit offset do not depend on the file pointer, so threads do not interfere
+        OVERLAPPED ov{};
+        uint64_t const read_offset = static_cast<uint64_t>(offset + n_total);
+        ov.Offset = static_cast<DWORD>(read_offset & 0xffffffffu);
+        ov.OffsetHigh = static_cast<DWORD>(read_offset >> 32);
+        DWORD const n_request = static_cast<DWORD>(std::min<int64_t>(size - n_total, (1 << 30)));
+        DWORD n_read = 0;
+        if (!ReadFile(m_handle, buffer + n_total, n_request, &n_read, &ov)) {
+            if (GetLastError() == ERROR_HANDLE_EOF) { break; }
+            return -1;
+        }
+        if (n_read == 0) { break; }
+        n_total += n_read;
+    }
+    return n_total;
+}
+#else
+ContainerFile::ContainerFile()
+    :m_fd(-1)
+{}
+
+bool ContainerFile::open(char const* path)
+{
+    close();
+    m_fd = ::open(path, O_RDONLY | O_CLOEXEC);
+    return m_fd != -1;
+}
+
+void ContainerFile::close()
+{
+    if (m_fd != -1) {
+        ::close(m_fd);
+        m_fd = -1;
+    }
+}
+
+bool ContainerFile::isOpen() const
+{
+    return m_fd != -1;
+}
+
+int64_t ContainerFile::readAt(int64_t offset, char* buffer, int64_t size) const
+{
+    int64_t n_total = 0;
+    while (n_total < size) {
+        ssize_t const n_read = ::pread(m_fd, buffer + n_total, static_cast<std::size_t>(size - n_total),
+                                       static_cast<off_t>(offset + n_total));
+        if (n_read < 0) {
+            if (errno == EINTR) { continue; }
+            return -1;
+        }
+        if (n_read == 0) { break; }
+        n_total += n_read;
+    }
+    return n_total;
+}
+#endif
+
+ContainerFile::~ContainerFile()
+{
+    close();
+}
+
+/** Serves read requests, so that several reads of a container are outstanding at once.
+ * With worker threads, requests are served in submission order, by whichever thread is idle. Without worker
+ * threads, requests are served on submission. The worker threads are only started by the first submission.
+ */
+class ReadRequestProcessor {
+private:
+    ContainerFile const* m_file;
+    std::size_t m_threadCount;
+    std::mutex m_mtx;
+    std::condition_variable m_cvWork;
+    std::condition_variable m_cvDone;
+    std::deque<BlimpStorageReadRequest*> m_queue;
+    std::unordered_set<BlimpStorageReadRequest*> m_submitted;   ///< submitted and not yet waited for
+    std::unordered_set<BlimpStorageReadRequest*> m_completed;
+    bool m_shutdown;
+    std::vector<std::thread> m_threads;
+public:
+    ReadRequestProcessor(ContainerFile const& file, std::size_t n_threads);
+    ~ReadRequestProcessor();
+
+    ReadRequestProcessor(ReadRequestProcessor const&) = delete;
+    ReadRequestProcessor& operator=(ReadRequestProcessor const&) = delete;
+
+    void submit(BlimpStorageReadRequest* requests, int64_t n_requests);
+    /** Blocks until request has been served.
+     * @return false if request was not submitted or has been waited for already.
+     */
+    bool wait(BlimpStorageReadRequest* request);
+    /** Blocks until all submitted requests have been served and forgets about them.
+     */
+    void waitForAll();
+private:
+    void work();
+    void serve(BlimpStorageReadRequest& request) const;
+};
+
+ReadRequestProcessor::ReadRequestProcessor(ContainerFile const& file, std::size_t n_threads)
+    :m_file(&file), m_threadCount(n_threads), m_shutdown(false)
+{}
+
+ReadRequestProcessor::~ReadRequestProcessor()
+{
+    {
+        std::lock_guard lk(m_mtx);
+        m_shutdown = true;
+    }
+    m_cvWork.notify_all();
+    for (auto& t : m_threads) { t.join(); }
+}
+
+void ReadRequestProcessor::submit(BlimpStorageReadRequest* requests, int64_t n_requests)
+{
+    if (m_threadCount == 0) {
+        for (int64_t i = 0; i < n_requests; ++i) {
+            serve(requests[i]);
+            m_submitted.insert(requests + i);
+            m_completed.insert(requests + i);
+        }
+        return;
+    }
+    if (m_threads.empty()) {
+        for (std::size_t i = 0; i < m_threadCount; ++i) {
+            m_threads.emplace_back([this]() { work(); });
+        }
+    }
+    {
+        std::lock_guard lk(m_mtx);
+        for (int64_t i = 0; i < n_requests; ++i) {
+            m_submitted.insert(requests + i);
+            m_queue.push_back(requests + i);
+        }
+    }
+    m_cvWork.notify_all();
+}
+
+bool ReadRequestProcessor::wait(BlimpStorageReadRequest* request)
+{
+    std::unique_lock lk(m_mtx);
+    if (m_submitted.erase(request) == 0) { return false; }
+    m_cvDone.wait(lk, [this, request]() { return m_completed.contains(request); });
+    m_completed.erase(request);
+    return true;
+}
+
+void ReadRequestProcessor::waitForAll()
+{
+    std::unique_lock lk(m_mtx);
+    m_cvDone.wait(lk, [this]() { return m_completed.size() == m_submitted.size(); });
+    m_submitted.clear();
+    m_completed.clear();
+}
+
+void ReadRequestProcessor::work()
+{
+    std::unique_lock lk(m_mtx);
+    for (;;) {
+        m_cvWork.wait(lk, [this]() { return (!m_queue.empty()) || m_shutdown; });
+        if (m_queue.empty()) { break; }
+        BlimpStorageReadRequest* request = m_queue.front();
+        m_queue.pop_front();
+        lk.unlock();
+        serve(*request);
+        lk.lock();
+        m_completed.insert(request);
+        m_cvDone.notify_all();
+    }
+}
+
+void ReadRequestProcessor::serve(BlimpStorageReadRequest& request) const
+{
+    if ((request.offset < 0) || (request.size < 0) || ((request.size > 0) && (!request.buffer))) {
+        request.out_size = 0;
+        request.out_result = BLIMP_PLUGIN_RESULT_INVALID_ARGUMENT;
+        return;
+    }
+    int64_t const n_read = m_file->readAt(request.offset, request.buffer, request.size);
+    request.out_size = std::max<int64_t>(n_read, 0);
+    request.out_result = (n_read < 0) ? BLIMP_PLUGIN_RESULT_FAILED : BLIMP_PLUGIN_RESULT_OK;
+}
 }   // anonymous namespace
 
 struct BlimpPluginStorageState {
@@ -28,6 +310,10 @@ struct BlimpPluginStorageState {
     std::string m_currentLocationString;
 
     std::ofstream m_fout;
+    ContainerFile m_fin;
+    int64_t m_readOffset;
+    std::vector<char> m_readBuffer;
+    ReadRequestProcessor m_readRequests;
 
     BlimpPluginStorageState(BlimpKeyValueStore const& n_kv_store);
     ~BlimpPluginStorageState();
@@ -40,6 +326,12 @@ struct BlimpPluginStorageState {
     BlimpPluginResult new_storage_container(int64_t container_id);
     BlimpPluginResult finalize_storage_container(BlimpStorageContainerLocation* out_location);
     BlimpPluginResult store_file_chunk(BlimpFileChunk const& chunk);
+    BlimpPluginResult open_storage_container(BlimpStorageContainerLocation const& location);
+    BlimpPluginResult read_file_chunk(BlimpFileChunk* out_chunk);
+    BlimpPluginResult read_range(int64_t offset, char* buffer, int64_t size, int64_t* out_size);
+    BlimpPluginResult submit_read_requests(BlimpStorageReadRequest* requests, int64_t n_requests);
+    BlimpPluginResult wait_read_request(BlimpStorageReadRequest* request);
+    BlimpPluginResult truncate_storage_container(int64_t size);
 };
 
 BlimpPluginInfo blimp_plugin_api_info()
@@ -86,9 +378,45 @@ BlimpPluginResult blimp_plugin_store_file_chunk(BlimpPluginStorageStateHandle st
     return state->store_file_chunk(chunk);
 }
 
+BlimpPluginResult blimp_plugin_open_storage_container(BlimpPluginStorageStateHandle state,
+                                                      BlimpStorageContainerLocation location)
+{
+    return state->open_storage_container(location);
+}
+
+BlimpPluginResult blimp_plugin_read_file_chunk(BlimpPluginStorageStateHandle state, BlimpFileChunk* out_chunk)
+{
+    return state->read_file_chunk(out_chunk);
+}
+
+BlimpPluginResult blimp_plugin_read_range(BlimpPluginStorageStateHandle state, int64_t offset, char* buffer,
+                                          int64_t size, int64_t* out_size)
+{
+    return state->read_range(offset, buffer, size, out_size);
+}
+
+BlimpPluginResult blimp_plugin_submit_read_requests(BlimpPluginStorageStateHandle state,
+                                                    BlimpStorageReadRequest* requests, int64_t n_requests)
+{
+    return state->submit_read_requests(requests, n_requests);
+}
+
+BlimpPluginResult blimp_plugin_wait_read_request(BlimpPluginStorageStateHandle state,
+                                                 BlimpStorageReadRequest* request)
+{
+    return state->wait_read_request(request);
+}
+
+BlimpPluginResult blimp_plugin_truncate_storage_container(BlimpPluginStorageStateHandle state, int64_t size)
+{
+    return state->truncate_storage_container(size);
+}
+
 BlimpPluginResult blimp_plugin_storage_initialize(BlimpKeyValueStore kv_store, BlimpPluginStorage* plugin)
 {
-    if (plugin->abi != BLIMP_PLUGIN_ABI_1_0_0) {
+    if ((plugin->abi != BLIMP_PLUGIN_ABI_1_0_0) && (plugin->abi != BLIMP_PLUGIN_ABI_1_1_0) &&
+        (plugin->abi != BLIMP_PLUGIN_ABI_1_2_0) && (plugin->abi != BLIMP_PLUGIN_ABI_1_3_0))
+    {
         return BLIMP_PLUGIN_RESULT_INVALID_ARGUMENT;
     }
     try {
@@ -102,6 +430,16 @@ BlimpPluginResult blimp_plugin_storage_initialize(BlimpKeyValueStore kv_store, B
     plugin->new_storage_container = blimp_plugin_new_storage_container;
     plugin->finalize_storage_container = blimp_plugin_finalize_storage_container;
     plugin->store_file_chunk = blimp_plugin_store_file_chunk;
+    if (plugin->abi != BLIMP_PLUGIN_ABI_1_0_0) {
+        plugin->open_storage_container = blimp_plugin_open_storage_container;
+        plugin->read_file_chunk = blimp_plugin_read_file_chunk;
+        plugin->read_range = blimp_plugin_read_range;
+        plugin->submit_read_requests = blimp_plugin_submit_read_requests;
+        plugin->wait_read_request = blimp_plugin_wait_read_request;
+    }
+    if (plugin->abi == BLIMP_PLUGIN_ABI_1_3_0) {
+        plugin->truncate_storage_container = blimp_plugin_truncate_storage_container;
+    }
     return BLIMP_PLUGIN_RESULT_OK;
 }
 
@@ -112,7 +450,8 @@ void blimp_plugin_storage_shutdown(BlimpPluginStorage* plugin)
 
 
 BlimpPluginStorageState::BlimpPluginStorageState(BlimpKeyValueStore const& n_kv_store)
-    :error_string(ErrorStrings::okay), kv_store(n_kv_store)
+    :error_string(ErrorStrings::okay), kv_store(n_kv_store), m_readOffset(0),
+     m_readRequests(m_fin, retrieveReadThreadCount(kv_store))
 {}
 
 BlimpPluginStorageState::~BlimpPluginStorageState()
@@ -181,3 +520,89 @@ BlimpPluginResult BlimpPluginStorageState::store_file_chunk(BlimpFileChunk const
     if (!m_fout) { return BLIMP_PLUGIN_RESULT_FAILED; }
     return BLIMP_PLUGIN_RESULT_OK;
 }
+
+/** Discards the data stored into the current container beyond size.
+ * Data written through m_fout is flushed first, so that the file holds all of it before it is cut.
+ */
+BlimpPluginResult BlimpPluginStorageState::truncate_storage_container(int64_t size)
+{
+    if (!m_fout.is_open()) { return BLIMP_PLUGIN_RESULT_FAILED; }
+    m_fout.flush();
+    if (!m_fout) { return BLIMP_PLUGIN_RESULT_FAILED; }
+    if ((size < 0) || (size > static_cast<int64_t>(m_fout.tellp()))) { return BLIMP_PLUGIN_RESULT_INVALID_ARGUMENT; }
+    boost::system::error_code ec;
+    boost::filesystem::resize_file(m_currentLocationString, static_cast<std::uintmax_t>(size), ec);
+    if (ec) {
+        error_string = ErrorStrings::truncate_error;
+        return BLIMP_PLUGIN_RESULT_FAILED;
+    }
+    m_fout.seekp(size);
+    if (!m_fout) { return BLIMP_PLUGIN_RESULT_FAILED; }
+    return BLIMP_PLUGIN_RESULT_OK;
+}
+
+BlimpPluginResult BlimpPluginStorageState::open_storage_container(BlimpStorageContainerLocation const& location)
+{
+    if (!location.location) { return BLIMP_PLUGIN_RESULT_INVALID_ARGUMENT; }
+    // the previous container may not be closed while reads from it are outstanding
+    m_readRequests.waitForAll();
+    m_readOffset = 0;
+    if (!m_fin.open(location.location)) {
+        error_string = ErrorStrings::open_error;
+        return BLIMP_PLUGIN_RESULT_FAILED;
+    }
+    m_readBuffer.resize(g_readChunkSize);
+    return BLIMP_PLUGIN_RESULT_OK;
+}
+
+BlimpPluginResult BlimpPluginStorageState::read_file_chunk(BlimpFileChunk* out_chunk)
+{
+    if (!m_fin.isOpen()) { return BLIMP_PLUGIN_RESULT_FAILED; }
+    int64_t const n_read = m_fin.readAt(m_readOffset, m_readBuffer.data(), static_cast<int64_t>(m_readBuffer.size()));
+    if (n_read < 0) {
+        error_string = ErrorStrings::read_error;
+        return BLIMP_PLUGIN_RESULT_FAILED;
+    }
+    m_readOffset += n_read;
+    if (n_read == 0) {
+        out_chunk->data = nullptr;
+        out_chunk->size = 0;
+    } else {
+        out_chunk->data = m_readBuffer.data();
+        out_chunk->size = n_read;
+    }
+    return BLIMP_PLUGIN_RESULT_OK;
+}
+
+BlimpPluginResult BlimpPluginStorageState::read_range(int64_t offset, char* buffer, int64_t size, int64_t* out_size)
+{
+    if ((offset < 0) || (size < 0) || ((size > 0) && (!buffer)) || (!out_size)) {
+        return BLIMP_PLUGIN_RESULT_INVALID_ARGUMENT;
+    }
+    if (!m_fin.isOpen()) { return BLIMP_PLUGIN_RESULT_FAILED; }
+    int64_t const n_read = m_fin.readAt(offset, buffer, size);
+    if (n_read < 0) {
+        error_string = ErrorStrings::read_error;
+        return BLIMP_PLUGIN_RESULT_FAILED;
+    }
+    *out_size = n_read;
+    return BLIMP_PLUGIN_RESULT_OK;
+}
+
+BlimpPluginResult BlimpPluginStorageState::submit_read_requests(BlimpStorageReadRequest* requests, int64_t n_requests)
+{
+    if ((n_requests < 0) || ((n_requests > 0) && (!requests))) { return BLIMP_PLUGIN_RESULT_INVALID_ARGUMENT; }
+    if (!m_fin.isOpen()) { return BLIMP_PLUGIN_RESULT_FAILED; }
+    m_readRequests.submit(requests, n_requests);
+    return BLIMP_PLUGIN_RESULT_OK;
+}
+
+BlimpPluginResult BlimpPluginStorageState::wait_read_request(BlimpStorageReadRequest* request)
+{
+    if (!m_readRequests.wait(request)) {
+        error_string = ErrorStrings::invalid_request;
+        return BLIMP_PLUGIN_RESULT_INVALID_ARGUMENT;
+    }
+    if (request->out_result == BLIMP_PLUGIN_RESULT_FAILED) { error_string = ErrorStrings::read_error; }
+    return request->out_result;
+}
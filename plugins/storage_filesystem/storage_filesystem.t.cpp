@@ -1,60 +1,215 @@
 #include <storage_filesystem.hpp>
 
+#include <blimp_plugin_test_helper_cpp.hpp>
+
 #include <catch.hpp>
 
 #include <algorithm>
+#include <cstdint>
+#include <filesystem>
 #include <iterator>
-#include <unordered_map>
 #include <string>
 #include <vector>
 
-struct BlimpKeyValueStoreState {
-    std::unordered_map<std::string, std::string> storage;
-    int call_count_store;
-    int call_count_retrieve;
-    std::string last_key_retrieve;
+TEST_CASE("Plugin Storage Filesystem")
+{
+    BlimpKeyValueStoreState stub_kv_store;
+    SECTION("Plugin Info")
+    {
+        auto const api_info = blimp_plugin_api_info();
+        CHECK(api_info.type == BLIMP_PLUGIN_TYPE_STORAGE);
+    }
+}
+
+TEST_CASE("Plugin Storage Filesystem Read Back")
+{
+    BlimpKeyValueStoreState stub_kv_store;
+    std::string const read_threads = GENERATE(as<std::string>{}, "0", "3");
+    stub_kv_store.storage["read_threads"] = read_threads;
+    BlimpPluginStorage storage{};
+    storage.abi = BLIMP_PLUGIN_ABI_1_1_0;
+    REQUIRE(blimp_plugin_storage_initialize(stub_kv_store, &storage) == BLIMP_PLUGIN_RESULT_OK);
+    REQUIRE(storage.open_storage_container);
+    REQUIRE(storage.read_file_chunk);
+    REQUIRE(storage.read_range);
+    REQUIRE(storage.submit_read_requests);
+    REQUIRE(storage.wait_read_request);
+
+    std::filesystem::path const base_path = std::filesystem::temp_directory_path() / "blimp_storage_filesystem_test";
+    std::filesystem::remove_all(base_path);
+    REQUIRE(storage.set_base_location(storage.state, base_path.string().c_str()) == BLIMP_PLUGIN_RESULT_OK);
 
-    BlimpKeyValueStoreState()
-        :call_count_store(0), call_count_retrieve(0)
-    {}
+    // more than one read chunk, not a multiple of the chunk size
+    std::vector<char> const data = generateNoise((5 << 19) + 17, 42);
 
-    void store(std::string const& key, BlimpKeyValueStoreValue const& v)
+    REQUIRE(storage.new_storage_container(storage.state, 142) == BLIMP_PLUGIN_RESULT_OK);
+    for (std::size_t offset = 0; offset < data.size(); offset += 100000) {
+        std::size_t const n = std::min<std::size_t>(100000, data.size() - offset);
+        REQUIRE(storage.store_file_chunk(storage.state,
+                                         BlimpFileChunk{ .data = data.data() + offset,
+                                                         .size = static_cast<int64_t>(n) }) == BLIMP_PLUGIN_RESULT_OK);
+    }
+    BlimpStorageContainerLocation location{};
+    REQUIRE(storage.finalize_storage_container(storage.state, &location) == BLIMP_PLUGIN_RESULT_OK);
+    std::string const location_string = location.location;
+
+    SECTION("Container contents are read back in order")
     {
-        ++call_count_store;
-        storage.insert(std::make_pair(key, std::string(v.data, v.data + v.size)));
+        REQUIRE(storage.open_storage_container(storage.state, BlimpStorageContainerLocation{
+                                                   .location = location_string.c_str() }) == BLIMP_PLUGIN_RESULT_OK);
+        std::vector<char> read_data;
+        int n_chunks = 0;
+        for (;;) {
+            BlimpFileChunk c{};
+            REQUIRE(storage.read_file_chunk(storage.state, &c) == BLIMP_PLUGIN_RESULT_OK);
+            if (!c.data) { break; }
+            read_data.insert(read_data.end(), c.data, c.data + c.size);
+            ++n_chunks;
+        }
+        CHECK(n_chunks == 3);
+        CHECK(read_data == data);
     }
 
-    BlimpKeyValueStoreValue retrieve(std::string const& key)
+    SECTION("Ranges are read at arbitrary offsets")
     {
-        ++call_count_retrieve;
-        last_key_retrieve = key;
-        auto it = storage.find(key);
-        return (it != storage.end()) ?
-            BlimpKeyValueStoreValue{ .data = it->second.data(), .size = static_cast<int64_t>(it->second.size()) } :
-            BlimpKeyValueStoreValue{ .data = nullptr, .size = -1 };
+        REQUIRE(storage.open_storage_container(storage.state, BlimpStorageContainerLocation{
+                                                   .location = location_string.c_str() }) == BLIMP_PLUGIN_RESULT_OK);
+        std::vector<char> buffer(300000);
+        int64_t n_read = -1;
+        REQUIRE(storage.read_range(storage.state, 1234567, buffer.data(), 300000, &n_read) == BLIMP_PLUGIN_RESULT_OK);
+        CHECK(n_read == 300000);
+        CHECK(std::equal(buffer.begin(), buffer.end(), data.begin() + 1234567));
+
+        // ranges extending beyond the end of the container are cut short
+        int64_t const tail_offset = static_cast<int64_t>(data.size()) - 10;
+        REQUIRE(storage.read_range(storage.state, tail_offset, buffer.data(), 100, &n_read) == BLIMP_PLUGIN_RESULT_OK);
+        CHECK(n_read == 10);
+        CHECK(std::equal(buffer.begin(), buffer.begin() + 10, data.end() - 10));
+        REQUIRE(storage.read_range(storage.state, tail_offset + 50, buffer.data(), 100, &n_read) ==
+                BLIMP_PLUGIN_RESULT_OK);
+        CHECK(n_read == 0);
+
+        CHECK(storage.read_range(storage.state, -1, buffer.data(), 100, &n_read) ==
+              BLIMP_PLUGIN_RESULT_INVALID_ARGUMENT);
     }
 
-    operator BlimpKeyValueStore() {
-        return BlimpKeyValueStore {
-            .state = this,
-            .store = [](BlimpKeyValueStoreStateHandle state, char const* key, BlimpKeyValueStoreValue value)
-            {
-                return state->store(key, value);
-        },
-            .retrieve = [](BlimpKeyValueStoreStateHandle state, char const* key) -> BlimpKeyValueStoreValue
-        {
-            return state->retrieve(key);
+    SECTION("Read requests are served asynchronously")
+    {
+        REQUIRE(storage.open_storage_container(storage.state, BlimpStorageContainerLocation{
+                                                   .location = location_string.c_str() }) == BLIMP_PLUGIN_RESULT_OK);
+        // the last request starts beyond the end of the container
+        int64_t const request_size = 700000;
+        std::vector<BlimpStorageReadRequest> requests;
+        std::vector<std::vector<char>> buffers;
+        for (int64_t offset = 0; offset <= static_cast<int64_t>(data.size()); offset += request_size) {
+            buffers.emplace_back(request_size);
+            requests.push_back(BlimpStorageReadRequest{ .offset = offset, .size = request_size,
+                                                        .buffer = buffers.back().data(), .out_size = -1,
+                                                        .out_result = BLIMP_PLUGIN_RESULT_FAILED });
         }
-        };
+        requests.push_back(BlimpStorageReadRequest{ .offset = static_cast<int64_t>(data.size()) + 1,
+                                                    .size = request_size, .buffer = buffers.back().data(),
+                                                    .out_size = -1, .out_result = BLIMP_PLUGIN_RESULT_FAILED });
+        REQUIRE(storage.submit_read_requests(storage.state, requests.data(),
+                                             static_cast<int64_t>(requests.size())) == BLIMP_PLUGIN_RESULT_OK);
+        CHECK(storage.wait_read_request(storage.state, &requests.back()) == BLIMP_PLUGIN_RESULT_OK);
+        CHECK(requests.back().out_size == 0);
+        // requests may be waited for in any order
+        for (std::size_t i = requests.size() - 1; i-- > 0;) {
+            REQUIRE(storage.wait_read_request(storage.state, &requests[i]) == BLIMP_PLUGIN_RESULT_OK);
+            int64_t const expected_size =
+                std::min<int64_t>(request_size, static_cast<int64_t>(data.size()) - requests[i].offset);
+            REQUIRE(requests[i].out_size == expected_size);
+            CHECK(std::equal(buffers[i].begin(), buffers[i].begin() + expected_size,
+                             data.begin() + requests[i].offset));
+        }
+        CHECK(storage.wait_read_request(storage.state, &requests.front()) == BLIMP_PLUGIN_RESULT_INVALID_ARGUMENT);
     }
-};
 
-TEST_CASE("Plugin Storage Filesystem")
+    SECTION("Opening a missing container fails")
+    {
+        std::string const missing = (base_path / "1" / "99").string();
+        CHECK(storage.open_storage_container(storage.state, BlimpStorageContainerLocation{
+                                                 .location = missing.c_str() }) == BLIMP_PLUGIN_RESULT_FAILED);
+    }
+
+    blimp_plugin_storage_shutdown(&storage);
+    std::filesystem::remove_all(base_path);
+}
+
+TEST_CASE("Plugin Storage Filesystem Truncation")
 {
     BlimpKeyValueStoreState stub_kv_store;
-    SECTION("Plugin Info")
+    BlimpPluginStorage storage{};
+    storage.abi = BLIMP_PLUGIN_ABI_1_3_0;
+    REQUIRE(blimp_plugin_storage_initialize(stub_kv_store, &storage) == BLIMP_PLUGIN_RESULT_OK);
+    REQUIRE(storage.truncate_storage_container);
+    REQUIRE(storage.read_range);
+
+    std::filesystem::path const base_path = std::filesystem::temp_directory_path() / "blimp_storage_filesystem_test";
+    std::filesystem::remove_all(base_path);
+    REQUIRE(storage.set_base_location(storage.state, base_path.string().c_str()) == BLIMP_PLUGIN_RESULT_OK);
+
+    std::vector<char> const data = generateNoise(300000, 42);
+    std::vector<char> const replacement = generateNoise(50000, 43);
+    auto const store = [&storage](std::vector<char> const& v, std::size_t size) {
+        return storage.store_file_chunk(storage.state, BlimpFileChunk{ .data = v.data(),
+                                                                       .size = static_cast<int64_t>(size) });
+    };
+    REQUIRE(storage.new_storage_container(storage.state, 143) == BLIMP_PLUGIN_RESULT_OK);
+    REQUIRE(store(data, data.size()) == BLIMP_PLUGIN_RESULT_OK);
+
+    SECTION("Storing continues at the truncated size")
     {
-        auto const api_info = blimp_plugin_api_info();
-        CHECK(api_info.type == BLIMP_PLUGIN_TYPE_STORAGE);
+        REQUIRE(storage.truncate_storage_container(storage.state, 123456) == BLIMP_PLUGIN_RESULT_OK);
+        REQUIRE(store(replacement, replacement.size()) == BLIMP_PLUGIN_RESULT_OK);
+        BlimpStorageContainerLocation location{};
+        REQUIRE(storage.finalize_storage_container(storage.state, &location) == BLIMP_PLUGIN_RESULT_OK);
+        std::string const location_string = location.location;
+        REQUIRE(storage.open_storage_container(storage.state, BlimpStorageContainerLocation{
+                                                   .location = location_string.c_str() }) == BLIMP_PLUGIN_RESULT_OK);
+        std::vector<char> buffer(data.size());
+        int64_t n_read = -1;
+        REQUIRE(storage.read_range(storage.state, 0, buffer.data(), static_cast<int64_t>(buffer.size()), &n_read) ==
+                BLIMP_PLUGIN_RESULT_OK);
+        REQUIRE(n_read == 123456 + 50000);
+        CHECK(std::equal(data.begin(), data.begin() + 123456, buffer.begin()));
+        CHECK(std::equal(replacement.begin(), replacement.end(), buffer.begin() + 123456));
     }
+
+    SECTION("Containers are truncated to empty")
+    {
+        REQUIRE(storage.truncate_storage_container(storage.state, 0) == BLIMP_PLUGIN_RESULT_OK);
+        BlimpStorageContainerLocation location{};
+        REQUIRE(storage.finalize_storage_container(storage.state, &location) == BLIMP_PLUGIN_RESULT_OK);
+        CHECK(std::filesystem::file_size(location.location) == 0);
+    }
+
+    SECTION("Containers cannot grow by truncation")
+    {
+        CHECK(storage.truncate_storage_container(storage.state, 300001) == BLIMP_PLUGIN_RESULT_INVALID_ARGUMENT);
+        CHECK(storage.truncate_storage_container(storage.state, -1) == BLIMP_PLUGIN_RESULT_INVALID_ARGUMENT);
+        BlimpStorageContainerLocation location{};
+        REQUIRE(storage.finalize_storage_container(storage.state, &location) == BLIMP_PLUGIN_RESULT_OK);
+        CHECK(std::filesystem::file_size(location.location) == 300000);
+    }
+
+    blimp_plugin_storage_shutdown(&storage);
+    std::filesystem::remove_all(base_path);
+}
+
+TEST_CASE("Plugin Storage Filesystem Previous ABI")
+{
+    BlimpKeyValueStoreState stub_kv_store;
+    BlimpPluginStorage storage{};
+    storage.abi = BLIMP_PLUGIN_ABI_1_0_0;
+    REQUIRE(blimp_plugin_storage_initialize(stub_kv_store, &storage) == BLIMP_PLUGIN_RESULT_OK);
+    CHECK(storage.store_file_chunk);
+    CHECK(!storage.open_storage_container);
+    CHECK(!storage.read_file_chunk);
+    CHECK(!storage.read_range);
+    CHECK(!storage.submit_read_requests);
+    CHECK(!storage.wait_read_request);
+    CHECK(!storage.truncate_storage_container);
+    blimp_plugin_storage_shutdown(&storage);
 }
@@ -18,4 +18,95 @@ public:
     }
 };
 
+/** Buffer lent from the host's buffer pool.
+ * The buffer goes back to the pool on destruction, unless ownership was passed on to the host with passOwnership().
+ */
+class LentBuffer {
+private:
+    BlimpBufferPool m_pool;
+    BlimpBuffer m_buffer;
+public:
+    LentBuffer()
+        :m_pool{}, m_buffer{}
+    {}
+
+    LentBuffer(BlimpBufferPool const& pool, BlimpBuffer const& buffer)
+        :m_pool(pool), m_buffer(buffer)
+    {}
+
+    ~LentBuffer() {
+        reset();
+    }
+
+    LentBuffer(LentBuffer const&) = delete;
+    LentBuffer& operator=(LentBuffer const&) = delete;
+
+    LentBuffer(LentBuffer&& rhs)
+        :m_pool(rhs.m_pool), m_buffer(rhs.m_buffer)
+    {
+        rhs.m_buffer = BlimpBuffer{};
+    }
+
+    LentBuffer& operator=(LentBuffer&& rhs) {
+        if (this != &rhs) {
+            reset();
+            m_pool = rhs.m_pool;
+            m_buffer = rhs.m_buffer;
+            rhs.m_buffer = BlimpBuffer{};
+        }
+        return *this;
+    }
+
+    bool isValid() const {
+        return m_buffer.data != nullptr;
+    }
+
+    char* data() const {
+        return m_buffer.data;
+    }
+
+    int64_t capacity() const {
+        return m_buffer.capacity;
+    }
+
+    uint64_t passOwnership() {
+        uint64_t const ret = m_buffer.token;
+        m_buffer = BlimpBuffer{};
+        return ret;
+    }
+
+    void reset() {
+        if (m_buffer.data != nullptr) {
+            m_pool.release(m_pool.state, m_buffer.token);
+            m_buffer = BlimpBuffer{};
+        }
+    }
+};
+
+/** The host's buffer pool, as passed to set_buffer_pool.
+ */
+class BufferPool {
+private:
+    BlimpBufferPool m_pool;
+public:
+    BufferPool()
+        :m_pool{}
+    {}
+
+    void set(BlimpBufferPool const& pool) {
+        m_pool = pool;
+    }
+
+    bool isSet() const {
+        return m_pool.acquire != nullptr;
+    }
+
+    /** Returns an invalid LentBuffer if no pool was set or the pool is exhausted.
+     */
+    LentBuffer acquire() const {
+        if (!isSet()) { return LentBuffer{}; }
+        return LentBuffer(m_pool, m_pool.acquire(m_pool.state));
+    }
+};
+
 #endif
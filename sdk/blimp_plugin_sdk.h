@@ -9,7 +9,10 @@ extern "C"
 #endif
 
 typedef enum BlimpPluginABI_Tag {
-    BLIMP_PLUGIN_ABI_1_0_0 = 1
+    BLIMP_PLUGIN_ABI_1_0_0 = 1,
+    BLIMP_PLUGIN_ABI_1_1_0 = 2,
+    BLIMP_PLUGIN_ABI_1_2_0 = 3,
+    BLIMP_PLUGIN_ABI_1_3_0 = 4
 } BlimpPluginABI;
 
 typedef enum BlimpPluginType_Tag {
@@ -80,6 +83,51 @@ typedef struct BlimpKeyValueStore_Tag {
     BlimpKeyValueStoreValue (*retrieve)(BlimpKeyValueStoreStateHandle state, char const* key);
 } BlimpKeyValueStore;
 
+/** Memory lent to a plugin from the host's buffer pool.
+ * A buffer with data == NULL indicates that the pool is exhausted; the plugin then has to fall back to memory of
+ * its own. The token identifies the buffer when ownership is passed back to the host.
+ */
+typedef struct BlimpBuffer_Tag {
+    char* data;
+    int64_t capacity;
+    uint64_t token;
+} BlimpBuffer;
+
+struct BlimpBufferPoolState;
+typedef struct BlimpBufferPoolState* BlimpBufferPoolStateHandle;
+
+/** Pool of output buffers shared by all plugins of a processing pipeline (since BLIMP_PLUGIN_ABI_1_1_0).
+ * acquire() never blocks. A buffer has to be either released back to the pool or handed to the host through
+ * take_processed_chunk; the pool must be set before any data is processed and outlives the plugin.
+ */
+typedef struct BlimpBufferPool_Tag {
+    BlimpBufferPoolStateHandle state;
+    BlimpBuffer (*acquire)(BlimpBufferPoolStateHandle state);
+    void (*release)(BlimpBufferPoolStateHandle state, uint64_t token);
+} BlimpBufferPool;
+
+/** Processed chunk with ownership of the underlying memory (since BLIMP_PLUGIN_ABI_1_1_0).
+ * A non-zero token transfers ownership of a pool buffer to the host, which releases it once the data was consumed.
+ * A token of 0 indicates plugin memory that, as for get_processed_chunk, stays valid until the next call.
+ */
+typedef struct BlimpLentChunk_Tag {
+    char const* data;
+    int64_t size;
+    uint64_t token;
+} BlimpLentChunk;
+
+/** Parameters of a compression plugin that the host may adjust during compression (since BLIMP_PLUGIN_ABI_1_2_0).
+ */
+typedef enum BlimpCompressionParameter_Tag {
+    BLIMP_COMPRESSION_PARAMETER_LEVEL = 1,      /* plugin-specific compression level; higher values compress better */
+    BLIMP_COMPRESSION_PARAMETER_THREADS = 2     /* number of worker threads; 0 compresses on the calling thread */
+} BlimpCompressionParameter;
+
+/** Since BLIMP_PLUGIN_ABI_1_2_0, get_compression_parameter retrieves the current value of a parameter along with
+ * the range of values the plugin accepts, and set_compression_parameter changes it. A changed value takes effect with
+ * the next compressed stream. Both return BLIMP_PLUGIN_RESULT_INVALID_ARGUMENT for parameters the plugin does not
+ * support, as does set_compression_parameter for values outside of the accepted range.
+ */
 struct BlimpPluginCompressionState;
 typedef struct BlimpPluginCompressionState* BlimpPluginCompressionStateHandle;
 
@@ -90,12 +138,33 @@ typedef struct BlimpPluginCompression_Tag {
     BlimpPluginResult (*compress_file_chunk)(BlimpPluginCompressionStateHandle state, BlimpFileChunk chunk);
     BlimpPluginResult (*decompress_file_chunk)(BlimpPluginCompressionStateHandle state, BlimpFileChunk chunk);
     BlimpFileChunk (*get_processed_chunk)(BlimpPluginCompressionStateHandle state);
+    /* since BLIMP_PLUGIN_ABI_1_1_0 */
+    void (*set_buffer_pool)(BlimpPluginCompressionStateHandle state, BlimpBufferPool pool);
+    BlimpLentChunk (*take_processed_chunk)(BlimpPluginCompressionStateHandle state);
+    /* since BLIMP_PLUGIN_ABI_1_2_0 */
+    BlimpPluginResult (*get_compression_parameter)(BlimpPluginCompressionStateHandle state,
+                                                   BlimpCompressionParameter parameter, int64_t* value,
+                                                   int64_t* min_value, int64_t* max_value);
+    BlimpPluginResult (*set_compression_parameter)(BlimpPluginCompressionStateHandle state,
+                                                   BlimpCompressionParameter parameter, int64_t value);
 } BlimpPluginCompression;
 
 typedef BlimpPluginResult (*blimp_plugin_compression_initialize_type)(BlimpKeyValueStore, BlimpPluginCompression*);
 typedef void (*blimp_plugin_compression_shutdown_type)(BlimpPluginCompression* plugin);
 
 
+/** Encryption plugins process the contents of one storage container at a time, selected by new_storage_container.
+ * The contents of a container may be encrypted as several consecutive streams, each one finished by passing a chunk
+ * with data == NULL to encrypt_file_chunk. Decryption has to be finished at the same stream boundaries.
+ * Since BLIMP_PLUGIN_ABI_1_2_0, seek_decryption prepares decrypting the container from the start of any of its
+ * streams, given as offset into the encrypted container. The host then passes the encrypted data starting at
+ * out_read_offset, which may precede the requested offset if the plugin needs data from before the stream.
+ * Since BLIMP_PLUGIN_ABI_1_3_0, encrypted streams can be taken back: mark_encryption records the state of the
+ * encryption between two streams, and rewind_encryption returns to the most recent mark of the current container, as
+ * if the streams encrypted since had never been. The host discards the output of those streams.
+ * Negative container ids denote data the host keeps outside of storage containers, such as small file contents stored
+ * inline in its database; they are encrypted like any other container.
+ */
 struct BlimpPluginEncryptionState;
 typedef struct BlimpPluginEncryptionState* BlimpPluginEncryptionStateHandle;
 
@@ -118,14 +187,48 @@ typedef struct BlimpPluginEncryption_Tag {
     BlimpPluginResult (*encrypt_file_chunk)(BlimpPluginEncryptionStateHandle state, BlimpFileChunk chunk);
     BlimpPluginResult (*decrypt_file_chunk)(BlimpPluginEncryptionStateHandle state, BlimpFileChunk file_chunk);
     BlimpFileChunk (*get_processed_chunk)(BlimpPluginEncryptionStateHandle state);
+    /* since BLIMP_PLUGIN_ABI_1_1_0 */
+    void (*set_buffer_pool)(BlimpPluginEncryptionStateHandle state, BlimpBufferPool pool);
+    BlimpLentChunk (*take_processed_chunk)(BlimpPluginEncryptionStateHandle state);
+    /* since BLIMP_PLUGIN_ABI_1_2_0 */
+    BlimpPluginResult (*seek_decryption)(BlimpPluginEncryptionStateHandle state, int64_t offset,
+                                         int64_t* out_read_offset);
+    /* since BLIMP_PLUGIN_ABI_1_3_0 */
+    BlimpPluginResult (*mark_encryption)(BlimpPluginEncryptionStateHandle state);
+    BlimpPluginResult (*rewind_encryption)(BlimpPluginEncryptionStateHandle state);
 } BlimpPluginEncryption;
 
 typedef BlimpPluginResult (*blimp_plugin_encryption_initialize_type)(BlimpKeyValueStore, BlimpPluginEncryption*);
 typedef void (*blimp_plugin_encryption_shutdown_type)(BlimpPluginEncryption* plugin);
 
+/** Storage plugins write one container at a time, through new_storage_container, store_file_chunk and
+ * finalize_storage_container.
+ * Since BLIMP_PLUGIN_ABI_1_1_0, a finalized container can be read back: open_storage_container opens the container
+ * at a location previously returned by finalize_storage_container, and each call to read_file_chunk then returns the
+ * next chunk of its contents. A chunk with data == NULL marks the end of the container. A returned chunk remains
+ * valid until the next call into the plugin.
+ * Ranges of the opened container can also be read at arbitrary offsets into memory provided by the host, either
+ * right away through read_range, or asynchronously through submit_read_requests. All submitted requests have to be
+ * completed through wait_read_request before another container is opened.
+ * Since BLIMP_PLUGIN_ABI_1_3_0, truncate_storage_container discards the data stored into the current container beyond
+ * size, so that storing continues at size. Storage plugins did not change with BLIMP_PLUGIN_ABI_1_2_0.
+ */
 struct BlimpPluginStorageState;
 typedef struct BlimpPluginStorageState* BlimpPluginStorageStateHandle;
 
+/** Request to read size bytes at offset of the opened container into buffer (since BLIMP_PLUGIN_ABI_1_1_0).
+ * The request and its buffer have to remain valid until the request was completed by wait_read_request.
+ * Reading beyond the end of the container is not an error; out_size then receives the number of bytes that were
+ * available, which may be 0.
+ */
+typedef struct BlimpStorageReadRequest_Tag {
+    int64_t offset;
+    int64_t size;
+    char* buffer;
+    int64_t out_size;
+    BlimpPluginResult out_result;
+} BlimpStorageReadRequest;
+
 typedef struct BlimpPluginStorage_Tag {
     BlimpPluginABI abi;
     BlimpPluginStorageStateHandle state;
@@ -135,6 +238,17 @@ typedef struct BlimpPluginStorage_Tag {
     BlimpPluginResult (*finalize_storage_container)(BlimpPluginStorageStateHandle state,
                                                     BlimpStorageContainerLocation* out_location);
     BlimpPluginResult (*store_file_chunk)(BlimpPluginStorageStateHandle state, BlimpFileChunk chunk);
+    /* since BLIMP_PLUGIN_ABI_1_1_0 */
+    BlimpPluginResult (*open_storage_container)(BlimpPluginStorageStateHandle state,
+                                                BlimpStorageContainerLocation location);
+    BlimpPluginResult (*read_file_chunk)(BlimpPluginStorageStateHandle state, BlimpFileChunk* out_chunk);
+    BlimpPluginResult (*read_range)(BlimpPluginStorageStateHandle state, int64_t offset, char* buffer, int64_t size,
+                                    int64_t* out_size);
+    BlimpPluginResult (*submit_read_requests)(BlimpPluginStorageStateHandle state, BlimpStorageReadRequest* requests,
+                                              int64_t n_requests);
+    BlimpPluginResult (*wait_read_request)(BlimpPluginStorageStateHandle state, BlimpStorageReadRequest* request);
+    /* since BLIMP_PLUGIN_ABI_1_3_0 */
+    BlimpPluginResult (*truncate_storage_container)(BlimpPluginStorageStateHandle state, int64_t size);
 } BlimpPluginStorage;
 
 typedef BlimpPluginResult (*blimp_plugin_storage_initialize_type)(BlimpKeyValueStore, BlimpPluginStorage*);
@@ -0,0 +1,154 @@
+#ifndef BLIMP_INCLUDE_GUARD_BLIMP_PLUGIN_SDK_PLUGIN_TEST_HELPER_CPP_HPP
+#define BLIMP_INCLUDE_GUARD_BLIMP_PLUGIN_SDK_PLUGIN_TEST_HELPER_CPP_HPP
+
+#include <blimp_plugin_sdk.h>
+
+#include <catch.hpp>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+/** In-memory key value store standing in for the database of the host.
+ * Counts the calls the plugin makes, and records the key that was retrieved last.
+ */
+struct BlimpKeyValueStoreState {
+    std::unordered_map<std::string, std::string> storage;
+    int call_count_store;
+    int call_count_retrieve;
+    std::string last_key_retrieve;
+
+    BlimpKeyValueStoreState()
+        :call_count_store(0), call_count_retrieve(0)
+    {}
+
+    void store(std::string const& key, BlimpKeyValueStoreValue const& v)
+    {
+        ++call_count_store;
+        storage.insert(std::make_pair(key, std::string(v.data, v.data + v.size)));
+    }
+
+    BlimpKeyValueStoreValue retrieve(std::string const& key)
+    {
+        ++call_count_retrieve;
+        last_key_retrieve = key;
+        auto it = storage.find(key);
+        return (it != storage.end()) ?
+            BlimpKeyValueStoreValue{ .data = it->second.data(), .size = static_cast<int64_t>(it->second.size()) } :
+            BlimpKeyValueStoreValue{ .data = nullptr, .size = -1 };
+    }
+
+    operator BlimpKeyValueStore() {
+        return BlimpKeyValueStore {
+            .state = this,
+            .store = [](BlimpKeyValueStoreStateHandle state, char const* key, BlimpKeyValueStoreValue value)
+            {
+                return state->store(key, value);
+            },
+            .retrieve = [](BlimpKeyValueStoreStateHandle state, char const* key) -> BlimpKeyValueStoreValue
+            {
+                return state->retrieve(key);
+            }
+        };
+    }
+};
+
+/** Linear congruential generator for test data that is the same on every run and platform.
+ */
+class TestRandom {
+private:
+    std::uint32_t m_state;
+public:
+    explicit TestRandom(std::uint32_t seed)
+        :m_state(seed)
+    {}
+
+    std::uint32_t next() {
+        m_state = m_state * 1664525u + 1013904223u;
+        return m_state;
+    }
+};
+
+/** Returns size bytes of compressible text, made up of words from a vocabulary of n_words words.
+ */
+inline std::vector<char> generateText(std::size_t size, std::uint32_t seed = 42, std::uint32_t n_words = 1000)
+{
+    std::vector<char> ret;
+    ret.reserve(size);
+    TestRandom rng(seed);
+    while (ret.size() < size) {
+        std::uint32_t const r = rng.next();
+        std::string const word = "word" + std::to_string((r >> 16) % n_words) + ((r & 0x100) ? " " : ", ");
+        ret.insert(ret.end(), word.begin(), word.end());
+    }
+    ret.resize(size);
+    return ret;
+}
+
+/** Returns size bytes of incompressible data.
+ */
+inline std::vector<char> generateNoise(std::size_t size, std::uint32_t seed = 4711)
+{
+    std::vector<char> ret(size);
+    TestRandom rng(seed);
+    for (auto& c : ret) {
+        c = static_cast<char>(rng.next() >> 24);
+    }
+    return ret;
+}
+
+/** Compresses data, passed to the plugin in chunks of chunk_size bytes, as one stream.
+ */
+inline std::vector<char> compressAll(BlimpPluginCompression& compression, std::vector<char> const& data,
+                                     std::size_t chunk_size)
+{
+    std::vector<char> ret;
+    auto const drain = [&]() {
+        for (BlimpFileChunk c = compression.get_processed_chunk(compression.state); c.data;
+             c = compression.get_processed_chunk(compression.state))
+        {
+            ret.insert(ret.end(), c.data, c.data + c.size);
+        }
+    };
+    for (std::size_t offset = 0; offset < data.size(); offset += chunk_size) {
+        std::size_t const n = std::min(chunk_size, data.size() - offset);
+        REQUIRE(compression.compress_file_chunk(compression.state,
+                                                BlimpFileChunk{ .data = data.data() + offset,
+                                                                .size = static_cast<int64_t>(n) }) ==
+                BLIMP_PLUGIN_RESULT_OK);
+        drain();
+    }
+    REQUIRE(compression.compress_file_chunk(compression.state, BlimpFileChunk{ .data = nullptr, .size = 0 }) ==
+            BLIMP_PLUGIN_RESULT_OK);
+    drain();
+    return ret;
+}
+
+/** Decompresses data, passed to the plugin in chunks of chunk_size bytes, up to the end of the input.
+ */
+inline std::vector<char> decompressAll(BlimpPluginCompression& compression, std::vector<char> const& data,
+                                       std::size_t chunk_size)
+{
+    for (std::size_t offset = 0; offset < data.size(); offset += chunk_size) {
+        std::size_t const n = std::min(chunk_size, data.size() - offset);
+        REQUIRE(compression.decompress_file_chunk(compression.state,
+                                                  BlimpFileChunk{ .data = data.data() + offset,
+                                                                  .size = static_cast<int64_t>(n) }) ==
+                BLIMP_PLUGIN_RESULT_OK);
+    }
+    REQUIRE(compression.decompress_file_chunk(compression.state, BlimpFileChunk{ .data = nullptr, .size = 0 }) ==
+            BLIMP_PLUGIN_RESULT_OK);
+    std::vector<char> ret;
+    for (BlimpFileChunk c = compression.get_processed_chunk(compression.state); c.data;
+         c = compression.get_processed_chunk(compression.state))
+    {
+        ret.insert(ret.end(), c.data, c.data + c.size);
+    }
+    return ret;
+}
+
+#endif
@@ -0,0 +1,84 @@
+#include <buffer_pool.hpp>
+
+#include <gbBase/Assert.hpp>
+
+#include <algorithm>
+
+struct BlimpBufferPoolState {
+    BufferPool* pool;
+};
+
+BufferPool::BufferPool(std::size_t buffer_size, std::size_t n_buffers)
+    :m_bufferSize(buffer_size), m_bufferCount(n_buffers), m_storage(std::make_unique<char[]>(buffer_size * n_buffers)),
+     m_peakBuffersInUse(0), m_poolState(std::make_unique<BlimpBufferPoolState>())
+{
+    GHULBUS_PRECONDITION(buffer_size > 0);
+    m_poolState->pool = this;
+    m_freeTokens.reserve(n_buffers);
+    // tokens are 1-based, as a token of 0 denotes memory owned by a plugin
+    for (std::uint64_t token = n_buffers; token > 0; --token) {
+        m_freeTokens.push_back(token);
+    }
+}
+
+BufferPool::~BufferPool()
+{
+    GHULBUS_ASSERT(m_freeTokens.size() == m_bufferCount);
+}
+
+std::size_t BufferPool::getBufferSize() const
+{
+    return m_bufferSize;
+}
+
+std::size_t BufferPool::getBufferCount() const
+{
+    return m_bufferCount;
+}
+
+BlimpBuffer BufferPool::acquire()
+{
+    std::lock_guard lk(m_mtx);
+    if (m_freeTokens.empty()) {
+        return BlimpBuffer{ .data = nullptr, .capacity = 0, .token = 0 };
+    }
+    std::uint64_t const token = m_freeTokens.back();
+    m_freeTokens.pop_back();
+    m_peakBuffersInUse = std::max(m_peakBuffersInUse, m_bufferCount - m_freeTokens.size());
+    return BlimpBuffer{ .data = m_storage.get() + ((token - 1) * m_bufferSize),
+                        .capacity = static_cast<int64_t>(m_bufferSize),
+                        .token = token };
+}
+
+void BufferPool::release(std::uint64_t token)
+{
+    GHULBUS_PRECONDITION((token > 0) && (token <= m_bufferCount));
+    std::lock_guard lk(m_mtx);
+    GHULBUS_ASSERT(m_freeTokens.size() < m_bufferCount);
+    m_freeTokens.push_back(token);
+}
+
+std::size_t BufferPool::getBuffersInUse()
+{
+    std::lock_guard lk(m_mtx);
+    return m_bufferCount - m_freeTokens.size();
+}
+
+std::size_t BufferPool::getPeakBuffersInUse()
+{
+    std::lock_guard lk(m_mtx);
+    return m_peakBuffersInUse;
+}
+
+BlimpBufferPool BufferPool::getPluginBufferPool() const
+{
+    BlimpBufferPool ret;
+    ret.state = m_poolState.get();
+    ret.acquire = [](BlimpBufferPoolStateHandle state) -> BlimpBuffer {
+        return state->pool->acquire();
+    };
+    ret.release = [](BlimpBufferPoolStateHandle state, uint64_t token) {
+        state->pool->release(token);
+    };
+    return ret;
+}
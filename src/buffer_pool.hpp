@@ -0,0 +1,48 @@
+#ifndef BLIMP_INCLUDE_GUARD_BUFFER_POOL_HPP
+#define BLIMP_INCLUDE_GUARD_BUFFER_POOL_HPP
+
+#include <blimp_plugin_sdk.h>
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+/** Fixed set of equally sized buffers, lent to the plugins of a processing pipeline.
+ * Plugins write their output directly to pool buffers and pass ownership on to the host, so that a chunk travels
+ * from one pipeline stage to the next without being copied. Since the number of buffers is fixed, the memory of
+ * all chunks in flight is bounded by the pool. acquire() does not block; if the pool is exhausted, plugins fall back
+ * to memory of their own.
+ * The pool must outlive all plugins it was passed to.
+ */
+class BufferPool {
+private:
+    std::size_t m_bufferSize;
+    std::size_t m_bufferCount;
+    std::unique_ptr<char[]> m_storage;
+    std::mutex m_mtx;
+    std::vector<std::uint64_t> m_freeTokens;
+    std::size_t m_peakBuffersInUse;
+    std::unique_ptr<BlimpBufferPoolState> m_poolState;
+public:
+    BufferPool(std::size_t buffer_size, std::size_t n_buffers);
+    ~BufferPool();
+
+    BufferPool(BufferPool const&) = delete;
+    BufferPool& operator=(BufferPool const&) = delete;
+
+    std::size_t getBufferSize() const;
+    std::size_t getBufferCount() const;
+
+    /** Returns a buffer with data == nullptr if all buffers are in use.
+     */
+    BlimpBuffer acquire();
+    void release(std::uint64_t token);
+
+    std::size_t getBuffersInUse();
+    std::size_t getPeakBuffersInUse();
+
+    BlimpBufferPool getPluginBufferPool() const;
+};
+
+#endif
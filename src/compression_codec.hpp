@@ -0,0 +1,29 @@
+#ifndef BLIMP_INCLUDE_GUARD_COMPRESSION_CODEC_HPP
+#define BLIMP_INCLUDE_GUARD_COMPRESSION_CODEC_HPP
+
+#include <cstdint>
+
+/** The compression applied to a block of a storage container.
+ * Values are recorded in the database and must not change.
+ */
+enum class CompressionCodec : std::int64_t {
+    Zlib = 0,                   ///< compression_zlib plugin; used for all data written before codecs were recorded
+    None = 1,                   ///< data is stored as is
+    Lz4 = 2,                    ///< compression_lz4 plugin
+    Zstd = 3,                   ///< compression_zstd plugin
+};
+
+/** Returns the name of the compression plugin implementing codec, or nullptr for CompressionCodec::None.
+ */
+constexpr char const* compressionPluginName(CompressionCodec codec)
+{
+    switch (codec) {
+    case CompressionCodec::Zlib: return "compression_zlib";
+    case CompressionCodec::Lz4:  return "compression_lz4";
+    case CompressionCodec::Zstd: return "compression_zstd";
+    case CompressionCodec::None: return nullptr;
+    }
+    return nullptr;
+}
+
+#endif
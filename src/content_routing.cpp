@@ -0,0 +1,98 @@
+#include <content_routing.hpp>
+
+#include <algorithm>
+#include <array>
+#include <cctype>
+#include <string>
+#include <string_view>
+
+namespace {
+struct MagicBytes {
+    std::size_t offset;
+    std::string_view bytes;
+};
+
+using namespace std::string_view_literals;
+
+/// Signatures of formats that carry compressed data
+constexpr std::array g_compressedFormats = {
+    MagicBytes{ 0, "\xFF\xD8\xFF"sv },                          // JPEG
+    MagicBytes{ 0, "\x89PNG\r\n\x1A\n"sv },                     // PNG
+    MagicBytes{ 0, "GIF8"sv },                                  // GIF
+    MagicBytes{ 8, "WEBP"sv },                                  // WebP
+    MagicBytes{ 8, "AVI "sv },                                  // AVI
+    MagicBytes{ 4, "ftyp"sv },                                  // MP4, MOV, HEIC
+    MagicBytes{ 0, "\x1A\x45\xDF\xA3"sv },                      // Matroska, WebM
+    MagicBytes{ 0, "OggS"sv },                                  // Ogg
+    MagicBytes{ 0, "fLaC"sv },                                  // FLAC
+    MagicBytes{ 0, "ID3"sv },                                   // MP3
+    MagicBytes{ 0, "PK\x03\x04"sv },                            // Zip and derived formats
+    MagicBytes{ 0, "\x1F\x8B"sv },                              // gzip
+    MagicBytes{ 0, "BZh"sv },                                   // bzip2
+    MagicBytes{ 0, "\xFD" "7zXZ\x00"sv },                       // xz
+    MagicBytes{ 0, "7z\xBC\xAF\x27\x1C"sv },                    // 7-Zip
+    MagicBytes{ 0, "Rar!\x1A\x07"sv },                          // RAR
+    MagicBytes{ 0, "\x28\xB5\x2F\xFD"sv },                      // zstd
+    MagicBytes{ 0, "\x04\x22\x4D\x18"sv },                      // LZ4 frame
+};
+
+constexpr std::array g_compressedExtensions = {
+    ".jpg"sv, ".jpeg"sv, ".png"sv, ".gif"sv, ".webp"sv, ".heic"sv, ".avif"sv,
+    ".mp3"sv, ".m4a"sv, ".aac"sv, ".ogg"sv, ".opus"sv, ".flac"sv,
+    ".mp4"sv, ".m4v"sv, ".mov"sv, ".mkv"sv, ".webm"sv, ".avi"sv,
+    ".zip"sv, ".gz"sv, ".tgz"sv, ".bz2"sv, ".xz"sv, ".7z"sv, ".rar"sv, ".zst"sv, ".lz4"sv,
+    ".jar"sv, ".apk"sv, ".docx"sv, ".xlsx"sv, ".pptx"sv, ".odt"sv,
+};
+
+constexpr std::array g_logExtensions = {
+    ".log"sv,
+};
+
+constexpr std::array g_diskImageExtensions = {
+    ".vmdk"sv, ".vdi"sv, ".vhd"sv, ".vhdx"sv, ".qcow2"sv, ".img"sv, ".iso"sv,
+};
+
+bool hasMagicBytes(std::span<char const> data, MagicBytes const& magic)
+{
+    if (data.size() < magic.offset + magic.bytes.size()) { return false; }
+    return std::equal(magic.bytes.begin(), magic.bytes.end(), data.begin() + magic.offset);
+}
+
+std::string lowercaseExtension(boost::filesystem::path const& p)
+{
+    std::string ret = p.extension().string();
+    std::transform(ret.begin(), ret.end(), ret.begin(),
+                   [](char c) { return static_cast<char>(std::tolower(static_cast<unsigned char>(c))); });
+    return ret;
+}
+
+template<std::size_t N>
+bool isOneOf(std::string const& extension, std::array<std::string_view, N> const& extensions)
+{
+    return std::find(extensions.begin(), extensions.end(), extension) != extensions.end();
+}
+
+/** Rotated logs carry a number after their extension, as in syslog.log.1
+ */
+bool isLogFile(boost::filesystem::path const& p)
+{
+    std::string const extension = lowercaseExtension(p);
+    if (isOneOf(extension, g_logExtensions)) { return true; }
+    bool const is_rotation = (extension.size() > 1) &&
+        std::all_of(extension.begin() + 1, extension.end(), [](char c) { return (c >= '0') && (c <= '9'); });
+    return is_rotation && isOneOf(lowercaseExtension(p.stem()), g_logExtensions);
+}
+}
+
+CompressionCodec routeContent(FileInfo const& file, std::span<char const> first_chunk)
+{
+    if (std::any_of(g_compressedFormats.begin(), g_compressedFormats.end(),
+                    [first_chunk](MagicBytes const& m) { return hasMagicBytes(first_chunk, m); }))
+    {
+        return CompressionCodec::None;
+    }
+    if (isOneOf(lowercaseExtension(file.path), g_compressedExtensions)) { return CompressionCodec::None; }
+    if (isLogFile(file.path)) { return CompressionCodec::Lz4; }
+    if (isOneOf(lowercaseExtension(file.path), g_diskImageExtensions)) { return CompressionCodec::Zstd; }
+    return CompressionCodec::Zlib;
+}
@@ -0,0 +1,20 @@
+#ifndef BLIMP_INCLUDE_GUARD_CONTENT_ROUTING_HPP
+#define BLIMP_INCLUDE_GUARD_CONTENT_ROUTING_HPP
+
+#include <compression_codec.hpp>
+#include <file_info.hpp>
+
+#include <span>
+
+/** Chooses the compression codec for storing a file content.
+ * Data that is compressed already, like images, audio, video and archives, is stored as is. Log files, which are
+ * large and compress well with any codec, use the fast LZ4 codec. Virtual machine and disk images, which are huge
+ * and repeat data over long distances, use zstd. Everything else, source code in particular, is compressed with zlib.
+ * The format is recognized from the magic bytes at the start of the content first, so that a compressed archive is
+ * never compressed again regardless of its name, and from the file extension otherwise.
+ * @param[in] file The file the content is read from.
+ * @param[in] first_chunk The start of the content; may be shorter than any of the magic byte sequences, or empty.
+ */
+CompressionCodec routeContent(FileInfo const& file, std::span<char const> first_chunk);
+
+#endif
@@ -9,11 +9,13 @@
 #include <db/table/file_contents.hpp>
 #include <db/table/file_elements.hpp>
 #include <db/table/indexed_locations.hpp>
+#include <db/table/inline_contents.hpp>
 #include <db/table/plugin_kv_store.hpp>
 #include <db/table/user_selection.hpp>
 #include <db/table/snapshots.hpp>
 #include <db/table/snapshot_contents.hpp>
 #include <db/table/sqlite_master.hpp>
+#include <db/table/storage_blocks.hpp>
 #include <db/table/storage_containers.hpp>
 #include <db/table/storage_inventory.hpp>
 
@@ -28,9 +30,13 @@
 
 #include <cstdint>
 #include <limits>
+#include <mutex>
 
 namespace
 {
+/// databases of older versions are migrated to the current version when they are opened
+constexpr int g_oldestMigratableVersion = 10000;
+
 inline bool constexpr sqlpp11_debug()
 {
 #ifdef NDEBUG
@@ -50,6 +56,7 @@ std::string to_string(boost::filesystem::path const& p)
 struct BlimpDB::Pimpl
 {
     sqlpp::sqlite3::connection db;
+    std::mutex mtx_plugin_kv_store;
 
     struct prepared_statements {
 
@@ -91,6 +98,8 @@ void createBlimpPropertiesTable(sqlpp::sqlite3::connection& db)
     db.execute(blimpdb::table_layout::snapshot_contents());
     db.execute(blimpdb::table_layout::storage_containers());
     db.execute(blimpdb::table_layout::storage_inventory());
+    db.execute(blimpdb::table_layout::storage_blocks());
+    db.execute(blimpdb::table_layout::inline_contents());
 
     db.execute("CREATE UNIQUE INDEX idx_indexed_locations_paths ON indexed_locations (path);");
     db.execute("CREATE INDEX idx_file_element_locations ON file_elements (location_id);");
@@ -138,15 +147,31 @@ void BlimpDB::openExistingFileDatabase(std::string const& db_filename)
     }
 
     auto const prop_tab = blimpdb::BlimpProperties{};
+    int version = 0;
     for(auto const& r : db(select(prop_tab.value).from(prop_tab).where(prop_tab.id == "version")))
     {
-        int const version = std::stoi(r.value);
-        GHULBUS_LOG(Trace, "Database version " << version);
-        if(version != BlimpVersion::version())
-        {
-            GHULBUS_THROW(Exceptions::DatabaseError(), "Unsupported database version " + std::string(r.value) + ".");
-        }
+        version = std::stoi(r.value);
+    }
+    GHULBUS_LOG(Trace, "Database version " << version);
+    if((version < g_oldestMigratableVersion) || (version > BlimpVersion::version()))
+    {
+        GHULBUS_THROW(Exceptions::DatabaseError(), "Unsupported database version " + std::to_string(version) + ".");
     }
+    if(version == BlimpVersion::version()) { return; }
+
+    GHULBUS_LOG(Info, "Migrating database from version " << version << " to " << BlimpVersion::version() << ".");
+    db.start_transaction();
+    if(version < 10100)
+    {
+        // 1.1.0 writes storage containers in blocks, records the codec of all stored data and stores small contents
+        // inline; all data stored before was compressed with zlib, which is codec 0
+        db.execute(blimpdb::table_layout::storage_blocks());
+        db.execute("ALTER TABLE storage_inventory ADD COLUMN codec INTEGER NOT NULL DEFAULT 0;");
+        db.execute(blimpdb::table_layout::inline_contents());
+    }
+    db(update(prop_tab).set(prop_tab.value = std::to_string(BlimpVersion::version()))
+                       .where(prop_tab.id == "version"));
+    db.commit_transaction();
 }
 
 void BlimpDB::setUserSelection(std::vector<std::string> const& selected_files)
@@ -443,10 +468,13 @@ StorageContainerId BlimpDB::newStorageContainer()
     return StorageContainerId{ .i = container_id };
 }
 
-void BlimpDB::finalizeStorageContainer(StorageContainer const& storage_container, bool do_sync)
+void BlimpDB::finalizeStorageContainer(StorageContainer const& storage_container,
+                                       std::span<StorageBlock const> const& blocks,
+                                       bool do_sync)
 {
     auto& db = m_pimpl->db;
     auto const tab_storage_containers = blimpdb::StorageContainers{};
+    auto const tab_storage_blocks = blimpdb::StorageBlocks{};
     if (do_sync) { db.start_transaction(); }
     auto const r = db(select(tab_storage_containers.location)
                       .from(tab_storage_containers)
@@ -459,6 +487,12 @@ void BlimpDB::finalizeStorageContainer(StorageContainer const& storage_container
     }
     db(update(tab_storage_containers).set(tab_storage_containers.location = storage_container.location.l)
                                      .where(tab_storage_containers.containerId == storage_container.id.i));
+    for (auto const& b : blocks) {
+        db(insert_into(tab_storage_blocks).set(tab_storage_blocks.containerId = storage_container.id.i,
+                                               tab_storage_blocks.offset = b.offset,
+                                               tab_storage_blocks.storedOffset = b.stored_offset,
+                                               tab_storage_blocks.codec = static_cast<std::int64_t>(b.codec)));
+    }
     if (do_sync) { db.commit_transaction(); }
 }
 
@@ -475,11 +509,27 @@ void BlimpDB::newStorageElement(FileContentId const& content_id,
                                                   tab_storage_inventory.containerId = l.container_id.i,
                                                   tab_storage_inventory.offset = l.offset,
                                                   tab_storage_inventory.size = l.size,
-                                                  tab_storage_inventory.partNumber = l.part_number));
+                                                  tab_storage_inventory.partNumber = l.part_number,
+                                                  tab_storage_inventory.codec = static_cast<std::int64_t>(l.codec)));
     }
     if (do_sync) { db.commit_transaction(); }
 }
 
+void BlimpDB::newInlineContent(InlineContent const& content, bool do_sync)
+{
+    auto& db = m_pimpl->db;
+    auto const tab_inline_contents = blimpdb::InlineContents{};
+
+    std::vector<std::uint8_t> const nonce{ content.nonce.begin(), content.nonce.end() };
+    std::vector<std::uint8_t> const data{ content.data.begin(), content.data.end() };
+    if (do_sync) { db.start_transaction(); }
+    db(insert_into(tab_inline_contents).set(tab_inline_contents.contentId = content.content_id.i,
+                                            tab_inline_contents.codec = static_cast<std::int64_t>(content.codec),
+                                            tab_inline_contents.nonce = nonce,
+                                            tab_inline_contents.data = data));
+    if (do_sync) { db.commit_transaction(); }
+}
+
 void BlimpDB::addSnapshotContents(SnapshotId const& snapshot_id,
                                   std::span<FileElementId const> const& files,
                                   bool do_sync)
@@ -505,6 +555,7 @@ void BlimpDB::pluginStoreValue(BlimpPluginInfo const& plugin, char const* key, B
 
     std::string const store_key = to_string(plugin.uuid) + "//" + key;
     std::vector<std::uint8_t> const data{ value.data, value.data + value.size };
+    std::lock_guard lk(m_pimpl->mtx_plugin_kv_store);
     if (db(select(tab_plugin_kv_store.value).from(tab_plugin_kv_store)
                                             .where(tab_plugin_kv_store.storeKey == store_key)).empty())
     {
@@ -522,6 +573,7 @@ BlimpDB::PluginStoreValue BlimpDB::pluginRetrieveValue(BlimpPluginInfo const& pl
     auto const tab_plugin_kv_store = blimpdb::PluginKvStore{};
 
     std::string const store_key = to_string(plugin.uuid) + "//" + key;
+    std::lock_guard lk(m_pimpl->mtx_plugin_kv_store);
     auto const res =
         db(select(tab_plugin_kv_store.value).from(tab_plugin_kv_store)
                                             .where(tab_plugin_kv_store.storeKey == store_key));
@@ -571,6 +623,7 @@ std::vector<BlimpDB::StorageElement> BlimpDB::getFileStorageInfo(FileElementId c
                           tab_storage_inventory.offset,
                           tab_storage_inventory.size,
                           tab_storage_inventory.partNumber,
+                          tab_storage_inventory.codec,
                           tab_storage_containers.location)
         .from(tab_file_elements
               .inner_join(tab_storage_inventory).on(tab_storage_inventory.contentId == tab_file_elements.contentId)
@@ -585,6 +638,7 @@ std::vector<BlimpDB::StorageElement> BlimpDB::getFileStorageInfo(FileElementId c
         se.location.offset = r.offset;
         se.location.size = r.size;
         se.location.part_number = r.partNumber;
+        se.location.codec = static_cast<CompressionCodec>(r.codec.value());
         ret.push_back(std::move(se));
     }
     std::sort(begin(ret), end(ret),
@@ -595,6 +649,125 @@ std::vector<BlimpDB::StorageElement> BlimpDB::getFileStorageInfo(FileElementId c
     return ret;
 }
 
+std::vector<BlimpDB::SnapshotStorageElement> BlimpDB::getStorageElementsForSnapshot(SnapshotId const& snapshot_id)
+{
+    auto& db = m_pimpl->db;
+    auto const tab_snapshot_contents = blimpdb::SnapshotContents{};
+    auto const tab_file_elements = blimpdb::FileElements{};
+    auto const tab_file_contents = blimpdb::FileContents{};
+    auto const tab_storage_inventory = blimpdb::StorageInventory{};
+    auto const tab_storage_containers = blimpdb::StorageContainers{};
+    auto const q = select(tab_file_elements.fileId,
+                          tab_file_contents.hash,
+                          tab_storage_inventory.containerId,
+                          tab_storage_inventory.offset,
+                          tab_storage_inventory.size,
+                          tab_storage_inventory.partNumber,
+                          tab_storage_inventory.codec,
+                          tab_storage_containers.location)
+        .from(tab_snapshot_contents
+              .inner_join(tab_file_elements).on(tab_file_elements.fileId == tab_snapshot_contents.fileId)
+              .inner_join(tab_file_contents).on(tab_file_contents.contentId == tab_file_elements.contentId)
+              .inner_join(tab_storage_inventory).on(tab_storage_inventory.contentId == tab_file_elements.contentId)
+              .inner_join(tab_storage_containers).on(tab_storage_containers.containerId == tab_storage_inventory.containerId))
+        .where(tab_snapshot_contents.snapshotId == snapshot_id.i);
+    std::vector<SnapshotStorageElement> ret;
+    for (auto const& r : db(q)) {
+        SnapshotStorageElement se;
+        se.file_id.i = r.fileId;
+        se.content_hash = Hash::from_string(r.hash);
+        se.storage.container.id.i = r.containerId;
+        se.storage.container.location.l = r.location;
+        se.storage.location.container_id.i = r.containerId;
+        se.storage.location.offset = r.offset;
+        se.storage.location.size = r.size;
+        se.storage.location.part_number = r.partNumber;
+        se.storage.location.codec = static_cast<CompressionCodec>(r.codec.value());
+        ret.push_back(std::move(se));
+    }
+    std::sort(begin(ret), end(ret),
+              [](SnapshotStorageElement const& lhs, SnapshotStorageElement const& rhs)
+              {
+                  return std::tie(lhs.storage.location.container_id.i, lhs.storage.location.offset, lhs.file_id.i) <
+                         std::tie(rhs.storage.location.container_id.i, rhs.storage.location.offset, rhs.file_id.i);
+              });
+    return ret;
+}
+
+std::optional<BlimpDB::InlineContent> BlimpDB::getFileInlineContent(FileElementId const& file_id)
+{
+    auto& db = m_pimpl->db;
+    auto const tab_file_elements = blimpdb::FileElements{};
+    auto const tab_inline_contents = blimpdb::InlineContents{};
+    auto const q = select(tab_inline_contents.contentId, tab_inline_contents.codec, tab_inline_contents.nonce,
+                          tab_inline_contents.data)
+        .from(tab_file_elements
+              .inner_join(tab_inline_contents).on(tab_inline_contents.contentId == tab_file_elements.contentId))
+        .where(tab_file_elements.fileId == file_id.i);
+    auto const res = db(q);
+    if (res.empty()) { return std::nullopt; }
+    auto const& r = res.front();
+    InlineContent ret;
+    ret.content_id.i = r.contentId;
+    ret.codec = static_cast<CompressionCodec>(r.codec.value());
+    ret.nonce.assign(r.nonce.blob, r.nonce.blob + r.nonce.len);
+    ret.data.assign(r.data.blob, r.data.blob + r.data.len);
+    return ret;
+}
+
+std::vector<BlimpDB::SnapshotInlineContent> BlimpDB::getInlineContentsForSnapshot(SnapshotId const& snapshot_id)
+{
+    auto& db = m_pimpl->db;
+    auto const tab_snapshot_contents = blimpdb::SnapshotContents{};
+    auto const tab_file_elements = blimpdb::FileElements{};
+    auto const tab_file_contents = blimpdb::FileContents{};
+    auto const tab_inline_contents = blimpdb::InlineContents{};
+    auto const q = select(tab_file_elements.fileId,
+                          tab_file_contents.hash,
+                          tab_inline_contents.contentId,
+                          tab_inline_contents.codec,
+                          tab_inline_contents.nonce,
+                          tab_inline_contents.data)
+        .from(tab_snapshot_contents
+              .inner_join(tab_file_elements).on(tab_file_elements.fileId == tab_snapshot_contents.fileId)
+              .inner_join(tab_file_contents).on(tab_file_contents.contentId == tab_file_elements.contentId)
+              .inner_join(tab_inline_contents).on(tab_inline_contents.contentId == tab_file_elements.contentId))
+        .where(tab_snapshot_contents.snapshotId == snapshot_id.i);
+    std::vector<SnapshotInlineContent> ret;
+    for (auto const& r : db(q)) {
+        SnapshotInlineContent ic;
+        ic.file_id.i = r.fileId;
+        ic.content_hash = Hash::from_string(r.hash);
+        ic.content.content_id.i = r.contentId;
+        ic.content.codec = static_cast<CompressionCodec>(r.codec.value());
+        ic.content.nonce.assign(r.nonce.blob, r.nonce.blob + r.nonce.len);
+        ic.content.data.assign(r.data.blob, r.data.blob + r.data.len);
+        ret.push_back(std::move(ic));
+    }
+    std::sort(begin(ret), end(ret),
+              [](SnapshotInlineContent const& lhs, SnapshotInlineContent const& rhs)
+              {
+                  return lhs.file_id.i < rhs.file_id.i;
+              });
+    return ret;
+}
+
+std::vector<StorageBlock> BlimpDB::getStorageBlocks(StorageContainerId const& container_id)
+{
+    auto& db = m_pimpl->db;
+    auto const tab_storage_blocks = blimpdb::StorageBlocks{};
+    std::vector<StorageBlock> ret;
+    for (auto const& r : db(select(tab_storage_blocks.offset, tab_storage_blocks.storedOffset, tab_storage_blocks.codec)
+                            .from(tab_storage_blocks)
+                            .where(tab_storage_blocks.containerId == container_id.i)
+                            .order_by(tab_storage_blocks.offset.asc())))
+    {
+        ret.push_back(StorageBlock{ .offset = r.offset, .stored_offset = r.storedOffset,
+                                    .codec = static_cast<CompressionCodec>(r.codec.value()) });
+    }
+    return ret;
+}
+
 std::optional<Hash> BlimpDB::getFileHash(FileElementId const& file_id)
 {
     auto& db = m_pimpl->db;
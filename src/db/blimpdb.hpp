@@ -3,6 +3,8 @@
 
 #include <db/file_element_id.hpp>
 
+#include <compression_codec.hpp>
+#include <file_hash.hpp>
 #include <file_info.hpp>
 #include <storage_container.hpp>
 #include <storage_location.hpp>
@@ -69,6 +71,27 @@ public:
         StorageContainer container;
         StorageLocation location;
     };
+
+    struct SnapshotStorageElement {
+        FileElementId file_id;
+        Hash content_hash;
+        StorageElement storage;
+    };
+
+    /** A content stored directly in the database instead of a storage container.
+     */
+    struct InlineContent {
+        FileContentId content_id;
+        CompressionCodec codec;
+        std::vector<char> nonce;        ///< first encrypted block of the content
+        std::vector<char> data;         ///< compressed and encrypted content following the nonce
+    };
+
+    struct SnapshotInlineContent {
+        FileElementId file_id;
+        Hash content_hash;
+        InlineContent content;
+    };
 private:
     struct Pimpl;
     std::unique_ptr<Pimpl> m_pimpl;
@@ -98,16 +121,25 @@ public:
 
     StorageContainerId newStorageContainer();
 
-    void finalizeStorageContainer(StorageContainer const& storage_container, bool do_sync = true);
+    /** Records the location of a storage container once it has been written, along with its block index.
+     */
+    void finalizeStorageContainer(StorageContainer const& storage_container,
+                                  std::span<StorageBlock const> const& blocks,
+                                  bool do_sync = true);
 
     void newStorageElement(FileContentId const& content_id,
                            std::span<StorageLocation const> const& storage_locations,
                            bool do_sync = true);
 
+    void newInlineContent(InlineContent const& content, bool do_sync = true);
+
     void addSnapshotContents(SnapshotId const& snapshot_id,
                              std::span<FileElementId const> const& files,
                              bool do_sync = true);
 
+    /** Access to the plugin key-value store is serialized, so that plugins on different threads may share the
+     * database, as long as no other database access happens concurrently.
+     */
     void pluginStoreValue(BlimpPluginInfo const& plugin, char const* key, BlimpKeyValueStoreValue value);
     PluginStoreValue pluginRetrieveValue(BlimpPluginInfo const& plugin, char const* key);
 
@@ -115,6 +147,25 @@ public:
 
     std::vector<StorageElement> getFileStorageInfo(FileElementId const& file_id);
 
+    /** Retrieves the storage elements of all files in a snapshot, sorted by container and offset.
+     * Elements of the same content occur once for each file referencing it.
+     */
+    std::vector<SnapshotStorageElement> getStorageElementsForSnapshot(SnapshotId const& snapshot_id);
+
+    /** Retrieves the inline content of a file, if its content is stored in the database instead of a container.
+     */
+    std::optional<InlineContent> getFileInlineContent(FileElementId const& file_id);
+
+    /** Retrieves the inline contents of all files in a snapshot, sorted by file.
+     * Contents of several files occur once for each file referencing them.
+     */
+    std::vector<SnapshotInlineContent> getInlineContentsForSnapshot(SnapshotId const& snapshot_id);
+
+    /** Retrieves the block index of a storage container, sorted by offset.
+     * The index is empty for containers written before containers were split into blocks.
+     */
+    std::vector<StorageBlock> getStorageBlocks(StorageContainerId const& container_id);
+
     std::optional<Hash> getFileHash(FileElementId const& file_id);
 
     std::optional<FileInfo> getFileInfo(FileElementId const& file_id);
@@ -0,0 +1,98 @@
+#ifndef BLIMP_INCLUDE_GUARD_DB_TABLE_INLINE_CONTENTS_HPP
+#define BLIMP_INCLUDE_GUARD_DB_TABLE_INLINE_CONTENTS_HPP
+
+#include <sqlpp11/table.h>
+#include <sqlpp11/data_types.h>
+#include <sqlpp11/char_sequence.h>
+
+namespace blimpdb
+{
+  namespace InlineContents_
+  {
+    struct ContentId
+    {
+      struct _alias_t
+      {
+        static constexpr const char _literal[] =  "content_id";
+        using _name_t = sqlpp::make_char_sequence<sizeof(_literal), _literal>;
+        template<typename T>
+        struct _member_t
+          {
+            T contentId;
+            T& operator()() { return contentId; }
+            const T& operator()() const { return contentId; }
+          };
+      };
+      using _traits = sqlpp::make_traits<sqlpp::integer, sqlpp::tag::require_insert>;
+    };
+    struct Codec
+    {
+      struct _alias_t
+      {
+        static constexpr const char _literal[] =  "codec";
+        using _name_t = sqlpp::make_char_sequence<sizeof(_literal), _literal>;
+        template<typename T>
+        struct _member_t
+          {
+            T codec;
+            T& operator()() { return codec; }
+            const T& operator()() const { return codec; }
+          };
+      };
+      using _traits = sqlpp::make_traits<sqlpp::integer>;
+    };
+    struct Nonce
+    {
+      struct _alias_t
+      {
+        static constexpr const char _literal[] =  "nonce";
+        using _name_t = sqlpp::make_char_sequence<sizeof(_literal), _literal>;
+        template<typename T>
+        struct _member_t
+          {
+            T nonce;
+            T& operator()() { return nonce; }
+            const T& operator()() const { return nonce; }
+          };
+      };
+      using _traits = sqlpp::make_traits<sqlpp::blob, sqlpp::tag::require_insert>;
+    };
+    struct Data
+    {
+      struct _alias_t
+      {
+        static constexpr const char _literal[] =  "data";
+        using _name_t = sqlpp::make_char_sequence<sizeof(_literal), _literal>;
+        template<typename T>
+        struct _member_t
+          {
+            T data;
+            T& operator()() { return data; }
+            const T& operator()() const { return data; }
+          };
+      };
+      using _traits = sqlpp::make_traits<sqlpp::blob, sqlpp::tag::require_insert>;
+    };
+  } // namespace InlineContents_
+
+  struct InlineContents: sqlpp::table_t<InlineContents,
+               InlineContents_::ContentId,
+               InlineContents_::Codec,
+               InlineContents_::Nonce,
+               InlineContents_::Data>
+  {
+    struct _alias_t
+    {
+      static constexpr const char _literal[] =  "inline_contents";
+      using _name_t = sqlpp::make_char_sequence<sizeof(_literal), _literal>;
+      template<typename T>
+      struct _member_t
+      {
+        T inlineContents;
+        T& operator()() { return inlineContents; }
+        const T& operator()() const { return inlineContents; }
+      };
+    };
+  };
+} // namespace blimpdb
+#endif
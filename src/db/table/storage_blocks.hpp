@@ -0,0 +1,98 @@
+#ifndef BLIMP_INCLUDE_GUARD_DB_TABLE_STORAGE_BLOCKS_HPP
+#define BLIMP_INCLUDE_GUARD_DB_TABLE_STORAGE_BLOCKS_HPP
+
+#include <sqlpp11/table.h>
+#include <sqlpp11/data_types.h>
+#include <sqlpp11/char_sequence.h>
+
+namespace blimpdb
+{
+  namespace StorageBlocks_
+  {
+    struct ContainerId
+    {
+      struct _alias_t
+      {
+        static constexpr const char _literal[] =  "container_id";
+        using _name_t = sqlpp::make_char_sequence<sizeof(_literal), _literal>;
+        template<typename T>
+        struct _member_t
+          {
+            T containerId;
+            T& operator()() { return containerId; }
+            const T& operator()() const { return containerId; }
+          };
+      };
+      using _traits = sqlpp::make_traits<sqlpp::integer, sqlpp::tag::require_insert>;
+    };
+    struct Offset
+    {
+      struct _alias_t
+      {
+        static constexpr const char _literal[] =  "offset";
+        using _name_t = sqlpp::make_char_sequence<sizeof(_literal), _literal>;
+        template<typename T>
+        struct _member_t
+          {
+            T offset;
+            T& operator()() { return offset; }
+            const T& operator()() const { return offset; }
+          };
+      };
+      using _traits = sqlpp::make_traits<sqlpp::integer, sqlpp::tag::require_insert>;
+    };
+    struct StoredOffset
+    {
+      struct _alias_t
+      {
+        static constexpr const char _literal[] =  "stored_offset";
+        using _name_t = sqlpp::make_char_sequence<sizeof(_literal), _literal>;
+        template<typename T>
+        struct _member_t
+          {
+            T storedOffset;
+            T& operator()() { return storedOffset; }
+            const T& operator()() const { return storedOffset; }
+          };
+      };
+      using _traits = sqlpp::make_traits<sqlpp::integer, sqlpp::tag::require_insert>;
+    };
+    struct Codec
+    {
+      struct _alias_t
+      {
+        static constexpr const char _literal[] =  "codec";
+        using _name_t = sqlpp::make_char_sequence<sizeof(_literal), _literal>;
+        template<typename T>
+        struct _member_t
+          {
+            T codec;
+            T& operator()() { return codec; }
+            const T& operator()() const { return codec; }
+          };
+      };
+      using _traits = sqlpp::make_traits<sqlpp::integer>;
+    };
+  } // namespace StorageBlocks_
+
+  struct StorageBlocks: sqlpp::table_t<StorageBlocks,
+               StorageBlocks_::ContainerId,
+               StorageBlocks_::Offset,
+               StorageBlocks_::StoredOffset,
+               StorageBlocks_::Codec>
+  {
+    struct _alias_t
+    {
+      static constexpr const char _literal[] =  "storage_blocks";
+      using _name_t = sqlpp::make_char_sequence<sizeof(_literal), _literal>;
+      template<typename T>
+      struct _member_t
+      {
+        T storageBlocks;
+        T& operator()() { return storageBlocks; }
+        const T& operator()() const { return storageBlocks; }
+      };
+    };
+  };
+} // namespace blimpdb
+#endif
@@ -89,6 +89,22 @@ namespace blimpdb
       };
       using _traits = sqlpp::make_traits<sqlpp::integer, sqlpp::tag::can_be_null>;
     };
+    struct Codec
+    {
+      struct _alias_t
+      {
+        static constexpr const char _literal[] =  "codec";
+        using _name_t = sqlpp::make_char_sequence<sizeof(_literal), _literal>;
+        template<typename T>
+        struct _member_t
+          {
+            T codec;
+            T& operator()() { return codec; }
+            const T& operator()() const { return codec; }
+          };
+      };
+      using _traits = sqlpp::make_traits<sqlpp::integer>;
+    };
   } // namespace StorageInventory_
 
   struct StorageInventory: sqlpp::table_t<StorageInventory,
@@ -96,7 +112,8 @@ namespace blimpdb
                StorageInventory_::ContainerId,
                StorageInventory_::Offset,
                StorageInventory_::Size,
-               StorageInventory_::PartNumber>
+               StorageInventory_::PartNumber,
+               StorageInventory_::Codec>
   {
     struct _alias_t
     {
@@ -134,7 +134,7 @@ inline constexpr char const* storage_containers()
  * The contents of a file may be spread across multiple inventory elements with the same content_id.
  * Each element is stored within a container at the specified offset. size is the number of bytes for
  * the respective content at that location, part_number is the 0-based index of the content_element among
- * all the elements with the same content_id.
+ * all the elements with the same content_id. codec is the CompressionCodec the content was compressed with.
  */
 inline constexpr char const* storage_inventory()
 {
@@ -147,9 +147,50 @@ inline constexpr char const* storage_inventory()
             offset          INTEGER,
             size            INTEGER,
             part_number     INTEGER,
+            codec           INTEGER NOT NULL    DEFAULT 0,
             PRIMARY KEY (content_id, container_id)
         );)";
 }
+
+/** The block index of the storage containers.
+ * A container is written as a sequence of blocks that can each be decompressed and decrypted on their own, so that
+ * restoring data from the middle of a container does not require processing the whole container. offset is the
+ * start of the block within the decompressed contents of the container, as used by storage_inventory, stored_offset
+ * its start within the container as stored. A block extends to the start of the next block. codec is the
+ * CompressionCodec of all data in the block.
+ * Containers without entries consist of a single block compressed with zlib.
+ */
+inline constexpr char const* storage_blocks()
+{
+    return R"(
+        CREATE TABLE storage_blocks (
+            container_id    INTEGER NOT NULL    REFERENCES storage_containers(container_id)
+                                                ON UPDATE RESTRICT ON DELETE RESTRICT,
+            offset          INTEGER NOT NULL,
+            stored_offset   INTEGER NOT NULL,
+            codec           INTEGER NOT NULL    DEFAULT 0,
+            PRIMARY KEY (container_id, offset)
+        );)";
+}
+
+/** File contents that are stored directly in the database instead of a storage container.
+ * Contents below a size threshold are compressed and encrypted on their own and kept as a whole in data, so they can
+ * be restored without touching any container. codec is the CompressionCodec the content was compressed with.
+ * All inline contents share one encryption key; nonce is the first encrypted block of the content, which makes its
+ * encryption unique, and data the remainder.
+ * A content is either stored inline or in the storage_inventory, never both.
+ */
+inline constexpr char const* inline_contents()
+{
+    return R"(
+        CREATE TABLE inline_contents (
+            content_id      INTEGER PRIMARY KEY REFERENCES file_contents(content_id)
+                                                ON UPDATE RESTRICT ON DELETE RESTRICT,
+            codec           INTEGER NOT NULL    DEFAULT 0,
+            nonce           BLOB    NOT NULL,
+            data            BLOB    NOT NULL
+        );)";
+}
 }
 }
 }
@@ -19,7 +19,7 @@ std::vector<FileBundleInfo> bundleFiles(std::vector<FileInfo> const& files, std:
     std::uint64_t size_acc = 0;         // accumulated size of all elements in current bundle
     std::uint64_t cut_point = 0;        // byte offset into the current bundle at which we could split off a bundle
     std::size_t cut_element_index = 0;  // index of the element preceding cut_point
-    for(int i = 0; i < files.size(); ++i) {
+    for(std::size_t i = 0; i < files.size(); ++i) {
         auto const& f = files[i];
         if(f.size < min_unbundled_size) {
             FileBundleInfo bi;
@@ -29,27 +29,34 @@ std::vector<FileBundleInfo> bundleFiles(std::vector<FileInfo> const& files, std:
             size_acc += f.size;
             if((cut_point == 0) && (size_acc > min_unbundled_size)) {
                 // place initial cut point;
-                // this happens only once in the beginning when we first exceed min_unbundled_size
+                // this happens only once per bundle when we first exceed min_unbundled_size
                 cut_point = size_acc;
                 cut_element_index = i;
             }
             if(size_acc > 3*min_unbundled_size) {
                 // bundle is big enough to allow cutting into two, both bigger than min_unbundled_size
                 GHULBUS_ASSERT(cut_point != 0);
-                // move cut_point
                 size_acc -= cut_point;
                 GHULBUS_ASSERT(size_acc > min_unbundled_size);
-                cut_point = size_acc;
                 // elements below cut point are committed to their bundle
                 auto const cut_it = std::upper_bound(begin(bundle_elements), end(bundle_elements), cut_element_index);
                 GHULBUS_ASSERT(cut_it != end(bundle_elements));
-                bundle_elements.erase(cut_it, end(bundle_elements));
-                cut_element_index = i;
+                bundle_elements.erase(begin(bundle_elements), cut_it);
                 // elements above cut point move to the next bundle
                 ++bundle_id;
                 for(auto const& element_index : bundle_elements) {
                     ret[element_index].bundle_id = bundle_id;
                 }
+                // the next bundle already exceeds min_unbundled_size; its cut point is where it first did so
+                std::uint64_t new_bundle_size = 0;
+                for(auto const& element_index : bundle_elements) {
+                    new_bundle_size += files[element_index].size;
+                    if(new_bundle_size > min_unbundled_size) {
+                        cut_point = new_bundle_size;
+                        cut_element_index = element_index;
+                        break;
+                    }
+                }
             }
         } else {
             // file is too big to be bundled
@@ -2,24 +2,47 @@
 #define BLIMP_INCLUDE_GUARD_FILE_CHUNK_HPP
 
 #include <cstddef>
+#include <cstdint>
 #include <vector>
 
 class FileChunk {
 private:
     std::vector<char> m_data;
+    std::size_t m_alignment;
+    std::size_t m_size;
+    char const* m_view;
     std::size_t m_used;
 public:
-    explicit FileChunk(std::size_t chunk_size)
-        :m_data(chunk_size, '\0'), m_used(0)
+    /** Constructs a chunk owning chunk_size bytes of storage.
+     * The start of the storage is aligned to alignment bytes, which must be a power of two.
+     */
+    explicit FileChunk(std::size_t chunk_size, std::size_t alignment = 1)
+        :m_data(chunk_size + alignment - 1, '\0'), m_alignment(alignment), m_size(chunk_size), m_view(nullptr),
+         m_used(0)
     {}
 
+    /** Constructs a chunk that refers to size bytes of memory owned by someone else.
+     * The chunk is read-only and only valid for as long as the referenced memory.
+     */
+    static FileChunk fromView(char const* data, std::size_t size) {
+        FileChunk ret(0);
+        ret.m_view = data;
+        ret.m_size = size;
+        ret.m_used = size;
+        return ret;
+    }
+
     FileChunk(FileChunk const&) = default;
     FileChunk& operator=(FileChunk const&) = default;
     FileChunk(FileChunk&&) = default;
     FileChunk& operator=(FileChunk&&) = default;
 
+    bool isView() const {
+        return m_view != nullptr;
+    }
+
     std::size_t getChunkSize() const {
-        return m_data.size();
+        return m_size;
     }
 
     void setUsedSize(std::size_t s) {
@@ -31,11 +54,16 @@ public:
     }
 
     char* getData() {
-        return m_data.data();
+        return alignedStorage();
     }
 
     char const* getData() const {
-        return m_data.data();
+        return isView() ? m_view : const_cast<FileChunk*>(this)->alignedStorage();
+    }
+private:
+    char* alignedStorage() {
+        auto const p = reinterpret_cast<std::uintptr_t>(m_data.data());
+        return m_data.data() + (((p + m_alignment - 1) & ~(m_alignment - 1)) - p);
     }
 };
 
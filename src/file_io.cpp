@@ -1,54 +1,735 @@
 #include <file_io.hpp>
 
+#include <memory_budget.hpp>
 #include <worker_pool.hpp>
 
 #include <gbBase/Assert.hpp>
 #include <gbBase/Exception.hpp>
 #include <gbBase/Finally.hpp>
+#include <gbBase/Log.hpp>
 
+#include <boost/filesystem/operations.hpp>
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+#include <boost/predef.h>
+
+#if BOOST_OS_LINUX
+#   include <fcntl.h>
+#   include <setjmp.h>
+#   include <signal.h>
+#   include <sys/stat.h>
+#   include <unistd.h>
+#   include <cerrno>
+#   include <mutex>
+#endif
+
+#ifdef BLIMP_HAS_IO_URING
+#   include <liburing.h>
+#   include <sys/uio.h>
+#   include <optional>
+#   include <string>
+#endif
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
 #include <cstdio>
+#include <cstring>
+#include <deque>
 #include <future>
 #include <limits>
 #include <tuple>
 #include <vector>
 
+namespace {
+constexpr std::size_t g_chunkSize = (1 << 20);
+constexpr std::size_t g_defaultQueueDepth = 3;
+constexpr std::size_t g_defaultDirectQueueDepth = 8;
+/// Chunk buffers are aligned suitably for direct I/O, which requires buffers aligned to the logical block size
+constexpr std::size_t g_chunkAlignment = 4096;
+constexpr std::uint64_t g_defaultMemoryMappingThreshold = (std::uint64_t{ 256 } << 20);
+
+#ifdef BLIMP_HAS_IO_URING
+/** Reads a file through io_uring.
+ * Up to queue_depth reads are kept in flight at consecutive offsets of the file. Completions are reaped on the
+ * thread calling getNextChunk(), so there is no hand-off to a worker thread. If the chunk buffers can be registered
+ * with the kernel, reads use the fixed buffers; otherwise plain reads into the same buffers are submitted.
+ * In direct mode, files are opened with O_DIRECT and every read requests a full chunk, as direct reads need to be
+ * block-aligned; only the bytes up to the end of the file are delivered to the client.
+ */
+class IoUringReader {
+private:
+    struct ChunkRead {
+        std::uint64_t offset;
+        std::size_t requested;
+        std::size_t expected;       ///< number of bytes before the end of file; less than requested for direct reads
+        std::size_t filled;
+        bool completed;
+    };
+
+    io_uring m_ring;
+    std::vector<FileChunk>* m_chunks;
+    std::size_t m_queueDepth;
+    FileIO::CacheMode m_cacheMode;
+    bool m_useFixedBuffers;
+    bool m_directRead;
+    bool m_dropBehind;
+    int m_fd;
+    boost::filesystem::path m_filepath;
+    std::uint64_t m_fileSize;
+    std::uint64_t m_nextOffset;
+    bool m_reachedEof;
+    std::size_t m_readsIssued;
+    std::size_t m_inFlight;
+    std::vector<ChunkRead> m_reads;
+    std::deque<std::size_t> m_pending;        ///< chunks submitted for reading, in file order
+    std::deque<std::size_t> m_free;           ///< chunks available for new reads
+    std::optional<std::size_t> m_handedOut;   ///< chunk last returned from getNextChunk()
+
+    IoUringReader(std::vector<FileChunk>& chunks, std::size_t queue_depth, FileIO::CacheMode cache_mode);
+public:
+    static std::unique_ptr<IoUringReader> create(std::vector<FileChunk>& chunks, std::size_t queue_depth,
+                                                 FileIO::CacheMode cache_mode);
+    ~IoUringReader();
+
+    IoUringReader(IoUringReader const&) = delete;
+    IoUringReader& operator=(IoUringReader const&) = delete;
+
+    void startReading(boost::filesystem::path const& p);
+    void cancelReading();
+    bool hasMoreChunks() const;
+    FileChunk const& getNextChunk();
+private:
+    void submitReads();
+    void prepareRead(std::size_t chunk_index);
+    void reapCompletion();
+    void dropCachedPages(ChunkRead const& r);
+    void closeFile();
+    [[noreturn]] void throwIOError(char const* msg, int err);
+};
+
+IoUringReader::IoUringReader(std::vector<FileChunk>& chunks, std::size_t queue_depth, FileIO::CacheMode cache_mode)
+    :m_ring{}, m_chunks(&chunks), m_queueDepth(queue_depth), m_cacheMode(cache_mode), m_useFixedBuffers(false),
+     m_directRead(false), m_dropBehind(false), m_fd(-1), m_fileSize(0), m_nextOffset(0), m_reachedEof(false),
+     m_readsIssued(0), m_inFlight(0),
+     m_reads(chunks.size(), ChunkRead{ .offset = 0, .requested = 0, .expected = 0, .filled = 0, .completed = false })
+{}
+
+std::unique_ptr<IoUringReader> IoUringReader::create(std::vector<FileChunk>& chunks, std::size_t queue_depth,
+                                                     FileIO::CacheMode cache_mode)
+{
+    std::unique_ptr<IoUringReader> ret{ new IoUringReader(chunks, queue_depth, cache_mode) };
+    int res = io_uring_queue_init(static_cast<unsigned>(queue_depth), &ret->m_ring, 0);
+    if (res < 0) {
+        GHULBUS_LOG(Info, "io_uring unavailable (" << std::strerror(-res) << "); falling back to threaded reads.");
+        return nullptr;
+    }
+    std::vector<iovec> iovecs;
+    iovecs.reserve(chunks.size());
+    for (auto& c : chunks) {
+        iovecs.push_back(iovec{ .iov_base = c.getData(), .iov_len = c.getChunkSize() });
+    }
+    res = io_uring_register_buffers(&ret->m_ring, iovecs.data(), static_cast<unsigned>(iovecs.size()));
+    if (res < 0) {
+        GHULBUS_LOG(Debug, "Unable to register fixed buffers with io_uring (" << std::strerror(-res) << ").");
+    }
+    ret->m_useFixedBuffers = (res == 0);
+    return ret;
+}
+
+IoUringReader::~IoUringReader()
+{
+    cancelReading();
+    io_uring_queue_exit(&m_ring);
+}
+
+void IoUringReader::startReading(boost::filesystem::path const& p)
+{
+    GHULBUS_PRECONDITION(!hasMoreChunks());
+    GHULBUS_PRECONDITION(m_inFlight == 0);
+    m_directRead = (m_cacheMode == FileIO::CacheMode::Direct);
+    m_dropBehind = (m_cacheMode == FileIO::CacheMode::DropBehind);
+    if (m_directRead) {
+        m_fd = ::open(p.string().c_str(), O_RDONLY | O_CLOEXEC | O_DIRECT);
+        if ((m_fd == -1) && (errno == EINVAL)) {
+            GHULBUS_LOG(Debug, "Direct I/O not supported for " << p << "; releasing cached pages after reading.");
+            m_directRead = false;
+            m_dropBehind = true;
+        }
+    }
+    if (!m_directRead) {
+        m_fd = ::open(p.string().c_str(), O_RDONLY | O_CLOEXEC);
+    }
+    if (m_fd == -1) {
+        GHULBUS_THROW(Ghulbus::Exceptions::IOError{} << Ghulbus::Exception_Info::filename(p.string()),
+                      "Unable to open file.");
+    }
+    struct stat st;
+    if (::fstat(m_fd, &st) != 0) {
+        closeFile();
+        GHULBUS_THROW(Ghulbus::Exceptions::IOError{} << Ghulbus::Exception_Info::filename(p.string()),
+                      "Unable to determine file size.");
+    }
+    m_filepath = p;
+    m_fileSize = static_cast<std::uint64_t>(st.st_size);
+    m_nextOffset = 0;
+    m_reachedEof = false;
+    m_readsIssued = 0;
+    m_handedOut.reset();
+    m_free.clear();
+    for (std::size_t i = 0; i < m_chunks->size(); ++i) { m_free.push_back(i); }
+    submitReads();
+}
+
+void IoUringReader::submitReads()
+{
+    std::size_t n_prepared = 0;
+    while ((!m_free.empty()) && (m_pending.size() < m_queueDepth) && (!m_reachedEof) &&
+           ((m_nextOffset < m_fileSize) || (m_readsIssued == 0)))
+    {
+        std::size_t const index = m_free.front();
+        m_free.pop_front();
+        std::size_t const chunk_size = (*m_chunks)[index].getChunkSize();
+        std::size_t const expected =
+            static_cast<std::size_t>(std::min<std::uint64_t>(chunk_size, m_fileSize - m_nextOffset));
+        m_reads[index] = ChunkRead{ .offset = m_nextOffset,
+                                    .requested = (m_directRead ? chunk_size : expected),
+                                    .expected = expected,
+                                    .filled = 0,
+                                    .completed = false };
+        m_nextOffset += expected;
+        ++m_readsIssued;
+        prepareRead(index);
+        m_pending.push_back(index);
+        ++n_prepared;
+    }
+    if (n_prepared > 0) {
+        int const res = io_uring_submit(&m_ring);
+        if (res < 0) { throwIOError("Unable to submit file read.", -res); }
+    }
+}
+
+void IoUringReader::prepareRead(std::size_t chunk_index)
+{
+    ChunkRead const& r = m_reads[chunk_index];
+    io_uring_sqe* sqe = io_uring_get_sqe(&m_ring);
+    if (!sqe) {
+        // submission queue is full; hand what we have to the kernel to make room
+        io_uring_submit(&m_ring);
+        sqe = io_uring_get_sqe(&m_ring);
+        if (!sqe) { throwIOError("io_uring submission queue exhausted.", EBUSY); }
+    }
+    char* const dest = (*m_chunks)[chunk_index].getData() + r.filled;
+    unsigned const n_bytes = static_cast<unsigned>(r.requested - r.filled);
+    std::uint64_t const offset = r.offset + r.filled;
+    if (m_useFixedBuffers) {
+        io_uring_prep_read_fixed(sqe, m_fd, dest, n_bytes, offset, static_cast<int>(chunk_index));
+    } else {
+        io_uring_prep_read(sqe, m_fd, dest, n_bytes, offset);
+    }
+    io_uring_sqe_set_data(sqe, reinterpret_cast<void*>(static_cast<std::uintptr_t>(chunk_index)));
+    ++m_inFlight;
+}
+
+void IoUringReader::reapCompletion()
+{
+    GHULBUS_PRECONDITION(m_inFlight > 0);
+    io_uring_cqe* cqe = nullptr;
+    int const wait_res = io_uring_wait_cqe(&m_ring, &cqe);
+    if (wait_res < 0) {
+        if (wait_res == -EINTR) { return; }
+        throwIOError("Error waiting for file read completion.", -wait_res);
+    }
+    std::size_t const index = static_cast<std::size_t>(reinterpret_cast<std::uintptr_t>(io_uring_cqe_get_data(cqe)));
+    int const res = cqe->res;
+    io_uring_cqe_seen(&m_ring, cqe);
+    --m_inFlight;
+
+    ChunkRead& r = m_reads[index];
+    if (res < 0) {
+        if ((res == -EINTR) || (res == -EAGAIN)) {
+            prepareRead(index);
+            io_uring_submit(&m_ring);
+            return;
+        }
+        throwIOError("Error reading from file.", -res);
+    }
+    r.filled += static_cast<std::size_t>(res);
+    if ((r.filled < r.expected) && ((res == 0) || m_directRead)) {
+        // file shrunk since we determined its size. direct reads only return short at the end of the file, and
+        // requesting the remainder would be unaligned for direct I/O
+        m_reachedEof = true;
+        r.completed = true;
+    } else if (r.filled < r.expected) {
+        // short read; request the remainder into the same buffer
+        prepareRead(index);
+        int const submit_res = io_uring_submit(&m_ring);
+        if (submit_res < 0) { throwIOError("Unable to submit file read.", -submit_res); }
+    } else {
+        // a direct read may deliver data that was appended after we determined the file size
+        r.filled = std::min(r.filled, r.expected);
+        r.completed = true;
+    }
+    if (r.completed && m_dropBehind) { dropCachedPages(r); }
+}
+
+void IoUringReader::dropCachedPages(ChunkRead const& r)
+{
+    if (r.filled == 0) { return; }
+    int const res = ::posix_fadvise(m_fd, static_cast<off_t>(r.offset), static_cast<off_t>(r.filled),
+                                    POSIX_FADV_DONTNEED);
+    if (res != 0) {
+        GHULBUS_LOG(Trace, "Unable to release cached pages of " << m_filepath << ": " << std::strerror(res));
+    }
+}
+
+void IoUringReader::cancelReading()
+{
+    while (m_inFlight > 0) {
+        io_uring_cqe* cqe = nullptr;
+        int const res = io_uring_wait_cqe(&m_ring, &cqe);
+        if (res == 0) {
+            io_uring_cqe_seen(&m_ring, cqe);
+            --m_inFlight;
+        } else if (res != -EINTR) {
+            GHULBUS_LOG(Error, "Unable to drain io_uring completion queue: " << std::strerror(-res));
+            break;
+        }
+    }
+    m_pending.clear();
+    m_handedOut.reset();
+    closeFile();
+}
+
+bool IoUringReader::hasMoreChunks() const
+{
+    return !m_pending.empty();
+}
+
+FileChunk const& IoUringReader::getNextChunk()
+{
+    GHULBUS_PRECONDITION(hasMoreChunks());
+    if (m_handedOut) {
+        m_free.push_back(*m_handedOut);
+        m_handedOut.reset();
+        submitReads();
+    }
+    std::size_t const index = m_pending.front();
+    while (!m_reads[index].completed) {
+        reapCompletion();
+    }
+    m_pending.pop_front();
+    m_handedOut = index;
+    if (m_reachedEof) {
+        // reads beyond the premature end of file will not deliver any data
+        while (m_inFlight > 0) { reapCompletion(); }
+        for (auto const i : m_pending) { m_free.push_back(i); }
+        m_pending.clear();
+    }
+    if (m_pending.empty()) {
+        closeFile();
+    }
+    FileChunk& chunk = (*m_chunks)[index];
+    chunk.setUsedSize(m_reads[index].filled);
+    return chunk;
+}
+
+void IoUringReader::closeFile()
+{
+    if (m_fd != -1) {
+        ::close(m_fd);
+        m_fd = -1;
+        m_filepath = boost::filesystem::path{};
+    }
+}
+
+void IoUringReader::throwIOError(char const* msg, int err)
+{
+    std::string const filename = m_filepath.string();
+    GHULBUS_LOG(Error, msg << " (" << std::strerror(err) << ")");
+    cancelReading();
+    GHULBUS_THROW(Ghulbus::Exceptions::IOError{} << Ghulbus::Exception_Info::filename(filename), msg);
+}
+#endif
+
+#if BOOST_OS_LINUX
+/// Jump target of the copy from a memory-mapped file that is in progress on this thread, if any
+thread_local sigjmp_buf* t_mappedCopyAbort = nullptr;
+struct sigaction g_previousSigbusAction;
+
+void handleSigbus(int sig, siginfo_t* info, void* context)
+{
+    if (t_mappedCopyAbort) { siglongjmp(*t_mappedCopyAbort, 1); }
+    // not caused by a copy from a mapped file, so the signal is handled as it was before
+    if (g_previousSigbusAction.sa_flags & SA_SIGINFO) {
+        g_previousSigbusAction.sa_sigaction(sig, info, context);
+    } else if ((g_previousSigbusAction.sa_handler != SIG_DFL) && (g_previousSigbusAction.sa_handler != SIG_IGN)) {
+        g_previousSigbusAction.sa_handler(sig);
+    } else {
+        // the faulting access is repeated on return and terminates the process
+        ::signal(SIGBUS, SIG_DFL);
+    }
+}
+#endif
+
+/** Copies n_bytes from a memory-mapped file.
+ * Accessing pages beyond the end of a mapped file raises SIGBUS. Returns false if that happened because the file was
+ * truncated during the copy.
+ */
+bool copyFromMappedFile(char* dest, char const* src, std::size_t n_bytes)
+{
+#if BOOST_OS_LINUX
+    static std::once_flag s_sigbusHandlerInstalled;
+    std::call_once(s_sigbusHandlerInstalled, []() {
+        struct sigaction action{};
+        action.sa_sigaction = handleSigbus;
+        action.sa_flags = SA_SIGINFO;
+        sigemptyset(&action.sa_mask);
+        if (::sigaction(SIGBUS, &action, &g_previousSigbusAction) != 0) {
+            GHULBUS_LOG(Warning, "Unable to install SIGBUS handler: " << std::strerror(errno));
+        }
+    });
+    sigjmp_buf abort_copy;
+    if (sigsetjmp(abort_copy, 1) != 0) {
+        t_mappedCopyAbort = nullptr;
+        return false;
+    }
+    t_mappedCopyAbort = &abort_copy;
+    std::atomic_signal_fence(std::memory_order_seq_cst);
+    std::memcpy(dest, src, n_bytes);
+    std::atomic_signal_fence(std::memory_order_seq_cst);
+    t_mappedCopyAbort = nullptr;
+#else
+    // files cannot be truncated while they are mapped on Windows
+    std::memcpy(dest, src, n_bytes);
+#endif
+    return true;
+}
+}   // anonymous namespace
+
 struct FileIO::Pimpl {
+    struct MappedFile {
+        boost::interprocess::file_mapping mapping;
+        boost::interprocess::mapped_region region;
+        boost::filesystem::path filepath;
+        std::size_t offset;
+        std::size_t size;        ///< number of mapped bytes that are still backed by the file
+    };
+
     boost::filesystem::path filepath;
     std::vector<FileChunk> chunks;
     std::size_t beginReadyChunk;
+    CacheMode cache_mode;
     FILE* fin;
-    WorkerPool pool;
+#if BOOST_OS_LINUX
+    int direct_fd;
+    std::uint64_t read_offset;
+#endif
+    std::unique_ptr<WorkerPool> pool;
     std::deque<std::future<std::tuple<std::size_t, bool>>> outstanding_reads;
+#ifdef BLIMP_HAS_IO_URING
+    std::unique_ptr<IoUringReader> uring;
+#endif
+    std::uint64_t memory_mapping_threshold;
+    std::unique_ptr<MappedFile> mapped;
+    MemoryBudget* budget;
+    MemoryBudget::Reservation chunks_reservation;
 
-    Pimpl()
-        :beginReadyChunk(0), fin(nullptr), pool(1)
+    Pimpl(std::size_t queue_depth, CacheMode requested_cache_mode)
+        :beginReadyChunk(0), cache_mode(requested_cache_mode), fin(nullptr),
+#if BOOST_OS_LINUX
+         direct_fd(-1), read_offset(0),
+#endif
+         memory_mapping_threshold(g_defaultMemoryMappingThreshold), budget(nullptr)
     {
-        chunks.reserve(4);
-        for (int i = 0; i < 4; ++i) { chunks.emplace_back(1024*1024); }
+        GHULBUS_PRECONDITION(queue_depth > 0);
+#if !BOOST_OS_LINUX
+        if (cache_mode != CacheMode::Cached) {
+            GHULBUS_LOG(Info, "Uncached file reads are not supported on this platform; falling back to cached reads.");
+            cache_mode = CacheMode::Cached;
+        }
+#endif
+        // one chunk more than the queue depth, as the most recently returned chunk is still in use by the client
+        chunks.reserve(queue_depth + 1);
+        for (std::size_t i = 0; i < queue_depth + 1; ++i) { chunks.emplace_back(g_chunkSize, g_chunkAlignment); }
+#ifdef BLIMP_HAS_IO_URING
+        uring = IoUringReader::create(chunks, queue_depth, cache_mode);
+        if (uring) { return; }
+#endif
+        pool = std::make_unique<WorkerPool>(1);
+    }
+
+    bool mapFile(boost::filesystem::path const& p);
+
+    void openFile(boost::filesystem::path const& p);
+
+    bool isFileOpen() const {
+#if BOOST_OS_LINUX
+        if (direct_fd != -1) { return true; }
+#endif
+        return fin != nullptr;
+    }
+
+    std::size_t readChunk(FileChunk& chunk);
+
+    void closeFile();
+
+    std::uint64_t getMappedFileSize() const;
+
+    FileChunk const& copyMappedChunk();
+
+    bool hasMoreMappedChunks() const {
+        return mapped && (mapped->offset < mapped->size);
+    }
+
+    /** Accessing mapped pages beyond the end of a file raises SIGBUS, so the current size of the file is checked
+     * before each chunk is copied. A file that shrank while being read ends at its new size.
+     */
+    void updateMappedFileSize() {
+        std::uint64_t const file_size = getMappedFileSize();
+        if (file_size < mapped->size) {
+            GHULBUS_LOG(Warning, "File " << mapped->filepath << " was truncated while being read.");
+            mapped->size = std::max(static_cast<std::size_t>(file_size), mapped->offset);
+        }
     }
 };
 
+bool FileIO::Pimpl::mapFile(boost::filesystem::path const& p)
+{
+    // mapped pages live in the page cache, so mapping is only an option for cached reads
+    if ((memory_mapping_threshold == 0) || (cache_mode != CacheMode::Cached)) { return false; }
+    boost::system::error_code ec;
+    std::uint64_t const file_size = boost::filesystem::file_size(p, ec);
+    if (ec || (file_size < memory_mapping_threshold) ||
+        (file_size > std::numeric_limits<std::size_t>::max()))
+    {
+        return false;
+    }
+    namespace bip = boost::interprocess;
+    try {
+        auto m = std::make_unique<MappedFile>(MappedFile{ .mapping = bip::file_mapping(p.string().c_str(), bip::read_only),
+                                                          .region = {},
+                                                          .filepath = p,
+                                                          .offset = 0,
+                                                          .size = static_cast<std::size_t>(file_size) });
+        m->region = bip::mapped_region(m->mapping, bip::read_only, 0, static_cast<std::size_t>(file_size));
+        if (!m->region.advise(bip::mapped_region::advice_sequential)) {
+            GHULBUS_LOG(Trace, "Unable to advise sequential access for " << p);
+        }
+        mapped = std::move(m);
+    } catch (bip::interprocess_exception& e) {
+        GHULBUS_LOG(Debug, "Unable to memory-map " << p << ": " << e.what());
+        return false;
+    }
+    return true;
+}
+
+std::uint64_t FileIO::Pimpl::getMappedFileSize() const
+{
+    GHULBUS_PRECONDITION(mapped);
+#if BOOST_OS_LINUX
+    // query the open file rather than the path, as the path may since refer to a different file
+    struct stat st;
+    if (::fstat(mapped->mapping.get_mapping_handle().handle, &st) != 0) {
+        GHULBUS_THROW(Ghulbus::Exceptions::IOError{} << Ghulbus::Exception_Info::filename(mapped->filepath.string()),
+                      "Unable to determine file size.");
+    }
+    return static_cast<std::uint64_t>(st.st_size);
+#else
+    boost::system::error_code ec;
+    std::uint64_t const file_size = boost::filesystem::file_size(mapped->filepath, ec);
+    if (ec) {
+        GHULBUS_THROW(Ghulbus::Exceptions::IOError{} << Ghulbus::Exception_Info::filename(mapped->filepath.string()),
+                      "Unable to determine file size.");
+    }
+    return file_size;
+#endif
+}
+
+/** The data is copied out of the mapping right away, so that a file that is truncated later on cannot fault while
+ * its data is hashed or processed. A truncation between checking the size and the copy is detected by the copy.
+ */
+FileChunk const& FileIO::Pimpl::copyMappedChunk()
+{
+    // the chunk buffers are not used for reading while a file is mapped
+    FileChunk& chunk = chunks.front();
+    MappedFile& m = *mapped;
+    char const* const src = static_cast<char const*>(m.region.get_address()) + m.offset;
+    updateMappedFileSize();
+    std::size_t n_bytes = std::min(chunk.getChunkSize(), m.size - m.offset);
+    if (!copyFromMappedFile(chunk.getData(), src, n_bytes)) {
+        // the file was truncated after its size was checked
+        updateMappedFileSize();
+        n_bytes = std::min(n_bytes, m.size - m.offset);
+        if (!copyFromMappedFile(chunk.getData(), src, n_bytes)) {
+            GHULBUS_THROW(Ghulbus::Exceptions::IOError{} << Ghulbus::Exception_Info::filename(m.filepath.string()),
+                          "Error reading from memory-mapped file.");
+        }
+    }
+    chunk.setUsedSize(n_bytes);
+    m.offset += n_bytes;
+    return chunk;
+}
+
+void FileIO::Pimpl::openFile(boost::filesystem::path const& p)
+{
+    GHULBUS_PRECONDITION(!isFileOpen());
+#if BOOST_OS_LINUX
+    read_offset = 0;
+    if (cache_mode == CacheMode::Direct) {
+        direct_fd = ::open(p.string().c_str(), O_RDONLY | O_CLOEXEC | O_DIRECT);
+        if ((direct_fd == -1) && (errno != EINVAL)) {
+            GHULBUS_THROW(Ghulbus::Exceptions::IOError{} << Ghulbus::Exception_Info::filename(p.string()),
+                          "Unable to open file.");
+        }
+        if (direct_fd != -1) {
+            filepath = p;
+            return;
+        }
+        GHULBUS_LOG(Debug, "Direct I/O not supported for " << p << "; releasing cached pages after reading.");
+    }
+#endif
+    fin = std::fopen(p.string().c_str(), "rb");
+    if (!fin) {
+        GHULBUS_THROW(Ghulbus::Exceptions::IOError{} << Ghulbus::Exception_Info::filename(p.string()),
+                      "Unable to open file.");
+    }
+    filepath = p;
+}
+
+std::size_t FileIO::Pimpl::readChunk(FileChunk& chunk)
+{
+#if BOOST_OS_LINUX
+    if (direct_fd != -1) {
+        // direct reads only return short at the end of the file; reading on from there would be unaligned for
+        // direct I/O, so a short read ends the chunk and, as the chunk is not full, the file
+        for (;;) {
+            ssize_t const res = ::read(direct_fd, chunk.getData(), chunk.getChunkSize());
+            if (res >= 0) { return static_cast<std::size_t>(res); }
+            if (errno != EINTR) {
+                GHULBUS_THROW(Ghulbus::Exceptions::IOError{} << Ghulbus::Exception_Info::filename(filepath.string()),
+                              "Error reading from file.");
+            }
+        }
+    }
+#endif
+    std::size_t const read = std::fread(chunk.getData(), 1, chunk.getChunkSize(), fin);
+    if (read < chunk.getChunkSize()) {
+        if (std::ferror(fin) != 0) {
+            GHULBUS_THROW(Ghulbus::Exceptions::IOError{} << Ghulbus::Exception_Info::filename(filepath.string()),
+                          "Error reading from file.");
+        } else if (std::feof(fin) == 0) {
+            GHULBUS_THROW(Ghulbus::Exceptions::IOError{} << Ghulbus::Exception_Info::filename(filepath.string()),
+                          "Unexpected I/O error.");
+        }
+    }
+#if BOOST_OS_LINUX
+    if ((cache_mode != CacheMode::Cached) && (read > 0)) {
+        // the data has been copied to the chunk, so the kernel may drop the pages from the cache
+        int const res = ::posix_fadvise(::fileno(fin), static_cast<off_t>(read_offset), static_cast<off_t>(read),
+                                        POSIX_FADV_DONTNEED);
+        if (res != 0) {
+            GHULBUS_LOG(Trace, "Unable to release cached pages of " << filepath << ": " << std::strerror(res));
+        }
+    }
+    read_offset += read;
+#endif
+    return read;
+}
+
+void FileIO::Pimpl::closeFile()
+{
+#if BOOST_OS_LINUX
+    if (direct_fd != -1) {
+        ::close(direct_fd);
+        direct_fd = -1;
+    }
+#endif
+    if (fin) {
+        std::fclose(fin);
+        fin = nullptr;
+    }
+    filepath = boost::filesystem::path{};
+}
+
 FileIO::FileIO()
-    :m_pimpl(std::make_unique<Pimpl>())
+    :FileIO(g_defaultQueueDepth)
+{
+}
+
+FileIO::FileIO(std::size_t queue_depth)
+    :FileIO(queue_depth, CacheMode::Cached)
+{
+}
+
+FileIO::FileIO(CacheMode cache_mode)
+    :FileIO((cache_mode == CacheMode::Direct) ? g_defaultDirectQueueDepth : g_defaultQueueDepth, cache_mode)
+{
+}
+
+FileIO::FileIO(std::size_t queue_depth, CacheMode cache_mode)
+    :m_pimpl(std::make_unique<Pimpl>(queue_depth, cache_mode))
 {
 }
 
 FileIO::~FileIO()
 {
-    if (!m_pimpl->outstanding_reads.empty()) {
+    if (hasMoreChunks()) {
         cancelReading();
     }
 }
 
+FileIO::Backend FileIO::getBackend() const
+{
+#ifdef BLIMP_HAS_IO_URING
+    if (m_pimpl->uring) { return Backend::IoUring; }
+#endif
+    return Backend::ThreadPool;
+}
+
+FileIO::CacheMode FileIO::getCacheMode() const
+{
+    return m_pimpl->cache_mode;
+}
+
+std::size_t FileIO::getQueueDepth() const
+{
+    return m_pimpl->chunks.size() - 1;
+}
+
+void FileIO::setQueueDepth(std::size_t queue_depth)
+{
+    GHULBUS_PRECONDITION(queue_depth > 0);
+    GHULBUS_PRECONDITION(!hasMoreChunks());
+    if (queue_depth == getQueueDepth()) { return; }
+    auto pimpl = std::make_unique<Pimpl>(queue_depth, m_pimpl->cache_mode);
+    pimpl->memory_mapping_threshold = m_pimpl->memory_mapping_threshold;
+    MemoryBudget* const budget = m_pimpl->budget;
+    m_pimpl = std::move(pimpl);
+    if (budget) { setMemoryBudget(*budget); }
+}
+
+void FileIO::setMemoryMappingThreshold(std::uint64_t threshold)
+{
+    m_pimpl->memory_mapping_threshold = threshold;
+}
+
+void FileIO::setMemoryBudget(MemoryBudget& budget)
+{
+    // the chunk buffers are in use for as long as the FileIO exists, so they cannot wait for the budget
+    m_pimpl->budget = &budget;
+    m_pimpl->chunks_reservation = budget.charge(m_pimpl->chunks.size() * g_chunkSize);
+}
+
 void FileIO::startReading(boost::filesystem::path const& p)
 {
     GHULBUS_PRECONDITION(!hasMoreChunks());
-    m_pimpl->fin = std::fopen(p.string().c_str(), "rb");
-    if (!m_pimpl->fin) {
-        GHULBUS_THROW(Ghulbus::Exceptions::IOError{} << Ghulbus::Exception_Info::filename(p.string()),
-                      "Unable to open file.");
-    }
-    m_pimpl->filepath = p;
+    m_pimpl->mapped.reset();
+    if (m_pimpl->mapFile(p)) { return; }
+#ifdef BLIMP_HAS_IO_URING
+    if (m_pimpl->uring) { m_pimpl->uring->startReading(p); return; }
+#endif
+    m_pimpl->openFile(p);
 
     for (std::size_t i = 0, i_end = m_pimpl->chunks.size() - 1; i < i_end; ++i) {
         scheduleChunkRead();
@@ -63,49 +744,47 @@ void FileIO::scheduleChunkRead()
     std::packaged_task<std::tuple<std::size_t, bool>()> pt{
         [this, index]() -> std::tuple<std::size_t, bool> {
             bool do_continue = true;
-            if (!m_pimpl->fin) { return std::make_tuple(std::numeric_limits<std::size_t>::max(), false); }
+            if (!m_pimpl->isFileOpen()) { return std::make_tuple(std::numeric_limits<std::size_t>::max(), false); }
             FileChunk& chunk = m_pimpl->chunks[index];
-            std::size_t read = std::fread(chunk.getData(), 1, chunk.getChunkSize(), m_pimpl->fin);
+            std::size_t const read = m_pimpl->readChunk(chunk);
             if (read < chunk.getChunkSize()) {
-                if (std::ferror(m_pimpl->fin) != 0) {
-                    GHULBUS_THROW(Ghulbus::Exceptions::IOError{} << Ghulbus::Exception_Info::filename(m_pimpl->filepath.string()),
-                                  "Error reading from file.");
-                } else if (std::feof(m_pimpl->fin) != 0) {
-                    std::fclose(m_pimpl->fin);
-                    m_pimpl->fin = nullptr;
-                    m_pimpl->filepath = boost::filesystem::path{};
-                    do_continue = false;
-                } else {
-                    GHULBUS_THROW(Ghulbus::Exceptions::IOError{} << Ghulbus::Exception_Info::filename(m_pimpl->filepath.string()),
-                                  "Unexpected I/O error.");
-                }
+                m_pimpl->closeFile();
+                do_continue = false;
             }
             chunk.setUsedSize(read);
             return std::make_tuple(index, do_continue);
     } };
     m_pimpl->outstanding_reads.emplace_back(pt.get_future());
-    m_pimpl->pool.schedule([pt = std::move(pt)]() mutable { pt(); });
+    m_pimpl->pool->schedule([pt = std::move(pt)]() mutable { pt(); });
 }
 
 void FileIO::cancelReading()
 {
-    m_pimpl->pool.cancelAndFlush();
-    if (m_pimpl->fin) {
-        std::fclose(m_pimpl->fin);
-        m_pimpl->fin = nullptr;
-        m_pimpl->filepath = boost::filesystem::path{};
-    }
+    m_pimpl->mapped.reset();
+#ifdef BLIMP_HAS_IO_URING
+    if (m_pimpl->uring) { m_pimpl->uring->cancelReading(); return; }
+#endif
+    m_pimpl->pool->cancelAndFlush();
+    m_pimpl->closeFile();
     m_pimpl->outstanding_reads.clear();
 }
 
 bool FileIO::hasMoreChunks() const
 {
+    if (m_pimpl->hasMoreMappedChunks()) { return true; }
+#ifdef BLIMP_HAS_IO_URING
+    if (m_pimpl->uring) { return m_pimpl->uring->hasMoreChunks(); }
+#endif
     return !m_pimpl->outstanding_reads.empty();
 }
 
 FileChunk const& FileIO::getNextChunk()
 {
     GHULBUS_PRECONDITION(hasMoreChunks());
+    if (m_pimpl->hasMoreMappedChunks()) { return m_pimpl->copyMappedChunk(); }
+#ifdef BLIMP_HAS_IO_URING
+    if (m_pimpl->uring) { return m_pimpl->uring->getNextChunk(); }
+#endif
     auto const [chunk_index, do_continue] = m_pimpl->outstanding_reads.front().get();
     m_pimpl->outstanding_reads.pop_front();
     if (do_continue) {
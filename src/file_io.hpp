@@ -5,26 +5,88 @@
 
 #include <boost/filesystem/path.hpp>
 
+#include <cstddef>
+#include <cstdint>
 #include <memory>
 
+class MemoryBudget;
+
 class FileIO {
+public:
+    enum class Backend {
+        ThreadPool,
+        IoUring
+    };
+
+    /** Determines how reads interact with the operating system's page cache.
+     */
+    enum class CacheMode {
+        Cached,         ///< Reads go through the page cache.
+        DropBehind,     ///< Reads go through the page cache, but the pages are released once they have been read.
+                        ///  Note that this also releases pages that were already cached before the read.
+        Direct          ///< Reads bypass the page cache. Falls back to DropBehind where the file system does not
+                        ///  support direct I/O.
+    };
 private:
     struct Pimpl;
     std::unique_ptr<Pimpl> m_pimpl;
 public:
     FileIO();
 
+    /** Constructs a FileIO that keeps up to queue_depth chunk reads in flight.
+     * If io_uring is available, reads are submitted to the kernel directly. Otherwise a single worker thread
+     * performs the reads one after another.
+     */
+    explicit FileIO(std::size_t queue_depth);
+
+    /** Constructs a FileIO with the default queue depth for the given cache mode.
+     * Since the kernel performs no readahead for direct reads, CacheMode::Direct uses a deeper queue.
+     */
+    explicit FileIO(CacheMode cache_mode);
+
+    /** Constructs a FileIO that keeps up to queue_depth chunk reads in flight using the given cache mode.
+     * Cache modes other than CacheMode::Cached are only supported on Linux and fall back to cached reads elsewhere.
+     * Files are never memory-mapped unless the cache mode is CacheMode::Cached.
+     */
+    FileIO(std::size_t queue_depth, CacheMode cache_mode);
+
     ~FileIO();
 
     FileIO(FileIO const&) = delete;
     FileIO& operator=(FileIO const&) = delete;
 
+    Backend getBackend() const;
+
+    CacheMode getCacheMode() const;
+
+    std::size_t getQueueDepth() const;
+
+    /** Changes the number of chunk reads kept in flight. Must not be called while a file is being read.
+     * Reallocates the chunk buffers, so this is meant for occasional adjustments between files.
+     */
+    void setQueueDepth(std::size_t queue_depth);
+
+    /** Files of at least threshold bytes are memory-mapped instead of being read with one system call per chunk.
+     * Each chunk is copied from the mapping into a chunk buffer by getNextChunk(), so no chunk refers to the mapping
+     * once it is returned. A file that is truncated while being read ends at its new size.
+     * A threshold of 0 disables memory mapping.
+     */
+    void setMemoryMappingThreshold(std::uint64_t threshold);
+
+    /** Accounts the memory of the chunk buffers to budget.
+     * Files that are memory-mapped are not accounted for, as their pages belong to the page cache.
+     */
+    void setMemoryBudget(MemoryBudget& budget);
+
     void startReading(boost::filesystem::path const& p);
 
     void cancelReading();
 
     bool hasMoreChunks() const;
 
+    /** Retrieves the next chunk of the file.
+     * The returned chunk remains valid until the next call to getNextChunk(), startReading() or cancelReading().
+     */
     FileChunk const& getNextChunk();
 private:
     void scheduleChunkRead();
@@ -1,22 +1,97 @@
 #include <file_processor.hpp>
 
+#include <exceptions.hpp>
+#include <file_bundling.hpp>
 #include <file_hash.hpp>
 #include <file_io.hpp>
+#include <memory_budget.hpp>
 #include <processing_pipeline.hpp>
+#include <restore_plan.hpp>
 #include <storage_location.hpp>
 #include <worker_pool.hpp>
 
 #include <gbBase/Assert.hpp>
+#include <gbBase/Finally.hpp>
 #include <gbBase/Log.hpp>
 
 #include <boost/filesystem/path.hpp>
 
+#include <algorithm>
 #include <cstdio>
 #include <chrono>
+#include <exception>
+#include <future>
+#include <optional>
+#include <random>
 #include <vector>
 
+namespace {
+/// Number of files per hashing thread that may be hashed ahead of the file being stored
+constexpr std::size_t g_hashingLookAheadPerThread = 4;
+/// Files are hashed on one thread per hardware thread by default, up to this many
+constexpr std::size_t g_maxDefaultHashingThreads = 4;
+/// New content is stored on one thread per hardware thread by default, up to this many; each keeps a container open
+constexpr std::size_t g_maxDefaultStoringThreads = 4;
+constexpr std::size_t g_defaultMemoryBudget = (std::size_t{ 256 } << 20);
+constexpr std::size_t g_defaultRestoreThreads = 4;
+constexpr std::uint64_t g_defaultBundleSize = (std::uint64_t{ 1 } << 20);
+constexpr std::uint64_t g_defaultInlineSizeLimit = (std::uint64_t{ 4 } << 10);
+/// Size of the pieces in which file contents kept in memory are passed to the processing pipeline
+constexpr std::size_t g_bufferedChunkSize = (std::size_t{ 1 } << 20);
+
+std::size_t defaultThreadCount(std::size_t max_threads)
+{
+    return std::clamp<std::size_t>(std::thread::hardware_concurrency(), 1, max_threads);
+}
+
+struct HashingResult {
+    Hash hash;
+    std::size_t bytes_read;
+    std::vector<char> content;          ///< the data of the file, if requested for a content to be stored inline
+};
+
+struct StoringResult {
+    std::vector<StorageLocation> locations;
+    std::size_t bytes_read;
+    std::exception_ptr error;           ///< set if the content could not be stored
+};
+
+/** File reader and hasher for use by one hashing thread at a time.
+ */
+struct HashingContext {
+    FileIO fio;
+    FileHasher hasher{ HashType::SHA_256 };
+
+    explicit HashingContext(FileIO::CacheMode cache_mode)
+        :fio(cache_mode)
+    {}
+
+    HashingResult hashFile(boost::filesystem::path const& p, std::atomic<bool> const& cancel, bool keep_content)
+    {
+        fio.startReading(p);
+        hasher.restart();
+        std::size_t bytes_read = 0;
+        std::vector<char> content;
+        while (fio.hasMoreChunks()) {
+            if (cancel.load()) { fio.cancelReading(); break; }
+            FileChunk const& c = fio.getNextChunk();
+            bytes_read += c.getUsedSize();
+            hasher.addData(c);
+            if (keep_content) { content.insert(content.end(), c.getData(), c.getData() + c.getUsedSize()); }
+        }
+        return HashingResult{ .hash = hasher.getHash(), .bytes_read = bytes_read, .content = std::move(content) };
+    }
+};
+}
+
 FileProcessor::FileProcessor()
-    :m_cancelProcessing(false)
+    :m_cancelProcessing(false), m_singlePass(true),
+     m_hashingThreads(defaultThreadCount(g_maxDefaultHashingThreads)),
+     m_storingThreads(defaultThreadCount(g_maxDefaultStoringThreads)),
+     m_restoreThreads(g_defaultRestoreThreads), m_readCacheMode(FileIO::CacheMode::Direct),
+     m_unchangedVerificationFraction(0.0),
+     m_memoryBudgetLimit(g_defaultMemoryBudget), m_bundleSize(g_defaultBundleSize),
+     m_inlineSizeLimit(g_defaultInlineSizeLimit)
 {}
 
 FileProcessor::~FileProcessor()
@@ -26,40 +101,394 @@ FileProcessor::~FileProcessor()
     }
 }
 
-void FileProcessor::startProcessing(BlimpDB::SnapshotId snapshot_id, std::vector<FileInfo>&& files, std::unique_ptr<BlimpDB>&& blimpdb)
+void FileProcessor::setSinglePassProcessing(bool enabled)
+{
+    GHULBUS_PRECONDITION(!m_processingThread.joinable());
+    m_singlePass = enabled;
+}
+
+void FileProcessor::setHashingThreads(std::size_t n_threads)
+{
+    GHULBUS_PRECONDITION(n_threads > 0);
+    GHULBUS_PRECONDITION(!m_processingThread.joinable());
+    m_hashingThreads = n_threads;
+}
+
+void FileProcessor::setStoringThreads(std::size_t n_threads)
+{
+    GHULBUS_PRECONDITION(n_threads > 0);
+    GHULBUS_PRECONDITION(!m_processingThread.joinable());
+    m_storingThreads = n_threads;
+}
+
+void FileProcessor::setRestoreThreads(std::size_t n_threads)
+{
+    GHULBUS_PRECONDITION(n_threads > 0);
+    m_restoreThreads = n_threads;
+}
+
+void FileProcessor::setReadCacheMode(FileIO::CacheMode cache_mode)
+{
+    GHULBUS_PRECONDITION(!m_processingThread.joinable());
+    m_readCacheMode = cache_mode;
+}
+
+void FileProcessor::setUnchangedVerificationFraction(double fraction)
+{
+    GHULBUS_PRECONDITION((fraction >= 0.0) && (fraction <= 1.0));
+    GHULBUS_PRECONDITION(!m_processingThread.joinable());
+    m_unchangedVerificationFraction = fraction;
+}
+
+void FileProcessor::setMemoryBudget(std::size_t n_bytes)
+{
+    GHULBUS_PRECONDITION(n_bytes > 0);
+    GHULBUS_PRECONDITION(!m_processingThread.joinable());
+    m_memoryBudgetLimit = n_bytes;
+}
+
+void FileProcessor::setBundleSize(std::uint64_t n_bytes)
+{
+    GHULBUS_PRECONDITION(!m_processingThread.joinable());
+    m_bundleSize = n_bytes;
+}
+
+void FileProcessor::setInlineSizeLimit(std::uint64_t n_bytes)
+{
+    GHULBUS_PRECONDITION(!m_processingThread.joinable());
+    m_inlineSizeLimit = n_bytes;
+}
+
+void FileProcessor::startProcessing(BlimpDB::SnapshotId snapshot_id, std::vector<FileInfo>&& files,
+                                    std::vector<FileIndexDiff::ElementDiff>&& file_diffs,
+                                    std::unique_ptr<BlimpDB>&& blimpdb)
 {
     GHULBUS_PRECONDITION(!m_dbReturnChannel);
+    GHULBUS_PRECONDITION(file_diffs.empty() || (file_diffs.size() == files.size()));
     m_dbReturnChannel = std::move(blimpdb);
-    m_processingPipeline = std::make_unique<ProcessingPipeline>(*m_dbReturnChannel);
+    // the previous pipelines still hold on to the previous budget
+    m_processingPipelines.clear();
+    m_memoryBudget = std::make_unique<MemoryBudget>(m_memoryBudgetLimit);
+    for (std::size_t i = 0; i < m_storingThreads; ++i) {
+        m_processingPipelines.emplace_back(
+            std::make_unique<ProcessingPipeline>(*m_dbReturnChannel, *m_memoryBudget, m_storingThreads));
+        // the storing threads cannot rotate containers in the middle of a content, as that requires the database
+        if (m_storingThreads > 1) { m_processingPipelines.back()->setContentSplitting(false); }
+    }
     m_filesToProcess = std::move(files);
+    m_fileDiffs = std::move(file_diffs);
     m_cancelProcessing.store(false);
     m_processingThread = std::thread([this, snapshot_id, &blimpdb = *m_dbReturnChannel]() {
-        FileIO fio;
+        FileIO fio(m_readCacheMode);
+        fio.setMemoryBudget(*m_memoryBudget);
         FileHasher hasher(HashType::SHA_256);
-        WorkerPool pool(1);
         std::size_t file_index = 0;
+        std::size_t n_unchanged_skipped = 0;
         std::vector<FileElementId> snapshot_contents;
+
+        // unchanged files are taken over from the database, except for those picked for verification
+        std::vector<bool> take_over_unchanged(m_filesToProcess.size(), false);
+        if (!m_fileDiffs.empty()) {
+            std::mt19937 rng{ std::random_device{}() };
+            std::bernoulli_distribution verify_unchanged{ m_unchangedVerificationFraction };
+            for (std::size_t i = 0; i < m_fileDiffs.size(); ++i) {
+                take_over_unchanged[i] = (m_fileDiffs[i].sync_status == FileSyncStatus::Unchanged) &&
+                                         (!verify_unchanged(rng));
+            }
+        }
+
+        // with more than one hashing thread, files are hashed ahead of the processing thread; results are
+        // consumed in file order, so database insertion and container assignment do not depend on timing
+        std::unique_ptr<WorkerPool> hashing_pool;
+        std::vector<std::unique_ptr<HashingContext>> free_hashing_contexts;
+        std::mutex mtx_hashing_contexts;
+        std::deque<std::future<HashingResult>> pending_hashes;
+        std::size_t next_file_to_hash = 0;
+        if (m_hashingThreads > 1) {
+            hashing_pool = std::make_unique<WorkerPool>(m_hashingThreads);
+            for (std::size_t i = 0; i < m_hashingThreads; ++i) {
+                free_hashing_contexts.emplace_back(std::make_unique<HashingContext>(m_readCacheMode));
+                free_hashing_contexts.back()->fio.setMemoryBudget(*m_memoryBudget);
+            }
+        }
+        auto const scheduleHashing = [&]() {
+            std::size_t const max_pending = g_hashingLookAheadPerThread * m_hashingThreads;
+            while ((pending_hashes.size() < max_pending) && (next_file_to_hash < m_filesToProcess.size())) {
+                std::size_t const index = next_file_to_hash++;
+                if (take_over_unchanged[index]) { continue; }
+                bool const keep_content = (m_filesToProcess[index].size < m_inlineSizeLimit);
+                std::packaged_task<HashingResult()> pt{
+                    [this, index, keep_content, &free_hashing_contexts, &mtx_hashing_contexts]() -> HashingResult {
+                        std::unique_ptr<HashingContext> ctx;
+                        {
+                            std::lock_guard lk(mtx_hashing_contexts);
+                            ctx = std::move(free_hashing_contexts.back());
+                            free_hashing_contexts.pop_back();
+                        }
+                        auto const release_context = Ghulbus::finally([&]() {
+                            std::lock_guard lk(mtx_hashing_contexts);
+                            free_hashing_contexts.emplace_back(std::move(ctx));
+                        });
+                        return ctx->hashFile(m_filesToProcess[index].path, m_cancelProcessing, keep_content);
+                } };
+                pending_hashes.emplace_back(pt.get_future());
+                hashing_pool->schedule([pt = std::move(pt)]() mutable { pt(); });
+            }
+        };
+        auto const cancel_hashing = Ghulbus::finally([&hashing_pool]() {
+            if (hashing_pool) { hashing_pool->cancelAndFlush(); }
+        });
+        if (hashing_pool) { scheduleHashing(); }
+
+        // files below the bundle size are grouped into bundles that are compressed as one stream each; unchanged
+        // files that are taken over from the database are not stored and files below the inline size limit are
+        // stored in the database, so they are left out of the bundles
+        std::vector<FileBundleInfo> bundles(m_filesToProcess.size(), FileBundleInfo{ .bundle_id = 0 });
+        if (m_bundleSize > 0) {
+            std::vector<FileInfo> bundle_candidates;
+            std::vector<std::size_t> candidate_indices;
+            for (std::size_t i = 0; i < m_filesToProcess.size(); ++i) {
+                if (take_over_unchanged[i] || (m_filesToProcess[i].size < m_inlineSizeLimit)) { continue; }
+                bundle_candidates.push_back(m_filesToProcess[i]);
+                candidate_indices.push_back(i);
+            }
+            std::vector<FileBundleInfo> const candidate_bundles = bundleFiles(bundle_candidates, m_bundleSize);
+            for (std::size_t i = 0; i < candidate_indices.size(); ++i) {
+                bundles[candidate_indices[i]] = candidate_bundles[i];
+            }
+        }
+
+        // with more than one storing thread, new contents are stored concurrently by one pipeline per thread, each
+        // into its own container; all database access remains on the processing thread, which records the results
+        // in file order and rotates the containers of pipelines that were handed back
+        std::unique_ptr<WorkerPool> storing_pool;
+        std::vector<std::unique_ptr<FileIO>> storing_fios;
+        std::vector<std::size_t> free_pipelines;
+        struct StoringEntry {
+            std::size_t file_index;
+            BlimpDB::FileContentId content_id;
+            Hash hash;
+        };
+        struct PendingStore {
+            std::vector<StoringEntry> entries;
+            std::size_t pipeline_index;
+            std::future<std::vector<StoringResult>> results;
+        };
+        std::deque<PendingStore> pending_stores;
+        if (m_processingPipelines.size() > 1) {
+            storing_pool = std::make_unique<WorkerPool>(m_processingPipelines.size());
+            for (std::size_t i = 0; i < m_processingPipelines.size(); ++i) {
+                storing_fios.emplace_back(std::make_unique<FileIO>(m_readCacheMode));
+                storing_fios.back()->setMemoryBudget(*m_memoryBudget);
+                free_pipelines.push_back(i);
+            }
+        }
+        auto const cancel_storing = Ghulbus::finally([&storing_pool]() {
+            if (storing_pool) { storing_pool->cancelAndFlush(); }
+        });
+        ProcessingPipeline& pipeline = *m_processingPipelines.front();
+
         blimpdb.startExternalSync();
-        StorageContainerId current_container = blimpdb.newStorageContainer();
-        m_processingPipeline->newStorageContainer(current_container);
+        for (auto& p : m_processingPipelines) {
+            p->newStorageContainer(blimpdb.newStorageContainer());
+        }
+        // full containers are finalized in the background; they are recorded once finalization succeeded
+        auto const recordFinalizedContainers = [this, &blimpdb]() {
+            for (auto& p : m_processingPipelines) {
+                for (auto const& c : p->takeFinalizedContainers()) {
+                    blimpdb.finalizeStorageContainer(c.container, c.blocks, false);
+                }
+            }
+        };
+        auto const rotateStorageContainer = [&blimpdb, &recordFinalizedContainers](ProcessingPipeline& p) {
+            p.newStorageContainer(blimpdb.newStorageContainer());
+            recordFinalizedContainers();
+        };
+        auto const storeContent = [this](ProcessingPipeline& p, FileIO& fio,
+                                         StoringEntry const& entry) -> StoringResult
+        {
+            try {
+                auto transaction = p.startNewContentTransaction(entry.hash, m_filesToProcess[entry.file_index]);
+                p.adjustReadQueueDepth(fio);
+                fio.startReading(m_filesToProcess[entry.file_index].path);
+                std::size_t bytes_read = 0;
+                while (fio.hasMoreChunks()) {
+                    if (m_cancelProcessing.load()) { fio.cancelReading(); return {}; }
+                    FileChunk const& c = fio.getNextChunk();
+                    // contents are not split, so the container only fills up on commit
+                    [[maybe_unused]] auto const status = transaction.addFileChunk(c);
+                    GHULBUS_ASSERT(status == ProcessingPipeline::ContainerStatus::Ok);
+                    bytes_read += c.getUsedSize();
+                }
+                return StoringResult{ .locations = p.commitTransaction(std::move(transaction)),
+                                      .bytes_read = bytes_read };
+            } catch (...) {
+                return StoringResult{ .locations = {}, .bytes_read = 0, .error = std::current_exception() };
+            }
+        };
+        // stores the entries one after another on a free pipeline; the contents of a bundle form one solid stream.
+        // a commit that fills the container ends the store early, as rotating the container requires the database
+        auto const scheduleStoring = [&](std::vector<StoringEntry> entries, bool is_bundle)
+        {
+            std::size_t const pipeline_index = free_pipelines.back();
+            free_pipelines.pop_back();
+            std::packaged_task<std::vector<StoringResult>()> pt{
+                [this, entries, pipeline_index, is_bundle, storeContent,
+                 &storing_fios]() -> std::vector<StoringResult>
+                {
+                    ProcessingPipeline& p = *m_processingPipelines[pipeline_index];
+                    FileIO& fio = *storing_fios[pipeline_index];
+                    std::vector<StoringResult> ret;
+                    if (is_bundle) { p.beginBundle(); }
+                    for (auto const& entry : entries) {
+                        if (p.isContainerFull() || m_cancelProcessing.load()) { break; }
+                        ret.push_back(storeContent(p, fio, entry));
+                    }
+                    if (is_bundle) { p.endBundle(); }
+                    return ret;
+            } };
+            pending_stores.push_back(PendingStore{ .entries = std::move(entries), .pipeline_index = pipeline_index,
+                                                   .results = pt.get_future() });
+            storing_pool->schedule([pt = std::move(pt)]() mutable { pt(); });
+        };
+        // returns the pipeline of the oldest pending store to the free pipelines, unless processing was canceled
+        auto const completeStoring = [&]() {
+            PendingStore store = std::move(pending_stores.front());
+            pending_stores.pop_front();
+            std::size_t n_stored = store.entries.size();
+            try {
+                std::vector<StoringResult> const results = store.results.get();
+                if (m_cancelProcessing.load()) { return; }
+                n_stored = results.size();
+                for (std::size_t i = 0; i < results.size(); ++i) {
+                    StoringEntry const& entry = store.entries[i];
+                    try {
+                        if (results[i].error) { std::rethrow_exception(results[i].error); }
+                        blimpdb.newStorageElement(entry.content_id, results[i].locations, false);
+                        emit processingUpdateFileProgress(results[i].bytes_read);
+                    } catch (std::exception& e) {
+                        GHULBUS_LOG(Error, "Unable to store file " << m_filesToProcess[entry.file_index].path <<
+                                    ": " << e.what());
+                    }
+                }
+            } catch (std::exception& e) {
+                for (auto const& entry : store.entries) {
+                    GHULBUS_LOG(Error, "Unable to store file " << m_filesToProcess[entry.file_index].path << ": " <<
+                                e.what());
+                }
+            }
+            free_pipelines.push_back(store.pipeline_index);
+            ProcessingPipeline& p = *m_processingPipelines[store.pipeline_index];
+            if (p.isContainerFull()) { rotateStorageContainer(p); }
+            if (n_stored < store.entries.size()) {
+                // the container filled up in the middle of a bundle; the rest of the bundle goes to the next container
+                // and is recorded ahead of the stores that were scheduled meanwhile
+                store.entries.erase(store.entries.begin(), store.entries.begin() + n_stored);
+                scheduleStoring(std::move(store.entries), true);
+                pending_stores.push_front(std::move(pending_stores.back()));
+                pending_stores.pop_back();
+            }
+        };
+        // completes pending stores until a pipeline is free; returns false if processing was canceled meanwhile
+        auto const waitForFreePipeline = [&]() -> bool {
+            while (free_pipelines.empty()) {
+                completeStoring();
+                if (m_cancelProcessing.load()) { return false; }
+            }
+            return true;
+        };
+        // with storing threads, the new contents of a bundle are collected and stored together by one pipeline;
+        // otherwise the contents of a bundle are stored as they come, with the bundle open on the pipeline
+        std::uint32_t open_bundle = 0;
+        std::vector<StoringEntry> bundle_entries;
+        auto const closeBundle = [&]() -> bool {
+            if (storing_pool && (!bundle_entries.empty())) {
+                if (!waitForFreePipeline()) { return false; }
+                scheduleStoring(std::move(bundle_entries), true);
+                bundle_entries.clear();
+            } else if ((!storing_pool) && (open_bundle != 0)) {
+                pipeline.endBundle();
+            }
+            open_bundle = 0;
+            return true;
+        };
         auto const t0 = std::chrono::steady_clock::now();
         for (auto const& f : m_filesToProcess) {
+            std::optional<Hash> reference_hash;
+            if ((!m_fileDiffs.empty()) && (m_fileDiffs[file_index].sync_status == FileSyncStatus::Unchanged)) {
+                FileElementId const reference_element{ .i = m_fileDiffs[file_index].reference_db_id };
+                if (take_over_unchanged[file_index]) {
+                    // size and modification time match the database; take over the existing file element
+                    emit processingUpdateNewFile(file_index, f.size);
+                    emit processingUpdateHashCompleted(file_index, f.size);
+                    snapshot_contents.push_back(reference_element);
+                    ++n_unchanged_skipped;
+                    ++file_index;
+                    if (m_cancelProcessing.load()) { emit processingCanceled(); return; }
+                    continue;
+                }
+                reference_hash = blimpdb.getFileHash(reference_element);
+            }
+            // inline contents do not pass through the pipeline, so they leave the open bundle untouched
+            bool const store_inline = (f.size < m_inlineSizeLimit);
             try {
+                if ((!store_inline) && (bundles[file_index].bundle_id != open_bundle)) {
+                    if (!closeBundle()) { emit processingCanceled(); return; }
+                    open_bundle = bundles[file_index].bundle_id;
+                    if ((open_bundle != 0) && (!storing_pool)) { pipeline.beginBundle(); }
+                }
                 // read file chunk
                 emit processingUpdateNewFile(file_index, f.size);
                 GHULBUS_LOG(Debug, "Processing file " << f.path.string());
-                fio.startReading(f.path);
+                Hash hash;
                 std::size_t bytes_read = 0;
-                hasher.restart();
-                while (fio.hasMoreChunks()) {
-                    FileChunk const& c = fio.getNextChunk();
-                    bytes_read += c.getUsedSize();
-                    hasher.addData(c);
-                    emit processingUpdateHashProgress(bytes_read);
+                std::optional<ProcessingPipeline::TransactionGuard> speculative_transaction;
+                // the data of a speculative transaction cannot be dropped from the compressed stream of a bundle,
+                // so bundled files are kept in memory while hashing instead, as are files to be stored inline
+                std::optional<std::vector<char>> buffered_content;
+                if (hashing_pool) {
+                    std::future<HashingResult> hash_result = std::move(pending_hashes.front());
+                    pending_hashes.pop_front();
+                    scheduleHashing();
+                    HashingResult r = hash_result.get();
                     if (m_cancelProcessing.load()) { emit processingCanceled(); return; }
+                    hash = r.hash;
+                    bytes_read = r.bytes_read;
+                    if (store_inline) { buffered_content = std::move(r.content); }
+                    emit processingUpdateHashProgress(bytes_read);
+                } else {
+                    if (store_inline || (m_singlePass && (!storing_pool) && (open_bundle != 0))) {
+                        buffered_content.emplace();
+                        buffered_content->reserve(f.size);
+                    } else if (m_singlePass && (!storing_pool)) {
+                        speculative_transaction.emplace(pipeline.startSpeculativeContentTransaction(f));
+                        pipeline.adjustReadQueueDepth(fio);
+                    }
+                    fio.startReading(f.path);
+                    hasher.restart();
+                    while (fio.hasMoreChunks()) {
+                        FileChunk const& c = fio.getNextChunk();
+                        bytes_read += c.getUsedSize();
+                        hasher.addData(c);
+                        if (buffered_content) {
+                            buffered_content->insert(buffered_content->end(), c.getData(),
+                                                     c.getData() + c.getUsedSize());
+                        }
+                        if (speculative_transaction) {
+                            if (speculative_transaction->addFileChunk(c) == ProcessingPipeline::ContainerStatus::Full) {
+                                rotateStorageContainer(pipeline);
+                            }
+                        }
+                        emit processingUpdateHashProgress(bytes_read);
+                        if (m_cancelProcessing.load()) { emit processingCanceled(); return; }
+                    }
+                    hash = hasher.getHash();
                 }
-                Hash const hash = hasher.getHash();
                 GHULBUS_LOG(Debug, "Calculated hash for " << f.path << " is " << to_string(hash));
+                if (reference_hash && (reference_hash->digest != hash.digest)) {
+                    GHULBUS_LOG(Warning, "Content of " << f.path << " changed without changing size or modification"
+                                " time; expected hash " << to_string(*reference_hash) << ".");
+                }
                 std::size_t const filesize = bytes_read;
                 if (filesize != f.size) {
                     /// @todo deal with changing files
@@ -68,27 +497,56 @@ void FileProcessor::startProcessing(BlimpDB::SnapshotId snapshot_id, std::vector
                 emit processingUpdateHashCompleted(file_index, filesize);
                 auto const [file_element, content_id, insertion_status] = blimpdb.newFileContent(f, hash, false);
                 snapshot_contents.push_back(file_element);
-                if (insertion_status == BlimpDB::FileContentInsertion::CreatedNew) {
-                    auto transaction = m_processingPipeline->startNewContentTransaction(hash);
+                if (speculative_transaction) {
+                    if (insertion_status == BlimpDB::FileContentInsertion::CreatedNew) {
+                        std::vector<StorageLocation> const storage_locations =
+                            pipeline.commitTransaction(std::move(*speculative_transaction));
+                        if (pipeline.isContainerFull()) { rotateStorageContainer(pipeline); }
+                        blimpdb.newStorageElement(content_id, storage_locations, false);
+                        emit processingUpdateFileProgress(bytes_read);
+                    } else {
+                        pipeline.abortTransaction(std::move(*speculative_transaction));
+                    }
+                } else if ((insertion_status == BlimpDB::FileContentInsertion::CreatedNew) && store_inline) {
+                    blimpdb.newInlineContent(pipeline.encodeInlineContent(content_id, f, *buffered_content), false);
+                    emit processingUpdateFileProgress(bytes_read);
+                } else if ((insertion_status == BlimpDB::FileContentInsertion::CreatedNew) && storing_pool) {
+                    StoringEntry entry{ .file_index = file_index, .content_id = content_id, .hash = hash };
+                    if (open_bundle != 0) {
+                        bundle_entries.push_back(entry);
+                    } else {
+                        if (!waitForFreePipeline()) { emit processingCanceled(); return; }
+                        scheduleStoring({ entry }, false);
+                    }
+                } else if ((insertion_status == BlimpDB::FileContentInsertion::CreatedNew) && buffered_content) {
+                    auto transaction = pipeline.startNewContentTransaction(hash, f);
+                    for (std::size_t offset = 0; offset < buffered_content->size(); offset += g_bufferedChunkSize) {
+                        std::size_t const n_bytes = std::min(g_bufferedChunkSize, buffered_content->size() - offset);
+                        FileChunk const c = FileChunk::fromView(buffered_content->data() + offset, n_bytes);
+                        if (transaction.addFileChunk(c) == ProcessingPipeline::ContainerStatus::Full) {
+                            rotateStorageContainer(pipeline);
+                        }
+                    }
+                    std::vector<StorageLocation> const storage_locations =
+                        pipeline.commitTransaction(std::move(transaction));
+                    blimpdb.newStorageElement(content_id, storage_locations, false);
+                    emit processingUpdateFileProgress(bytes_read);
+                } else if (insertion_status == BlimpDB::FileContentInsertion::CreatedNew) {
+                    auto transaction = pipeline.startNewContentTransaction(hash, f);
+                    pipeline.adjustReadQueueDepth(fio);
                     fio.startReading(f.path);
                     bytes_read = 0;
                     while (fio.hasMoreChunks()) {
                         FileChunk const& c = fio.getNextChunk();
                         if (transaction.addFileChunk(c) == ProcessingPipeline::ContainerStatus::Full) {
-                            auto const new_container_id = blimpdb.newStorageContainer();
-                            m_processingPipeline->newStorageContainer(new_container_id);
-                            auto const container_location = m_processingPipeline->getLastContainerLocation();
-                            StorageContainer const container{ .id = current_container,
-                                                              .location = container_location };
-                            blimpdb.finalizeStorageContainer(container, false);
-                            current_container = new_container_id;
+                            rotateStorageContainer(pipeline);
                         }
                         bytes_read += c.getUsedSize();
                         emit processingUpdateFileProgress(bytes_read);
                         if (m_cancelProcessing.load()) { emit processingCanceled(); return; }
                     }
                     std::vector<StorageLocation> const storage_locations =
-                        m_processingPipeline->commitTransaction(std::move(transaction));
+                        pipeline.commitTransaction(std::move(transaction));
                     blimpdb.newStorageElement(content_id, storage_locations, false);
                 }
                 if (m_cancelProcessing.load()) { emit processingCanceled(); return; }
@@ -97,14 +555,21 @@ void FileProcessor::startProcessing(BlimpDB::SnapshotId snapshot_id, std::vector
             }
             ++file_index;
         }
-        m_processingPipeline->finish();
-        StorageContainer const container{ .id = current_container,
-                                          .location = m_processingPipeline->getLastContainerLocation() };
-        blimpdb.finalizeStorageContainer(container, false);
+        if (!closeBundle()) { emit processingCanceled(); return; }
+        while (!pending_stores.empty()) {
+            completeStoring();
+            if (m_cancelProcessing.load()) { emit processingCanceled(); return; }
+        }
+        for (auto& p : m_processingPipelines) {
+            p->finish();
+        }
+        recordFinalizedContainers();
         auto const t1 = std::chrono::steady_clock::now();
         GHULBUS_LOG(Info, "Processing " << m_filesToProcess.size() << " file" <<
                     ((m_filesToProcess.size() != 1) ? "s" : "") << " took " <<
                     std::chrono::duration_cast<std::chrono::milliseconds>(t1 - t0) << " total.");
+        GHULBUS_LOG(Info, "Skipped reading " << n_unchanged_skipped << " unchanged file" <<
+                    ((n_unchanged_skipped != 1) ? "s" : "") << ".");
         GHULBUS_LOG(Debug, "Adding " << snapshot_contents.size() << " elements as snapshot contents");
         blimpdb.addSnapshotContents(snapshot_id, snapshot_contents, false);
         blimpdb.commitExternalSync();
@@ -125,8 +590,122 @@ std::unique_ptr<BlimpDB> FileProcessor::joinProcessing()
     return ret;
 }
 
-void FileProcessor::retrieveFile(boost::filesystem::path to, FileInfo const& file_info, Hash const& file_hash,
-                                 std::vector<BlimpDB::StorageElement> const& storage_elements)
+void FileProcessor::retrieveFile(BlimpDB& blimpdb, boost::filesystem::path to, FileInfo const& file_info,
+                                 Hash const& file_hash, std::vector<BlimpDB::StorageElement> const& storage_elements)
 {
-    
+    GHULBUS_PRECONDITION(!m_dbReturnChannel);
+    std::int64_t restored_size = 0;
+    for (auto const& element : storage_elements) {
+        restored_size += element.location.size;
+    }
+    if (restored_size != static_cast<std::int64_t>(file_info.size)) {
+        GHULBUS_THROW(Exceptions::DatabaseError{} << Ghulbus::Exception_Info::filename(file_info.path.string()),
+                      "Storage elements do not match the size of the file");
+    }
+    MemoryBudget budget(m_memoryBudgetLimit);
+    ProcessingPipeline pipeline(blimpdb, budget);
+    pipeline.retrieveFile(storage_elements, file_hash, to);
+}
+
+void FileProcessor::retrieveInlineFile(BlimpDB& blimpdb, boost::filesystem::path to, Hash const& file_hash,
+                                       BlimpDB::InlineContent const& content)
+{
+    GHULBUS_PRECONDITION(!m_dbReturnChannel);
+    MemoryBudget budget(m_memoryBudgetLimit);
+    ProcessingPipeline pipeline(blimpdb, budget);
+    pipeline.restoreInlineContent(content, file_hash, to);
+}
+
+void FileProcessor::restoreSnapshot(BlimpDB& blimpdb, BlimpDB::SnapshotId const& snapshot_id,
+                                    boost::filesystem::path const& target_dir)
+{
+    GHULBUS_PRECONDITION(!m_dbReturnChannel);
+    auto const t0 = std::chrono::steady_clock::now();
+    std::vector<BlimpDB::SnapshotInlineContent> inline_contents = blimpdb.getInlineContentsForSnapshot(snapshot_id);
+    RestorePlan plan = planSnapshotRestore(blimpdb.getFileElementsForSnapshot(snapshot_id),
+                                           blimpdb.getStorageElementsForSnapshot(snapshot_id), inline_contents,
+                                           target_dir);
+    for (auto& c : plan.containers) {
+        c.blocks = blimpdb.getStorageBlocks(c.container.id);
+    }
+    for (auto const& f : plan.files) {
+        createRestoreDestination(f.destination);
+    }
+
+    // the plugins of a pipeline hold the state of the container being restored, so each thread needs its own
+    MemoryBudget budget(m_memoryBudgetLimit);
+    std::size_t const n_threads = std::clamp(plan.containers.size(), std::size_t{ 1 }, m_restoreThreads);
+    std::vector<std::unique_ptr<ProcessingPipeline>> free_pipelines;
+    for (std::size_t i = 0; i < n_threads; ++i) {
+        free_pipelines.emplace_back(std::make_unique<ProcessingPipeline>(blimpdb, budget, n_threads));
+    }
+
+    // inline contents need no container; they are restored before the restore threads start accessing the database
+    for (auto const& f : plan.inline_files) {
+        BlimpDB::SnapshotInlineContent const& c = inline_contents[f.content_index];
+        free_pipelines.front()->restoreInlineContent(c.content, c.content_hash, f.destination);
+    }
+    // the inline data is no longer needed while the containers are restored
+    inline_contents = {};
+    std::mutex mtx_pipelines;
+    std::atomic<bool> restore_failed(false);
+    std::vector<std::future<void>> pending_containers;
+    {
+        WorkerPool restore_pool(n_threads);
+        for (auto const& c : plan.containers) {
+            std::packaged_task<void()> pt{ [&c, &free_pipelines, &mtx_pipelines, &restore_failed]() {
+                // once a container failed, the remaining ones are skipped
+                if (restore_failed.load()) { return; }
+                std::unique_ptr<ProcessingPipeline> pipeline;
+                {
+                    std::lock_guard lk(mtx_pipelines);
+                    pipeline = std::move(free_pipelines.back());
+                    free_pipelines.pop_back();
+                }
+                auto const release_pipeline = Ghulbus::finally([&]() {
+                    std::lock_guard lk(mtx_pipelines);
+                    free_pipelines.emplace_back(std::move(pipeline));
+                });
+                try {
+                    pipeline->restoreContainer(c.container, c.blocks, c.parts);
+                } catch (...) {
+                    restore_failed.store(true);
+                    throw;
+                }
+            } };
+            pending_containers.emplace_back(pt.get_future());
+            restore_pool.schedule([pt = std::move(pt)]() mutable { pt(); });
+        }
+    }
+    for (auto& f : pending_containers) {
+        f.get();
+    }
+    auto const t1 = std::chrono::steady_clock::now();
+
+    // files spanning several containers were written out of order and are read back for verification
+    FileIO fio;
+    FileHasher hasher(HashType::SHA_256);
+    for (auto const& f : plan.files) {
+        Hash restored_hash;
+        if (f.hasher) {
+            restored_hash = f.hasher->getHash();
+        } else {
+            fio.startReading(f.destination);
+            hasher.restart();
+            while (fio.hasMoreChunks()) {
+                hasher.addData(fio.getNextChunk());
+            }
+            restored_hash = hasher.getHash();
+        }
+        if (restored_hash.digest != f.hash.digest) {
+            GHULBUS_THROW(Ghulbus::Exceptions::IOError{} << Ghulbus::Exception_Info::filename(f.destination.string()),
+                          "Restored file does not match its hash");
+        }
+    }
+    auto const t2 = std::chrono::steady_clock::now();
+    GHULBUS_LOG(Info, "Restored " << plan.files.size() << " file" << ((plan.files.size() != 1) ? "s" : "") <<
+                " from " << plan.containers.size() << " container" << ((plan.containers.size() != 1) ? "s" : "") <<
+                " and " << plan.inline_files.size() << " inline file" << ((plan.inline_files.size() != 1) ? "s" : "") <<
+                " in " << std::chrono::duration_cast<std::chrono::milliseconds>(t1 - t0) << ", verification took " <<
+                std::chrono::duration_cast<std::chrono::milliseconds>(t2 - t1) << ".");
 }
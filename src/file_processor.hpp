@@ -6,6 +6,7 @@
 #include <db/blimpdb.hpp>
 #include <file_hash.hpp>
 #include <file_info.hpp>
+#include <file_io.hpp>
 
 #include <boost/filesystem/path.hpp>
 
@@ -19,6 +20,7 @@
 #include <thread>
 #include <vector>
 
+class MemoryBudget;
 class ProcessingPipeline;
 
 class FileProcessor : public QObject
@@ -26,9 +28,19 @@ class FileProcessor : public QObject
     Q_OBJECT
 private:
     std::atomic<bool> m_cancelProcessing;
+    bool m_singlePass;
+    std::size_t m_hashingThreads;
+    std::size_t m_storingThreads;
+    std::size_t m_restoreThreads;
+    FileIO::CacheMode m_readCacheMode;
     std::mutex m_mtx;
     std::thread m_processingThread;
     std::vector<FileInfo> m_filesToProcess;
+    std::vector<FileIndexDiff::ElementDiff> m_fileDiffs;
+    double m_unchangedVerificationFraction;
+    std::size_t m_memoryBudgetLimit;
+    std::uint64_t m_bundleSize;
+    std::uint64_t m_inlineSizeLimit;
     struct Timings {
         std::chrono::steady_clock::time_point indexingStart;
         std::chrono::steady_clock::time_point indexingFinished;
@@ -40,19 +52,110 @@ private:
         std::chrono::steady_clock::time_point indexDbUpdateFinished;
     } m_timings;
     std::unique_ptr<BlimpDB> m_dbReturnChannel;
-    std::unique_ptr<ProcessingPipeline> m_processingPipeline;
+    std::unique_ptr<MemoryBudget> m_memoryBudget;
+    std::vector<std::unique_ptr<ProcessingPipeline>> m_processingPipelines;
 public:
     FileProcessor();
     ~FileProcessor();
     FileProcessor(FileProcessor const&) = delete;
     FileProcessor& operator=(FileProcessor const&) = delete;
 
-    void startProcessing(BlimpDB::SnapshotId snapshot_id, std::vector<FileInfo>&& files, std::unique_ptr<BlimpDB>&& blimpdb);
+    /** Enables speculative single-pass processing (enabled by default).
+     * Each file is fed to the processing pipeline while it is being hashed, so that new content only has to be read
+     * once. If the hash reveals the content to be already in the database, the data sent to the pipeline is discarded.
+     * With single-pass processing disabled, files with new content are read a second time after hashing.
+     * Single-pass processing only applies with one hashing and one storing thread, which by default is the case on
+     * machines with a single hardware thread only.
+     */
+    void setSinglePassProcessing(bool enabled);
+
+    /** Sets the number of threads reading and hashing files concurrently (one per hardware thread, up to 4, by
+     * default).
+     * With more than one thread, files are hashed ahead of the processing thread, which still stores the files
+     * one after another in their original order. Files with new content are then read a second time for storing,
+     * as single-pass processing requires hashing and storing to happen on the same thread.
+     */
+    void setHashingThreads(std::size_t n_threads);
+
+    /** Sets the number of threads storing new content concurrently (one per hardware thread, up to 4, by default).
+     * Each storing thread has a processing pipeline of its own, with its own plugin instances and its own open
+     * storage container. A content is never split across containers then, so that it always lands contiguously in
+     * one container; containers may exceed their size limit by the size of one file. Files with new content are read
+     * a second time for storing, as with more than one hashing thread.
+     */
+    void setStoringThreads(std::size_t n_threads);
+
+    /** Sets how files are read for processing with regard to the page cache (FileIO::CacheMode::Direct by default).
+     * By default, backups bypass the page cache, so that reading the whole selection does not evict the cached data
+     * of other processes. Files that are read a second time for storing are then read from disk again.
+     */
+    void setReadCacheMode(FileIO::CacheMode cache_mode);
+
+    /** Sets the fraction of unchanged files that are read and hashed nonetheless (0 by default).
+     * Files that the index diff reports as unchanged are added to the snapshot under their existing file element,
+     * without reading them. A fraction in ]0, 1] selects a random sample of those files for verification against
+     * the hash stored in the database; 1 verifies all of them.
+     */
+    void setUnchangedVerificationFraction(double fraction);
+
+    /** Sets the number of storage containers that are restored concurrently by restoreSnapshot() (4 by default).
+     */
+    void setRestoreThreads(std::size_t n_threads);
+
+    /** Sets the memory budget for reading and processing files in bytes (256 MB by default).
+     * Reading blocks while the chunks in the processing pipeline exhaust the budget. The peak usage is logged once
+     * processing has finished.
+     */
+    void setMemoryBudget(std::size_t n_bytes);
+
+    /** Sets the size below which files are bundled with other small files (1 MB by default); 0 disables bundling.
+     * The new contents of a bundle are compressed as one solid stream, which improves the compression of many small
+     * files and saves the framing of a stream per file (see bundleFiles()). Each file remains recorded at its own
+     * offset within the decompressed storage container. Bundled files are kept in memory while they are hashed
+     * instead of being processed speculatively.
+     */
+    void setBundleSize(std::uint64_t n_bytes);
+
+    /** Sets the size below which file contents are stored inline in the database (4 KB by default); 0 disables it.
+     * An inline content is compressed and encrypted on its own and kept in the database instead of a storage container,
+     * which saves tiny files the framing of a stream and the seek into a container when restoring. Inline contents are
+     * stored by the processing thread rather than the storing threads, and are left out of bundles.
+     */
+    void setInlineSizeLimit(std::uint64_t n_bytes);
+
+    /** Processes files into the given snapshot.
+     * file_diffs is either empty or holds the index diff entry for each element of files. Unchanged files are
+     * then taken over from the database without reading them (see setUnchangedVerificationFraction()).
+     */
+    void startProcessing(BlimpDB::SnapshotId snapshot_id, std::vector<FileInfo>&& files,
+                         std::vector<FileIndexDiff::ElementDiff>&& file_diffs, std::unique_ptr<BlimpDB>&& blimpdb);
     void cancelProcessing();
     [[nodiscard]] std::unique_ptr<BlimpDB> joinProcessing();
 
-    void retrieveFile(boost::filesystem::path to, FileInfo const& file_info, Hash const& file_hash,
+    /** Restores a file from the storage elements returned by BlimpDB::getFileStorageInfo() to the path to.
+     * Restoring runs on the calling thread and must not overlap with processing. Throws if the file cannot be
+     * restored or does not match file_hash.
+     */
+    void retrieveFile(BlimpDB& blimpdb, boost::filesystem::path to, FileInfo const& file_info, Hash const& file_hash,
                       std::vector<BlimpDB::StorageElement> const& storage_elements);
+
+    /** Restores a file whose content is stored inline in the database, as returned by BlimpDB::getFileInlineContent(),
+     * to the path to. Restoring runs on the calling thread and must not overlap with processing. Throws if the file
+     * cannot be restored or does not match file_hash.
+     */
+    void retrieveInlineFile(BlimpDB& blimpdb, boost::filesystem::path to, Hash const& file_hash,
+                            BlimpDB::InlineContent const& content);
+
+    /** Restores all files of a snapshot to their original paths relative to target_dir.
+     * Instead of restoring file by file, each storage container is read exactly once, from front to back, and its
+     * contents are distributed to the files it holds parts of (see planSnapshotRestore()). Several containers are
+     * restored concurrently (see setRestoreThreads()). Files with inline contents are restored first, without
+     * touching any container.
+     * Restoring runs on the calling thread and must not overlap with processing. Throws if a file cannot be restored
+     * or does not match its hash; files that were restored until then remain in place.
+     */
+    void restoreSnapshot(BlimpDB& blimpdb, BlimpDB::SnapshotId const& snapshot_id,
+                         boost::filesystem::path const& target_dir);
 signals:
     void processingUpdateNewFile(std::uint64_t current_file_indexed, std::uint64_t current_file_size);
     void processingUpdateHashProgress(std::uint64_t current_file_bytes_processed);
@@ -0,0 +1,109 @@
+#include <memory_budget.hpp>
+
+#include <gbBase/Assert.hpp>
+
+#include <algorithm>
+
+MemoryBudget::Reservation::Reservation()
+    :m_budget(nullptr), m_size(0), m_isAcquired(false)
+{}
+
+MemoryBudget::Reservation::Reservation(MemoryBudget* budget, std::size_t size, bool is_acquired)
+    :m_budget(budget), m_size(size), m_isAcquired(is_acquired)
+{}
+
+MemoryBudget::Reservation::~Reservation()
+{
+    release();
+}
+
+MemoryBudget::Reservation::Reservation(Reservation&& rhs)
+    :m_budget(rhs.m_budget), m_size(rhs.m_size), m_isAcquired(rhs.m_isAcquired)
+{
+    rhs.m_budget = nullptr;
+    rhs.m_size = 0;
+}
+
+MemoryBudget::Reservation& MemoryBudget::Reservation::operator=(Reservation&& rhs)
+{
+    if (this != &rhs) {
+        release();
+        m_budget = rhs.m_budget;
+        m_size = rhs.m_size;
+        m_isAcquired = rhs.m_isAcquired;
+        rhs.m_budget = nullptr;
+        rhs.m_size = 0;
+    }
+    return *this;
+}
+
+std::size_t MemoryBudget::Reservation::getSize() const
+{
+    return m_size;
+}
+
+void MemoryBudget::Reservation::release()
+{
+    if (m_budget) {
+        m_budget->release(m_size, m_isAcquired);
+        m_budget = nullptr;
+        m_size = 0;
+    }
+}
+
+MemoryBudget::MemoryBudget(std::size_t limit)
+    :m_limit(limit), m_usage(0), m_acquiredUsage(0), m_peakUsage(0)
+{
+    GHULBUS_PRECONDITION(limit > 0);
+}
+
+MemoryBudget::~MemoryBudget()
+{
+    GHULBUS_ASSERT(m_usage == 0);
+}
+
+std::size_t MemoryBudget::getLimit() const
+{
+    return m_limit;
+}
+
+std::size_t MemoryBudget::getUsage()
+{
+    std::lock_guard lk(m_mtx);
+    return m_usage;
+}
+
+std::size_t MemoryBudget::getPeakUsage()
+{
+    std::lock_guard lk(m_mtx);
+    return m_peakUsage;
+}
+
+MemoryBudget::Reservation MemoryBudget::acquire(std::size_t n_bytes)
+{
+    std::unique_lock lk(m_mtx);
+    m_cv.wait(lk, [this, n_bytes]() { return (m_usage + n_bytes <= m_limit) || (m_acquiredUsage == 0); });
+    m_usage += n_bytes;
+    m_acquiredUsage += n_bytes;
+    m_peakUsage = std::max(m_peakUsage, m_usage);
+    return Reservation(this, n_bytes, true);
+}
+
+MemoryBudget::Reservation MemoryBudget::charge(std::size_t n_bytes)
+{
+    std::lock_guard lk(m_mtx);
+    m_usage += n_bytes;
+    m_peakUsage = std::max(m_peakUsage, m_usage);
+    return Reservation(this, n_bytes, false);
+}
+
+void MemoryBudget::release(std::size_t n_bytes, bool is_acquired)
+{
+    {
+        std::lock_guard lk(m_mtx);
+        GHULBUS_ASSERT(m_usage >= n_bytes);
+        m_usage -= n_bytes;
+        if (is_acquired) { m_acquiredUsage -= n_bytes; }
+    }
+    m_cv.notify_all();
+}
@@ -0,0 +1,65 @@
+#ifndef BLIMP_INCLUDE_GUARD_MEMORY_BUDGET_HPP
+#define BLIMP_INCLUDE_GUARD_MEMORY_BUDGET_HPP
+
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+
+/** Upper limit for the memory held by file reading and the processing pipeline.
+ * Memory is accounted for through reservations. Producers of data acquire() their reservations and block while the
+ * budget is exhausted; memory that is in use already or cannot be waited for is charge()d without blocking, which
+ * may temporarily push the usage beyond the limit.
+ * To guarantee progress, acquire() always succeeds if no other acquired reservation is outstanding, as then there
+ * is nothing left to wait for.
+ */
+class MemoryBudget {
+public:
+    class [[nodiscard]] Reservation {
+        friend class MemoryBudget;
+    private:
+        MemoryBudget* m_budget;
+        std::size_t m_size;
+        bool m_isAcquired;
+    private:
+        Reservation(MemoryBudget* budget, std::size_t size, bool is_acquired);
+    public:
+        Reservation();
+        ~Reservation();
+        Reservation(Reservation const&) = delete;
+        Reservation& operator=(Reservation const&) = delete;
+        Reservation(Reservation&& rhs);
+        Reservation& operator=(Reservation&& rhs);
+
+        std::size_t getSize() const;
+        void release();
+    };
+private:
+    std::size_t m_limit;
+    std::mutex m_mtx;
+    std::condition_variable m_cv;
+    std::size_t m_usage;
+    std::size_t m_acquiredUsage;
+    std::size_t m_peakUsage;
+public:
+    explicit MemoryBudget(std::size_t limit);
+    ~MemoryBudget();
+
+    MemoryBudget(MemoryBudget const&) = delete;
+    MemoryBudget& operator=(MemoryBudget const&) = delete;
+
+    std::size_t getLimit() const;
+    std::size_t getUsage();
+    std::size_t getPeakUsage();
+
+    /** Blocks until n_bytes fit into the budget.
+     */
+    Reservation acquire(std::size_t n_bytes);
+
+    /** Reserves n_bytes without blocking, even if that exceeds the budget.
+     */
+    Reservation charge(std::size_t n_bytes);
+private:
+    void release(std::size_t n_bytes, bool is_acquired);
+};
+
+#endif
@@ -4,6 +4,8 @@
 #include <plugin_common.hpp>
 #include <plugin_key_value_store.hpp>
 
+#include <gbBase/Assert.hpp>
+
 PluginCompression::PluginCompression(BlimpDB& blimpdb, std::string const& plugin_name)
     :m_compression_guard(nullptr, nullptr)
 {
@@ -21,9 +23,22 @@ PluginCompression::PluginCompression(BlimpDB& blimpdb, std::string const& plugin
         m_compression_dll.get<BlimpPluginResult(BlimpKeyValueStore, BlimpPluginCompression*)>("blimp_plugin_compression_initialize");
     m_compression_plugin_shutdown =
         m_compression_dll.get<void(BlimpPluginCompression*)>("blimp_plugin_compression_shutdown");
-    m_compression.abi = BLIMP_PLUGIN_ABI_1_0_0;
+    m_compression = BlimpPluginCompression{};
+    m_compression.abi = BLIMP_PLUGIN_ABI_1_2_0;
     m_kvStore = std::make_unique<PluginKeyValueStore>(blimpdb, api_info);
-    BlimpPluginResult const res = m_compression_plugin_initialize(m_kvStore->getPluginKeyValueStore(), &m_compression);
+    BlimpPluginResult res = m_compression_plugin_initialize(m_kvStore->getPluginKeyValueStore(), &m_compression);
+    if (res == BLIMP_PLUGIN_RESULT_INVALID_ARGUMENT) {
+        // plugin predates adjustable compression parameters
+        m_compression = BlimpPluginCompression{};
+        m_compression.abi = BLIMP_PLUGIN_ABI_1_1_0;
+        res = m_compression_plugin_initialize(m_kvStore->getPluginKeyValueStore(), &m_compression);
+    }
+    if (res == BLIMP_PLUGIN_RESULT_INVALID_ARGUMENT) {
+        // plugin predates buffer lending
+        m_compression = BlimpPluginCompression{};
+        m_compression.abi = BLIMP_PLUGIN_ABI_1_0_0;
+        res = m_compression_plugin_initialize(m_kvStore->getPluginKeyValueStore(), &m_compression);
+    }
     if (res != BLIMP_PLUGIN_RESULT_OK) {
         GHULBUS_THROW(Exceptions::PluginError{}
                       << Exception_Info::Records::plugin_name(plugin_name)
@@ -75,3 +90,56 @@ BlimpFileChunk PluginCompression::getProcessedChunk()
 {
     return m_compression.get_processed_chunk(m_compression.state);
 }
+
+bool PluginCompression::supportsBufferLending() const
+{
+    return m_compression.abi != BLIMP_PLUGIN_ABI_1_0_0;
+}
+
+void PluginCompression::setBufferPool(BlimpBufferPool const& pool)
+{
+    GHULBUS_PRECONDITION(supportsBufferLending());
+    m_compression.set_buffer_pool(m_compression.state, pool);
+}
+
+BlimpLentChunk PluginCompression::takeProcessedChunk()
+{
+    if (!supportsBufferLending()) {
+        BlimpFileChunk const chunk = getProcessedChunk();
+        return BlimpLentChunk{ .data = chunk.data, .size = chunk.size, .token = 0 };
+    }
+    return m_compression.take_processed_chunk(m_compression.state);
+}
+
+std::optional<PluginCompression::ParameterRange> PluginCompression::getCompressionParameter(
+    BlimpCompressionParameter parameter)
+{
+    if (m_compression.abi != BLIMP_PLUGIN_ABI_1_2_0) { return std::nullopt; }
+    ParameterRange ret{ .value = 0, .min_value = 0, .max_value = 0 };
+    BlimpPluginResult const res = m_compression.get_compression_parameter(m_compression.state, parameter, &ret.value,
+                                                                          &ret.min_value, &ret.max_value);
+    if (res == BLIMP_PLUGIN_RESULT_INVALID_ARGUMENT) { return std::nullopt; }
+    if (res != BLIMP_PLUGIN_RESULT_OK) {
+        GHULBUS_THROW(Exceptions::PluginError{}
+                      << Ghulbus::Exception_Info::filename(m_compression_dll.location().string())
+                      << Exception_Info::Records::plugin_error_code(res)
+                      << Exception_Info::Records::plugin_error_message(this->getLastError()),
+                      "Error while retrieving compression parameter");
+    }
+    return ret;
+}
+
+bool PluginCompression::setCompressionParameter(BlimpCompressionParameter parameter, std::int64_t value)
+{
+    if (m_compression.abi != BLIMP_PLUGIN_ABI_1_2_0) { return false; }
+    BlimpPluginResult const res = m_compression.set_compression_parameter(m_compression.state, parameter, value);
+    if (res == BLIMP_PLUGIN_RESULT_INVALID_ARGUMENT) { return false; }
+    if (res != BLIMP_PLUGIN_RESULT_OK) {
+        GHULBUS_THROW(Exceptions::PluginError{}
+                      << Ghulbus::Exception_Info::filename(m_compression_dll.location().string())
+                      << Exception_Info::Records::plugin_error_code(res)
+                      << Exception_Info::Records::plugin_error_message(this->getLastError()),
+                      "Error while setting compression parameter");
+    }
+    return true;
+}
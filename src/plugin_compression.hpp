@@ -5,7 +5,9 @@
 
 #include <boost/dll/shared_library.hpp>
 
+#include <cstdint>
 #include <memory>
+#include <optional>
 
 class BlimpDB;
 class PluginKeyValueStore;
@@ -29,6 +31,29 @@ public:
     void compressFileChunk(BlimpFileChunk chunk);
     void decompressFileChunk(BlimpFileChunk chunk);
     BlimpFileChunk getProcessedChunk();
+
+    bool supportsBufferLending() const;
+    /** Requires supportsBufferLending(). The pool must outlive the plugin.
+     */
+    void setBufferPool(BlimpBufferPool const& pool);
+    /** Like getProcessedChunk(), but passes ownership of chunks in lent buffers to the caller.
+     * Chunks with a non-zero token have to be released to the buffer pool once consumed.
+     */
+    BlimpLentChunk takeProcessedChunk();
+
+    struct ParameterRange {
+        std::int64_t value;
+        std::int64_t min_value;
+        std::int64_t max_value;
+    };
+    /** Returns the current value of a compression parameter and the range of values the plugin accepts.
+     * Returns an empty optional if the plugin does not support adjusting the parameter.
+     */
+    std::optional<ParameterRange> getCompressionParameter(BlimpCompressionParameter parameter);
+    /** Changes a compression parameter; the new value takes effect with the next compressed stream.
+     * Returns false if the plugin does not support the parameter or the value.
+     */
+    bool setCompressionParameter(BlimpCompressionParameter parameter, std::int64_t value);
 };
 
 #endif
@@ -4,6 +4,8 @@
 #include <plugin_common.hpp>
 #include <plugin_key_value_store.hpp>
 
+#include <gbBase/Assert.hpp>
+
 PluginEncryption::PluginEncryption(BlimpDB& blimpdb, std::string const& plugin_name)
     :m_encryption_guard(nullptr, nullptr)
 {
@@ -21,9 +23,28 @@ PluginEncryption::PluginEncryption(BlimpDB& blimpdb, std::string const& plugin_n
         m_encryption_dll.get<BlimpPluginResult(BlimpKeyValueStore, BlimpPluginEncryption*)>("blimp_plugin_encryption_initialize");
     m_encryption_plugin_shutdown =
         m_encryption_dll.get<void(BlimpPluginEncryption*)>("blimp_plugin_encryption_shutdown");
-    m_encryption.abi = BLIMP_PLUGIN_ABI_1_0_0;
+    m_encryption = BlimpPluginEncryption{};
+    m_encryption.abi = BLIMP_PLUGIN_ABI_1_3_0;
     m_kvStore = std::make_unique<PluginKeyValueStore>(blimpdb, api_info);
-    BlimpPluginResult const res = m_encryption_plugin_initialize(m_kvStore->getPluginKeyValueStore(), &m_encryption);
+    BlimpPluginResult res = m_encryption_plugin_initialize(m_kvStore->getPluginKeyValueStore(), &m_encryption);
+    if (res == BLIMP_PLUGIN_RESULT_INVALID_ARGUMENT) {
+        // plugin predates rewinding
+        m_encryption = BlimpPluginEncryption{};
+        m_encryption.abi = BLIMP_PLUGIN_ABI_1_2_0;
+        res = m_encryption_plugin_initialize(m_kvStore->getPluginKeyValueStore(), &m_encryption);
+    }
+    if (res == BLIMP_PLUGIN_RESULT_INVALID_ARGUMENT) {
+        // plugin predates seeking
+        m_encryption = BlimpPluginEncryption{};
+        m_encryption.abi = BLIMP_PLUGIN_ABI_1_1_0;
+        res = m_encryption_plugin_initialize(m_kvStore->getPluginKeyValueStore(), &m_encryption);
+    }
+    if (res == BLIMP_PLUGIN_RESULT_INVALID_ARGUMENT) {
+        // plugin predates buffer lending
+        m_encryption = BlimpPluginEncryption{};
+        m_encryption.abi = BLIMP_PLUGIN_ABI_1_0_0;
+        res = m_encryption_plugin_initialize(m_kvStore->getPluginKeyValueStore(), &m_encryption);
+    }
     if (res != BLIMP_PLUGIN_RESULT_OK) {
         GHULBUS_THROW(Exceptions::PluginError{}
                       << Exception_Info::Records::plugin_name(plugin_name)
@@ -103,3 +124,74 @@ BlimpFileChunk PluginEncryption::getProcessedChunk()
 {
     return m_encryption.get_processed_chunk(m_encryption.state);
 }
+
+bool PluginEncryption::supportsBufferLending() const
+{
+    return m_encryption.abi != BLIMP_PLUGIN_ABI_1_0_0;
+}
+
+void PluginEncryption::setBufferPool(BlimpBufferPool const& pool)
+{
+    GHULBUS_PRECONDITION(supportsBufferLending());
+    m_encryption.set_buffer_pool(m_encryption.state, pool);
+}
+
+BlimpLentChunk PluginEncryption::takeProcessedChunk()
+{
+    if (!supportsBufferLending()) {
+        BlimpFileChunk const chunk = getProcessedChunk();
+        return BlimpLentChunk{ .data = chunk.data, .size = chunk.size, .token = 0 };
+    }
+    return m_encryption.take_processed_chunk(m_encryption.state);
+}
+
+bool PluginEncryption::supportsSeeking() const
+{
+    return (m_encryption.abi == BLIMP_PLUGIN_ABI_1_2_0) || (m_encryption.abi == BLIMP_PLUGIN_ABI_1_3_0);
+}
+
+std::int64_t PluginEncryption::seekDecryption(std::int64_t offset)
+{
+    GHULBUS_PRECONDITION(supportsSeeking());
+    int64_t read_offset = 0;
+    BlimpPluginResult const res = m_encryption.seek_decryption(m_encryption.state, offset, &read_offset);
+    if (res != BLIMP_PLUGIN_RESULT_OK) {
+        GHULBUS_THROW(Exceptions::PluginError{}
+                      << Ghulbus::Exception_Info::filename(m_encryption_dll.location().string())
+                      << Exception_Info::Records::plugin_error_code(res)
+                      << Exception_Info::Records::plugin_error_message(getLastError()),
+                      "Error while seeking in encrypted container");
+    }
+    return read_offset;
+}
+
+bool PluginEncryption::supportsRewinding() const
+{
+    return m_encryption.abi == BLIMP_PLUGIN_ABI_1_3_0;
+}
+
+void PluginEncryption::markEncryption()
+{
+    GHULBUS_PRECONDITION(supportsRewinding());
+    BlimpPluginResult const res = m_encryption.mark_encryption(m_encryption.state);
+    if (res != BLIMP_PLUGIN_RESULT_OK) {
+        GHULBUS_THROW(Exceptions::PluginError{}
+                      << Ghulbus::Exception_Info::filename(m_encryption_dll.location().string())
+                      << Exception_Info::Records::plugin_error_code(res)
+                      << Exception_Info::Records::plugin_error_message(getLastError()),
+                      "Error while marking encryption");
+    }
+}
+
+void PluginEncryption::rewindEncryption()
+{
+    GHULBUS_PRECONDITION(supportsRewinding());
+    BlimpPluginResult const res = m_encryption.rewind_encryption(m_encryption.state);
+    if (res != BLIMP_PLUGIN_RESULT_OK) {
+        GHULBUS_THROW(Exceptions::PluginError{}
+                      << Ghulbus::Exception_Info::filename(m_encryption_dll.location().string())
+                      << Exception_Info::Records::plugin_error_code(res)
+                      << Exception_Info::Records::plugin_error_message(getLastError()),
+                      "Error while rewinding encryption");
+    }
+}
@@ -7,6 +7,7 @@
 
 #include <boost/dll/shared_library.hpp>
 
+#include <cstdint>
 #include <memory>
 #include <string>
 #include <string_view>
@@ -35,6 +36,30 @@ public:
     void encryptFileChunk(BlimpFileChunk chunk);
     void decryptFileChunk(BlimpFileChunk chunk);
     BlimpFileChunk getProcessedChunk();
+
+    bool supportsBufferLending() const;
+    /** Requires supportsBufferLending(). The pool must outlive the plugin.
+     */
+    void setBufferPool(BlimpBufferPool const& pool);
+    /** Like getProcessedChunk(), but passes ownership of chunks in lent buffers to the caller.
+     * Chunks with a non-zero token have to be released to the buffer pool once consumed.
+     */
+    BlimpLentChunk takeProcessedChunk();
+
+    bool supportsSeeking() const;
+    /** Requires supportsSeeking(). Prepares decrypting the current container from the start of the encryption stream
+     * at offset. Returns the offset from which the encrypted data has to be passed to decryptFileChunk().
+     */
+    std::int64_t seekDecryption(std::int64_t offset);
+
+    bool supportsRewinding() const;
+    /** Requires supportsRewinding(). Records the state of the encryption between two streams of the current container.
+     */
+    void markEncryption();
+    /** Requires supportsRewinding(). Returns the encryption to the state recorded by the last markEncryption() for the
+     * current container. The output of the streams encrypted since has to be discarded by the caller.
+     */
+    void rewindEncryption();
 };
 
 #endif
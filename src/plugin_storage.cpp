@@ -4,6 +4,8 @@
 #include <plugin_common.hpp>
 #include <plugin_key_value_store.hpp>
 
+#include <gbBase/Assert.hpp>
+
 PluginStorage::PluginStorage(BlimpDB& blimpdb, std::string const& plugin_name)
     :m_storage_guard(nullptr, nullptr)
 {
@@ -21,9 +23,22 @@ PluginStorage::PluginStorage(BlimpDB& blimpdb, std::string const& plugin_name)
         m_storage_dll.get<BlimpPluginResult(BlimpKeyValueStore, BlimpPluginStorage*)>("blimp_plugin_storage_initialize");
     m_storage_plugin_shutdown =
         m_storage_dll.get<void(BlimpPluginStorage*)>("blimp_plugin_storage_shutdown");
-    m_storage.abi = BLIMP_PLUGIN_ABI_1_0_0;
+    m_storage = BlimpPluginStorage{};
+    m_storage.abi = BLIMP_PLUGIN_ABI_1_3_0;
     m_kvStore = std::make_unique<PluginKeyValueStore>(blimpdb, api_info);
-    BlimpPluginResult const res = m_storage_plugin_initialize(m_kvStore->getPluginKeyValueStore(), &m_storage);
+    BlimpPluginResult res = m_storage_plugin_initialize(m_kvStore->getPluginKeyValueStore(), &m_storage);
+    if (res == BLIMP_PLUGIN_RESULT_INVALID_ARGUMENT) {
+        // plugin predates truncation
+        m_storage = BlimpPluginStorage{};
+        m_storage.abi = BLIMP_PLUGIN_ABI_1_1_0;
+        res = m_storage_plugin_initialize(m_kvStore->getPluginKeyValueStore(), &m_storage);
+    }
+    if (res == BLIMP_PLUGIN_RESULT_INVALID_ARGUMENT) {
+        // plugin predates reading from storage
+        m_storage = BlimpPluginStorage{};
+        m_storage.abi = BLIMP_PLUGIN_ABI_1_0_0;
+        res = m_storage_plugin_initialize(m_kvStore->getPluginKeyValueStore(), &m_storage);
+    }
     if (res != BLIMP_PLUGIN_RESULT_OK) {
         GHULBUS_THROW(Exceptions::PluginError{}
                       << Exception_Info::Records::plugin_name(plugin_name)
@@ -95,3 +110,95 @@ void PluginStorage::storeFileChunk(BlimpFileChunk chunk)
                       "Error while moving file chunk to storage");
     }
 }
+
+bool PluginStorage::supportsReading() const
+{
+    return m_storage.abi != BLIMP_PLUGIN_ABI_1_0_0;
+}
+
+void PluginStorage::openStorageContainer(StorageContainerLocation const& location)
+{
+    GHULBUS_PRECONDITION(supportsReading());
+    BlimpPluginResult const res =
+        m_storage.open_storage_container(m_storage.state, BlimpStorageContainerLocation{ .location = location.l.c_str() });
+    if (res != BLIMP_PLUGIN_RESULT_OK) {
+        GHULBUS_THROW(Exceptions::PluginError{}
+                      << Ghulbus::Exception_Info::filename(m_storage_dll.location().string())
+                      << Exception_Info::Records::plugin_error_code(res)
+                      << Exception_Info::Records::plugin_error_message(getLastError()),
+                      "Error while opening storage container for reading");
+    }
+}
+
+BlimpFileChunk PluginStorage::readFileChunk()
+{
+    BlimpFileChunk out_chunk{ .data = nullptr, .size = 0 };
+    BlimpPluginResult const res = m_storage.read_file_chunk(m_storage.state, &out_chunk);
+    if (res != BLIMP_PLUGIN_RESULT_OK) {
+        GHULBUS_THROW(Exceptions::PluginError{}
+                      << Ghulbus::Exception_Info::filename(m_storage_dll.location().string())
+                      << Exception_Info::Records::plugin_error_code(res)
+                      << Exception_Info::Records::plugin_error_message(getLastError()),
+                      "Error while reading file chunk from storage");
+    }
+    return out_chunk;
+}
+
+std::int64_t PluginStorage::readRange(std::int64_t offset, std::span<char> buffer)
+{
+    std::int64_t n_read = 0;
+    BlimpPluginResult const res = m_storage.read_range(m_storage.state, offset, buffer.data(),
+                                                       static_cast<int64_t>(buffer.size()), &n_read);
+    if (res != BLIMP_PLUGIN_RESULT_OK) {
+        GHULBUS_THROW(Exceptions::PluginError{}
+                      << Ghulbus::Exception_Info::filename(m_storage_dll.location().string())
+                      << Exception_Info::Records::plugin_error_code(res)
+                      << Exception_Info::Records::plugin_error_message(getLastError()),
+                      "Error while reading range from storage");
+    }
+    return n_read;
+}
+
+void PluginStorage::submitReadRequests(std::span<BlimpStorageReadRequest> requests)
+{
+    BlimpPluginResult const res = m_storage.submit_read_requests(m_storage.state, requests.data(),
+                                                                 static_cast<int64_t>(requests.size()));
+    if (res != BLIMP_PLUGIN_RESULT_OK) {
+        GHULBUS_THROW(Exceptions::PluginError{}
+                      << Ghulbus::Exception_Info::filename(m_storage_dll.location().string())
+                      << Exception_Info::Records::plugin_error_code(res)
+                      << Exception_Info::Records::plugin_error_message(getLastError()),
+                      "Error while submitting read requests to storage");
+    }
+}
+
+std::int64_t PluginStorage::waitForReadRequest(BlimpStorageReadRequest& request)
+{
+    BlimpPluginResult const res = m_storage.wait_read_request(m_storage.state, &request);
+    if (res != BLIMP_PLUGIN_RESULT_OK) {
+        GHULBUS_THROW(Exceptions::PluginError{}
+                      << Ghulbus::Exception_Info::filename(m_storage_dll.location().string())
+                      << Exception_Info::Records::plugin_error_code(res)
+                      << Exception_Info::Records::plugin_error_message(getLastError()),
+                      "Error while reading range from storage");
+    }
+    return request.out_size;
+}
+
+bool PluginStorage::supportsTruncation() const
+{
+    return m_storage.abi == BLIMP_PLUGIN_ABI_1_3_0;
+}
+
+void PluginStorage::truncateStorageContainer(std::int64_t size)
+{
+    GHULBUS_PRECONDITION(supportsTruncation());
+    BlimpPluginResult const res = m_storage.truncate_storage_container(m_storage.state, size);
+    if (res != BLIMP_PLUGIN_RESULT_OK) {
+        GHULBUS_THROW(Exceptions::PluginError{}
+                      << Ghulbus::Exception_Info::filename(m_storage_dll.location().string())
+                      << Exception_Info::Records::plugin_error_code(res)
+                      << Exception_Info::Records::plugin_error_message(getLastError()),
+                      "Error while truncating storage container");
+    }
+}
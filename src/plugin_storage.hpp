@@ -6,7 +6,9 @@
 
 #include <boost/dll/shared_library.hpp>
 
+#include <cstdint>
 #include <memory>
+#include <span>
 #include <string>
 #include <string_view>
 
@@ -33,6 +35,33 @@ public:
     void newStorageContainer(StorageContainerId const& container_id);
     BlimpStorageContainerLocation finalizeStorageContainer();
     void storeFileChunk(BlimpFileChunk chunk);
+
+    bool supportsReading() const;
+    /** Requires supportsReading().
+     */
+    void openStorageContainer(StorageContainerLocation const& location);
+    /** Retrieves the next chunk of the container opened by openStorageContainer().
+     * A chunk with data == nullptr marks the end of the container. The chunk remains valid until the next call.
+     */
+    BlimpFileChunk readFileChunk();
+    /** Reads up to buffer.size() bytes at offset of the container opened by openStorageContainer().
+     * @return Number of bytes read; less than requested only at the end of the container.
+     */
+    std::int64_t readRange(std::int64_t offset, std::span<char> buffer);
+    /** Starts reading the requested ranges of the container opened by openStorageContainer().
+     * The requests and their buffers have to remain valid until each request was passed to waitForReadRequest().
+     */
+    void submitReadRequests(std::span<BlimpStorageReadRequest> requests);
+    /** Blocks until a submitted request has been served.
+     * @return Number of bytes read; less than requested only at the end of the container.
+     */
+    std::int64_t waitForReadRequest(BlimpStorageReadRequest& request);
+
+    bool supportsTruncation() const;
+    /** Requires supportsTruncation(). Discards the data stored into the current container beyond size bytes, so that
+     * storing continues at size.
+     */
+    void truncateStorageContainer(std::int64_t size);
 };
 
 #endif
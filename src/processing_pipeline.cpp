@@ -1,7 +1,12 @@
 #include <processing_pipeline.hpp>
 
+#include <buffer_pool.hpp>
+#include <content_routing.hpp>
+#include <exceptions.hpp>
 #include <file_chunk.hpp>
 #include <file_hash.hpp>
+#include <file_io.hpp>
+#include <memory_budget.hpp>
 #include <storage_container.hpp>
 #include <storage_location.hpp>
 
@@ -14,33 +19,360 @@
 
 #include <gbBase/Assert.hpp>
 #include <gbBase/AnyInvocable.hpp>
+#include <gbBase/Exception.hpp>
+#include <gbBase/Finally.hpp>
 #include <gbBase/Log.hpp>
 
+#include <boost/filesystem/operations.hpp>
+
+#include <algorithm>
+#include <atomic>
 #include <chrono>
+#include <deque>
+#include <exception>
+#include <fstream>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <utility>
 
 namespace {
-constexpr std::size_t g_containerSizeLimit = (100 << 20);
+constexpr std::int64_t g_containerSizeLimit = (100 << 20);
+/// Amount of uncompressed data after which a new block of the container is started
+constexpr std::int64_t g_blockSize = (4 << 20);
+constexpr std::size_t g_speculativeStagingLimit = (32 << 20);
+constexpr std::size_t g_stagedReleaseChunkSize = (1 << 20);
+constexpr std::size_t g_stageQueueCapacity = 4;
+constexpr std::size_t g_lentBufferSize = (1 << 20);
+constexpr std::size_t g_storageReadSize = (1 << 20);
+constexpr char const g_encryptionPassword[] = "batteryhorsestaples";
+/// Number of reads from storage kept in flight while restoring
+constexpr std::size_t g_storageReadAhead = 4;
+/// the queues between stages, the buffers held by the plugins and some slack for bursts of output
+constexpr std::size_t g_lentBufferCount = 32;
+constexpr std::size_t g_minLentBufferCount = 8;
+/// Interval at which the throughput tuner compares the busy times of the parts of the pipeline
+constexpr std::chrono::milliseconds g_tuningInterval{ 1000 };
+/// Fraction of an interval that a part of the pipeline has to be busy to be considered saturated
+constexpr double g_tuningSaturated = 0.8;
+/// Fractions of an interval below which the compression stage or the producer have time to spare
+constexpr double g_tuningCompressionSpare = 0.5;
+constexpr double g_tuningProducerSpare = 0.25;
+constexpr std::size_t g_maxReadQueueDepth = 16;
+constexpr std::size_t g_maxLoggedTuningDecisions = 32;
+
+/// Lent buffers and held back data are limited to a fraction of the memory budget each; pipelines sharing a budget
+/// split the fraction for lent buffers among them
+std::size_t lentBufferCount(MemoryBudget const& budget, std::size_t n_pipelines)
+{
+    return std::clamp(budget.getLimit() / 4 / n_pipelines / g_lentBufferSize, g_minLentBufferCount, g_lentBufferCount);
+}
+
+std::size_t speculativeStagingLimit(MemoryBudget const& budget)
+{
+    return std::min(g_speculativeStagingLimit, budget.getLimit() / 4);
+}
+
+/** Loads the plugin for a codec that is optional at build time; returns nullptr if the plugin cannot be loaded.
+ */
+std::unique_ptr<PluginCompression> loadOptionalCompressionPlugin(BlimpDB& blimpdb, CompressionCodec codec)
+{
+    try {
+        return std::make_unique<PluginCompression>(blimpdb, compressionPluginName(codec));
+    } catch (std::exception& e) {
+        GHULBUS_LOG(Warning, "Compression plugin " << compressionPluginName(codec) << " is not available; falling back "
+                    "to " << compressionPluginName(CompressionCodec::Zlib) << ": " << e.what());
+        return nullptr;
+    }
+}
+
+/** Plugins of the codecs that are optional at build time; each is nullptr if it is not available.
+ */
+struct OptionalCompressionPlugins {
+    std::unique_ptr<PluginCompression> lz4;
+    std::unique_ptr<PluginCompression> zstd;
+
+    explicit OptionalCompressionPlugins(BlimpDB& blimpdb)
+        :lz4(loadOptionalCompressionPlugin(blimpdb, CompressionCodec::Lz4)),
+         zstd(loadOptionalCompressionPlugin(blimpdb, CompressionCodec::Zstd))
+    {}
+
+    std::array<PluginCompression*, 2> all() const {
+        return { lz4.get(), zstd.get() };
+    }
+
+    /** Returns the plugin for an optional codec; nullptr if it is not available or codec is not optional.
+     */
+    PluginCompression* get(CompressionCodec codec) const {
+        switch (codec) {
+        case CompressionCodec::Lz4:  return lz4.get();
+        case CompressionCodec::Zstd: return zstd.get();
+        default: return nullptr;
+        }
+    }
+};
+
+/** Returns the plugin implementing codec, or nullptr for CompressionCodec::None.
+ * Throws if the plugin for codec is not available.
+ */
+PluginCompression* selectCompressionPlugin(CompressionCodec codec, PluginCompression& zlib,
+                                           OptionalCompressionPlugins const& optional)
+{
+    switch (codec) {
+    case CompressionCodec::Zlib: return &zlib;
+    case CompressionCodec::Lz4:
+    case CompressionCodec::Zstd:
+        if (PluginCompression* compression = optional.get(codec)) { return compression; }
+        GHULBUS_THROW(Exceptions::PluginError{}
+                      << Exception_Info::Records::plugin_name(std::string(compressionPluginName(codec))),
+                      "Compression plugin is not available");
+    case CompressionCodec::None: return nullptr;
+    }
+    GHULBUS_THROW(Exceptions::DatabaseError{}, "Unknown compression codec " +
+                  std::to_string(static_cast<std::int64_t>(codec)) + ".");
+}
+
+/** Returns codec, or CompressionCodec::Zlib in place of a codec whose plugin is not available.
+ */
+CompressionCodec availableCodec(CompressionCodec codec, OptionalCompressionPlugins const& optional)
+{
+    bool const is_optional = (codec == CompressionCodec::Lz4) || (codec == CompressionCodec::Zstd);
+    return (is_optional && (!optional.get(codec))) ? CompressionCodec::Zlib : codec;
+}
+
+/** Inline contents are encrypted as consecutive streams of a single storage container, whose id never collides with
+ * the ids of actual containers. Each content is prefixed with a random block before encryption, so that its encryption
+ * is unique although all contents share one key. The first encrypted block is kept apart as the content's nonce.
+ */
+constexpr StorageContainerId g_inlineContainerId{ .i = -1 };
+/// Size of the random block that inline contents are prefixed with; one block of the cipher
+constexpr std::size_t g_inlineNonceSize = 16;
+
+void appendRandomBlock(std::vector<char>& out)
+{
+    std::random_device rd;
+    for (std::size_t i = 0; i < g_inlineNonceSize; i += sizeof(std::uint32_t)) {
+        std::uint32_t const r = rd();
+        char const* const bytes = reinterpret_cast<char const*>(&r);
+        out.insert(out.end(), bytes, bytes + sizeof(r));
+    }
+}
+
+/** Passes data through a plugin as a stream of its own and appends the output to out.
+ */
+template<typename Plugin>
+void processStream(Plugin& plugin, void (Plugin::*process)(BlimpFileChunk), std::span<char const> data,
+                   std::vector<char>& out)
+{
+    auto const take_output = [&plugin, &out]() {
+        for (BlimpFileChunk c = plugin.getProcessedChunk(); c.data != nullptr; c = plugin.getProcessedChunk()) {
+            out.insert(out.end(), c.data, c.data + c.size);
+        }
+    };
+    if (!data.empty()) {
+        (plugin.*process)(BlimpFileChunk{ .data = data.data(), .size = static_cast<std::int64_t>(data.size()) });
+        take_output();
+    }
+    (plugin.*process)(BlimpFileChunk{ .data = nullptr, .size = 0 });
+    take_output();
+}
+}
+
+/** Bounded queue of chunks between two pipeline stages.
+ * The queue is a lock-free ring for a single producer and a single consumer. Chunk data is copied into buffers owned
+ * by the queue, so the producer may reuse its memory as soon as push() returns. Chunks in buffers lent from a
+ * BufferPool are not copied; instead, ownership of the buffer passes to the queue.
+ * push() blocks while the queue is full and, unless the caller passes in a reservation for the data, while copied
+ * data does not fit into the memory budget. The memory remains reserved until the consumer releases the item's
+ * reservation.
+ */
+class ChunkQueue {
+public:
+    enum class ItemType {
+        Data,
+        Flush,          ///< flush the receiving stage
+        FlushAll,       ///< flush the receiving stage and pass the flush on downstream
+        NewContainer,           ///< the following data belongs to the container of the item
+        FinalizeContainer,      ///< all data of the container of the item has passed
+        Terminate
+    };
+    struct Item {
+        ItemType type;
+        std::vector<char> data;
+        BufferPool* owner;          ///< pool of the lent buffer holding the data; nullptr if data is a copy
+        BlimpLentChunk lent;
+        MemoryBudget::Reservation reservation;
+        StorageContainerId container;   ///< only for container events
+    };
+private:
+    MemoryBudget* m_budget;
+    std::vector<Item> m_items;
+    std::atomic<std::size_t> m_readIndex;
+    std::atomic<std::size_t> m_writeIndex;
+public:
+    ChunkQueue(std::size_t capacity, MemoryBudget& budget);
+    void push(ItemType type, BlimpFileChunk chunk);
+    void push(ItemType type, BlimpFileChunk chunk, MemoryBudget::Reservation reservation);
+    void push(BlimpLentChunk chunk, BufferPool& owner);
+    void push(ItemType type, StorageContainerId const& container);
+    /** Blocks until an item is available and returns it. The item remains in the queue until pop().
+     */
+    Item& front();
+    void pop();
+    /** Blocks until all items pushed so far have been popped.
+     */
+    void waitUntilEmpty() const;
+private:
+    Item& waitForFreeItem();
+    void commitItem();
+};
+
+ChunkQueue::ChunkQueue(std::size_t capacity, MemoryBudget& budget)
+    :m_budget(&budget), m_items(capacity), m_readIndex(0), m_writeIndex(0)
+{
+    GHULBUS_PRECONDITION(capacity > 0);
+}
+
+ChunkQueue::Item& ChunkQueue::waitForFreeItem()
+{
+    std::size_t const w = m_writeIndex.load(std::memory_order_relaxed);
+    for (std::size_t r = m_readIndex.load(std::memory_order_acquire); w - r == m_items.size();
+         r = m_readIndex.load(std::memory_order_acquire))
+    {
+        m_readIndex.wait(r, std::memory_order_acquire);
+    }
+    return m_items[w % m_items.size()];
+}
+
+void ChunkQueue::commitItem()
+{
+    m_writeIndex.store(m_writeIndex.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    m_writeIndex.notify_one();
+}
+
+void ChunkQueue::push(ItemType type, BlimpFileChunk chunk)
+{
+    push(type, chunk,
+         chunk.data ? m_budget->acquire(static_cast<std::size_t>(chunk.size)) : MemoryBudget::Reservation{});
+}
+
+void ChunkQueue::push(ItemType type, BlimpFileChunk chunk, MemoryBudget::Reservation reservation)
+{
+    Item& item = waitForFreeItem();
+    item.type = type;
+    if (chunk.data) {
+        item.data.assign(chunk.data, chunk.data + chunk.size);
+    } else {
+        item.data.clear();
+    }
+    item.owner = nullptr;
+    item.reservation = std::move(reservation);
+    commitItem();
+}
+
+void ChunkQueue::push(BlimpLentChunk chunk, BufferPool& owner)
+{
+    GHULBUS_PRECONDITION((chunk.data != nullptr) && (chunk.token != 0));
+    Item& item = waitForFreeItem();
+    item.type = ItemType::Data;
+    item.data.clear();
+    item.owner = &owner;
+    item.lent = chunk;
+    commitItem();
 }
 
+void ChunkQueue::push(ItemType type, StorageContainerId const& container)
+{
+    GHULBUS_PRECONDITION((type == ItemType::NewContainer) || (type == ItemType::FinalizeContainer));
+    Item& item = waitForFreeItem();
+    item.type = type;
+    item.data.clear();
+    item.owner = nullptr;
+    item.container = container;
+    commitItem();
+}
+
+ChunkQueue::Item& ChunkQueue::front()
+{
+    std::size_t const r = m_readIndex.load(std::memory_order_relaxed);
+    for (std::size_t w = m_writeIndex.load(std::memory_order_acquire); w == r;
+         w = m_writeIndex.load(std::memory_order_acquire))
+    {
+        m_writeIndex.wait(w, std::memory_order_acquire);
+    }
+    return m_items[r % m_items.size()];
+}
+
+void ChunkQueue::pop()
+{
+    m_readIndex.store(m_readIndex.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    // both the producer and threads waiting for the queue to drain may be waiting for the read index
+    m_readIndex.notify_all();
+}
+
+void ChunkQueue::waitUntilEmpty() const
+{
+    for (std::size_t r = m_readIndex.load(std::memory_order_acquire);
+         r != m_writeIndex.load(std::memory_order_acquire);
+         r = m_readIndex.load(std::memory_order_acquire))
+    {
+        m_readIndex.wait(r, std::memory_order_acquire);
+    }
+}
+
+/** A stage of the processing pipeline, running on its own thread.
+ * Chunks pumped into the stage are queued and processed asynchronously; the processed output is pumped into the
+ * downstream stage. Errors during processing are rethrown on the pumping thread by the next call to pump(),
+ * flushStage(), flushAll(), pumpContainerEvent() or waitUntilIdle().
+ * The downstream stage must only be changed while the stage is idle.
+ */
 class PipelineStage {
 private:
+    using Duration = std::chrono::steady_clock::duration;
     PipelineStage* m_downstream;
     Ghulbus::AnyInvocable<void(BlimpFileChunk)> m_funcProcess;
-    Ghulbus::AnyInvocable<BlimpFileChunk()> m_funcGetChunk;
-    std::size_t m_byteCounter;
-    std::size_t m_byteCounterCurrentContainer;
-    std::chrono::steady_clock::duration m_timeLastPump;
-    std::chrono::steady_clock::duration m_timeTotal;
-    std::chrono::steady_clock::duration m_timeTotalCurrentContainer;
+    Ghulbus::AnyInvocable<BlimpLentChunk()> m_funcGetChunk;
+    Ghulbus::AnyInvocable<void(ChunkQueue::ItemType, StorageContainerId const&)> m_funcContainerEvent;
+    std::atomic<std::size_t> m_byteCounter;
+    std::atomic<std::size_t> m_byteCounterCurrentContainer;
+    std::atomic<Duration> m_timeLastPump;
+    std::atomic<Duration> m_timeTotal;
+    std::atomic<Duration> m_timeTotalCurrentContainer;
+    BufferPool* m_bufferPool;
+    MemoryBudget* m_budget;
+    ChunkQueue m_queue;
+    std::atomic<bool> m_failed;
+    std::exception_ptr m_error;
+    std::thread m_thread;
 public:
+    /** Chunks returned from get_func with a non-zero token are lent from buffer_pool.
+     * container_func, if set, handles container events on the stage thread.
+     */
     PipelineStage(Ghulbus::AnyInvocable<void(BlimpFileChunk)> process_func,
-                  Ghulbus::AnyInvocable<BlimpFileChunk()> get_func);
+                  Ghulbus::AnyInvocable<BlimpLentChunk()> get_func, BufferPool* buffer_pool, MemoryBudget& budget,
+                  Ghulbus::AnyInvocable<void(ChunkQueue::ItemType, StorageContainerId const&)> container_func = {});
     ~PipelineStage();
-    PipelineStage(PipelineStage&&) = default;
-    PipelineStage& operator=(PipelineStage&&) = default;
+    PipelineStage(PipelineStage const&) = delete;
+    PipelineStage& operator=(PipelineStage const&) = delete;
     void setDownstream(PipelineStage& downstream);
     void pump(BlimpFileChunk chunk);
+    /** Passes on the output of an upstream stage. Takes ownership of chunk if it was lent from owner.
+     * Copied data is charged to the memory budget without blocking: the upstream stage may only wait for memory
+     * that is held by other stages, which could in turn be waiting for memory.
+     */
+    void pump(BlimpLentChunk chunk, BufferPool* owner);
     void flushStage();
+    void flushAll();
+    /** Passes a NewContainer or FinalizeContainer event through this and all downstream stages, in order with the
+     * chunks pumped before and after it.
+     */
+    void pumpContainerEvent(ChunkQueue::ItemType event, StorageContainerId const& container_id);
+    void waitUntilIdle();
     std::size_t getByteCounter() const;
     std::size_t getByteCounterCurrentContainer() const;
     std::chrono::milliseconds getTimeTotal() const;
@@ -49,22 +381,30 @@ public:
     void resetStats();
     void resetStatsCurrentContainer();
 private:
+    void run();
+    void processItem(ChunkQueue::Item const& item);
     void process(BlimpFileChunk chunk);
-    BlimpFileChunk getProcessedChunk();
+    BlimpLentChunk getProcessedChunk();
+    void rethrowIfFailed();
 };
 
 PipelineStage::PipelineStage(Ghulbus::AnyInvocable<void(BlimpFileChunk)> process_func,
-                             Ghulbus::AnyInvocable<BlimpFileChunk()> get_func)
+                             Ghulbus::AnyInvocable<BlimpLentChunk()> get_func, BufferPool* buffer_pool,
+                             MemoryBudget& budget,
+                             Ghulbus::AnyInvocable<void(ChunkQueue::ItemType, StorageContainerId const&)> container_func)
     :m_downstream(nullptr), m_funcProcess(std::move(process_func)), m_funcGetChunk(std::move(get_func)),
-     m_byteCounter(0), m_byteCounterCurrentContainer(0),
-     m_timeLastPump(std::chrono::steady_clock::duration::zero()),
-     m_timeTotal(std::chrono::steady_clock::duration::zero()),
-     m_timeTotalCurrentContainer(std::chrono::steady_clock::duration::zero())
-{}
+     m_funcContainerEvent(std::move(container_func)), m_byteCounter(0), m_byteCounterCurrentContainer(0),
+     m_timeLastPump(Duration::zero()), m_timeTotal(Duration::zero()), m_timeTotalCurrentContainer(Duration::zero()),
+     m_bufferPool(buffer_pool), m_budget(&budget), m_queue(g_stageQueueCapacity, budget), m_failed(false)
+{
+    m_thread = std::thread([this]() { run(); });
+}
 
 PipelineStage::~PipelineStage()
 {
-    GHULBUS_ASSERT(m_funcGetChunk.empty() || (getProcessedChunk().data == nullptr));
+    m_queue.push(ChunkQueue::ItemType::Terminate, BlimpFileChunk{ .data = nullptr, .size = 0 });
+    m_thread.join();
+    GHULBUS_ASSERT(m_failed.load() || m_funcGetChunk.empty() || (getProcessedChunk().data == nullptr));
 }
 
 void PipelineStage::setDownstream(PipelineStage& downstream)
@@ -74,148 +414,1074 @@ void PipelineStage::setDownstream(PipelineStage& downstream)
 
 void PipelineStage::pump(BlimpFileChunk chunk)
 {
-    m_byteCounter += chunk.size;
-    m_byteCounterCurrentContainer += chunk.size;
+    rethrowIfFailed();
+    m_queue.push((chunk.data != nullptr) ? ChunkQueue::ItemType::Data : ChunkQueue::ItemType::Flush, chunk);
+}
+
+void PipelineStage::pump(BlimpLentChunk chunk, BufferPool* owner)
+{
+    if (chunk.token == 0) {
+        rethrowIfFailed();
+        m_queue.push(ChunkQueue::ItemType::Data, BlimpFileChunk{ .data = chunk.data, .size = chunk.size },
+                     m_budget->charge(static_cast<std::size_t>(chunk.size)));
+        return;
+    }
+    GHULBUS_PRECONDITION(owner);
+    if (m_failed.load(std::memory_order_acquire)) {
+        owner->release(chunk.token);
+        std::rethrow_exception(m_error);
+    }
+    m_queue.push(chunk, *owner);
+}
+
+void PipelineStage::flushStage()
+{
+    pump(BlimpFileChunk{ .data = nullptr, .size = 0 });
+}
+
+void PipelineStage::flushAll()
+{
+    rethrowIfFailed();
+    m_queue.push(ChunkQueue::ItemType::FlushAll, BlimpFileChunk{ .data = nullptr, .size = 0 });
+}
+
+void PipelineStage::pumpContainerEvent(ChunkQueue::ItemType event, StorageContainerId const& container_id)
+{
+    rethrowIfFailed();
+    m_queue.push(event, container_id);
+}
+
+void PipelineStage::waitUntilIdle()
+{
+    m_queue.waitUntilEmpty();
+    rethrowIfFailed();
+}
+
+void PipelineStage::run()
+{
+    for (;;) {
+        ChunkQueue::Item& item = m_queue.front();
+        if (item.type == ChunkQueue::ItemType::Terminate) {
+            m_queue.pop();
+            break;
+        }
+        if (!m_failed.load(std::memory_order_relaxed)) {
+            try {
+                processItem(item);
+            } catch (...) {
+                GHULBUS_LOG(Error, "Error in processing pipeline stage.");
+                m_error = std::current_exception();
+                m_failed.store(true, std::memory_order_release);
+            }
+        }
+        if (item.owner) { item.owner->release(item.lent.token); }
+        item.reservation.release();
+        // only pop once the item was processed, so that an empty queue means the stage is idle
+        m_queue.pop();
+    }
+}
+
+void PipelineStage::processItem(ChunkQueue::Item const& item)
+{
+    if ((item.type == ChunkQueue::ItemType::NewContainer) || (item.type == ChunkQueue::ItemType::FinalizeContainer)) {
+        if (item.type == ChunkQueue::ItemType::NewContainer) { resetStatsCurrentContainer(); }
+        if (!m_funcContainerEvent.empty()) { m_funcContainerEvent(item.type, item.container); }
+        if (m_downstream) { m_downstream->pumpContainerEvent(item.type, item.container); }
+        return;
+    }
+    BlimpFileChunk const chunk = (item.type != ChunkQueue::ItemType::Data) ?
+        BlimpFileChunk{ .data = nullptr, .size = 0 } :
+        (item.owner ? BlimpFileChunk{ .data = item.lent.data, .size = item.lent.size } :
+                      BlimpFileChunk{ .data = item.data.data(), .size = static_cast<int64_t>(item.data.size()) });
+    m_byteCounter.fetch_add(chunk.size, std::memory_order_relaxed);
+    m_byteCounterCurrentContainer.fetch_add(chunk.size, std::memory_order_relaxed);
+    // output the plugin produces from the chunk, until it has been passed on downstream
+    MemoryBudget::Reservation const plugin_output = m_budget->charge(static_cast<std::size_t>(chunk.size));
     auto const t0 = std::chrono::steady_clock::now();
     process(chunk);
     auto const t1 = std::chrono::steady_clock::now();
     auto const dt = t1 - t0;
-    m_timeLastPump = dt;
-    m_timeTotal += dt;
-    m_timeTotalCurrentContainer += dt;
+    m_timeLastPump.store(dt, std::memory_order_relaxed);
+    m_timeTotal.store(m_timeTotal.load(std::memory_order_relaxed) + dt, std::memory_order_relaxed);
+    m_timeTotalCurrentContainer.store(m_timeTotalCurrentContainer.load(std::memory_order_relaxed) + dt,
+                                      std::memory_order_relaxed);
     if (m_downstream) {
-        for(BlimpFileChunk c = getProcessedChunk(); c.data != nullptr; c = getProcessedChunk()) {
-            m_downstream->pump(c);
+        for(BlimpLentChunk c = getProcessedChunk(); c.data != nullptr; c = getProcessedChunk()) {
+            m_downstream->pump(c, m_bufferPool);
+        }
+        if (item.type == ChunkQueue::ItemType::FlushAll) {
+            m_downstream->flushAll();
         }
     }
 }
 
-void PipelineStage::flushStage()
-{
-    pump(BlimpFileChunk{ .data = nullptr, .size = 0 });
-}
-
 void PipelineStage::process(BlimpFileChunk chunk)
 {
     m_funcProcess(chunk);
 }
 
-BlimpFileChunk PipelineStage::getProcessedChunk()
+BlimpLentChunk PipelineStage::getProcessedChunk()
 {
     return m_funcGetChunk();
 }
 
+void PipelineStage::rethrowIfFailed()
+{
+    if (m_failed.load(std::memory_order_acquire)) {
+        std::rethrow_exception(m_error);
+    }
+}
+
 std::size_t PipelineStage::getByteCounter() const
 {
-    return m_byteCounter;
+    return m_byteCounter.load(std::memory_order_relaxed);
 }
 
 std::size_t PipelineStage::getByteCounterCurrentContainer() const
 {
-    return m_byteCounterCurrentContainer;
+    return m_byteCounterCurrentContainer.load(std::memory_order_relaxed);
 }
 
 std::chrono::milliseconds PipelineStage::getTimeTotal() const
 {
-    return std::chrono::duration_cast<std::chrono::milliseconds>(m_timeTotal);
+    return std::chrono::duration_cast<std::chrono::milliseconds>(m_timeTotal.load(std::memory_order_relaxed));
 }
 
 std::chrono::milliseconds PipelineStage::getTimeTotalCurrentContainer() const
 {
-    return std::chrono::duration_cast<std::chrono::milliseconds>(m_timeTotalCurrentContainer);
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+        m_timeTotalCurrentContainer.load(std::memory_order_relaxed));
 }
 
 double PipelineStage::getBandwidthMbps() const
 {
-    auto const mbytes_processed = static_cast<double>(m_byteCounter) / (1024.0 * 1024.0);
+    auto const mbytes_processed = static_cast<double>(getByteCounter()) / (1024.0 * 1024.0);
     auto const seconds_spent = static_cast<double>(getTimeTotal().count()) / 1000.0;
     return mbytes_processed / seconds_spent;
 }
 
 void PipelineStage::resetStats()
 {
-    m_byteCounter = 0;
-    m_byteCounterCurrentContainer = 0;
-    m_timeLastPump = std::chrono::steady_clock::duration::zero();
-    m_timeTotal = std::chrono::steady_clock::duration::zero();
-    m_timeTotalCurrentContainer = std::chrono::steady_clock::duration::zero();
+    m_byteCounter.store(0, std::memory_order_relaxed);
+    m_byteCounterCurrentContainer.store(0, std::memory_order_relaxed);
+    m_timeLastPump.store(Duration::zero(), std::memory_order_relaxed);
+    m_timeTotal.store(Duration::zero(), std::memory_order_relaxed);
+    m_timeTotalCurrentContainer.store(Duration::zero(), std::memory_order_relaxed);
 }
 
 void PipelineStage::resetStatsCurrentContainer()
 {
-    m_byteCounterCurrentContainer = 0;
-    m_timeTotalCurrentContainer = std::chrono::steady_clock::duration::zero();
+    m_byteCounterCurrentContainer.store(0, std::memory_order_relaxed);
+    m_timeTotalCurrentContainer.store(Duration::zero(), std::memory_order_relaxed);
+}
+
+/** Adjusts the compression parameters and the read queue depth while data is passed through the pipeline, so that
+ * the slowest part of the pipeline stays saturated.
+ * Once per g_tuningInterval, the time each stage spent processing and the time the producer spent between chunks,
+ * reading and hashing the data, are compared to the time that elapsed. A saturated compression stage gets more worker
+ * threads and, once those are exhausted, a lower compression level. If the compression stage has time to spare while
+ * a stage after it or the producer is saturated, it gives up worker threads first and then raises the level; this
+ * costs no wall time and leaves less data for the stages after it. A saturated producer gets a deeper read queue,
+ * which is reduced again once reading no longer holds up the pipeline. Each setting changes by one step at most per
+ * evaluation.
+ * The tuner runs on the producer thread. Changed compression parameters are picked up by the compression stage through
+ * takeCompressionParameters(); the plugin applies them with the next compressed stream.
+ */
+class ThroughputTuner {
+public:
+    struct CompressionParameters {
+        std::int64_t level;
+        std::int64_t threads;
+    };
+private:
+    using Clock = std::chrono::steady_clock;
+    struct Parameter {
+        bool supported;
+        std::int64_t initial;
+        std::int64_t value;
+        std::int64_t min_value;
+        std::int64_t max_value;
+    };
+    std::deque<PipelineStage> const* m_stages;
+    Parameter m_level;
+    Parameter m_threads;
+    std::atomic<bool> m_compressionChanged;
+    std::atomic<std::int64_t> m_requestedLevel;
+    std::atomic<std::int64_t> m_requestedThreads;
+    std::size_t m_initialReadQueueDepth;
+    std::size_t m_readQueueDepth;
+    Clock::time_point m_start;
+    Clock::time_point m_intervalStart;
+    std::vector<std::chrono::milliseconds> m_intervalStartStageTimes;
+    Clock::duration m_producerTime;
+    std::optional<Clock::time_point> m_lastChunkPassed;
+    std::vector<std::string> m_decisions;
+    std::size_t m_decisionCount;
+public:
+    /** stages are the compression, encryption and storage stages; they are only inspected once data arrives.
+     */
+    ThroughputTuner(std::deque<PipelineStage> const& stages, PluginCompression& compression,
+                    std::size_t n_pipelines);
+    ThroughputTuner(ThroughputTuner const&) = delete;
+    ThroughputTuner& operator=(ThroughputTuner const&) = delete;
+    /// Time between chunks of different contents is not accounted to the producer
+    void startContent();
+    void chunkArrived();
+    void chunkPassed();
+    /** Returns the read queue depth for reading the data passed into the pipeline.
+     * The first call sets the depth the tuner starts out with.
+     */
+    std::size_t getReadQueueDepth(std::size_t current_depth);
+    /** Called by the compression stage; returns the parameters to use if they changed since the last call.
+     */
+    std::optional<CompressionParameters> takeCompressionParameters();
+    void logDecisions() const;
+private:
+    void evaluate(Clock::time_point now);
+    void record(std::string const& setting, std::int64_t from, std::int64_t to, std::string const& reason);
+    void requestCompressionParameters();
+    static Parameter queryParameter(PluginCompression& compression, BlimpCompressionParameter parameter,
+                                    std::int64_t max_value);
+};
+
+ThroughputTuner::ThroughputTuner(std::deque<PipelineStage> const& stages, PluginCompression& compression,
+                                 std::size_t n_pipelines)
+    :m_stages(&stages), m_compressionChanged(false), m_requestedLevel(0), m_requestedThreads(0),
+     m_initialReadQueueDepth(0), m_readQueueDepth(0), m_start(Clock::now()), m_intervalStart(m_start),
+     m_producerTime(Clock::duration::zero()), m_decisionCount(0)
+{
+    m_level = queryParameter(compression, BLIMP_COMPRESSION_PARAMETER_LEVEL, std::numeric_limits<std::int64_t>::max());
+    // pipelines sharing the machine share its cores; each pipeline keeps one for its compression stage
+    auto const n_cores = static_cast<std::int64_t>(std::max(1u, std::thread::hardware_concurrency()));
+    std::int64_t const max_threads = std::max<std::int64_t>(n_cores / static_cast<std::int64_t>(n_pipelines) - 1, 0);
+    m_threads = queryParameter(compression, BLIMP_COMPRESSION_PARAMETER_THREADS, max_threads);
+}
+
+ThroughputTuner::Parameter ThroughputTuner::queryParameter(PluginCompression& compression,
+                                                           BlimpCompressionParameter parameter,
+                                                           std::int64_t max_value)
+{
+    auto const p = compression.getCompressionParameter(parameter);
+    if (!p) { return Parameter{ .supported = false, .initial = 0, .value = 0, .min_value = 0, .max_value = 0 }; }
+    return Parameter{ .supported = true, .initial = p->value, .value = p->value, .min_value = p->min_value,
+                      .max_value = std::max(p->value, std::min(p->max_value, max_value)) };
+}
+
+void ThroughputTuner::startContent()
+{
+    m_lastChunkPassed.reset();
+}
+
+void ThroughputTuner::chunkArrived()
+{
+    if (m_lastChunkPassed) { m_producerTime += Clock::now() - *m_lastChunkPassed; }
+}
+
+void ThroughputTuner::chunkPassed()
+{
+    auto const now = Clock::now();
+    m_lastChunkPassed = now;
+    if (now - m_intervalStart >= g_tuningInterval) { evaluate(now); }
+}
+
+std::size_t ThroughputTuner::getReadQueueDepth(std::size_t current_depth)
+{
+    if (m_readQueueDepth == 0) {
+        m_initialReadQueueDepth = current_depth;
+        m_readQueueDepth = current_depth;
+    }
+    return m_readQueueDepth;
+}
+
+std::optional<ThroughputTuner::CompressionParameters> ThroughputTuner::takeCompressionParameters()
+{
+    if (!m_compressionChanged.exchange(false, std::memory_order_acquire)) { return std::nullopt; }
+    return CompressionParameters{ .level = m_requestedLevel.load(std::memory_order_relaxed),
+                                  .threads = m_requestedThreads.load(std::memory_order_relaxed) };
+}
+
+void ThroughputTuner::requestCompressionParameters()
+{
+    m_requestedLevel.store(m_level.value, std::memory_order_relaxed);
+    m_requestedThreads.store(m_threads.value, std::memory_order_relaxed);
+    m_compressionChanged.store(true, std::memory_order_release);
+}
+
+void ThroughputTuner::evaluate(Clock::time_point now)
+{
+    double const elapsed = std::chrono::duration<double>(now - m_intervalStart).count();
+    std::vector<std::chrono::milliseconds> stage_times;
+    for (auto const& s : *m_stages) { stage_times.push_back(s.getTimeTotal()); }
+    if (m_intervalStartStageTimes.empty()) { m_intervalStartStageTimes.resize(stage_times.size()); }
+    auto const busy = [&](std::size_t i) {
+        return std::chrono::duration<double>(stage_times[i] - m_intervalStartStageTimes[i]).count() / elapsed;
+    };
+    double const compression = busy(0);
+    double const downstream = std::max(busy(1), busy(2));
+    double const producer = std::chrono::duration<double>(m_producerTime).count() / elapsed;
+    std::ostringstream reason;
+    reason << "busy: compression " << static_cast<int>(compression * 100) << "%, encryption " <<
+        static_cast<int>(busy(1) * 100) << "%, storage " << static_cast<int>(busy(2) * 100) << "%, reading " <<
+        static_cast<int>(producer * 100) << "%";
+    m_intervalStart = now;
+    m_intervalStartStageTimes = std::move(stage_times);
+    m_producerTime = Clock::duration::zero();
+
+    if ((compression >= g_tuningSaturated) && (compression >= downstream) && (compression >= producer)) {
+        // a single worker thread would only move the work off the stage thread
+        std::int64_t const more_threads =
+            std::min((m_threads.value == 0) ? 2 : (m_threads.value * 2), m_threads.max_value);
+        if (m_threads.supported && (more_threads > m_threads.value) && (more_threads >= 2)) {
+            record("compression threads", m_threads.value, more_threads, reason.str());
+            m_threads.value = more_threads;
+            requestCompressionParameters();
+        } else if (m_level.supported && (m_level.value > m_level.min_value)) {
+            record("compression level", m_level.value, m_level.value - 1, reason.str());
+            --m_level.value;
+            requestCompressionParameters();
+        }
+    } else if ((compression < g_tuningCompressionSpare) && (std::max(downstream, producer) >= g_tuningSaturated)) {
+        if (m_threads.supported && (m_threads.value > 0)) {
+            std::int64_t const fewer_threads = (m_threads.value > 2) ? (m_threads.value / 2) : 0;
+            record("compression threads", m_threads.value, fewer_threads, reason.str());
+            m_threads.value = fewer_threads;
+            requestCompressionParameters();
+        } else if (m_level.supported && (m_level.value < m_level.max_value)) {
+            record("compression level", m_level.value, m_level.value + 1, reason.str());
+            ++m_level.value;
+            requestCompressionParameters();
+        }
+    }
+
+    if (m_readQueueDepth == 0) { return; }
+    if ((producer >= g_tuningSaturated) && (producer >= std::max(compression, downstream)) &&
+        (m_readQueueDepth < g_maxReadQueueDepth))
+    {
+        std::size_t const deeper = std::min(m_readQueueDepth * 2, g_maxReadQueueDepth);
+        record("read queue depth", m_readQueueDepth, deeper, reason.str());
+        m_readQueueDepth = deeper;
+    } else if ((producer < g_tuningProducerSpare) && (m_readQueueDepth > m_initialReadQueueDepth)) {
+        std::size_t const shallower = std::max(m_readQueueDepth / 2, m_initialReadQueueDepth);
+        record("read queue depth", m_readQueueDepth, shallower, reason.str());
+        m_readQueueDepth = shallower;
+    }
+}
+
+void ThroughputTuner::record(std::string const& setting, std::int64_t from, std::int64_t to,
+                             std::string const& reason)
+{
+    ++m_decisionCount;
+    if (m_decisions.size() == g_maxLoggedTuningDecisions) { return; }
+    std::ostringstream decision;
+    decision << "after " << std::chrono::duration_cast<std::chrono::milliseconds>(Clock::now() - m_start) <<
+        ": " << setting << " " << from << " -> " << to << " (" << reason << ")";
+    m_decisions.push_back(decision.str());
+}
+
+void ThroughputTuner::logDecisions() const
+{
+    if (m_decisionCount == 0) {
+        GHULBUS_LOG(Debug, "Throughput tuning made no adjustments.");
+        return;
+    }
+    std::ostringstream settings;
+    if (m_level.supported) { settings << "; compression level " << m_level.initial << " -> " << m_level.value; }
+    if (m_threads.supported) {
+        settings << "; compression threads " << m_threads.initial << " -> " << m_threads.value;
+    }
+    settings << "; read queue depth " << m_initialReadQueueDepth << " -> " << m_readQueueDepth;
+    GHULBUS_LOG(Info, "Throughput tuning made " << m_decisionCount << " adjustment" <<
+                ((m_decisionCount != 1) ? "s" : "") << settings.str() << ".");
+    for (auto const& d : m_decisions) {
+        GHULBUS_LOG(Debug, "Throughput tuning " << d);
+    }
+    if (m_decisionCount > m_decisions.size()) {
+        GHULBUS_LOG(Debug, "Throughput tuning made " << (m_decisionCount - m_decisions.size()) <<
+                    " further adjustments.");
+    }
+}
+
+/** Final stage of the restore path.
+ * Cuts the parts of files out of the decompressed contents of a storage container and writes them to their
+ * destination files.
+ */
+class RestoreSink {
+private:
+    using RestorePart = ProcessingPipeline::RestorePart;
+    struct ActivePart {
+        RestorePart const* part;
+        std::ofstream fout;
+    };
+    std::vector<RestorePart const*> m_pendingParts;     ///< in reverse order of offset
+    std::deque<ActivePart> m_activeParts;               ///< parts overlapping the current position
+    std::int64_t m_position;                            ///< offset of the next byte within the decompressed container
+    std::int64_t m_bytesWritten;
+public:
+    RestoreSink();
+    void startContainer(std::span<RestorePart const> parts);
+    /** Continues at position within the decompressed container, skipping the data up to there.
+     */
+    void seek(std::int64_t position);
+    void consume(BlimpFileChunk chunk);
+    bool isComplete() const;
+    std::int64_t getBytesWritten() const;
+    /** Closes all destination files.
+     */
+    void abort();
+private:
+    void write(ActivePart& active, char const* data, std::size_t size);
+};
+
+RestoreSink::RestoreSink()
+    :m_position(0), m_bytesWritten(0)
+{}
+
+void RestoreSink::startContainer(std::span<RestorePart const> parts)
+{
+    GHULBUS_PRECONDITION(m_activeParts.empty());
+    m_pendingParts.clear();
+    // empty parts have nothing to write
+    for (auto it = parts.rbegin(); it != parts.rend(); ++it) {
+        if (it->size > 0) { m_pendingParts.push_back(&(*it)); }
+    }
+    m_position = 0;
+    m_bytesWritten = 0;
+}
+
+void RestoreSink::seek(std::int64_t position)
+{
+    GHULBUS_PRECONDITION(m_activeParts.empty() && (position >= m_position));
+    m_position = position;
+}
+
+void RestoreSink::consume(BlimpFileChunk chunk)
+{
+    if (!chunk.data) { return; }
+    std::int64_t const chunk_begin = m_position;
+    std::int64_t const chunk_end = m_position + chunk.size;
+    m_position = chunk_end;
+    while ((!m_pendingParts.empty()) && (m_pendingParts.back()->offset < chunk_end)) {
+        RestorePart const& part = *m_pendingParts.back();
+        m_pendingParts.pop_back();
+        ActivePart& active = m_activeParts.emplace_back(ActivePart{ .part = &part, .fout = {} });
+        // the destination file may receive other parts concurrently, so it must not be truncated
+        active.fout.open(part.destination.string(), std::ios_base::binary | std::ios_base::in | std::ios_base::out);
+        active.fout.seekp(part.destination_offset);
+        if (!active.fout) {
+            GHULBUS_THROW(Ghulbus::Exceptions::IOError{} << Ghulbus::Exception_Info::filename(part.destination.string()),
+                          "Unable to open file for restoring");
+        }
+    }
+    for (auto it = m_activeParts.begin(); it != m_activeParts.end();) {
+        RestorePart const& part = *it->part;
+        std::int64_t const part_end = part.offset + part.size;
+        std::int64_t const begin = std::max(chunk_begin, part.offset);
+        std::int64_t const end = std::min(chunk_end, part_end);
+        if (begin < end) {
+            write(*it, chunk.data + (begin - chunk_begin), static_cast<std::size_t>(end - begin));
+        }
+        if (part_end <= chunk_end) {
+            it->fout.close();
+            if (!it->fout) {
+                GHULBUS_THROW(Ghulbus::Exceptions::IOError{} << Ghulbus::Exception_Info::filename(part.destination.string()),
+                              "Error while writing restored file");
+            }
+            it = m_activeParts.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+void RestoreSink::write(ActivePart& active, char const* data, std::size_t size)
+{
+    active.fout.write(data, static_cast<std::streamsize>(size));
+    if (!active.fout) {
+        GHULBUS_THROW(Ghulbus::Exceptions::IOError{} << Ghulbus::Exception_Info::filename(active.part->destination.string()),
+                      "Error while writing restored file");
+    }
+    if (active.part->hasher) { active.part->hasher->addData(FileChunk::fromView(data, size)); }
+    m_bytesWritten += static_cast<std::int64_t>(size);
+}
+
+bool RestoreSink::isComplete() const
+{
+    return m_pendingParts.empty() && m_activeParts.empty();
+}
+
+std::int64_t RestoreSink::getBytesWritten() const
+{
+    return m_bytesWritten;
+}
+
+void RestoreSink::abort()
+{
+    m_activeParts.clear();
+    m_pendingParts.clear();
+}
+
+/** Reads a range of the storage container opened for restoring, with several reads in flight.
+ * The range is handed out in order, one read at a time. The buffers for the reads are allocated by the first call
+ * to start() and charged to the memory budget.
+ */
+class StorageReader {
+private:
+    PluginStorage* m_storage;
+    MemoryBudget* m_budget;
+    std::unique_ptr<char[]> m_buffers;
+    MemoryBudget::Reservation m_buffersReservation;
+    std::vector<BlimpStorageReadRequest> m_requests;    ///< ring of reads, starting at m_first
+    std::size_t m_first;
+    std::size_t m_inFlight;
+    bool m_handedOut;               ///< whether the first read was handed out by next() and is still in use
+    std::int64_t m_nextOffset;
+    std::int64_t m_end;
+public:
+    StorageReader(PluginStorage& storage, MemoryBudget& budget);
+    ~StorageReader();
+    StorageReader(StorageReader const&) = delete;
+    StorageReader& operator=(StorageReader const&) = delete;
+
+    /** Starts reading [begin, end) of the container; end may lie beyond the end of the container.
+     */
+    void start(std::int64_t begin, std::int64_t end);
+    /** Blocks until the next chunk of the range has been read.
+     * A chunk with data == nullptr marks the end of the range or of the container. The chunk remains valid until
+     * the next call.
+     */
+    BlimpFileChunk next();
+    /** Waits for all reads still in flight, so that another container may be opened.
+     */
+    void cancel();
+private:
+    void submitReads();
+    void retireFirst();
+};
+
+StorageReader::StorageReader(PluginStorage& storage, MemoryBudget& budget)
+    :m_storage(&storage), m_budget(&budget), m_first(0), m_inFlight(0), m_handedOut(false), m_nextOffset(0),
+     m_end(0)
+{}
+
+StorageReader::~StorageReader()
+{
+    cancel();
+}
+
+void StorageReader::start(std::int64_t begin, std::int64_t end)
+{
+    GHULBUS_PRECONDITION((begin >= 0) && (begin <= end));
+    cancel();
+    if (!m_buffers) {
+        m_buffers = std::make_unique<char[]>(g_storageReadAhead * g_storageReadSize);
+        m_buffersReservation = m_budget->charge(g_storageReadAhead * g_storageReadSize);
+        m_requests.resize(g_storageReadAhead);
+    }
+    m_nextOffset = begin;
+    m_end = end;
+}
+
+BlimpFileChunk StorageReader::next()
+{
+    if (m_handedOut) {
+        retireFirst();
+        m_handedOut = false;
+    }
+    submitReads();
+    if (m_inFlight == 0) { return BlimpFileChunk{ .data = nullptr, .size = 0 }; }
+    BlimpStorageReadRequest& request = m_requests[m_first];
+    std::int64_t const n_read = m_storage->waitForReadRequest(request);
+    if (n_read < request.size) {
+        // the container ends within this read; reads beyond it are still waited for, but deliver nothing
+        m_end = m_nextOffset;
+    }
+    if (n_read == 0) {
+        retireFirst();
+        cancel();
+        return BlimpFileChunk{ .data = nullptr, .size = 0 };
+    }
+    m_handedOut = true;
+    return BlimpFileChunk{ .data = request.buffer, .size = n_read };
+}
+
+void StorageReader::cancel()
+{
+    if (m_handedOut) {
+        retireFirst();
+        m_handedOut = false;
+    }
+    while (m_inFlight > 0) {
+        try {
+            m_storage->waitForReadRequest(m_requests[m_first]);
+        } catch (...) {
+            // failed reads of a range that is no longer of interest do not matter
+        }
+        retireFirst();
+    }
+    m_nextOffset = m_end;
+}
+
+void StorageReader::submitReads()
+{
+    std::size_t const n_before = m_inFlight;
+    while ((m_inFlight < m_requests.size()) && (m_nextOffset < m_end)) {
+        std::size_t const i = (m_first + m_inFlight) % m_requests.size();
+        std::int64_t const size = std::min(static_cast<std::int64_t>(g_storageReadSize), m_end - m_nextOffset);
+        m_requests[i] = BlimpStorageReadRequest{ .offset = m_nextOffset, .size = size,
+                                                 .buffer = m_buffers.get() + i * g_storageReadSize,
+                                                 .out_size = 0, .out_result = BLIMP_PLUGIN_RESULT_OK };
+        m_nextOffset += size;
+        ++m_inFlight;
+    }
+    // the new reads are contiguous in the ring, except where they wrap around its end
+    for (std::size_t n_submitted = n_before; n_submitted < m_inFlight;) {
+        std::size_t const i = (m_first + n_submitted) % m_requests.size();
+        std::size_t const n = std::min(m_inFlight - n_submitted, m_requests.size() - i);
+        m_storage->submitReadRequests(std::span<BlimpStorageReadRequest>(m_requests.data() + i, n));
+        n_submitted += n;
+    }
+}
+
+void StorageReader::retireFirst()
+{
+    m_first = (m_first + 1) % m_requests.size();
+    --m_inFlight;
 }
 
 struct ProcessingPipeline::Pipeline {
+    BlimpDB* m_blimpdb;
+    MemoryBudget* m_budget;
+    /// Output buffers of the plugins; must outlive both the plugins and the stages
+    BufferPool m_bufferPool;
+    MemoryBudget::Reservation m_bufferPoolReservation;
+    /// Compression plugins implementing CompressionCodec::Zlib, which is the one tuned by m_tuner, and the optional
+    /// codecs. Plugins are loaded on construction, as their initialization accesses the database, which storing
+    /// threads must not do.
     PluginCompression m_compression;
+    OptionalCompressionPlugins m_optionalCompression;
     PluginEncryption m_encryption;
     PluginStorage m_storage;
+    StorageReader m_storageReader;
 
-    std::vector<PipelineStage> m_stages;
+    std::deque<PipelineStage> m_stages;
+    ThroughputTuner m_tuner;
 
-    Pipeline(BlimpDB& blimpdb);
+    /// Codec of the compression stage, and of the decompression stage while restoring; only changed while the stage
+    /// is idle
+    CompressionCodec m_codec;
+    /// Chunk that is passed on unchanged with CompressionCodec::None
+    BlimpFileChunk m_uncompressedChunk;
 
-    void resetStatsCurrentContainer();
-    void flush();
+    /// Block index of the current container: the offsets and codecs of the blocks within the decompressed container,
+    /// recorded when a block is started, and the stored sizes at the end of each block, recorded by the storage stage
+    std::vector<StorageBlock> m_blocks;
+    std::vector<std::int64_t> m_blockStoredEnds;
+    std::atomic<std::int64_t> m_storedSize;
+    /// Container the storage stage is currently writing; 0 if none
+    std::atomic<std::int64_t> m_storingContainerId;
+
+    /// Block index of containers that were closed by the producer, but not yet finalized by the storage stage, and
+    /// the containers finalized by the storage stage, but not yet taken by the producer
+    std::mutex m_finalizationMutex;
+    std::deque<std::vector<StorageBlock>> m_closedBlocks;
+    std::vector<FinalizedContainer> m_finalizedContainers;
+
+    /// Receives the compressed output of speculative transactions instead of the encryption stage.
+    PipelineStage m_staging;
+    std::vector<char> m_stagedData;
+    MemoryBudget::Reservation m_stagedDataReservation;
+
+    /// Stages of the restore path, created on the first restore: decryption, decompression and the restore sink
+    RestoreSink m_restoreSink;
+    std::deque<PipelineStage> m_restoreStages;
+
+    /// Plugin instances for contents stored inline in the database, created on first use; they are apart from the
+    /// plugins of the stages, whose state belongs to the container being written or restored
+    struct InlinePlugins {
+        PluginCompression compression;
+        OptionalCompressionPlugins optionalCompression;
+        PluginEncryption encryption;
+
+        explicit InlinePlugins(BlimpDB& blimpdb);
+        PluginCompression* compressionPlugin(CompressionCodec codec);
+    };
+    std::unique_ptr<InlinePlugins> m_inlinePlugins;
+
+    Pipeline(BlimpDB& blimpdb, MemoryBudget& budget, std::size_t n_pipelines);
+    ~Pipeline();
+
+    void drain();
+
+    PluginCompression* compressionPlugin(CompressionCodec codec);
+    void compressChunk(BlimpFileChunk c);
+    void decompressChunk(BlimpFileChunk c);
+    BlimpLentChunk takeCodecOutput();
+    void storeChunk(BlimpFileChunk c);
+    void handleStorageContainerEvent(ChunkQueue::ItemType event, StorageContainerId const& container_id);
+    std::int64_t getStoredSize(StorageContainerId const& container_id) const;
+    void closeBlockIndex();
+    std::vector<StorageBlock> takeBlockIndex();
+
+    void beginStaging();
+    std::size_t getStagedSize() const;
+    void releaseStagedData();
+    void discardStagedData();
+    void stageData(BlimpFileChunk c);
+    void clearStagedData();
+
+    void setupRestoreStages();
+    void drainRestore();
+    void discardRestoreOutput();
+
+    InlinePlugins& inlinePlugins();
 };
 
-ProcessingPipeline::Pipeline::Pipeline(BlimpDB& blimpdb)
-    :m_compression(blimpdb, "compression_zlib"), m_encryption(blimpdb, "encryption_aes"),
-     m_storage(blimpdb, "storage_filesystem")
+ProcessingPipeline::Pipeline::Pipeline(BlimpDB& blimpdb, MemoryBudget& budget, std::size_t n_pipelines)
+    :m_blimpdb(&blimpdb), m_budget(&budget), m_bufferPool(g_lentBufferSize, lentBufferCount(budget, n_pipelines)),
+     m_bufferPoolReservation(budget.charge(m_bufferPool.getBufferSize() * m_bufferPool.getBufferCount())),
+     m_compression(blimpdb, compressionPluginName(CompressionCodec::Zlib)),
+     m_optionalCompression(blimpdb),
+     m_encryption(blimpdb, "encryption_aes"),
+     m_storage(blimpdb, "storage_filesystem"), m_storageReader(m_storage, budget),
+     m_tuner(m_stages, m_compression, n_pipelines), m_codec(CompressionCodec::Zlib),
+     m_uncompressedChunk{ .data = nullptr, .size = 0 }, m_storedSize(0),
+     m_storingContainerId(0),
+     m_staging([this](BlimpFileChunk c) { stageData(c); }, []() -> BlimpLentChunk { return {}; }, nullptr, budget)
 {
-    m_encryption.setPassword("batteryhorsestaples");
+    m_encryption.setPassword(g_encryptionPassword);
     m_storage.setBaseLocation("./test_storage");
+    if (m_compression.supportsBufferLending()) { m_compression.setBufferPool(m_bufferPool.getPluginBufferPool()); }
+    for (PluginCompression* compression : m_optionalCompression.all()) {
+        if (compression && compression->supportsBufferLending()) {
+            compression->setBufferPool(m_bufferPool.getPluginBufferPool());
+        }
+    }
+    if (m_encryption.supportsBufferLending()) { m_encryption.setBufferPool(m_bufferPool.getPluginBufferPool()); }
 
-    m_stages.reserve(3);
-    m_stages.emplace_back([this](BlimpFileChunk c) { m_compression.compressFileChunk(c); }, [this]() -> BlimpFileChunk { return m_compression.getProcessedChunk(); });
-    m_stages.emplace_back([this](BlimpFileChunk c) { m_encryption.encryptFileChunk(c); }, [this]() -> BlimpFileChunk { return m_encryption.getProcessedChunk(); });
-    m_stages.emplace_back([this](BlimpFileChunk c) { m_storage.storeFileChunk(c); }, []() -> BlimpFileChunk { return {}; });
+    m_stages.emplace_back([this](BlimpFileChunk c) { compressChunk(c); }, [this]() -> BlimpLentChunk { return takeCodecOutput(); }, &m_bufferPool, budget);
+    m_stages.emplace_back([this](BlimpFileChunk c) { m_encryption.encryptFileChunk(c); }, [this]() -> BlimpLentChunk { return m_encryption.takeProcessedChunk(); }, &m_bufferPool, budget);
+    m_stages.emplace_back([this](BlimpFileChunk c) { storeChunk(c); }, []() -> BlimpLentChunk { return {}; }, nullptr, budget,
+                          [this](ChunkQueue::ItemType event, StorageContainerId const& container_id) { handleStorageContainerEvent(event, container_id); });
     for (std::size_t i = 0, i_end = m_stages.size() - 1; i != i_end; ++i) {
         m_stages[i].setDownstream(m_stages[i+1]);
     }
 }
 
-void ProcessingPipeline::Pipeline::flush()
+ProcessingPipeline::Pipeline::~Pipeline()
 {
-    for (auto& s : m_stages) {
-        s.pump(BlimpFileChunk{ .data = nullptr, .size = 0 });
+    try {
+        drain();
+    } catch (std::exception& e) {
+        GHULBUS_LOG(Error, "Error while shutting down processing pipeline: " << e.what());
     }
 }
 
-void ProcessingPipeline::Pipeline::resetStatsCurrentContainer()
+void ProcessingPipeline::Pipeline::drain()
 {
+    // stages only pump downstream while processing, so waiting for them in pipeline order leaves all of them idle
+    m_stages.front().waitUntilIdle();
+    m_staging.waitUntilIdle();
     for (auto& s : m_stages) {
-        s.resetStatsCurrentContainer();
+        s.waitUntilIdle();
+    }
+}
+
+/** Returns nullptr for CompressionCodec::None. Throws if the plugin for codec is not available.
+ */
+PluginCompression* ProcessingPipeline::Pipeline::compressionPlugin(CompressionCodec codec)
+{
+    return selectCompressionPlugin(codec, m_compression, m_optionalCompression);
+}
+
+void ProcessingPipeline::Pipeline::compressChunk(BlimpFileChunk c)
+{
+    if (auto const p = m_tuner.takeCompressionParameters()) {
+        m_compression.setCompressionParameter(BLIMP_COMPRESSION_PARAMETER_LEVEL, p->level);
+        m_compression.setCompressionParameter(BLIMP_COMPRESSION_PARAMETER_THREADS, p->threads);
+    }
+    if (PluginCompression* compression = compressionPlugin(m_codec)) {
+        compression->compressFileChunk(c);
+    } else {
+        m_uncompressedChunk = c;
+    }
+}
+
+void ProcessingPipeline::Pipeline::decompressChunk(BlimpFileChunk c)
+{
+    if (PluginCompression* compression = compressionPlugin(m_codec)) {
+        compression->decompressFileChunk(c);
+    } else {
+        m_uncompressedChunk = c;
     }
 }
 
-ProcessingPipeline::ProcessingPipeline(BlimpDB& blimpdb)
-    :m_startOffset(0), m_sizeCounter(0), m_partCounter(0),
-     m_pipeline(std::make_unique<Pipeline>(blimpdb)), m_currentContainerFull(true), m_currentContainerId{ .i = 0 }
+/** Returns the output of the compression or decompression stage.
+ * Uncompressed chunks are passed on from the input of the stage, which remains valid until the stage passed on
+ * all of its output.
+ */
+BlimpLentChunk ProcessingPipeline::Pipeline::takeCodecOutput()
+{
+    if (PluginCompression* compression = compressionPlugin(m_codec)) {
+        return compression->takeProcessedChunk();
+    }
+    BlimpFileChunk const c = std::exchange(m_uncompressedChunk, BlimpFileChunk{ .data = nullptr, .size = 0 });
+    return BlimpLentChunk{ .data = c.data, .size = c.size, .token = 0 };
+}
+
+void ProcessingPipeline::Pipeline::storeChunk(BlimpFileChunk c)
+{
+    m_storage.storeFileChunk(c);
+    if (c.data) {
+        m_storedSize.store(m_storedSize.load(std::memory_order_relaxed) + c.size, std::memory_order_relaxed);
+    } else {
+        // the encryption stage passes on a flush once it finished the encrypted stream of a block
+        m_blockStoredEnds.push_back(m_storedSize.load(std::memory_order_relaxed));
+    }
+}
+
+/** Runs on the storage stage thread.
+ * Finalizing a container there lets the stages before it go on processing the data of the next container meanwhile.
+ */
+void ProcessingPipeline::Pipeline::handleStorageContainerEvent(ChunkQueue::ItemType event,
+                                                               StorageContainerId const& container_id)
+{
+    if (event == ChunkQueue::ItemType::NewContainer) {
+        m_storage.newStorageContainer(container_id);
+        m_blockStoredEnds.clear();
+        m_storedSize.store(0, std::memory_order_relaxed);
+        m_storingContainerId.store(container_id.i, std::memory_order_release);
+    } else {
+        GHULBUS_ASSERT(event == ChunkQueue::ItemType::FinalizeContainer);
+        m_storingContainerId.store(0, std::memory_order_relaxed);
+        BlimpStorageContainerLocation const location = m_storage.finalizeStorageContainer();
+        FinalizedContainer finalized{ .container = StorageContainer{ .id = container_id,
+                                                                     .location = { .l = location.location } },
+                                      .blocks = takeBlockIndex() };
+        std::lock_guard lk(m_finalizationMutex);
+        m_finalizedContainers.push_back(std::move(finalized));
+    }
+}
+
+/** Returns the size that was stored so far for the given container, or 0 if the storage stage has not started
+ * writing the container yet.
+ */
+std::int64_t ProcessingPipeline::Pipeline::getStoredSize(StorageContainerId const& container_id) const
+{
+    // only the producer starts new containers, so the storage stage cannot move past the container meanwhile
+    if (m_storingContainerId.load(std::memory_order_acquire) != container_id.i) { return 0; }
+    return m_storedSize.load(std::memory_order_relaxed);
+}
+
+/** Hands the block offsets of the current container over to the storage stage, which completes the index once it
+ * stored the last block of the container.
+ */
+void ProcessingPipeline::Pipeline::closeBlockIndex()
+{
+    std::lock_guard lk(m_finalizationMutex);
+    m_closedBlocks.push_back(std::move(m_blocks));
+    m_blocks.clear();
+}
+
+/** Runs on the storage stage thread once the last block of the container was stored.
+ */
+std::vector<StorageBlock> ProcessingPipeline::Pipeline::takeBlockIndex()
+{
+    std::vector<StorageBlock> ret;
+    {
+        std::lock_guard lk(m_finalizationMutex);
+        GHULBUS_ASSERT(!m_closedBlocks.empty());
+        ret = std::move(m_closedBlocks.front());
+        m_closedBlocks.pop_front();
+    }
+    GHULBUS_ASSERT(m_blockStoredEnds.size() == ret.size());
+    for (std::size_t i = 1; i < ret.size(); ++i) {
+        ret[i].stored_offset = m_blockStoredEnds[i - 1];
+    }
+    m_blockStoredEnds.clear();
+    return ret;
+}
+
+void ProcessingPipeline::Pipeline::beginStaging()
+{
+    GHULBUS_PRECONDITION(m_stagedData.empty());
+    // the compression stage may still be passing on the end of the previous transaction
+    m_stages.front().waitUntilIdle();
+    m_staging.resetStats();
+    m_stages.front().setDownstream(m_staging);
+}
+
+std::size_t ProcessingPipeline::Pipeline::getStagedSize() const
+{
+    return m_staging.getByteCounter();
+}
+
+void ProcessingPipeline::Pipeline::releaseStagedData()
+{
+    m_stages.front().waitUntilIdle();
+    m_staging.waitUntilIdle();
+    m_stages.front().setDownstream(m_stages[1]);
+    for (std::size_t offset = 0; offset < m_stagedData.size(); offset += g_stagedReleaseChunkSize) {
+        std::size_t const n_bytes = std::min(g_stagedReleaseChunkSize, m_stagedData.size() - offset);
+        m_stages[1].pump(BlimpFileChunk{ .data = m_stagedData.data() + offset,
+                                         .size = static_cast<int64_t>(n_bytes) });
+    }
+    clearStagedData();
+}
+
+void ProcessingPipeline::Pipeline::discardStagedData()
+{
+    // finish the compressed stream into the staging area, so that the next transaction starts a fresh stream
+    m_stages.front().flushStage();
+    m_stages.front().waitUntilIdle();
+    m_staging.waitUntilIdle();
+    m_stages.front().setDownstream(m_stages[1]);
+    clearStagedData();
+}
+
+void ProcessingPipeline::Pipeline::stageData(BlimpFileChunk c)
+{
+    std::size_t const old_capacity = m_stagedData.capacity();
+    m_stagedData.insert(m_stagedData.end(), c.data, c.data + c.size);
+    if (m_stagedData.capacity() != old_capacity) {
+        m_stagedDataReservation.release();
+        m_stagedDataReservation = m_budget->charge(m_stagedData.capacity());
+    }
+}
+
+void ProcessingPipeline::Pipeline::clearStagedData()
+{
+    m_stagedData = std::vector<char>{};
+    m_stagedDataReservation.release();
+}
+
+void ProcessingPipeline::Pipeline::setupRestoreStages()
+{
+    GHULBUS_PRECONDITION(m_restoreStages.empty());
+    m_restoreStages.emplace_back([this](BlimpFileChunk c) { m_encryption.decryptFileChunk(c); }, [this]() -> BlimpLentChunk { return m_encryption.takeProcessedChunk(); }, &m_bufferPool, *m_budget);
+    m_restoreStages.emplace_back([this](BlimpFileChunk c) { decompressChunk(c); }, [this]() -> BlimpLentChunk { return takeCodecOutput(); }, &m_bufferPool, *m_budget);
+    m_restoreStages.emplace_back([this](BlimpFileChunk c) { m_restoreSink.consume(c); }, []() -> BlimpLentChunk { return {}; }, nullptr, *m_budget);
+    for (std::size_t i = 0, i_end = m_restoreStages.size() - 1; i != i_end; ++i) {
+        m_restoreStages[i].setDownstream(m_restoreStages[i+1]);
+    }
+}
+
+void ProcessingPipeline::Pipeline::drainRestore()
+{
+    // as with drain(), waiting in pipeline order leaves all stages idle
+    for (auto& s : m_restoreStages) {
+        s.waitUntilIdle();
+    }
+}
+
+/** Drops the output that failed restore stages left behind in the plugins, which are shared with the backup stages.
+ * Requires all stages to be idle.
+ */
+void ProcessingPipeline::Pipeline::discardRestoreOutput()
+{
+    for (BlimpLentChunk c = m_encryption.takeProcessedChunk(); c.data != nullptr; c = m_encryption.takeProcessedChunk()) {
+        if (c.token != 0) { m_bufferPool.release(c.token); }
+    }
+    std::array<PluginCompression*, 3> const compression_plugins = { &m_compression, m_optionalCompression.lz4.get(),
+                                                                    m_optionalCompression.zstd.get() };
+    for (PluginCompression* compression : compression_plugins) {
+        if (!compression) { continue; }
+        for (BlimpLentChunk c = compression->takeProcessedChunk(); c.data != nullptr; c = compression->takeProcessedChunk()) {
+            if (c.token != 0) { m_bufferPool.release(c.token); }
+        }
+    }
+    m_uncompressedChunk = BlimpFileChunk{ .data = nullptr, .size = 0 };
+}
+
+ProcessingPipeline::Pipeline::InlinePlugins::InlinePlugins(BlimpDB& blimpdb)
+    :compression(blimpdb, compressionPluginName(CompressionCodec::Zlib)),
+     optionalCompression(blimpdb),
+     encryption(blimpdb, "encryption_aes")
+{
+    encryption.setPassword(g_encryptionPassword);
+    encryption.newStorageContainer(g_inlineContainerId);
+}
+
+/** Returns nullptr for CompressionCodec::None. Throws if the plugin for codec is not available.
+ */
+PluginCompression* ProcessingPipeline::Pipeline::InlinePlugins::compressionPlugin(CompressionCodec codec)
+{
+    return selectCompressionPlugin(codec, compression, optionalCompression);
+}
+
+ProcessingPipeline::Pipeline::InlinePlugins& ProcessingPipeline::Pipeline::inlinePlugins()
+{
+    if (!m_inlinePlugins) { m_inlinePlugins = std::make_unique<InlinePlugins>(*m_blimpdb); }
+    return *m_inlinePlugins;
+}
+
+ProcessingPipeline::ProcessingPipeline(BlimpDB& blimpdb, MemoryBudget& budget, std::size_t n_pipelines)
+    :m_startOffset(0), m_sizeCounter(0), m_partCounter(0), m_blockStartOffset(0), m_contentRouted(false),
+     m_contentCodec(CompressionCodec::Zlib), m_blockHasData(false), m_blockHadDataBeforeContent(false),
+     m_compressionPending(false), m_inBundle(false),
+     m_pipeline(std::make_unique<Pipeline>(blimpdb, budget, n_pipelines)),
+     m_currentContainerFull(true),
+     m_splitContents(true), m_currentContainerId{ .i = 0 }, m_speculativeState(SpeculativeState::None),
+     m_speculationBlockIndex(0), m_speculationStoredSize(0)
 {
 }
 
 ProcessingPipeline::~ProcessingPipeline() = default;
 
+void ProcessingPipeline::setContentSplitting(bool enabled)
+{
+    m_splitContents = enabled;
+}
+
 void ProcessingPipeline::newStorageContainer(StorageContainerId const& container_id)
 {
-    m_pipeline->m_storage.newStorageContainer(container_id);
+    GHULBUS_PRECONDITION(m_currentContainerId.i == 0);
+    // container events bypass the staging stage
+    GHULBUS_PRECONDITION(m_speculativeState != SpeculativeState::Staged);
+    // the encryption plugin records the key of the container in the database, so it is told about the new container
+    // from this thread once it encrypted the previous one; the storage stage meanwhile goes on finalizing the previous
+    // container and is told about the new one behind its data
+    m_pipeline->m_stages[0].waitUntilIdle();
+    m_pipeline->m_stages[1].waitUntilIdle();
     m_pipeline->m_encryption.newStorageContainer(container_id);
-    m_pipeline->resetStatsCurrentContainer();
+    // a content that continues from the previous container keeps its codec
+    m_pipeline->m_blocks.assign(1, StorageBlock{ .offset = 0, .stored_offset = 0, .codec = m_contentCodec });
+    m_pipeline->m_stages.front().pumpContainerEvent(ChunkQueue::ItemType::NewContainer, container_id);
 
     m_startOffset = 0;
     m_sizeCounter = 0;
+    m_blockStartOffset = 0;
+    m_blockHasData = false;
     m_currentContainerFull = false;
     m_currentContainerId = container_id;
 }
 
-ProcessingPipeline::TransactionGuard ProcessingPipeline::startNewContentTransaction(Hash const& data_hash)
+ProcessingPipeline::TransactionGuard ProcessingPipeline::startNewContentTransaction(Hash const& data_hash,
+                                                                                   FileInfo const& file)
 {
+    m_pipeline->m_tuner.startContent();
     m_locations.clear();
     m_partCounter = 0;
     m_startOffset += m_sizeCounter;
     m_sizeCounter = 0;
+    m_contentFile = file;
+    m_contentRouted = false;
+    m_speculativeState = SpeculativeState::None;
+
+    return TransactionGuard(this);
+}
+
+ProcessingPipeline::TransactionGuard ProcessingPipeline::startSpeculativeContentTransaction(FileInfo const& file)
+{
+    GHULBUS_PRECONDITION(!m_inBundle);
+    m_pipeline->m_tuner.startContent();
+    m_locations.clear();
+    m_partCounter = 0;
+    m_startOffset += m_sizeCounter;
+    m_sizeCounter = 0;
+    m_contentFile = file;
+    m_contentRouted = false;
+    // staging begins once the codec for the content was chosen
+    m_speculativeState = SpeculativeState::Staged;
 
     return TransactionGuard(this);
 }
@@ -223,63 +1489,493 @@ ProcessingPipeline::TransactionGuard ProcessingPipeline::startNewContentTransact
 ProcessingPipeline::ContainerStatus ProcessingPipeline::addFileChunk(FileChunk const& chunk)
 {
     if (m_currentContainerFull) { return ContainerStatus::Full; }
+    ThroughputTuner& tuner = m_pipeline->m_tuner;
+    tuner.chunkArrived();
+    auto const chunk_passed = Ghulbus::finally([&tuner]() { tuner.chunkPassed(); });
+    if (!m_contentRouted) { selectContentCodec(std::span<char const>(chunk.getData(), chunk.getUsedSize())); }
     m_sizeCounter += chunk.getUsedSize();
     BlimpFileChunk blimp_chunk{ .data = chunk.getData(), .size = static_cast<int64_t>(chunk.getUsedSize()) };
 
     m_pipeline->m_stages.front().pump(blimp_chunk);
-    if (m_pipeline->m_stages.back().getByteCounterCurrentContainer() > g_containerSizeLimit) {
-        m_pipeline->flush();
+    m_blockHasData = true;
+    m_compressionPending = true;
+    if (m_speculativeState == SpeculativeState::Staged) {
+        if (m_pipeline->getStagedSize() <= speculativeStagingLimit(*m_pipeline->m_budget)) {
+            return ContainerStatus::Ok;
+        }
+        releaseSpeculativeData();
+    }
+    // a rewindable content must remain in the container it started in
+    if (m_splitContents && (m_speculativeState != SpeculativeState::Rewindable) &&
+        (m_pipeline->getStoredSize(m_currentContainerId) > g_containerSizeLimit))
+    {
         m_locations.push_back(StorageLocation{ .container_id = m_currentContainerId,
                                                .offset = m_startOffset,
                                                .size = m_sizeCounter,
-                                               .part_number = m_partCounter });
-        BlimpStorageContainerLocation container_location = m_pipeline->m_storage.finalizeStorageContainer();
-        m_lastContainerLocation = StorageContainerLocation{ .l = container_location.location };
+                                               .part_number = m_partCounter,
+                                               .codec = m_contentCodec });
+        finalizeCurrentContainer();
         ++m_partCounter;
-        m_currentContainerFull = true;
-        m_currentContainerId = StorageContainerId{ .i = 0 };
         return ContainerStatus::Full;
     }
+    startNewBlockIfDue();
     return ContainerStatus::Ok;
 }
 
+/** Chooses the codec for the current content from its first chunk and prepares the pipeline for it.
+ * Each block of the container is compressed with a single codec, so switching codecs starts a new block, unless the
+ * current block has no data yet. A block that received data, but no uncompressed bytes, keeps its codec instead, as
+ * two blocks cannot start at the same offset. Contents routed to a codec whose plugin is not available are compressed
+ * with zlib instead.
+ */
+void ProcessingPipeline::selectContentCodec(std::span<char const> first_chunk)
+{
+    CompressionCodec const codec = availableCodec(routeContent(m_contentFile, first_chunk),
+                                                  m_pipeline->m_optionalCompression);
+    StorageBlock& block = m_pipeline->m_blocks.back();
+    if (!m_blockHasData) {
+        block.codec = codec;
+    } else if ((codec != block.codec) && (m_startOffset != m_blockStartOffset)) {
+        startNewBlock(codec);
+    } else if (m_speculativeState == SpeculativeState::Staged) {
+        // held back data bypasses the encryption stage, so blocks can only be ended before staging begins
+        startNewBlockIfDue();
+    }
+    m_contentCodec = m_pipeline->m_blocks.back().codec;
+    m_blockHadDataBeforeContent = m_blockHasData;
+    if (m_contentCodec != m_pipeline->m_codec) {
+        m_pipeline->m_stages.front().waitUntilIdle();
+        m_pipeline->m_codec = m_contentCodec;
+    }
+    if (m_speculativeState == SpeculativeState::Staged) { m_pipeline->beginStaging(); }
+    m_contentRouted = true;
+}
+
+/** Ends the current block of the container and starts a new one with the given codec.
+ * Flushing the whole pipeline ends both the compressed and the encrypted stream, so that the next block can be
+ * decoded without any of the data before it.
+ */
+void ProcessingPipeline::startNewBlock(CompressionCodec codec)
+{
+    std::int64_t const offset = m_startOffset + m_sizeCounter;
+    m_pipeline->m_stages.front().flushAll();
+    m_pipeline->m_blocks.push_back(StorageBlock{ .offset = offset, .stored_offset = 0, .codec = codec });
+    m_blockStartOffset = offset;
+    m_blockHasData = false;
+    m_compressionPending = false;
+}
+
+/** Ends the current block of the container once it holds enough data. Blocks may end in the middle of a file.
+ */
+void ProcessingPipeline::startNewBlockIfDue()
+{
+    std::int64_t const offset = m_startOffset + m_sizeCounter;
+    if (m_currentContainerFull || (offset - m_blockStartOffset < g_blockSize)) { return; }
+    startNewBlock(m_pipeline->m_blocks.back().codec);
+}
+
+/** Writes the data held back by a speculative transaction through to the container once it exceeded the staging limit.
+ * If the plugins support it, the content gets a block of its own and the encryption is marked at its start, so that
+ * rewindSpeculativeData() can take the content back out of the container. A block that received data without
+ * uncompressed bytes cannot be ended where the content starts, so the content is merely streamed then.
+ */
+void ProcessingPipeline::releaseSpeculativeData()
+{
+    Pipeline& p = *m_pipeline;
+    bool const can_rewind = p.m_encryption.supportsRewinding() && p.m_storage.supportsTruncation() &&
+                            ((m_blockStartOffset != m_startOffset) || (!m_blockHadDataBeforeContent));
+    if (!can_rewind) {
+        p.releaseStagedData();
+        m_speculativeState = SpeculativeState::Streaming;
+        return;
+    }
+    // the staged data is the only data of the content so far, so nothing of it has reached the encryption stage yet
+    p.m_stages.front().waitUntilIdle();
+    p.m_staging.waitUntilIdle();
+    if (m_blockStartOffset != m_startOffset) {
+        p.m_stages[1].flushAll();
+        p.m_blocks.push_back(StorageBlock{ .offset = m_startOffset, .stored_offset = 0, .codec = m_contentCodec });
+        m_blockStartOffset = m_startOffset;
+    }
+    p.drain();
+    p.m_encryption.markEncryption();
+    m_speculationBlockIndex = p.m_blocks.size() - 1;
+    m_speculationStoredSize = p.getStoredSize(m_currentContainerId);
+    p.releaseStagedData();
+    m_speculativeState = SpeculativeState::Rewindable;
+}
+
+/** Takes the data of an aborted Rewindable transaction back out of the container.
+ * The blocks the content started are dropped from the block index, except for the first one, which is left empty
+ * for the next content.
+ */
+void ProcessingPipeline::rewindSpeculativeData()
+{
+    Pipeline& p = *m_pipeline;
+    p.m_stages.front().flushAll();
+    p.drain();
+    p.m_storage.truncateStorageContainer(m_speculationStoredSize);
+    p.m_encryption.rewindEncryption();
+    p.m_blocks.resize(m_speculationBlockIndex + 1);
+    p.m_blockStoredEnds.resize(m_speculationBlockIndex);
+    p.m_storedSize.store(m_speculationStoredSize, std::memory_order_relaxed);
+    m_blockStartOffset = m_startOffset;
+    m_blockHasData = false;
+    m_compressionPending = false;
+}
+
+/** Ends the last block of the current container and leaves finalizing the container to the storage stage.
+ */
+void ProcessingPipeline::finalizeCurrentContainer()
+{
+    m_pipeline->m_stages.front().flushAll();
+    m_compressionPending = false;
+    m_pipeline->closeBlockIndex();
+    m_pipeline->m_stages.front().pumpContainerEvent(ChunkQueue::ItemType::FinalizeContainer, m_currentContainerId);
+    m_currentContainerFull = true;
+    m_currentContainerId = StorageContainerId{ .i = 0 };
+}
+
 std::vector<StorageLocation> ProcessingPipeline::commitTransaction(TransactionGuard&& tg)
 {
-    // flush compression
-    m_pipeline->m_stages.front().flushStage();
+    // flush compression; empty contents and contents that ended with their block leave nothing to flush, which
+    // keeps a block from receiving data without uncompressed bytes. contents of a bundle continue the stream.
+    if (m_compressionPending && (!m_inBundle)) {
+        m_pipeline->m_stages.front().flushStage();
+        m_compressionPending = false;
+    }
+    if ((m_speculativeState == SpeculativeState::Staged) && m_contentRouted) {
+        m_pipeline->releaseStagedData();
+    }
     tg.m_requiresAbort = false;
     m_locations.push_back(StorageLocation{ .container_id = m_currentContainerId,
                                            .offset = m_startOffset,
                                            .size = m_sizeCounter,
-                                           .part_number = m_partCounter });
+                                           .part_number = m_partCounter,
+                                           .codec = m_contentRouted ? m_contentCodec : CompressionCodec::None });
+    if (((m_speculativeState != SpeculativeState::None) || (!m_splitContents)) &&
+        (m_pipeline->getStoredSize(m_currentContainerId) > g_containerSizeLimit))
+    {
+        // released staging data or an unsplit content pushed the container over its limit
+        finalizeCurrentContainer();
+    }
+    m_speculativeState = SpeculativeState::None;
+    m_contentRouted = false;
     return m_locations;
 }
 
 void ProcessingPipeline::abortTransaction(TransactionGuard&& tg)
 {
     tg.m_requiresAbort = false;
+    if (m_speculativeState == SpeculativeState::Staged) {
+        // nothing reached the container yet, so the content can be dropped without a trace
+        if (m_contentRouted) {
+            m_pipeline->discardStagedData();
+            m_compressionPending = false;
+            m_blockHasData = m_blockHadDataBeforeContent;
+        }
+        m_sizeCounter = 0;
+    } else if (m_speculativeState == SpeculativeState::Rewindable) {
+        // aborting may happen while unwinding from an error; a pipeline that failed rethrows on its next use
+        try {
+            rewindSpeculativeData();
+            m_sizeCounter = 0;
+        } catch (std::exception& e) {
+            GHULBUS_LOG(Error, "Error while taking aborted content out of the storage container: " << e.what());
+        }
+    }
+    m_speculativeState = SpeculativeState::None;
+    m_contentRouted = false;
+}
+
+void ProcessingPipeline::beginBundle()
+{
+    GHULBUS_PRECONDITION(!m_inBundle);
+    m_inBundle = true;
+}
+
+void ProcessingPipeline::endBundle()
+{
+    GHULBUS_PRECONDITION(m_inBundle);
+    m_inBundle = false;
+    if (m_compressionPending) {
+        m_pipeline->m_stages.front().flushStage();
+        m_compressionPending = false;
+    }
 }
 
 void ProcessingPipeline::finish()
 {
+    m_inBundle = false;
     if (m_currentContainerId.i != 0) {
-        m_pipeline->flush();
-        BlimpStorageContainerLocation container_location = m_pipeline->m_storage.finalizeStorageContainer();
-        m_currentContainerId = StorageContainerId{ 0 };
-        m_lastContainerLocation = StorageContainerLocation{ .l = container_location.location };
+        finalizeCurrentContainer();
     }
+    m_pipeline->drain();
     GHULBUS_LOG(Debug, "Processing stastics per pipeline stage:");
     for (std::size_t i = 0, i_end = m_pipeline->m_stages.size(); i != i_end; ++i) {
         auto const& s = m_pipeline->m_stages[i];
         GHULBUS_LOG(Debug, "Stage #" << i << ": " << s.getTimeTotal() << " (" << s.getBandwidthMbps() << "Mbps)");
     }
+    MemoryBudget& budget = *m_pipeline->m_budget;
+    GHULBUS_LOG(Debug, "Peak memory usage: " << (budget.getPeakUsage() >> 20) << " MB of " <<
+                (budget.getLimit() >> 20) << " MB budget; peak lent buffers: " <<
+                m_pipeline->m_bufferPool.getPeakBuffersInUse() << " of " << m_pipeline->m_bufferPool.getBufferCount());
+    m_pipeline->m_tuner.logDecisions();
+}
+
+void ProcessingPipeline::adjustReadQueueDepth(FileIO& fio)
+{
+    fio.setQueueDepth(m_pipeline->m_tuner.getReadQueueDepth(fio.getQueueDepth()));
+}
+
+bool ProcessingPipeline::isContainerFull() const
+{
+    return m_currentContainerFull;
+}
+
+std::vector<ProcessingPipeline::FinalizedContainer> ProcessingPipeline::takeFinalizedContainers()
+{
+    std::lock_guard lk(m_pipeline->m_finalizationMutex);
+    return std::exchange(m_pipeline->m_finalizedContainers, {});
+}
+
+void ProcessingPipeline::restoreContainer(StorageContainer const& container, std::span<StorageBlock const> blocks,
+                                          std::span<RestorePart const> parts)
+{
+    GHULBUS_PRECONDITION(m_currentContainerId.i == 0);
+    GHULBUS_PRECONDITION(std::is_sorted(parts.begin(), parts.end(),
+        [](RestorePart const& lhs, RestorePart const& rhs) { return lhs.offset < rhs.offset; }));
+    GHULBUS_PRECONDITION(std::is_sorted(blocks.begin(), blocks.end(),
+        [](StorageBlock const& lhs, StorageBlock const& rhs) { return lhs.offset < rhs.offset; }));
+    GHULBUS_PRECONDITION(blocks.empty() || (blocks.front().offset == 0));
+    Pipeline& p = *m_pipeline;
+    // the storage stage may still be finalizing the last container written
+    p.drain();
+    if (!p.m_storage.supportsReading()) {
+        GHULBUS_THROW(Exceptions::PluginError{}, "Storage plugin does not support reading");
+    }
+    if (p.m_restoreStages.empty()) { p.setupRestoreStages(); }
+
+    // containers without a block index consist of a single block
+    StorageBlock const single_block{ .offset = 0, .stored_offset = 0, .codec = CompressionCodec::Zlib };
+    if (blocks.empty()) { blocks = std::span<StorageBlock const>(&single_block, 1); }
+    auto const stored_block_end = [blocks](std::size_t i) {
+        return (i + 1 < blocks.size()) ? blocks[i + 1].stored_offset : std::numeric_limits<std::int64_t>::max();
+    };
+    std::vector<bool> required_blocks(blocks.size(), false);
+    for (auto const& part : parts) {
+        if (part.size == 0) { continue; }
+        auto const first = std::upper_bound(blocks.begin(), blocks.end(), part.offset,
+            [](std::int64_t offset, StorageBlock const& b) { return offset < b.offset; }) - 1;
+        auto const last = std::lower_bound(blocks.begin(), blocks.end(), part.offset + part.size,
+            [](StorageBlock const& b, std::int64_t offset) { return b.offset < offset; }) - 1;
+        std::fill(required_blocks.begin() + (first - blocks.begin()), required_blocks.begin() + (last - blocks.begin()) + 1,
+                  true);
+    }
+    if (!p.m_encryption.supportsSeeking()) {
+        // without seeking, decryption has to start from the beginning of the container
+        auto const last_required = std::find(required_blocks.rbegin(), required_blocks.rend(), true);
+        std::fill(last_required, required_blocks.rend(), true);
+    }
+    // optional plugins are only required for the blocks compressed with them; a missing one fails before reading
+    for (std::size_t i = 0; i < blocks.size(); ++i) {
+        if (required_blocks[i]) { p.compressionPlugin(blocks[i].codec); }
+    }
+
+    try {
+        // the decryption stage is idle, so the plugin may be accessed from this thread
+        p.m_encryption.newStorageContainer(container.id);
+        p.m_storage.openStorageContainer(container.location);
+        p.m_restoreSink.startContainer(parts);
+
+        BlimpFileChunk chunk{ .data = nullptr, .size = 0 };
+        std::int64_t chunk_offset = 0;
+        bool end_of_container = false;
+        // passes the stored data in [begin, end) of the current run on for decryption;
+        // returns false if the container ends before end
+        auto const pump_stored = [&](std::int64_t begin, std::int64_t end) -> bool {
+            for (;;) {
+                std::int64_t const chunk_end = chunk_offset + chunk.size;
+                std::int64_t const pump_begin = std::max(begin, chunk_offset);
+                std::int64_t const pump_end = std::min(end, chunk_end);
+                if (pump_begin < pump_end) {
+                    p.m_restoreStages.front().pump(BlimpFileChunk{ .data = chunk.data + (pump_begin - chunk_offset),
+                                                                   .size = pump_end - pump_begin });
+                }
+                if (chunk_end >= end) { return true; }
+                if (end_of_container) { return false; }
+                chunk_offset = chunk_end;
+                chunk = p.m_storageReader.next();
+                end_of_container = (chunk.data == nullptr);
+            }
+        };
+
+        // consecutive required blocks are restored in one run; each block is a stream of its own and the
+        // decompression stage switches codecs between blocks once it finished the blocks before
+        for (std::size_t run_begin = 0; run_begin < blocks.size();) {
+            if (!required_blocks[run_begin]) { ++run_begin; continue; }
+            std::size_t run_end = run_begin;
+            while ((run_end < blocks.size()) && required_blocks[run_end]) { ++run_end; }
+            std::int64_t read_offset = 0;
+            if (run_begin != 0) {
+                // a previous run may still be passing through the stages
+                p.drainRestore();
+                read_offset = p.m_encryption.seekDecryption(blocks[run_begin].stored_offset);
+                p.m_restoreSink.seek(blocks[run_begin].offset);
+            }
+            // only the stored data of the run is read, with reads of the following blocks already in flight
+            p.m_storageReader.start(read_offset, stored_block_end(run_end - 1));
+            chunk = BlimpFileChunk{ .data = nullptr, .size = 0 };
+            chunk_offset = read_offset;
+            end_of_container = false;
+            for (std::size_t i = run_begin; i < run_end; ++i) {
+                if (blocks[i].codec != p.m_codec) {
+                    p.drainRestore();
+                    p.m_codec = blocks[i].codec;
+                }
+                std::int64_t const block_end = stored_block_end(i);
+                if ((!pump_stored(read_offset, block_end)) && (block_end != std::numeric_limits<std::int64_t>::max())) {
+                    GHULBUS_THROW(Ghulbus::Exceptions::IOError{} << Ghulbus::Exception_Info::filename(container.location.l),
+                                  "Storage container ends before the end of a block");
+                }
+                read_offset = block_end;
+                if ((i + 1 < run_end) && (blocks[i + 1].codec == blocks[i].codec)) {
+                    p.m_restoreStages.front().flushStage();
+                } else {
+                    p.m_restoreStages.front().flushAll();
+                }
+            }
+            run_begin = run_end;
+        }
+        p.drainRestore();
+        if (!p.m_restoreSink.isComplete()) {
+            GHULBUS_THROW(Ghulbus::Exceptions::IOError{} << Ghulbus::Exception_Info::filename(container.location.l),
+                          "Storage container ends before the end of a file part");
+        }
+    } catch (...) {
+        // stages still processing would otherwise write into the files of the next container
+        for (auto& s : p.m_restoreStages) {
+            try { s.waitUntilIdle(); } catch (...) {}
+        }
+        p.m_storageReader.cancel();
+        p.discardRestoreOutput();
+        p.m_restoreSink.abort();
+        throw;
+    }
+    GHULBUS_LOG(Trace, "Restored " << p.m_restoreSink.getBytesWritten() << " bytes from " <<
+                std::count(required_blocks.begin(), required_blocks.end(), true) << " of " << blocks.size() <<
+                " blocks of container #" << container.id.i);
+}
+
+void ProcessingPipeline::retrieveFile(std::span<BlimpDB::StorageElement const> storage_elements, Hash const& file_hash,
+                                      boost::filesystem::path const& to)
+{
+    GHULBUS_PRECONDITION(std::is_sorted(storage_elements.begin(), storage_elements.end(),
+        [](BlimpDB::StorageElement const& lhs, BlimpDB::StorageElement const& rhs) {
+            return lhs.location.part_number < rhs.location.part_number;
+        }));
+    auto const t0 = std::chrono::steady_clock::now();
+    createRestoreDestination(to);
+    FileHasher hasher(HashType::SHA_256);
+    std::int64_t destination_offset = 0;
+    try {
+        // the parts are restored in order, so the file can be hashed while it is being written
+        for (auto const& element : storage_elements) {
+            RestorePart const part{ .offset = element.location.offset,
+                                    .size = element.location.size,
+                                    .destination = to,
+                                    .destination_offset = destination_offset,
+                                    .hasher = &hasher };
+            std::vector<StorageBlock> const blocks = m_pipeline->m_blimpdb->getStorageBlocks(element.container.id);
+            restoreContainer(element.container, blocks, std::span<RestorePart const>(&part, 1));
+            destination_offset += element.location.size;
+        }
+        if (hasher.getHash().digest != file_hash.digest) {
+            GHULBUS_THROW(Ghulbus::Exceptions::IOError{} << Ghulbus::Exception_Info::filename(to.string()),
+                          "Restored file does not match its hash");
+        }
+    } catch (...) {
+        boost::system::error_code ec;
+        boost::filesystem::remove(to, ec);
+        throw;
+    }
+    auto const t1 = std::chrono::steady_clock::now();
+    GHULBUS_LOG(Info, "Restored " << to << " (" << destination_offset << " bytes from " <<
+                storage_elements.size() << " container" << ((storage_elements.size() != 1) ? "s" : "") <<
+                ") in " << std::chrono::duration_cast<std::chrono::milliseconds>(t1 - t0) << ".");
+    for (std::size_t i = 0, i_end = m_pipeline->m_restoreStages.size(); i != i_end; ++i) {
+        auto const& s = m_pipeline->m_restoreStages[i];
+        GHULBUS_LOG(Debug, "Restore stage #" << i << ": " << s.getTimeTotal() << " (" << s.getBandwidthMbps() << "Mbps)");
+    }
 }
 
-StorageContainerLocation ProcessingPipeline::getLastContainerLocation() const
+BlimpDB::InlineContent ProcessingPipeline::encodeInlineContent(BlimpDB::FileContentId const& content_id,
+                                                               FileInfo const& file, std::span<char const> data)
 {
-    return m_lastContainerLocation;
+    Pipeline::InlinePlugins& plugins = m_pipeline->inlinePlugins();
+    BlimpDB::InlineContent ret{ .content_id = content_id,
+                                .codec = availableCodec(routeContent(file, data), plugins.optionalCompression),
+                                .data = {} };
+    std::vector<char> plain;
+    plain.reserve(g_inlineNonceSize + data.size());
+    appendRandomBlock(plain);
+    if (PluginCompression* compression = plugins.compressionPlugin(ret.codec)) {
+        processStream(*compression, &PluginCompression::compressFileChunk, data, plain);
+    } else {
+        plain.insert(plain.end(), data.begin(), data.end());
+    }
+    std::vector<char> encrypted;
+    processStream(plugins.encryption, &PluginEncryption::encryptFileChunk, plain, encrypted);
+    GHULBUS_ASSERT(encrypted.size() >= g_inlineNonceSize);
+    ret.nonce.assign(encrypted.begin(), encrypted.begin() + g_inlineNonceSize);
+    ret.data.assign(encrypted.begin() + g_inlineNonceSize, encrypted.end());
+    return ret;
 }
 
-void ProcessingPipeline::retrieveFile(std::vector<StorageLocation> const& locations, Hash const& file_hash)
+void ProcessingPipeline::restoreInlineContent(BlimpDB::InlineContent const& content, Hash const& file_hash,
+                                              boost::filesystem::path const& to)
 {
+    Pipeline::InlinePlugins& plugins = m_pipeline->inlinePlugins();
+    std::vector<char> encrypted;
+    encrypted.reserve(content.nonce.size() + content.data.size());
+    encrypted.insert(encrypted.end(), content.nonce.begin(), content.nonce.end());
+    encrypted.insert(encrypted.end(), content.data.begin(), content.data.end());
+    // reopening the container discards any state left behind by the previous stream
+    plugins.encryption.newStorageContainer(g_inlineContainerId);
+    std::vector<char> decrypted;
+    processStream(plugins.encryption, &PluginEncryption::decryptFileChunk, encrypted, decrypted);
+    if (decrypted.size() < g_inlineNonceSize) {
+        GHULBUS_THROW(Ghulbus::Exceptions::IOError{} << Ghulbus::Exception_Info::filename(to.string()),
+                      "Inline content is corrupted");
+    }
+    std::span<char const> data = std::span<char const>(decrypted).subspan(g_inlineNonceSize);
+    std::vector<char> decompressed;
+    if (PluginCompression* compression = plugins.compressionPlugin(content.codec)) {
+        processStream(*compression, &PluginCompression::decompressFileChunk, data, decompressed);
+        data = decompressed;
+    }
+
+    FileHasher hasher(HashType::SHA_256);
+    hasher.addData(FileChunk::fromView(data.data(), data.size()));
+    if (hasher.getHash().digest != file_hash.digest) {
+        GHULBUS_THROW(Ghulbus::Exceptions::IOError{} << Ghulbus::Exception_Info::filename(to.string()),
+                      "Restored file does not match its hash");
+    }
+    if (to.has_parent_path()) { boost::filesystem::create_directories(to.parent_path()); }
+    std::ofstream fout(to.string(), std::ios_base::binary | std::ios_base::trunc);
+    fout.write(data.data(), data.size());
+    if (!fout) {
+        GHULBUS_THROW(Ghulbus::Exceptions::IOError{} << Ghulbus::Exception_Info::filename(to.string()),
+                      "Unable to write restored file");
+    }
+}
+
+void createRestoreDestination(boost::filesystem::path const& p)
+{
+    if (p.has_parent_path()) { boost::filesystem::create_directories(p.parent_path()); }
+    std::ofstream fout(p.string(), std::ios_base::binary | std::ios_base::trunc);
+    if (!fout) {
+        GHULBUS_THROW(Ghulbus::Exceptions::IOError{} << Ghulbus::Exception_Info::filename(p.string()),
+                      "Unable to create file for restoring");
+    }
 }
@@ -1,16 +1,24 @@
 #ifndef BLIMP_INCLUDE_GUARD_PROCESSING_PIPELINE_HPP
 #define BLIMP_INCLUDE_GUARD_PROCESSING_PIPELINE_HPP
 
+#include <compression_codec.hpp>
+#include <db/blimpdb.hpp>
+#include <file_info.hpp>
 #include <storage_container.hpp>
 
 #include <gbBase/Assert.hpp>
 
+#include <boost/filesystem/path.hpp>
+
 #include <memory>
+#include <span>
 #include <vector>
 
-class BlimpDB;
 class FileChunk;
+class FileHasher;
+class FileIO;
 struct Hash;
+class MemoryBudget;
 struct StorageLocation;
 
 class ProcessingPipeline {
@@ -20,6 +28,24 @@ public:
         Full
     };
 
+    /** A storage container that was finalized in the background, to be recorded in the database.
+     * A container is written as a sequence of blocks that can each be decompressed and decrypted on their own.
+     */
+    struct FinalizedContainer {
+        StorageContainer container;
+        std::vector<StorageBlock> blocks;
+    };
+
+    /** A part of a file, to be cut out of the decompressed contents of a storage container.
+     */
+    struct RestorePart {
+        std::int64_t offset;                    ///< offset of the part within the decompressed container
+        std::int64_t size;
+        boost::filesystem::path destination;
+        std::int64_t destination_offset;        ///< offset of the part within the destination file
+        FileHasher* hasher;                     ///< receives the data of the part, unless nullptr
+    };
+
     class [[nodiscard]] TransactionGuard {
         friend class ProcessingPipeline;
     private:
@@ -63,40 +89,177 @@ public:
         }
     };
 private:
+    enum class SpeculativeState {
+        None,           ///< the current transaction is not speculative
+        Staged,         ///< processed data of the current transaction is held back in memory
+        Streaming,      ///< the staging limit was exceeded; data goes to the container right away
+        Rewindable      ///< as Streaming, but the container is truncated to the start of the content on abort
+    };
+
     std::vector<StorageLocation> m_locations;
     std::int64_t m_startOffset;
     std::int64_t m_sizeCounter;
     std::int64_t m_partCounter;
+    std::int64_t m_blockStartOffset;
+    /// File of the current content and the codec it was routed to once its first chunk arrived
+    FileInfo m_contentFile;
+    bool m_contentRouted;
+    CompressionCodec m_contentCodec;
+    /// Whether data was passed into the current block; the codec of a block can only change while it has no data
+    bool m_blockHasData;
+    bool m_blockHadDataBeforeContent;
+    /// Whether data was passed into the compression stage since the compressed stream was last ended
+    bool m_compressionPending;
+    /// Whether committed contents continue the compressed stream of the current bundle
+    bool m_inBundle;
     bool m_currentContainerFull;
+    bool m_splitContents;
     StorageContainerId m_currentContainerId;
-    StorageContainerLocation m_lastContainerLocation;
+    SpeculativeState m_speculativeState;
+    /// Block of the container and stored size of the container where the data of a Rewindable transaction starts
+    std::size_t m_speculationBlockIndex;
+    std::int64_t m_speculationStoredSize;
 
     struct Pipeline;
     std::unique_ptr<Pipeline> m_pipeline;
 public:
-    explicit ProcessingPipeline(BlimpDB& blimpdb);
+    /** The budget must outlive the pipeline.
+     * @param[in] n_pipelines Number of pipelines sharing the budget, including this one.
+     */
+    ProcessingPipeline(BlimpDB& blimpdb, MemoryBudget& budget, std::size_t n_pipelines = 1);
 
     ~ProcessingPipeline();
 
     ProcessingPipeline(ProcessingPipeline const&) = delete;
     ProcessingPipeline& operator=(ProcessingPipeline const&) = delete;
 
+    /** Enables splitting a content across storage containers (enabled by default).
+     * With splitting enabled, a content transaction reports ContainerStatus::Full as soon as the container exceeds
+     * its size limit, and the content continues in the next container. With splitting disabled, a content always
+     * lands contiguously in one container; the container is only closed on commit, so it may exceed its size limit
+     * by the size of one content. Check isContainerFull() after committing.
+     */
+    void setContentSplitting(bool enabled);
+
+    /** Starts filling a new storage container.
+     * The previous container may still be finalized in the background meanwhile.
+     */
     void newStorageContainer(StorageContainerId const& container_id);
 
-    TransactionGuard startNewContentTransaction(Hash const& data_hash);
+    /** Starts a transaction for content whose hash is known.
+     * The compression codec for the content is chosen by routeContent() once the first chunk arrives. A content with
+     * a different codec than the data before it starts a new block of the container, so that each block can be
+     * restored with a single decoder. The codec is recorded in the storage locations of the content.
+     * @param[in] file The file the content is read from.
+     */
+    TransactionGuard startNewContentTransaction(Hash const& data_hash, FileInfo const& file);
+
+    /** Starts a transaction for content whose hash is not known yet.
+     * The processed data is held back in memory, so that aborting the transaction leaves no trace in the storage
+     * container. Once the held back data exceeds a size limit, it is written through to the container. If the
+     * encryption and storage plugins support it, the content then starts a block of its own and the container is
+     * truncated back to the start of that block on abort; the content is not split across containers in that case.
+     * Otherwise, aborting from then on leaves the data behind as unreferenced space in the container.
+     * As the held back data is only written on commit, committing may push the container over its size limit.
+     * Check isContainerFull() after committing.
+     * The codec is chosen as for startNewContentTransaction().
+     */
+    TransactionGuard startSpeculativeContentTransaction(FileInfo const& file);
 
     std::vector<StorageLocation> commitTransaction(TransactionGuard&& tg);
 
+    /** Starts a bundle of contents that are compressed as one solid stream.
+     * Committing a content of the bundle does not end the compressed stream, so small contents share the state of
+     * the compressor instead of paying for the framing of a stream each. Contents remain addressable by their offset
+     * within the decompressed container, as restoring decompresses whole blocks. The stream still ends where a block
+     * or the container ends, or where the codec changes.
+     * Contents of a bundle must be stored with startNewContentTransaction(), as the data of a speculative transaction
+     * cannot be dropped from the middle of a stream.
+     */
+    void beginBundle();
+
+    /** Ends the compressed stream of the current bundle.
+     */
+    void endBundle();
+
     void abortTransaction(TransactionGuard&& tg);
 
+    /** Finalizes the current container and waits until all containers were finalized.
+     * Logs the statistics of the pipeline stages and the adjustments made by the throughput tuner.
+     */
     void finish();
 
-    StorageContainerLocation getLastContainerLocation() const;
+    /** Applies the read queue depth that the throughput tuner picked for reading the data passed into the pipeline.
+     * The tuner adjusts the compression parameters and the read queue depth while data passes through the pipeline,
+     * so that the slowest part of the pipeline stays saturated. Must not be called while fio is reading a file.
+     */
+    void adjustReadQueueDepth(FileIO& fio);
+
+    bool isContainerFull() const;
 
-    void retrieveFile(std::vector<StorageLocation> const& locations, Hash const& file_hash);
+    /** Returns the containers that completed finalization since the last call, in the order they were filled.
+     * Full containers are finalized in the background while the next container is filled. A container must only be
+     * recorded as finalized in the database once it is returned from here. Errors during finalization are rethrown
+     * by the next call that passes data into the pipeline, or by finish().
+     */
+    std::vector<FinalizedContainer> takeFinalizedContainers();
+
+    /** Restores parts of files from a single storage container, reading the container exactly once.
+     * The container is passed through the decryption and decompression stages, which run concurrently like the
+     * stages of the backup path. Only the blocks of the container holding data of the parts are decrypted and
+     * decompressed, each with the codec recorded for the block. parts must be sorted by offset; several parts may
+     * refer to the same range of the container. The destination files must exist and are not truncated, so that parts
+     * of a file held by different containers can be restored by different pipelines concurrently.
+     * Must not be called while a storage container is open for writing. A pipeline that failed to restore a container
+     * cannot be used for restoring further containers.
+     * @param[in] blocks The block index of the container, as returned by BlimpDB::getStorageBlocks().
+     */
+    void restoreContainer(StorageContainer const& container, std::span<StorageBlock const> blocks,
+                          std::span<RestorePart const> parts);
+
+    /** Restores a file from the storage elements holding its parts to the path to.
+     * The block indices of the containers are read from the database.
+     * The restored file is verified against file_hash and removed again if verification fails.
+     */
+    void retrieveFile(std::span<BlimpDB::StorageElement const> storage_elements, Hash const& file_hash,
+                      boost::filesystem::path const& to);
+
+    /** Compresses and encrypts a content that is stored inline in the database instead of a storage container.
+     * All inline contents share the key of one storage container reserved for them. Each content is prefixed with a
+     * random block and encrypted as a stream of its own, so that it can be decrypted from its nonce and data alone.
+     * The codec is chosen by routeContent().
+     * Inline contents are processed on the calling thread by plugin instances apart from those of the stages, so this
+     * may be called while another thread stores contents through the pipeline. The encryption plugin records the shared
+     * key in the database on first use, so the calling thread must be the one accessing the database.
+     */
+    BlimpDB::InlineContent encodeInlineContent(BlimpDB::FileContentId const& content_id, FileInfo const& file,
+                                               std::span<char const> data);
+
+    /** Restores a content stored inline in the database to the path to, on the calling thread.
+     * The content is verified against file_hash before the file is written.
+     */
+    void restoreInlineContent(BlimpDB::InlineContent const& content, Hash const& file_hash,
+                              boost::filesystem::path const& to);
 
 private:
     ContainerStatus addFileChunk(FileChunk const& chunk);
+
+    void selectContentCodec(std::span<char const> first_chunk);
+
+    void finalizeCurrentContainer();
+
+    void startNewBlock(CompressionCodec codec);
+
+    void startNewBlockIfDue();
+
+    void releaseSpeculativeData();
+
+    void rewindSpeculativeData();
 };
 
+/** Creates an empty file at p to be filled by ProcessingPipeline::restoreContainer(), including missing parent
+ * directories. An existing file is truncated.
+ */
+void createRestoreDestination(boost::filesystem::path const& p);
+
 #endif
@@ -0,0 +1,98 @@
+#include <restore_plan.hpp>
+
+#include <exceptions.hpp>
+
+#include <gbBase/Assert.hpp>
+
+#include <algorithm>
+#include <tuple>
+#include <unordered_map>
+
+RestorePlan planSnapshotRestore(std::span<BlimpDB::FileElement const> files,
+                                std::span<BlimpDB::SnapshotStorageElement const> storage_elements,
+                                std::span<BlimpDB::SnapshotInlineContent const> inline_contents,
+                                boost::filesystem::path const& target_dir)
+{
+    using StorageElement = BlimpDB::SnapshotStorageElement;
+    GHULBUS_PRECONDITION(std::is_sorted(storage_elements.begin(), storage_elements.end(),
+        [](StorageElement const& lhs, StorageElement const& rhs) {
+            return std::tie(lhs.storage.location.container_id.i, lhs.storage.location.offset) <
+                   std::tie(rhs.storage.location.container_id.i, rhs.storage.location.offset);
+        }));
+    std::unordered_map<std::int64_t, std::size_t> inline_indices;
+    for (std::size_t i = 0; i < inline_contents.size(); ++i) {
+        inline_indices.emplace(inline_contents[i].file_id.i, i);
+    }
+    RestorePlan plan;
+    plan.files.reserve(files.size());
+    plan.inline_files.reserve(inline_contents.size());
+    // files with contents in storage containers, in the order of plan.files
+    std::vector<BlimpDB::FileElement const*> container_files;
+    container_files.reserve(files.size());
+    std::unordered_map<std::int64_t, std::size_t> file_indices;
+    for (auto const& f : files) {
+        boost::filesystem::path destination = target_dir / f.info.path.relative_path();
+        if (auto const it = inline_indices.find(f.id.i); it != inline_indices.end()) {
+            plan.inline_files.push_back(RestorePlan::InlineFile{ .destination = std::move(destination),
+                                                                 .content_index = it->second });
+            continue;
+        }
+        file_indices.emplace(f.id.i, plan.files.size());
+        container_files.push_back(&f);
+        plan.files.push_back(RestorePlan::File{ .destination = std::move(destination),
+                                                .hash = {},
+                                                .n_parts = 0,
+                                                .hasher = nullptr });
+    }
+
+    // parts of each file in storage element order, for determining their offsets in the destination file
+    std::vector<std::vector<std::size_t>> file_parts(container_files.size());
+    for (std::size_t i = 0; i < storage_elements.size(); ++i) {
+        auto const it = file_indices.find(storage_elements[i].file_id.i);
+        if (it == file_indices.end()) {
+            GHULBUS_THROW(Exceptions::DatabaseError{}, "Storage element refers to a file outside of the snapshot");
+        }
+        file_parts[it->second].push_back(i);
+    }
+    std::vector<std::int64_t> destination_offsets(storage_elements.size());
+    for (std::size_t i = 0; i < container_files.size(); ++i) {
+        auto const& file_info = container_files[i]->info;
+        auto& parts = file_parts[i];
+        if (parts.empty()) {
+            GHULBUS_THROW(Exceptions::DatabaseError{} << Ghulbus::Exception_Info::filename(file_info.path.string()),
+                          "File has no storage elements");
+        }
+        std::sort(parts.begin(), parts.end(), [storage_elements](std::size_t lhs, std::size_t rhs) {
+            return storage_elements[lhs].storage.location.part_number <
+                   storage_elements[rhs].storage.location.part_number;
+        });
+        std::int64_t offset = 0;
+        for (std::size_t const p : parts) {
+            destination_offsets[p] = offset;
+            offset += storage_elements[p].storage.location.size;
+        }
+        if (offset != static_cast<std::int64_t>(file_info.size)) {
+            GHULBUS_THROW(Exceptions::DatabaseError{} << Ghulbus::Exception_Info::filename(file_info.path.string()),
+                          "Storage elements do not match the size of the file");
+        }
+        RestorePlan::File& f = plan.files[i];
+        f.hash = storage_elements[parts.front()].content_hash;
+        f.n_parts = parts.size();
+        if (f.n_parts == 1) { f.hasher = std::make_unique<FileHasher>(HashType::SHA_256); }
+    }
+
+    for (std::size_t i = 0; i < storage_elements.size(); ++i) {
+        auto const& se = storage_elements[i];
+        if (plan.containers.empty() || (plan.containers.back().container.id.i != se.storage.container.id.i)) {
+            plan.containers.push_back(RestorePlan::Container{ .container = se.storage.container, .parts = {}, .blocks = {} });
+        }
+        RestorePlan::File const& f = plan.files[file_indices.at(se.file_id.i)];
+        plan.containers.back().parts.push_back(ProcessingPipeline::RestorePart{
+            .offset = se.storage.location.offset,
+            .size = se.storage.location.size,
+            .destination = f.destination,
+            .destination_offset = destination_offsets[i],
+            .hasher = f.hasher.get() });
+    }
+    return plan;
+}
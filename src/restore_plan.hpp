@@ -0,0 +1,58 @@
+#ifndef BLIMP_INCLUDE_GUARD_RESTORE_PLAN_HPP
+#define BLIMP_INCLUDE_GUARD_RESTORE_PLAN_HPP
+
+#include <db/blimpdb.hpp>
+#include <file_hash.hpp>
+#include <processing_pipeline.hpp>
+#include <storage_container.hpp>
+
+#include <boost/filesystem/path.hpp>
+
+#include <cstdint>
+#include <memory>
+#include <span>
+#include <vector>
+
+struct RestorePlan {
+    struct File {
+        boost::filesystem::path destination;
+        Hash hash;
+        std::size_t n_parts;
+        /// Files in a single part are hashed while they are restored; files spanning several containers are
+        /// restored out of order and have to be read back for verification instead.
+        std::unique_ptr<FileHasher> hasher;
+    };
+    /// A file whose content is stored inline in the database, to be restored without any container
+    struct InlineFile {
+        boost::filesystem::path destination;
+        std::size_t content_index;      ///< index of the content within the inline contents of the snapshot
+    };
+    struct Container {
+        StorageContainer container;
+        std::vector<ProcessingPipeline::RestorePart> parts;     ///< sorted by offset
+        std::vector<StorageBlock> blocks;                       ///< left to the caller, see BlimpDB::getStorageBlocks()
+    };
+    std::vector<File> files;
+    std::vector<InlineFile> inline_files;
+    std::vector<Container> containers;                          ///< sorted by container id
+};
+
+/** Plans the restore of a snapshot such that each storage container is read exactly once, from front to back.
+ * The storage elements of all files are grouped by container. Each file is assigned the parts it has in each of the
+ * containers, at the offset in the destination file that follows from the sizes of its preceding parts.
+ * @param[in] files The files of the snapshot, as returned by BlimpDB::getFileElementsForSnapshot().
+ * @param[in] storage_elements The storage elements of the files, sorted by container and offset, as returned by
+ *                             BlimpDB::getStorageElementsForSnapshot().
+ * @param[in] inline_contents The contents of the files that are stored inline in the database, as returned by
+ *                            BlimpDB::getInlineContentsForSnapshot(). These files are planned as inline files
+ *                            instead and have no storage elements.
+ * @param[in] target_dir Each file is restored to its original path relative to this directory.
+ * @return The restore plan. The parts refer to the hashers of the files in the plan.
+ * @throw Exceptions::DatabaseError If the storage elements of a file are missing or do not add up to its size.
+ */
+RestorePlan planSnapshotRestore(std::span<BlimpDB::FileElement const> files,
+                                std::span<BlimpDB::SnapshotStorageElement const> storage_elements,
+                                std::span<BlimpDB::SnapshotInlineContent const> inline_contents,
+                                boost::filesystem::path const& target_dir);
+
+#endif
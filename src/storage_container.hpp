@@ -1,6 +1,8 @@
 #ifndef BLIMP_INCLUDE_GUARD_STORAGE_CONTAINER_HPP
 #define BLIMP_INCLUDE_GUARD_STORAGE_CONTAINER_HPP
 
+#include <compression_codec.hpp>
+
 #include <cstdint>
 #include <string>
 
@@ -17,4 +19,14 @@ struct StorageContainer {
     StorageContainerLocation location;
 };
 
+/** A block of a storage container that can be decompressed and decrypted independently of the preceding blocks.
+ * A block extends to the start of the next block of the container, or to the end of the container.
+ * All data in a block is compressed with the same codec.
+ */
+struct StorageBlock {
+    int64_t offset;             ///< offset of the block within the decompressed container
+    int64_t stored_offset;      ///< offset of the block within the container as stored
+    CompressionCodec codec;
+};
+
 #endif
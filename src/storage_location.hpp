@@ -1,6 +1,7 @@
 #ifndef BLIMP_INCLUDE_GUARD_STORAGE_LOCATION_HPP
 #define BLIMP_INCLUDE_GUARD_STORAGE_LOCATION_HPP
 
+#include <compression_codec.hpp>
 #include <storage_container.hpp>
 
 #include <cstdint>
@@ -11,6 +12,7 @@ struct StorageLocation {
     std::int64_t offset;
     std::int64_t size;
     std::int64_t part_number;
+    CompressionCodec codec;     ///< codec the content was compressed with
 };
 
 #endif
@@ -37,6 +37,18 @@ std::vector<FileInfo> FileDiffModel::getCheckedFiles() const
     return ret;
 }
 
+std::vector<FileIndexDiff::ElementDiff> FileDiffModel::getCheckedFileDiffs() const
+{
+    std::vector<FileIndexDiff::ElementDiff> ret;
+    ret.reserve(std::count(begin(m_entry_checked), end(m_entry_checked), true));
+    for(std::size_t i = 0; i < m_file_index_diff.index_files.size(); ++i) {
+        if(m_entry_checked[i]) {
+            ret.push_back(m_file_index_diff.index_files[i]);
+        }
+    }
+    return ret;
+}
+
 Qt::ItemFlags FileDiffModel::flags(QModelIndex const& index) const
 {
     GHULBUS_ASSERT(index.isValid());
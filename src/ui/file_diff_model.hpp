@@ -21,6 +21,7 @@ public:
 
     void setFileIndexData(std::vector<FileInfo> const& file_index, FileIndexDiff const& file_index_diff);
     std::vector<FileInfo> getCheckedFiles() const;
+    std::vector<FileIndexDiff::ElementDiff> getCheckedFileDiffs() const;
 
     /** @name Implementation of QAbstractItemModel
      * @{
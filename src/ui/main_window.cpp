@@ -97,16 +97,20 @@ struct MainWindow::Pimpl
         QBoxLayout* layout;
         SnapshotBrowser* snapshotBrowser;
         QPushButton* buttonCreateNewSnapshot;
+        QPushButton* buttonRestoreSnapshot;
 
         SnapshotBrowserPage(QWidget* parent)
             :widget(new QWidget(parent)),
              layout(new QBoxLayout(QBoxLayout::Direction::TopToBottom, widget)),
              snapshotBrowser(new SnapshotBrowser(widget)),
-             buttonCreateNewSnapshot(new QPushButton(widget))
+             buttonCreateNewSnapshot(new QPushButton(widget)),
+             buttonRestoreSnapshot(new QPushButton(widget))
         {
             layout->addWidget(snapshotBrowser);
             buttonCreateNewSnapshot->setText("New Snapshot");
             layout->addWidget(buttonCreateNewSnapshot);
+            buttonRestoreSnapshot->setText("Restore Snapshot");
+            layout->addWidget(buttonRestoreSnapshot);
         }
     } snapshotBrowserPage;
 
@@ -220,6 +224,7 @@ struct MainWindow::Pimpl
         QPushButton* buttonCreateSnapshot;
         QPushButton* buttonCancel;
         std::vector<FileInfo> checked_files;
+        std::vector<FileIndexDiff::ElementDiff> checked_file_diffs;
 
         CreateSnapshotPage(MainWindow* parent)
             :widget(new QWidget(parent)),
@@ -232,7 +237,7 @@ struct MainWindow::Pimpl
             layout->addRow("Snapshot Name: ", editSnapshotName);
             checkboxForceChecksum->setText("Recompute checksums even for unchanged files");
             checkboxForceChecksum->setChecked(false);
-            checkboxForceChecksum->setEnabled(false);
+            checkboxForceChecksum->setEnabled(true);
             layout->addWidget(checkboxForceChecksum);
             buttonCreateSnapshot->setText("Create Snapshot");
             layout->addWidget(buttonCreateSnapshot);
@@ -285,6 +290,8 @@ MainWindow::MainWindow()
     // snapshot browser page
     connect(m_pimpl->snapshotBrowserPage.buttonCreateNewSnapshot, &QPushButton::clicked,
             this, &MainWindow::onNewSnapshot);
+    connect(m_pimpl->snapshotBrowserPage.buttonRestoreSnapshot, &QPushButton::clicked,
+            this, &MainWindow::onRestoreSnapshot);
     m_pimpl->central->addWidget(m_pimpl->snapshotBrowserPage.widget);
 
     // scan select page
@@ -434,6 +441,36 @@ void MainWindow::onNewSnapshot()
     m_pimpl->central->setCurrentWidget(m_pimpl->scanSelectPage.widget);
 }
 
+void MainWindow::onRestoreSnapshot()
+{
+    GHULBUS_ASSERT(m_pimpl->blimpdb);
+    auto const snapshot_id = m_pimpl->snapshotBrowserPage.snapshotBrowser->getSelectedSnapshot();
+    if (!snapshot_id) {
+        return;
+    }
+    auto const qt_target_dir = QFileDialog::getExistingDirectory(this, tr("Restore Snapshot To"));
+    if (qt_target_dir.isEmpty()) {
+        return;
+    }
+    auto const target_dir = boost::filesystem::path(std::string(qt_target_dir.toUtf8().constData()));
+    statusBar()->show();
+    statusBar()->showMessage(tr("Restoring snapshot..."));
+    try {
+        m_pimpl->fileProcessor.restoreSnapshot(*m_pimpl->blimpdb, *snapshot_id, target_dir);
+    } catch(std::exception& e) {
+        statusBar()->clearMessage();
+        QMessageBox msgBox;
+        msgBox.setText(tr("Error while restoring snapshot to ") + qt_target_dir + ".");
+        msgBox.setStandardButtons(QMessageBox::Ok);
+        msgBox.setInformativeText(tr("Files that were restored until the error remain in place."));
+        msgBox.setDetailedText(tr("The reported error was:\n%1").arg(e.what()));
+        msgBox.setIcon(QMessageBox::Critical);
+        msgBox.exec();
+        return;
+    }
+    statusBar()->showMessage(tr("Snapshot restored to %1.").arg(qt_target_dir), 5000);
+}
+
 void MainWindow::onStartFileScan()
 {
     GHULBUS_ASSERT(m_pimpl->blimpdb);
@@ -519,6 +556,7 @@ void MainWindow::onFileScanDiffCompleted()
 void MainWindow::onFileDiffApprove()
 {
     m_pimpl->createSnapshotPage.checked_files = m_pimpl->fileDiffPage.diffmodel->getCheckedFiles();
+    m_pimpl->createSnapshotPage.checked_file_diffs = m_pimpl->fileDiffPage.diffmodel->getCheckedFileDiffs();
 
     auto const snapshots = m_pimpl->blimpdb->getSnapshots();
     m_pimpl->createSnapshotPage.editSnapshotName->setText(QString("Snapshot #%1").arg(snapshots.size()));
@@ -547,14 +585,18 @@ void MainWindow::onCreateSnapshotRequest()
     m_pimpl->progressPage.buttonCancel->setEnabled(true);
     m_pimpl->central->setCurrentWidget(m_pimpl->progressPage.widget);
     BlimpDB::SnapshotId const snapshot_id = m_pimpl->blimpdb->addSnapshot(snapshot_name.toStdString());
+    m_pimpl->fileProcessor.setUnchangedVerificationFraction(
+        m_pimpl->createSnapshotPage.checkboxForceChecksum->isChecked() ? 1.0 : 0.0);
     m_pimpl->fileProcessor.startProcessing(snapshot_id,
                                            std::move(m_pimpl->createSnapshotPage.checked_files),
+                                           std::move(m_pimpl->createSnapshotPage.checked_file_diffs),
                                            std::move(m_pimpl->blimpdb));
 }
 
 void MainWindow::onCreateSnapshotCancel()
 {
     m_pimpl->createSnapshotPage.checked_files.clear();
+    m_pimpl->createSnapshotPage.checked_file_diffs.clear();
     m_pimpl->blimpdb.reset();
     m_pimpl->central->setCurrentWidget(m_pimpl->welcomePage.widget);
 }
@@ -620,11 +662,16 @@ void MainWindow::onFileScanChecksumCompleted()
 void MainWindow::onFileRetrievalRequested(FileElementId file_id)
 {
     auto const storage_infos = m_pimpl->blimpdb->getFileStorageInfo(file_id);
+    auto const inline_content = m_pimpl->blimpdb->getFileInlineContent(file_id);
     auto const file_hash = m_pimpl->blimpdb->getFileHash(file_id);
     auto const file_info = m_pimpl->blimpdb->getFileInfo(file_id);
-    if ((!file_hash) || (!file_info) || (storage_infos.empty())) {
+    if ((!file_hash) || (!file_info) || (storage_infos.empty() && (!inline_content))) {
         GHULBUS_THROW(Exceptions::DatabaseError{}, "File not in database");
     }
-    m_pimpl->fileProcessor.retrieveFile(boost::filesystem::path{"blimp_out_dir"} / file_info->path.filename(),
-                                        *file_info, *file_hash, storage_infos);
+    auto const destination = boost::filesystem::path{"blimp_out_dir"} / file_info->path.filename();
+    if (inline_content) {
+        m_pimpl->fileProcessor.retrieveInlineFile(*m_pimpl->blimpdb, destination, *file_hash, *inline_content);
+    } else {
+        m_pimpl->fileProcessor.retrieveFile(*m_pimpl->blimpdb, destination, *file_info, *file_hash, storage_infos);
+    }
 }
@@ -28,6 +28,7 @@ public slots:
     void onNewDatabase();
     void onOpenDatabase();
     void onNewSnapshot();
+    void onRestoreSnapshot();
     void onStartFileScan();
     void onCancelFileScan();
     void onFileScanIndexingUpdate(std::uint64_t n_files);
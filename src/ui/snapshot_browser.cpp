@@ -33,6 +33,7 @@ void SnapshotBrowser::setData(BlimpDB& blimpdb)
 {
     auto const snapshots = blimpdb.getSnapshots();
     m_comboSnapshotList->clear();
+    m_snapshotIds.clear();
 
     int count = 0;
     int const n_digits = getNumberOfDigits(snapshots.size());
@@ -40,6 +41,7 @@ void SnapshotBrowser::setData(BlimpDB& blimpdb)
         m_comboSnapshotList->addItem(QString("#%1 - %2")
                                      .arg(count, n_digits, 10, QChar('0'))
                                      .arg(QString::fromStdString(s.name)));
+        m_snapshotIds.push_back(s.id);
         ++count;
     }
 
@@ -49,6 +51,13 @@ void SnapshotBrowser::setData(BlimpDB& blimpdb)
     m_model->finalize();
 }
 
+std::optional<BlimpDB::SnapshotId> SnapshotBrowser::getSelectedSnapshot() const
+{
+    int const index = m_comboSnapshotList->currentIndex();
+    if ((index < 0) || (static_cast<std::size_t>(index) >= m_snapshotIds.size())) { return std::nullopt; }
+    return m_snapshotIds[index];
+}
+
 void SnapshotBrowser::onItemDoubleClicked(QModelIndex const& idx)
 {
     auto const* item = static_cast<SnapshotContentsModel::SnapshotContentItem*>(idx.internalPointer());
@@ -1,11 +1,14 @@
 #ifndef BLIMP_INCLUDE_GUARD_UI_SNAPSHOT_BROWSER_HPP
 #define BLIMP_INCLUDE_GUARD_UI_SNAPSHOT_BROWSER_HPP
 
+#include <db/blimpdb.hpp>
 #include <db/file_element_id.hpp>
 
 #include <QWidget>
 
-class BlimpDB;
+#include <optional>
+#include <vector>
+
 class SnapshotContentsModel;
 
 class QBoxLayout;
@@ -19,11 +22,16 @@ private:
     QComboBox* m_comboSnapshotList;
     SnapshotContentsModel* m_model;
     QTreeView* m_treeView;
+    std::vector<BlimpDB::SnapshotId> m_snapshotIds;
 public:
     SnapshotBrowser(QWidget* parent);
 
     void setData(BlimpDB& blimpdb);
 
+    /** Returns the snapshot selected in the snapshot list; nullopt if the database holds no snapshots.
+     */
+    std::optional<BlimpDB::SnapshotId> getSelectedSnapshot() const;
+
 signals:
     void fileRetrievalRequest(FileElementId);
 private slots:
@@ -4,7 +4,7 @@
 struct BlimpVersion
 {
     static inline constexpr int major() { return 1; }
-    static inline constexpr int minor() { return 0; }
+    static inline constexpr int minor() { return 1; }
     static inline constexpr int patch() { return 0; }
     static inline constexpr int version() { return major() * 10000 + minor() * 100 + patch(); }
 };
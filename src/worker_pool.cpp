@@ -3,6 +3,7 @@
 #include <gbBase/Log.hpp>
 
 #include <latch>
+#include <memory>
 
 WorkerPool::WorkerPool(std::size_t n_threads)
     :m_done(false)
@@ -34,14 +35,15 @@ void WorkerPool::schedule(Ghulbus::AnyInvocable<void()> task)
 void WorkerPool::cancelAndFlush()
 {
     std::size_t const n_threads = m_threads.size();
-    std::latch sync(n_threads);
+    // workers may still be on their way out of arrive_and_wait() when wait() returns here, so they share ownership
+    auto const sync = std::make_shared<std::latch>(n_threads);
     {
         std::lock_guard<std::mutex> lk(m_mtx);
         m_tasks.clear();
-        for (std::size_t i = 0; i < n_threads; ++i) { m_tasks.emplace_back([&sync]() { sync.arrive_and_wait(); }); }
+        for (std::size_t i = 0; i < n_threads; ++i) { m_tasks.emplace_back([sync]() { sync->arrive_and_wait(); }); }
     }
     m_cv.notify_all();
-    sync.wait();
+    sync->wait();
 }
 
 void WorkerPool::work()
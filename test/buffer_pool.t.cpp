@@ -0,0 +1,107 @@
+#include <buffer_pool.hpp>
+
+#include <catch.hpp>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <set>
+#include <thread>
+#include <vector>
+
+TEST_CASE("BufferPool")
+{
+    SECTION("Buffers are distinct and lie within the pool")
+    {
+        struct TestCase {
+            std::size_t buffer_size;
+            std::size_t n_buffers;
+        };
+        std::vector<TestCase> const test_cases{
+            { 1, 1 },
+            { 16, 1 },
+            { 1, 16 },
+            { 4096, 7 },
+            { 1 << 20, 4 },
+        };
+        for (auto const& tc : test_cases) {
+            INFO(tc.n_buffers << " buffers of " << tc.buffer_size << " bytes");
+            BufferPool pool(tc.buffer_size, tc.n_buffers);
+            CHECK(pool.getBufferSize() == tc.buffer_size);
+            CHECK(pool.getBufferCount() == tc.n_buffers);
+            std::vector<BlimpBuffer> buffers;
+            for (std::size_t i = 0; i < tc.n_buffers; ++i) {
+                buffers.push_back(pool.acquire());
+                REQUIRE(buffers.back().data != nullptr);
+                CHECK(buffers.back().capacity == static_cast<std::int64_t>(tc.buffer_size));
+                // a token of 0 denotes plugin memory
+                CHECK(buffers.back().token > 0);
+                CHECK(pool.getBuffersInUse() == i + 1);
+            }
+            std::sort(buffers.begin(), buffers.end(),
+                      [](BlimpBuffer const& lhs, BlimpBuffer const& rhs) { return lhs.data < rhs.data; });
+            for (std::size_t i = 1; i < buffers.size(); ++i) {
+                CHECK(buffers[i - 1].data + tc.buffer_size <= buffers[i].data);
+                CHECK(buffers[i - 1].token != buffers[i].token);
+            }
+            CHECK(buffers.back().data + tc.buffer_size <= buffers.front().data + tc.buffer_size * tc.n_buffers);
+            for (auto const& b : buffers) { pool.release(b.token); }
+            CHECK(pool.getBuffersInUse() == 0);
+            CHECK(pool.getPeakBuffersInUse() == tc.n_buffers);
+        }
+    }
+
+    SECTION("Acquire does not block on an exhausted pool")
+    {
+        BufferPool pool(64, 2);
+        BlimpBuffer const b1 = pool.acquire();
+        BlimpBuffer const b2 = pool.acquire();
+        BlimpBuffer const exhausted = pool.acquire();
+        CHECK(exhausted.data == nullptr);
+        CHECK(exhausted.capacity == 0);
+        CHECK(exhausted.token == 0);
+        pool.release(b1.token);
+        BlimpBuffer const b3 = pool.acquire();
+        CHECK(b3.data == b1.data);
+        CHECK(b3.token == b1.token);
+        CHECK(pool.getPeakBuffersInUse() == 2);
+        pool.release(b2.token);
+        pool.release(b3.token);
+    }
+
+    SECTION("Plugin interface")
+    {
+        BufferPool pool(64, 2);
+        BlimpBufferPool const plugin_pool = pool.getPluginBufferPool();
+        BlimpBuffer const b = plugin_pool.acquire(plugin_pool.state);
+        REQUIRE(b.data != nullptr);
+        CHECK(pool.getBuffersInUse() == 1);
+        plugin_pool.release(plugin_pool.state, b.token);
+        CHECK(pool.getBuffersInUse() == 0);
+    }
+
+    SECTION("Concurrent use")
+    {
+        // plugins acquire buffers on their stage threads, while downstream stages release them
+        std::size_t const n_buffers = 4;
+        BufferPool pool(8, n_buffers);
+        std::vector<std::thread> threads;
+        std::vector<std::size_t> acquired_counts(4, 0);
+        for (std::size_t t = 0; t < acquired_counts.size(); ++t) {
+            threads.emplace_back([&pool, &count = acquired_counts[t], t]() {
+                for (int i = 0; i < 10000; ++i) {
+                    BlimpBuffer const b = pool.acquire();
+                    if (!b.data) { continue; }
+                    ++count;
+                    // writing to the buffer exposes buffers handed out twice to the thread sanitizer
+                    std::fill(b.data, b.data + b.capacity, static_cast<char>(t));
+                    pool.release(b.token);
+                }
+            });
+        }
+        for (auto& t : threads) { t.join(); }
+        CHECK(pool.getBuffersInUse() == 0);
+        CHECK(pool.getPeakBuffersInUse() <= n_buffers);
+        for (std::size_t const count : acquired_counts) { CHECK(count > 0); }
+    }
+}
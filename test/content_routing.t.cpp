@@ -0,0 +1,120 @@
+#include <content_routing.hpp>
+
+#include <catch.hpp>
+
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace {
+using namespace std::string_view_literals;
+
+CompressionCodec route(std::string const& filename, std::string_view first_chunk)
+{
+    return routeContent(FileInfo{ .path = filename, .size = first_chunk.size(), .modified_time = {} },
+                        std::span<char const>(first_chunk.data(), first_chunk.size()));
+}
+
+struct TestCase {
+    std::string filename;
+    std::string_view first_chunk;
+    CompressionCodec expected;
+};
+}
+
+TEST_CASE("routeContent()")
+{
+    SECTION("Magic bytes")
+    {
+        std::vector<TestCase> const test_cases{
+            { "image",   "\xFF\xD8\xFF\xE0\x00\x10JFIF"sv,              CompressionCodec::None },
+            { "image",   "\x89PNG\r\n\x1A\n\x00\x00\x00\x0DIHDR"sv,     CompressionCodec::None },
+            { "image",   "GIF89a"sv,                                    CompressionCodec::None },
+            { "image",   "RIFF\x24\x00\x00\x00WEBPVP8 "sv,              CompressionCodec::None },
+            { "video",   "RIFF\x24\x00\x00\x00" "AVI LIST"sv,           CompressionCodec::None },
+            { "video",   "\x00\x00\x00\x20" "ftypisom"sv,               CompressionCodec::None },
+            { "video",   "\x1A\x45\xDF\xA3\x9F"sv,                      CompressionCodec::None },
+            { "audio",   "OggS\x00\x02"sv,                              CompressionCodec::None },
+            { "audio",   "fLaC\x00\x00\x00\x22"sv,                      CompressionCodec::None },
+            { "audio",   "ID3\x04\x00"sv,                               CompressionCodec::None },
+            { "archive", "PK\x03\x04\x14\x00"sv,                        CompressionCodec::None },
+            { "archive", "\x1F\x8B\x08\x00"sv,                          CompressionCodec::None },
+            { "archive", "BZh91AY&SY"sv,                                CompressionCodec::None },
+            { "archive", "\xFD" "7zXZ\x00\x00"sv,                       CompressionCodec::None },
+            { "archive", "7z\xBC\xAF\x27\x1C\x00\x04"sv,                CompressionCodec::None },
+            { "archive", "Rar!\x1A\x07\x01\x00"sv,                      CompressionCodec::None },
+            { "archive", "\x28\xB5\x2F\xFD\x24"sv,                      CompressionCodec::None },
+            { "archive", "\x04\x22\x4D\x18\x64"sv,                      CompressionCodec::None },
+            // magic bytes take precedence over the extension
+            { "notes.txt", "PK\x03\x04"sv,                              CompressionCodec::None },
+            { "debug.log", "\x1F\x8B\x08\x00"sv,                        CompressionCodec::None },
+            // magic bytes only match at their offset
+            { "data",    "xPK\x03\x04"sv,                               CompressionCodec::Zlib },
+            { "data",    "ftyp\x00\x00\x00\x00"sv,                      CompressionCodec::Zlib },
+            { "data",    "WEBP"sv,                                      CompressionCodec::Zlib },
+        };
+        for (auto const& tc : test_cases) {
+            INFO(tc.filename << " starting with " << std::string(tc.first_chunk));
+            CHECK(route(tc.filename, tc.first_chunk) == tc.expected);
+        }
+    }
+
+    SECTION("Content shorter than the magic bytes")
+    {
+        std::vector<TestCase> const test_cases{
+            { "data",    ""sv,                                          CompressionCodec::Zlib },
+            { "data",    "\x89PNG"sv,                                   CompressionCodec::Zlib },
+            { "data",    "RIFF\x24\x00\x00\x00WEB"sv,                   CompressionCodec::Zlib },
+            { "data",    "\x1F"sv,                                      CompressionCodec::Zlib },
+            { "data",    "\x1F\x8B"sv,                                  CompressionCodec::None },
+        };
+        for (auto const& tc : test_cases) {
+            INFO(tc.filename << " of size " << tc.first_chunk.size());
+            CHECK(route(tc.filename, tc.first_chunk) == tc.expected);
+        }
+    }
+
+    SECTION("File extensions")
+    {
+        std::vector<TestCase> const test_cases{
+            { "photo.jpg",          "text"sv,   CompressionCodec::None },
+            { "photo.JPEG",         "text"sv,   CompressionCodec::None },
+            { "clip.Mp4",           "text"sv,   CompressionCodec::None },
+            { "backup.tar.gz",      "text"sv,   CompressionCodec::None },
+            { "report.docx",        "text"sv,   CompressionCodec::None },
+            { "dir.zip/main.cpp",   "text"sv,   CompressionCodec::Zlib },
+            { "main.cpp",           "text"sv,   CompressionCodec::Zlib },
+            { "README",             "text"sv,   CompressionCodec::Zlib },
+            { "archive.gz.txt",     "text"sv,   CompressionCodec::Zlib },
+            { "server.log",         "text"sv,   CompressionCodec::Lz4 },
+            { "SERVER.LOG",         "text"sv,   CompressionCodec::Lz4 },
+            { "logs/app.log",       "text"sv,   CompressionCodec::Lz4 },
+            { "vm/disk.vmdk",       "text"sv,   CompressionCodec::Zstd },
+            { "Ubuntu.VDI",         "text"sv,   CompressionCodec::Zstd },
+            { "guest.qcow2",        "text"sv,   CompressionCodec::Zstd },
+            { "image.img.gz",       "text"sv,   CompressionCodec::None },
+        };
+        for (auto const& tc : test_cases) {
+            INFO(tc.filename);
+            CHECK(route(tc.filename, tc.first_chunk) == tc.expected);
+        }
+    }
+
+    SECTION("Rotated log files")
+    {
+        std::vector<TestCase> const test_cases{
+            { "syslog.log.1",       "text"sv,   CompressionCodec::Lz4 },
+            { "syslog.log.12",      "text"sv,   CompressionCodec::Lz4 },
+            { "syslog.Log.3",       "text"sv,   CompressionCodec::Lz4 },
+            { "syslog.log.",        "text"sv,   CompressionCodec::Zlib },
+            { "syslog.log.1a",      "text"sv,   CompressionCodec::Zlib },
+            { "syslog.log.gz",      "text"sv,   CompressionCodec::None },
+            { "syslog.txt.1",       "text"sv,   CompressionCodec::Zlib },
+            { "version.1",          "text"sv,   CompressionCodec::Zlib },
+        };
+        for (auto const& tc : test_cases) {
+            INFO(tc.filename);
+            CHECK(route(tc.filename, tc.first_chunk) == tc.expected);
+        }
+    }
+}
@@ -0,0 +1,125 @@
+#include <file_bundling.hpp>
+
+#include <catch.hpp>
+
+#include <cstdint>
+#include <map>
+#include <vector>
+
+namespace {
+std::vector<FileInfo> filesOfSizes(std::vector<std::uint64_t> const& sizes)
+{
+    std::vector<FileInfo> ret;
+    for (std::size_t i = 0; i < sizes.size(); ++i) {
+        ret.push_back(FileInfo{ .path = "file" + std::to_string(i), .size = sizes[i], .modified_time = {} });
+    }
+    return ret;
+}
+
+/** Checks the guarantees documented for bundleFiles() and returns the total size of each bundle.
+ */
+std::map<std::uint32_t, std::uint64_t> checkBundles(std::vector<FileInfo> const& files,
+                                                    std::vector<FileBundleInfo> const& bundles,
+                                                    std::uint64_t min_unbundled_size)
+{
+    REQUIRE(bundles.size() == files.size());
+    std::map<std::uint32_t, std::uint64_t> bundle_sizes;
+    std::uint64_t total_small_size = 0;
+    std::uint32_t last_id = 0;
+    for (std::size_t i = 0; i < files.size(); ++i) {
+        if (files[i].size >= min_unbundled_size) {
+            CHECK(bundles[i].bundle_id == 0);
+            continue;
+        }
+        CHECK(bundles[i].bundle_id >= 1);
+        CHECK(bundles[i].bundle_id >= last_id);
+        last_id = bundles[i].bundle_id;
+        bundle_sizes[bundles[i].bundle_id] += files[i].size;
+        total_small_size += files[i].size;
+    }
+    std::uint32_t expected_id = 1;
+    for (auto const& [id, size] : bundle_sizes) {
+        CHECK(id == expected_id++);
+        if (total_small_size > min_unbundled_size) { CHECK(size > min_unbundled_size); }
+        CHECK(size <= 3 * min_unbundled_size);
+    }
+    return bundle_sizes;
+}
+}
+
+TEST_CASE("bundleFiles()")
+{
+    SECTION("Empty file list")
+    {
+        CHECK(bundleFiles({}, 100).empty());
+    }
+
+    SECTION("Small files that do not exceed the minimum size form a single bundle")
+    {
+        auto const files = filesOfSizes({ 10, 20, 30, 40 });
+        auto const bundles = bundleFiles(files, 100);
+        auto const bundle_sizes = checkBundles(files, bundles, 100);
+        REQUIRE(bundle_sizes.size() == 1);
+        CHECK(bundle_sizes.at(1) == 100);
+    }
+
+    SECTION("Files of at least the minimum size remain unbundled")
+    {
+        auto const files = filesOfSizes({ 100, 101, 5000 });
+        auto const bundles = bundleFiles(files, 100);
+        CHECK(checkBundles(files, bundles, 100).empty());
+    }
+
+    SECTION("Multiple splits")
+    {
+        struct TestCase {
+            std::vector<std::uint64_t> sizes;
+            std::uint64_t min_unbundled_size;
+            std::size_t expected_bundles;
+        };
+        std::vector<TestCase> const test_cases{
+            { std::vector<std::uint64_t>(100, 1), 10, 8 },
+            { std::vector<std::uint64_t>(40, 10), 25, 12 },
+            { { 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9 }, 10, 6 },
+            { { 1, 2, 3, 4, 5, 6, 7, 8, 9, 9, 8, 7, 6, 5, 4, 3, 2, 1 }, 10, 5 },
+        };
+        for (auto const& tc : test_cases) {
+            auto const files = filesOfSizes(tc.sizes);
+            auto const bundles = bundleFiles(files, tc.min_unbundled_size);
+            auto const bundle_sizes = checkBundles(files, bundles, tc.min_unbundled_size);
+            CHECK(bundle_sizes.size() == tc.expected_bundles);
+        }
+    }
+
+    SECTION("Every bundle ends above the minimum size")
+    {
+        std::uint64_t const min_unbundled_size = 1000;
+        std::vector<std::uint64_t> sizes;
+        std::uint64_t x = 42;
+        for (int i = 0; i < 1000; ++i) {
+            x = x * 6364136223846793005ull + 1442695040888963407ull;
+            sizes.push_back((x >> 33) % min_unbundled_size);
+        }
+        auto const files = filesOfSizes(sizes);
+        auto const bundles = bundleFiles(files, min_unbundled_size);
+        auto const bundle_sizes = checkBundles(files, bundles, min_unbundled_size);
+        CHECK(bundle_sizes.size() > 1);
+        for (auto const& [id, size] : bundle_sizes) {
+            CHECK(size > min_unbundled_size);
+        }
+    }
+
+    SECTION("Large files interleaved with small files")
+    {
+        auto const files = filesOfSizes({ 6, 500, 6, 6, 100, 6, 6, 7000, 6, 6, 6, 6, 6, 6, 6, 6, 100, 6 });
+        auto const bundles = bundleFiles(files, 10);
+        auto const bundle_sizes = checkBundles(files, bundles, 10);
+        for (std::size_t i : { 1, 4, 7, 16 }) {
+            CHECK(bundles[i].bundle_id == 0);
+        }
+        // large files neither end nor split bundles
+        CHECK(bundles[0].bundle_id == bundles[2].bundle_id);
+        CHECK(bundles[0].bundle_id != 0);
+        CHECK(bundle_sizes.size() == 6);
+    }
+}
@@ -0,0 +1,255 @@
+#include <file_io.hpp>
+
+#include <memory_budget.hpp>
+
+#include <catch.hpp>
+
+#include <boost/filesystem.hpp>
+#include <boost/predef.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+namespace {
+constexpr std::size_t g_chunkSize = (1 << 20);
+
+/** Directory for the files of a test, removed with everything in it on destruction.
+ */
+struct TemporaryDirectory {
+    boost::filesystem::path path;
+
+    TemporaryDirectory()
+        :path(boost::filesystem::temp_directory_path() / boost::filesystem::unique_path("blimp_test_%%%%-%%%%-%%%%"))
+    {
+        boost::filesystem::create_directories(path);
+    }
+
+    ~TemporaryDirectory()
+    {
+        boost::system::error_code ec;
+        boost::filesystem::remove_all(path, ec);
+    }
+
+    TemporaryDirectory(TemporaryDirectory const&) = delete;
+    TemporaryDirectory& operator=(TemporaryDirectory const&) = delete;
+};
+
+std::vector<char> generateData(std::size_t size)
+{
+    std::vector<char> ret(size);
+    for (std::size_t i = 0; i < size; ++i) { ret[i] = static_cast<char>((i * 31 + i / 4099) % 253); }
+    return ret;
+}
+
+boost::filesystem::path writeFile(TemporaryDirectory const& dir, std::string const& name,
+                                  std::vector<char> const& data)
+{
+    boost::filesystem::path const ret = dir.path / name;
+    std::ofstream fout(ret.string(), std::ios::binary);
+    fout.write(data.data(), static_cast<std::streamsize>(data.size()));
+    REQUIRE(fout);
+    return ret;
+}
+
+std::vector<char> readAll(FileIO& fio, boost::filesystem::path const& p)
+{
+    std::vector<char> ret;
+    fio.startReading(p);
+    while (fio.hasMoreChunks()) {
+        FileChunk const& c = fio.getNextChunk();
+        ret.insert(ret.end(), c.getData(), c.getData() + c.getUsedSize());
+    }
+    return ret;
+}
+}
+
+TEST_CASE("FileIO")
+{
+    TemporaryDirectory const dir;
+
+    SECTION("Files are read completely at any queue depth")
+    {
+        std::vector<std::size_t> const file_sizes{
+            0, 1, 4096, g_chunkSize - 1, g_chunkSize, g_chunkSize + 1, 5 * g_chunkSize + 333,
+        };
+        std::vector<boost::filesystem::path> files;
+        std::vector<std::vector<char>> contents;
+        for (std::size_t const size : file_sizes) {
+            contents.push_back(generateData(size));
+            files.push_back(writeFile(dir, "f" + std::to_string(size), contents.back()));
+        }
+        for (std::size_t const queue_depth : { 1, 2, 3, 8 }) {
+            INFO("Queue depth " << queue_depth);
+            FileIO fio(queue_depth);
+            CHECK(fio.getQueueDepth() == queue_depth);
+            // the same FileIO reads one file after another
+            for (std::size_t i = 0; i < files.size(); ++i) {
+                INFO("File size " << file_sizes[i]);
+                CHECK(readAll(fio, files[i]) == contents[i]);
+                CHECK(!fio.hasMoreChunks());
+            }
+        }
+    }
+
+    SECTION("Chunks are full except for the last one")
+    {
+        std::vector<char> const data = generateData(3 * g_chunkSize + 5);
+        boost::filesystem::path const p = writeFile(dir, "f", data);
+        FileIO fio(4);
+        fio.startReading(p);
+        std::vector<std::size_t> chunk_sizes;
+        while (fio.hasMoreChunks()) { chunk_sizes.push_back(fio.getNextChunk().getUsedSize()); }
+        CHECK(chunk_sizes == std::vector<std::size_t>{ g_chunkSize, g_chunkSize, g_chunkSize, 5 });
+    }
+
+    SECTION("Cancelled reads leave the FileIO ready for the next file")
+    {
+        std::vector<char> const large = generateData(6 * g_chunkSize);
+        std::vector<char> const small = generateData(g_chunkSize / 2);
+        boost::filesystem::path const p_large = writeFile(dir, "large", large);
+        boost::filesystem::path const p_small = writeFile(dir, "small", small);
+        FileIO fio(3);
+        fio.startReading(p_large);
+        FileChunk const& c = fio.getNextChunk();
+        CHECK(std::vector<char>(c.getData(), c.getData() + c.getUsedSize()) ==
+              std::vector<char>(large.begin(), large.begin() + g_chunkSize));
+        fio.cancelReading();
+        CHECK(!fio.hasMoreChunks());
+        CHECK(readAll(fio, p_small) == small);
+        CHECK(readAll(fio, p_large) == large);
+    }
+
+    SECTION("Queue depth can be changed between files")
+    {
+        std::vector<char> const data = generateData(4 * g_chunkSize + 17);
+        boost::filesystem::path const p = writeFile(dir, "f", data);
+        MemoryBudget budget(64 * g_chunkSize);
+        FileIO fio(2);
+        fio.setMemoryBudget(budget);
+        // the chunk buffers, one more than the queue depth, are accounted to the budget
+        CHECK(budget.getUsage() == 3 * g_chunkSize);
+        CHECK(readAll(fio, p) == data);
+        fio.setQueueDepth(6);
+        CHECK(fio.getQueueDepth() == 6);
+        CHECK(budget.getUsage() == 7 * g_chunkSize);
+        CHECK(readAll(fio, p) == data);
+        fio.setQueueDepth(1);
+        CHECK(budget.getUsage() == 2 * g_chunkSize);
+        CHECK(readAll(fio, p) == data);
+    }
+
+    SECTION("Missing files cannot be read")
+    {
+        FileIO fio;
+        CHECK_THROWS(fio.startReading(dir.path / "missing"));
+        CHECK(!fio.hasMoreChunks());
+    }
+}
+
+TEST_CASE("FileIO Memory Mapping")
+{
+    TemporaryDirectory const dir;
+    std::uint64_t const threshold = 2 * g_chunkSize + 1;
+
+    SECTION("Files around the threshold are read completely")
+    {
+        for (std::uint64_t const size : { threshold - 1, threshold, threshold + 1, 3 * threshold }) {
+            INFO("File size " << size);
+            std::vector<char> const data = generateData(size);
+            boost::filesystem::path const p = writeFile(dir, "f" + std::to_string(size), data);
+            FileIO fio;
+            fio.setMemoryMappingThreshold(threshold);
+            CHECK(readAll(fio, p) == data);
+            // memory mapping disabled
+            fio.setMemoryMappingThreshold(0);
+            CHECK(readAll(fio, p) == data);
+        }
+    }
+
+    SECTION("Files truncated while being read end at their new size")
+    {
+        std::vector<char> const data = generateData(4 * g_chunkSize);
+        for (std::uint64_t const new_size : { std::uint64_t{ 0 }, std::uint64_t{ g_chunkSize },
+                                              std::uint64_t{ g_chunkSize + g_chunkSize / 2 + 100 } })
+        {
+            INFO("Truncated to " << new_size);
+            boost::filesystem::path const p = writeFile(dir, "f" + std::to_string(new_size), data);
+            FileIO fio;
+            fio.setMemoryMappingThreshold(threshold);
+            fio.startReading(p);
+            FileChunk const& first = fio.getNextChunk();
+            std::vector<char> read_data(first.getData(), first.getData() + first.getUsedSize());
+            boost::filesystem::resize_file(p, new_size);
+            while (fio.hasMoreChunks()) {
+                FileChunk const& c = fio.getNextChunk();
+                read_data.insert(read_data.end(), c.getData(), c.getData() + c.getUsedSize());
+            }
+            std::size_t const expected_size = std::max<std::size_t>(new_size, g_chunkSize);
+            CHECK(read_data == std::vector<char>(data.begin(), data.begin() + expected_size));
+        }
+    }
+}
+
+TEST_CASE("FileIO Cache Modes")
+{
+    TemporaryDirectory const dir;
+    std::vector<std::size_t> const file_sizes{
+        0, 1, 4095, 4096, 4097, g_chunkSize, g_chunkSize + 1, 3 * g_chunkSize + 333,
+    };
+    std::vector<boost::filesystem::path> files;
+    std::vector<std::vector<char>> contents;
+    for (std::size_t const size : file_sizes) {
+        contents.push_back(generateData(size));
+        files.push_back(writeFile(dir, "f" + std::to_string(size), contents.back()));
+    }
+
+    SECTION("Files are read completely in all modes")
+    {
+        // direct reads need aligned sizes and offsets, except for the short read at the end of the file
+        for (FileIO::CacheMode const mode :
+             { FileIO::CacheMode::Cached, FileIO::CacheMode::DropBehind, FileIO::CacheMode::Direct })
+        {
+            INFO("Cache mode " << static_cast<int>(mode));
+            FileIO fio(mode);
+#if BOOST_OS_LINUX
+            CHECK(fio.getCacheMode() == mode);
+#else
+            CHECK(fio.getCacheMode() == FileIO::CacheMode::Cached);
+#endif
+            for (std::size_t i = 0; i < files.size(); ++i) {
+                INFO("File size " << file_sizes[i]);
+                CHECK(readAll(fio, files[i]) == contents[i]);
+            }
+        }
+    }
+
+    SECTION("Direct reads keep more reads in flight")
+    {
+        CHECK(FileIO(FileIO::CacheMode::Direct).getQueueDepth() > FileIO(FileIO::CacheMode::Cached).getQueueDepth());
+        CHECK(FileIO(FileIO::CacheMode::DropBehind).getQueueDepth() ==
+              FileIO(FileIO::CacheMode::Cached).getQueueDepth());
+    }
+
+    SECTION("Cache mode is kept when the queue depth changes")
+    {
+        FileIO fio(FileIO::CacheMode::DropBehind);
+        fio.setQueueDepth(5);
+        CHECK(fio.getCacheMode() == FileIO(FileIO::CacheMode::DropBehind).getCacheMode());
+        CHECK(readAll(fio, files.back()) == contents.back());
+    }
+
+    SECTION("Memory mapping threshold does not affect uncached reads")
+    {
+        for (FileIO::CacheMode const mode : { FileIO::CacheMode::DropBehind, FileIO::CacheMode::Direct }) {
+            FileIO fio(mode);
+            fio.setMemoryMappingThreshold(1);
+            for (std::size_t i = 0; i < files.size(); ++i) {
+                CHECK(readAll(fio, files[i]) == contents[i]);
+            }
+        }
+    }
+}
@@ -0,0 +1,120 @@
+#include <memory_budget.hpp>
+
+#include <catch.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <thread>
+#include <vector>
+
+TEST_CASE("MemoryBudget")
+{
+    SECTION("Accounting of reservations")
+    {
+        enum class Op { Acquire, Charge, Release };
+        struct Step {
+            Op op;
+            std::size_t arg;            ///< bytes to reserve, or index of the reservation to release
+            std::size_t usage;
+            std::size_t peak_usage;
+        };
+        struct TestCase {
+            char const* description;
+            std::vector<Step> steps;
+        };
+        std::vector<TestCase> const test_cases{
+            { "acquire up to the limit",
+              { { Op::Acquire, 40, 40, 40 }, { Op::Acquire, 60, 100, 100 }, { Op::Release, 0, 60, 100 },
+                { Op::Release, 1, 0, 100 } } },
+            { "charge beyond the limit",
+              { { Op::Acquire, 80, 80, 80 }, { Op::Charge, 50, 130, 130 }, { Op::Release, 1, 80, 130 },
+                { Op::Charge, 10, 90, 130 }, { Op::Release, 0, 10, 130 }, { Op::Release, 2, 0, 130 } } },
+            { "acquire beyond the limit without other acquired reservations",
+              { { Op::Charge, 70, 70, 70 }, { Op::Acquire, 150, 220, 220 }, { Op::Release, 0, 150, 220 },
+                { Op::Release, 1, 0, 220 } } },
+            { "empty reservations",
+              { { Op::Acquire, 0, 0, 0 }, { Op::Charge, 0, 0, 0 }, { Op::Release, 1, 0, 0 },
+                { Op::Release, 0, 0, 0 } } },
+        };
+        for (auto const& tc : test_cases) {
+            INFO(tc.description);
+            MemoryBudget budget(100);
+            std::vector<MemoryBudget::Reservation> reservations;
+            reservations.reserve(tc.steps.size());
+            for (auto const& s : tc.steps) {
+                switch (s.op) {
+                case Op::Acquire: reservations.push_back(budget.acquire(s.arg)); break;
+                case Op::Charge:  reservations.push_back(budget.charge(s.arg)); break;
+                case Op::Release: reservations[s.arg].release(); break;
+                }
+                CHECK(budget.getUsage() == s.usage);
+                CHECK(budget.getPeakUsage() == s.peak_usage);
+            }
+        }
+    }
+
+    SECTION("Reservations release their memory once")
+    {
+        MemoryBudget budget(100);
+        {
+            MemoryBudget::Reservation r1 = budget.acquire(30);
+            CHECK(r1.getSize() == 30);
+            MemoryBudget::Reservation r2 = std::move(r1);
+            CHECK(r1.getSize() == 0);
+            CHECK(r2.getSize() == 30);
+            r1.release();
+            CHECK(budget.getUsage() == 30);
+            MemoryBudget::Reservation r3 = budget.charge(20);
+            r2 = std::move(r3);
+            CHECK(budget.getUsage() == 20);
+            r2.release();
+            r2.release();
+            CHECK(budget.getUsage() == 0);
+            r2 = budget.acquire(10);
+        }
+        CHECK(budget.getUsage() == 0);
+    }
+
+    SECTION("Acquire blocks until the memory is released")
+    {
+        MemoryBudget budget(100);
+        MemoryBudget::Reservation held = budget.acquire(80);
+        std::atomic<bool> acquired = false;
+        std::thread t([&budget, &acquired]() {
+            MemoryBudget::Reservation r = budget.acquire(40);
+            acquired.store(true);
+        });
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        CHECK(!acquired.load());
+        held.release();
+        t.join();
+        CHECK(acquired.load());
+        CHECK(budget.getPeakUsage() == 80);
+    }
+
+    SECTION("Charging never blocks, even while the budget is exhausted")
+    {
+        // a stage holding an acquired reservation passes on its output by charging it; acquiring the output
+        // instead could wait for memory that is only released by other stages waiting in the same way
+        MemoryBudget budget(100);
+        std::vector<MemoryBudget::Reservation> held;
+        held.push_back(budget.acquire(60));
+        held.push_back(budget.acquire(40));
+        std::thread t([&budget]() {
+            MemoryBudget::Reservation r1 = budget.charge(100);
+            MemoryBudget::Reservation r2 = budget.charge(100);
+        });
+        t.join();
+        CHECK(budget.getUsage() == 100);
+        CHECK(budget.getPeakUsage() == 300);
+    }
+
+    SECTION("Acquire only waits for acquired reservations")
+    {
+        MemoryBudget budget(100);
+        MemoryBudget::Reservation charged = budget.charge(500);
+        MemoryBudget::Reservation r = budget.acquire(10);
+        CHECK(budget.getUsage() == 510);
+    }
+}
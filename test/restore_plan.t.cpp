@@ -0,0 +1,133 @@
+#include <restore_plan.hpp>
+
+#include <exceptions.hpp>
+
+#include <catch.hpp>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace {
+BlimpDB::FileElement fileElement(std::int64_t id, std::string const& path, std::uint64_t size)
+{
+    return BlimpDB::FileElement{ .id = FileElementId{ id },
+                                 .info = FileInfo{ .path = path, .size = size, .modified_time = {} } };
+}
+
+BlimpDB::SnapshotStorageElement storageElement(std::int64_t file_id, std::int64_t container_id, std::int64_t offset,
+                                               std::int64_t size, std::int64_t part_number)
+{
+    StorageContainer const container{ .id = StorageContainerId{ container_id },
+                                       .location = StorageContainerLocation{ "c" + std::to_string(container_id) } };
+    return BlimpDB::SnapshotStorageElement{
+        .file_id = FileElementId{ file_id },
+        .content_hash = {},
+        .storage = BlimpDB::StorageElement{ .container = container,
+                                            .location = StorageLocation{ .container_id = container.id,
+                                                                         .offset = offset,
+                                                                         .size = size,
+                                                                         .part_number = part_number,
+                                                                         .codec = CompressionCodec::Zlib } } };
+}
+
+struct ExpectedPart {
+    std::int64_t offset;
+    std::int64_t size;
+    std::string destination;
+    std::int64_t destination_offset;
+};
+
+struct ExpectedContainer {
+    std::int64_t id;
+    std::vector<ExpectedPart> parts;
+};
+}
+
+TEST_CASE("planSnapshotRestore()")
+{
+    std::vector<BlimpDB::FileElement> const files{
+        fileElement(1, "/data/one", 100),
+        fileElement(2, "/data/two", 50),
+        fileElement(3, "/data/three", 105),
+        fileElement(4, "/data/four", 10),
+        fileElement(5, "/data/five", 3),
+    };
+    std::vector<BlimpDB::SnapshotInlineContent> const inline_contents{
+        BlimpDB::SnapshotInlineContent{ .file_id = FileElementId{ 5 }, .content_hash = {}, .content = {} },
+    };
+
+    SECTION("Each container is read once, in order of container id, from front to back")
+    {
+        // the file three spans three containers, with its parts out of order relative to the containers
+        std::vector<BlimpDB::SnapshotStorageElement> const storage_elements{
+            storageElement(1, 1, 0, 100, 0),
+            storageElement(2, 1, 100, 50, 0),
+            storageElement(3, 1, 150, 30, 1),
+            storageElement(3, 2, 0, 70, 0),
+            storageElement(4, 2, 70, 10, 0),
+            storageElement(3, 5, 0, 5, 2),
+        };
+        std::vector<ExpectedContainer> const expected{
+            { 1, { { 0, 100, "restore/data/one", 0 }, { 100, 50, "restore/data/two", 0 },
+                   { 150, 30, "restore/data/three", 70 } } },
+            { 2, { { 0, 70, "restore/data/three", 0 }, { 70, 10, "restore/data/four", 0 } } },
+            { 5, { { 0, 5, "restore/data/three", 100 } } },
+        };
+
+        RestorePlan const plan = planSnapshotRestore(files, storage_elements, inline_contents, "restore");
+        REQUIRE(plan.containers.size() == expected.size());
+        for (std::size_t i = 0; i < expected.size(); ++i) {
+            auto const& c = plan.containers[i];
+            INFO("Container #" << expected[i].id);
+            CHECK(c.container.id.i == expected[i].id);
+            CHECK(c.container.location.l == "c" + std::to_string(expected[i].id));
+            CHECK(c.blocks.empty());
+            REQUIRE(c.parts.size() == expected[i].parts.size());
+            for (std::size_t j = 0; j < c.parts.size(); ++j) {
+                CHECK(c.parts[j].offset == expected[i].parts[j].offset);
+                CHECK(c.parts[j].size == expected[i].parts[j].size);
+                CHECK(c.parts[j].destination == boost::filesystem::path(expected[i].parts[j].destination));
+                CHECK(c.parts[j].destination_offset == expected[i].parts[j].destination_offset);
+            }
+        }
+
+        // files in a single part are hashed while restoring, files spanning several containers are not
+        REQUIRE(plan.files.size() == 4);
+        std::vector<std::size_t> const expected_parts{ 1, 1, 3, 1 };
+        for (std::size_t i = 0; i < plan.files.size(); ++i) {
+            CHECK(plan.files[i].n_parts == expected_parts[i]);
+            CHECK((plan.files[i].hasher != nullptr) == (expected_parts[i] == 1));
+        }
+        CHECK(plan.containers[0].parts[0].hasher == plan.files[0].hasher.get());
+        CHECK(plan.containers[0].parts[2].hasher == nullptr);
+
+        REQUIRE(plan.inline_files.size() == 1);
+        CHECK(plan.inline_files[0].destination == boost::filesystem::path("restore/data/five"));
+        CHECK(plan.inline_files[0].content_index == 0);
+    }
+
+    SECTION("Files without matching storage elements")
+    {
+        struct TestCase {
+            char const* description;
+            std::vector<BlimpDB::SnapshotStorageElement> storage_elements;
+        };
+        std::vector<TestCase> const test_cases{
+            { "file without storage elements",
+              { storageElement(1, 1, 0, 100, 0), storageElement(2, 1, 100, 50, 0),
+                storageElement(3, 1, 150, 105, 0) } },
+            { "parts not adding up to the file size",
+              { storageElement(1, 1, 0, 100, 0), storageElement(2, 1, 100, 50, 0), storageElement(3, 1, 150, 104, 0),
+                storageElement(4, 1, 254, 10, 0) } },
+            { "storage element of a file outside the snapshot",
+              { storageElement(1, 1, 0, 100, 0), storageElement(2, 1, 100, 50, 0), storageElement(3, 1, 150, 105, 0),
+                storageElement(4, 1, 255, 10, 0), storageElement(6, 1, 265, 10, 0) } },
+        };
+        for (auto const& tc : test_cases) {
+            INFO(tc.description);
+            CHECK_THROWS_AS(planSnapshotRestore(files, tc.storage_elements, inline_contents, "restore"),
+                            Exceptions::DatabaseError);
+        }
+    }
+}